@@ -0,0 +1,290 @@
+/*
+ * broadcast_ring.h - Single-producer, multi-reader slot ring (fan-out)
+ *
+ * One capture host feeding several VMs that map the same region. The host
+ * publishes frames once; every registered reader consumes every frame at its
+ * own pace. Each reader owns one cache line holding its consume cursor
+ * (`tail`) and its statistics, so readers never write a line another reader
+ * or the host writes. The host may only reuse a slot once the slowest
+ * reader has released it: free slots = slot_count - (head - min(tail)).
+ *
+ * Readers register while the host holds the stream open for them: a reader
+ * claims an id by incrementing `registration` with a CAS, and the host closes
+ * registration (BCAST_REG_CLOSED) before publishing the first frame, so the
+ * set of cursors it waits on never changes mid-stream. A reader that arrives
+ * late is refused rather than silently stalling the producer.
+ */
+
+#ifndef BROADCAST_RING_H
+#define BROADCAST_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#define BCAST_MAGIC 0x42434153     // "BCAS"
+#define BCAST_CACHE_LINE 64
+#define BCAST_SLOT_ALIGN 4096      // Slot payloads are page aligned
+#define BCAST_MAX_READERS 8
+#define BCAST_REG_CLOSED 0x80000000u  // Set in `registration` once the host stops accepting readers
+
+// Per-slot descriptor (one cache line each) - written by the host before publish
+struct bcast_slot_desc {
+    uint32_t sequence;             // Frame number
+    uint32_t data_size;            // Valid bytes in the payload
+    uint8_t  _pad[BCAST_CACHE_LINE - 8];
+} __attribute__((aligned(BCAST_CACHE_LINE)));
+
+// Per-reader cursor and statistics (one cache line each) - written only by that reader
+struct bcast_reader {
+    uint64_t tail;                 // Frames released (consume cursor)
+    uint64_t lag_sum;              // Sum of (head - tail) seen when each frame was taken
+    uint64_t lag_max;
+    uint64_t copy_ns;              // Time spent copying frames out
+    uint64_t stall_ns;             // Time spent waiting for the host to publish
+    uint32_t done;                 // Set once the reader has drained a closed stream
+    uint32_t error_code;
+} __attribute__((aligned(BCAST_CACHE_LINE)));
+
+// Broadcast control block, placed at the start of shared_data.buffer
+struct bcast_header {
+    // Geometry - written once by the host in bcast_init()
+    uint32_t magic;                // BCAST_MAGIC once geometry is valid
+    uint32_t slot_count;
+    uint32_t slot_size;            // Payload capacity per slot (bytes)
+    uint32_t data_offset;          // Offset of first payload from the broadcast header
+
+    // Registered reader count | BCAST_REG_CLOSED - readers CAS, host closes
+    uint32_t registration __attribute__((aligned(BCAST_CACHE_LINE)));
+
+    // Producer index and end of stream - host writes, readers read
+    uint64_t head __attribute__((aligned(BCAST_CACHE_LINE)));
+    uint32_t closed;               // Set after the last publish
+
+    struct bcast_reader readers[BCAST_MAX_READERS] __attribute__((aligned(BCAST_CACHE_LINE)));
+
+    struct bcast_slot_desc slots[0] __attribute__((aligned(BCAST_CACHE_LINE)));
+};
+
+// Process-local view of a broadcast ring (never placed in shared memory)
+struct bcast {
+    volatile struct bcast_header *hdr;
+    uint8_t *data;                 // Base of the slot payload area
+    uint32_t slot_count;
+    uint32_t slot_size;
+    size_t   slot_stride;          // Distance between payloads (page aligned)
+    uint32_t reader_count;         // Host: readers admitted when registration closed
+    int      reader;               // Reader: our id, -1 until registered
+    uint64_t local_index;          // Our own index (head for the host, tail for a reader)
+    uint64_t peer_index;           // Last observed min(tail) (host) or head (reader)
+};
+
+static inline size_t bcast_align_up(size_t value, size_t align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+
+// Bytes needed for a broadcast ring with the given geometry
+static inline size_t bcast_required_size(uint32_t slot_count, uint32_t slot_size)
+{
+    size_t control = sizeof(struct bcast_header) + slot_count * sizeof(struct bcast_slot_desc);
+    return bcast_align_up(control, BCAST_SLOT_ALIGN) +
+           (size_t)slot_count * bcast_align_up(slot_size, BCAST_SLOT_ALIGN);
+}
+
+// Largest slot count that fits in `avail` bytes (0 if not even one slot fits)
+static inline uint32_t bcast_max_slots(size_t avail, uint32_t slot_size)
+{
+    uint32_t count = 0;
+    while (bcast_required_size(count + 1, slot_size) <= avail) {
+        count++;
+    }
+    return count;
+}
+
+static inline void bcast_setup_view(struct bcast *b, void *base)
+{
+    b->hdr = (volatile struct bcast_header *)base;
+    b->slot_count = b->hdr->slot_count;
+    b->slot_size = b->hdr->slot_size;
+    b->slot_stride = bcast_align_up(b->slot_size, BCAST_SLOT_ALIGN);
+    b->data = (uint8_t *)base + b->hdr->data_offset;
+    b->reader_count = 0;
+    b->reader = -1;
+    b->local_index = 0;
+    b->peer_index = 0;
+}
+
+// Host: format a broadcast ring in [base, base + avail) with registration open
+static inline bool bcast_init(struct bcast *b, void *base, size_t avail, uint32_t slot_count, uint32_t slot_size)
+{
+    if (slot_count == 0 || slot_size == 0 || bcast_required_size(slot_count, slot_size) > avail) {
+        return false;
+    }
+
+    volatile struct bcast_header *hdr = (volatile struct bcast_header *)base;
+    hdr->magic = 0;
+    __sync_synchronize();
+
+    memset((void *)hdr, 0, sizeof(struct bcast_header) + slot_count * sizeof(struct bcast_slot_desc));
+    hdr->slot_count = slot_count;
+    hdr->slot_size = slot_size;
+    hdr->data_offset = (uint32_t)bcast_align_up(sizeof(struct bcast_header) +
+                                                slot_count * sizeof(struct bcast_slot_desc),
+                                                BCAST_SLOT_ALIGN);
+
+    // Publish geometry last so a reader never attaches to a half-built ring
+    __atomic_store_n(&hdr->magic, BCAST_MAGIC, __ATOMIC_RELEASE);
+
+    bcast_setup_view(b, base);
+    return true;
+}
+
+// Reader: attach to a broadcast ring formatted by the host. Returns false if absent or invalid.
+static inline bool bcast_attach(struct bcast *b, void *base, size_t avail)
+{
+    volatile struct bcast_header *hdr = (volatile struct bcast_header *)base;
+
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != BCAST_MAGIC) {
+        return false;
+    }
+    if (hdr->slot_count == 0 || bcast_required_size(hdr->slot_count, hdr->slot_size) > avail) {
+        return false;
+    }
+
+    bcast_setup_view(b, base);
+    return true;
+}
+
+// Reader: claim the next reader id. Returns -1 if registration is closed or full.
+static inline int bcast_register(struct bcast *b)
+{
+    uint32_t reg = __atomic_load_n(&b->hdr->registration, __ATOMIC_ACQUIRE);
+    for (;;) {
+        if ((reg & BCAST_REG_CLOSED) || reg >= BCAST_MAX_READERS) {
+            return -1;
+        }
+        if (__atomic_compare_exchange_n(&b->hdr->registration, &reg, reg + 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            b->reader = (int)reg;
+            b->local_index = 0;
+            b->peer_index = 0;
+            return b->reader;
+        }
+    }
+}
+
+// Host: readers registered so far
+static inline uint32_t bcast_registered(const struct bcast *b)
+{
+    return __atomic_load_n(&b->hdr->registration, __ATOMIC_ACQUIRE) & ~BCAST_REG_CLOSED;
+}
+
+// Host: stop accepting readers. Returns the number admitted; the host waits on exactly these.
+static inline uint32_t bcast_close_registration(struct bcast *b)
+{
+    uint32_t reg = __atomic_fetch_or(&b->hdr->registration, BCAST_REG_CLOSED, __ATOMIC_ACQ_REL);
+    b->reader_count = reg & ~BCAST_REG_CLOSED;
+    return b->reader_count;
+}
+
+static inline uint8_t *bcast_slot_data(const struct bcast *b, uint64_t index)
+{
+    return b->data + (index % b->slot_count) * b->slot_stride;
+}
+
+static inline volatile struct bcast_slot_desc *bcast_slot_desc(const struct bcast *b, uint64_t index)
+{
+    return &b->hdr->slots[index % b->slot_count];
+}
+
+static inline volatile struct bcast_reader *bcast_reader_stats(const struct bcast *b, uint32_t reader)
+{
+    return &b->hdr->readers[reader];
+}
+
+// Host: cursor of the slowest admitted reader (and which reader that is)
+static inline uint64_t bcast_min_tail(const struct bcast *b, uint32_t *slowest)
+{
+    uint64_t min_tail = UINT64_MAX;
+    for (uint32_t r = 0; r < b->reader_count; r++) {
+        uint64_t tail = __atomic_load_n(&b->hdr->readers[r].tail, __ATOMIC_ACQUIRE);
+        if (tail < min_tail) {
+            min_tail = tail;
+            if (slowest) *slowest = r;
+        }
+    }
+    return min_tail == UINT64_MAX ? b->local_index : min_tail;
+}
+
+// Host: true if the slowest reader has released at least one slot. Only
+// touches the readers' cache lines when the cached view says the ring is full.
+static inline bool bcast_has_space(struct bcast *b)
+{
+    if (b->local_index - b->peer_index < b->slot_count) {
+        return true;
+    }
+    b->peer_index = bcast_min_tail(b, NULL);
+    return b->local_index - b->peer_index < b->slot_count;
+}
+
+// Host: publish the frame already written to bcast_slot_data(b, b->local_index)
+static inline void bcast_publish(struct bcast *b, uint32_t size, uint32_t sequence)
+{
+    volatile struct bcast_slot_desc *desc = bcast_slot_desc(b, b->local_index);
+    desc->sequence = sequence;
+    desc->data_size = size;
+
+    // Release: payload and descriptor are visible before the new head
+    b->local_index++;
+    __atomic_store_n(&b->hdr->head, b->local_index, __ATOMIC_RELEASE);
+}
+
+// Host: mark the end of the stream after the last publish
+static inline void bcast_close(struct bcast *b)
+{
+    __atomic_store_n(&b->hdr->closed, 1, __ATOMIC_RELEASE);
+}
+
+static inline bool bcast_closed(const struct bcast *b)
+{
+    return __atomic_load_n(&b->hdr->closed, __ATOMIC_ACQUIRE) != 0;
+}
+
+// Host: true once every admitted reader has drained the closed stream
+static inline bool bcast_all_done(const struct bcast *b)
+{
+    for (uint32_t r = 0; r < b->reader_count; r++) {
+        if (!__atomic_load_n(&b->hdr->readers[r].done, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Reader: true if a frame we haven't consumed has been published
+static inline bool bcast_has_data(struct bcast *b)
+{
+    if (b->peer_index != b->local_index) {
+        return true;
+    }
+    b->peer_index = __atomic_load_n(&b->hdr->head, __ATOMIC_ACQUIRE);
+    return b->peer_index != b->local_index;
+}
+
+// Reader: release the frame at local_index. Release: our reads of the slot
+// complete before the host may reuse it.
+static inline void bcast_release(struct bcast *b)
+{
+    b->local_index++;
+    __atomic_store_n(&b->hdr->readers[b->reader].tail, b->local_index, __ATOMIC_RELEASE);
+}
+
+// Reader: mark this reader finished (statistics are final)
+static inline void bcast_done(struct bcast *b)
+{
+    __atomic_store_n(&b->hdr->readers[b->reader].done, 1, __ATOMIC_RELEASE);
+}
+
+#endif // BROADCAST_RING_H
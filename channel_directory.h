@@ -0,0 +1,274 @@
+/*
+ * channel_directory.h - Several named channels in one shared region
+ *
+ * Video, audio, control and telemetry share one ivshmem BAR. The host writes
+ * a directory at the start of the data area listing every channel (name,
+ * type, direction, offset, size, slot geometry); the guest reads it at
+ * startup and looks channels up by name. Each channel is an independent SPSC
+ * ring from ring_buffer.h with its own head/tail lines, so traffic on one
+ * channel never touches another channel's control block.
+ *
+ *   buffer + 0           struct chan_directory (one page)
+ *   buffer + offset[0]   ring for channel 0
+ *   buffer + offset[1]   ring for channel 1 ...
+ *
+ * A control channel may name a reply channel (guest->host) the guest echoes
+ * its messages on, which lets the host time control round trips on its own
+ * clock while bulk channels are busy.
+ *
+ * chan_produce / chan_consume are the per-channel worker loops (pthread entry
+ * points) both programs run, one thread per channel.
+ */
+
+#ifndef CHANNEL_DIRECTORY_H
+#define CHANNEL_DIRECTORY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#include "ring_buffer.h"
+#include "timing.h"
+#include "wait_policy.h"
+
+#define CHANDIR_MAGIC 0x4348414E   // "CHAN"
+#define CHANDIR_VERSION 1
+#define CHANDIR_SIZE 4096          // Directory page; channels start after it
+#define CHANDIR_MAX_CHANNELS 16
+#define CHANNEL_NAME_LEN 16
+#define CHANNEL_NO_REPLY 0xFFFFFFFFu
+
+// Message sizes used by the channel benchmark
+#define CHANNEL_AUDIO_BYTES 1920       // 10 ms of 48 kHz 16-bit stereo
+#define CHANNEL_CONTROL_BYTES 256
+#define CHANNEL_TELEMETRY_BYTES 512
+
+typedef enum {
+    CHANNEL_VIDEO = 0,             // Bulk frames
+    CHANNEL_AUDIO = 1,             // Small periodic buffers
+    CHANNEL_CONTROL = 2,           // Small latency-sensitive messages
+    CHANNEL_TELEMETRY = 3,         // Small periodic reports
+    CHANNEL_TYPE_COUNT
+} channel_type_t;
+
+typedef enum {
+    CHANNEL_HOST_TO_GUEST = 0,
+    CHANNEL_GUEST_TO_HOST = 1
+} channel_dir_t;
+
+// Directory entry (one cache line) - written by the host before the directory is published
+struct chan_entry {
+    char     name[CHANNEL_NAME_LEN];  // NUL-terminated
+    uint32_t type;                 // channel_type_t
+    uint32_t direction;            // channel_dir_t
+    uint32_t slot_count;
+    uint32_t slot_size;            // Payload capacity per slot (bytes)
+    uint64_t offset;               // Ring header, from the directory
+    uint64_t size;                 // Bytes reserved for the ring
+    uint32_t reply;                // Channel the guest echoes this one on, or CHANNEL_NO_REPLY
+    uint32_t period_us;            // Producer's nominal send period, 0 = as fast as the consumer drains
+    uint8_t  _pad[64 - 56];
+} __attribute__((aligned(64)));
+
+struct chan_directory {
+    uint32_t magic;                // CHANDIR_MAGIC once every channel is formatted
+    uint32_t version;              // CHANDIR_VERSION
+    uint32_t count;                // Channels in use
+    uint32_t closed;               // Host: no more traffic on any channel
+    uint64_t region_size;          // Bytes the directory and channels may use
+    struct chan_entry entries[CHANDIR_MAX_CHANNELS] __attribute__((aligned(64)));
+};
+
+_Static_assert(sizeof(struct chan_directory) <= CHANDIR_SIZE, "Channel directory must fit in its page");
+
+static inline const char *channel_type_name(uint32_t type)
+{
+    static const char *names[CHANNEL_TYPE_COUNT] = { "video", "audio", "control", "telemetry" };
+    return type < CHANNEL_TYPE_COUNT ? names[type] : "unknown";
+}
+
+// Host: start an empty directory in [base, base + avail)
+static inline bool chandir_init(volatile struct chan_directory *dir, size_t avail)
+{
+    if (avail <= CHANDIR_SIZE) {
+        return false;
+    }
+    dir->magic = 0;
+    __sync_synchronize();
+    memset((void *)dir, 0, sizeof(struct chan_directory));
+    dir->version = CHANDIR_VERSION;
+    dir->region_size = avail;
+    return true;
+}
+
+static inline void *chandir_ring_base(volatile struct chan_directory *dir, uint32_t index)
+{
+    return (uint8_t *)dir + dir->entries[index].offset;
+}
+
+// Host: reserve space after the last channel and format its ring.
+// Returns the channel index, or -1 if the directory or the region is full.
+static inline int chandir_add(volatile struct chan_directory *dir, const char *name, channel_type_t type,
+                              channel_dir_t direction, uint32_t slot_count, uint32_t slot_size)
+{
+    if (dir->count >= CHANDIR_MAX_CHANNELS) {
+        return -1;
+    }
+
+    uint64_t offset = CHANDIR_SIZE;
+    if (dir->count > 0) {
+        volatile struct chan_entry *last = &dir->entries[dir->count - 1];
+        offset = last->offset + last->size;
+    }
+    uint64_t size = ring_required_size(slot_count, slot_size);
+    if (offset + size > dir->region_size) {
+        return -1;
+    }
+
+    uint32_t index = dir->count;
+    volatile struct chan_entry *entry = &dir->entries[index];
+    memset((void *)entry, 0, sizeof(struct chan_entry));
+    strncpy((char *)entry->name, name, CHANNEL_NAME_LEN - 1);
+    entry->type = type;
+    entry->direction = direction;
+    entry->slot_count = slot_count;
+    entry->slot_size = slot_size;
+    entry->offset = offset;
+    entry->size = size;
+    entry->reply = CHANNEL_NO_REPLY;
+
+    struct ring ring;
+    if (!ring_init(&ring, chandir_ring_base(dir, index), size, slot_count, slot_size)) {
+        return -1;
+    }
+    dir->count = index + 1;
+    return (int)index;
+}
+
+// Host: make the directory visible to the guest
+static inline void chandir_publish(volatile struct chan_directory *dir)
+{
+    __atomic_store_n(&dir->magic, CHANDIR_MAGIC, __ATOMIC_RELEASE);
+}
+
+// Guest: validate a directory published by the host
+static inline bool chandir_attach(volatile struct chan_directory *dir, size_t avail)
+{
+    if (__atomic_load_n(&dir->magic, __ATOMIC_ACQUIRE) != CHANDIR_MAGIC ||
+        dir->version != CHANDIR_VERSION || dir->count > CHANDIR_MAX_CHANNELS || dir->region_size > avail) {
+        return false;
+    }
+    for (uint32_t i = 0; i < dir->count; i++) {
+        volatile struct chan_entry *entry = &dir->entries[i];
+        if (entry->offset < CHANDIR_SIZE || entry->offset + entry->size > dir->region_size ||
+            (entry->reply != CHANNEL_NO_REPLY && entry->reply >= dir->count)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Either side: index of the channel called `name`, or -1
+static inline int chandir_find(volatile struct chan_directory *dir, const char *name)
+{
+    for (uint32_t i = 0; i < dir->count; i++) {
+        if (strncmp((const char *)dir->entries[i].name, name, CHANNEL_NAME_LEN) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// Either side: open one channel's ring. The producer side (host for
+// host->guest channels, guest otherwise) attaches with `produce` set.
+static inline bool chandir_open(volatile struct chan_directory *dir, uint32_t index, struct ring *ring, bool produce)
+{
+    if (index >= dir->count) {
+        return false;
+    }
+    void *base = chandir_ring_base(dir, index);
+    size_t size = dir->entries[index].size;
+    return produce ? ring_attach_producer(ring, base, size) : ring_attach(ring, base, size);
+}
+
+// Host: set the producer's nominal period for a channel
+static inline void chandir_set_period(volatile struct chan_directory *dir, uint32_t index, uint32_t period_us)
+{
+    dir->entries[index].period_us = period_us;
+}
+
+static inline void chandir_close(volatile struct chan_directory *dir)
+{
+    __atomic_store_n(&dir->closed, 1, __ATOMIC_RELEASE);
+}
+
+static inline bool chandir_closed(volatile struct chan_directory *dir)
+{
+    return __atomic_load_n(&dir->closed, __ATOMIC_ACQUIRE) != 0;
+}
+
+// One channel as driven by one thread (process-local)
+struct chan_worker {
+    struct ring ring;
+    const struct wait_policy *wait;
+    volatile uint32_t *stop;       // Producer: stop sending; consumer: stop once drained
+    uint8_t *buffer;               // Message source (producer) or destination (consumer)
+    uint32_t size;                 // Message size (producer) or buffer capacity (consumer)
+    uint64_t period_ns;            // Producer pacing, 0 = unpaced
+    uint64_t messages;             // Sent or received so far (relaxed atomic; sample any time)
+    uint64_t bytes;
+};
+
+// Producer loop (pthread entry): send w->buffer every period until *stop
+static inline void *chan_produce(void *arg)
+{
+    struct chan_worker *w = (struct chan_worker *)arg;
+    struct wait_state ws;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    uint32_t sequence = 0;
+
+    while (!__atomic_load_n(w->stop, __ATOMIC_ACQUIRE)) {
+        if (w->period_ns > 0) {
+            uint64_t ns = next.tv_nsec + w->period_ns;
+            next.tv_sec += ns / 1000000000ULL;
+            next.tv_nsec = ns % 1000000000ULL;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+        wait_begin(&ws);
+        while (!ring_try_push(&w->ring, w->buffer, w->size, sequence, NULL)) {
+            if (__atomic_load_n(w->stop, __ATOMIC_ACQUIRE)) {
+                return NULL;
+            }
+            wait_step(w->wait, &ws);
+        }
+        sequence++;
+        __atomic_store_n(&w->messages, w->messages + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&w->bytes, w->bytes + w->size, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+// Consumer loop (pthread entry): copy messages out until *stop and drained
+static inline void *chan_consume(void *arg)
+{
+    struct chan_worker *w = (struct chan_worker *)arg;
+    struct wait_state ws;
+
+    for (;;) {
+        uint32_t size = 0;
+        wait_begin(&ws);
+        while (!ring_try_pop(&w->ring, w->buffer, w->size, &size, NULL, NULL)) {
+            if (__atomic_load_n(w->stop, __ATOMIC_ACQUIRE) && !ring_has_data(&w->ring)) {
+                return NULL;
+            }
+            wait_step(w->wait, &ws);
+        }
+        __atomic_store_n(&w->messages, w->messages + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&w->bytes, w->bytes + size, __ATOMIC_RELAXED);
+    }
+}
+
+#endif // CHANNEL_DIRECTORY_H
@@ -0,0 +1,240 @@
+/*
+ * clock_sync.h - NTP-style host/guest clock offset estimation
+ *
+ * Host and guest clocks are independent. The guest's TSC runs with a
+ * hypervisor offset and scale, and CLOCK_MONOTONIC has a different epoch in
+ * each kernel. A host timestamp can still be mapped onto the guest clock
+ * with the NTP exchange, run over five words in the control blocks:
+ *
+ *   host   t1 = now, write t1, bump sync_seq
+ *   guest  sees sync_seq: t2 = now ... t3 = now, write t2/t3, echo sync_seq
+ *   host   sees the echo: t4 = now
+ *
+ *   offset = ((t2 - t1) + (t3 - t4)) / 2      guest clock - host clock
+ *   rtt    = (t4 - t1) - (t3 - t2)            time spent in flight
+ *
+ * Whatever the split of rtt between the two directions, the true offset lies
+ * within offset ± rtt / 2. Probes go out in bursts, and only the probe with
+ * the smallest rtt in a burst is kept, since it was least delayed by
+ * scheduling or polling. The kept samples of the last CLOCK_SYNC_WINDOW
+ * bursts are fitted with a line, whose slope is the drift between the clocks
+ * (once they span CLOCK_SYNC_MIN_SPAN_NS; before that, drift is taken as 0).
+ * The newest sample anchors the offset. The error bound is that sample's
+ * rtt / 2 plus the largest distance of any window sample from the fitted
+ * line, and holds at the anchor only: carried away from it, the offset picks
+ * up the slope's own error times the distance. Timestamps that fall between
+ * two bursts are better served by clock_sync_interpolate(), whose bound does
+ * not depend on how far apart the bursts are.
+ *
+ * Probes read timing_shared_ns(), the clock the message-rate publish and
+ * detection stamps come from, so the estimate maps exactly those stamps.
+ *
+ * Host: clock_sync_burst() between measurements, then clock_sync_offset_at().
+ * Guest: call clock_sync_respond() from a thread that polls for probes.
+ */
+
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "timing.h"
+#include "wait_policy.h"
+
+#define CLOCK_SYNC_PROBES 32              // Probes per burst; the min-RTT one is kept
+#define CLOCK_SYNC_WINDOW 16              // Bursts kept for the drift fit
+#define CLOCK_SYNC_TIMEOUT_NS 100000000ULL  // A probe unanswered for 100 ms is lost
+#define CLOCK_SYNC_MIN_SPAN_NS 1000000000ULL // Window span below which drift isn't fitted (noise / short span)
+
+struct clock_sync_sample {
+    uint64_t host_ns;              // Host time of the exchange, midway between t1 and t4
+    int64_t  offset_ns;            // Guest clock - host clock
+    uint64_t rtt_ns;               // Round trip less the guest's turnaround
+};
+
+// Host-side estimator over the probe words in the shared control blocks
+struct clock_sync {
+    volatile uint32_t *seq;        // Host writes: probe number
+    volatile uint64_t *t1;         // Host writes: send time
+    volatile uint32_t *echo;       // Guest writes: probe answered
+    volatile uint64_t *t2;         // Guest writes: receive time
+    volatile uint64_t *t3;         // Guest writes: reply time
+
+    uint32_t next_seq;
+    struct clock_sync_sample window[CLOCK_SYNC_WINDOW];
+    int count;                     // Samples in the window
+    int head;                      // Next slot to overwrite
+
+    // Current estimate: offset(t) = anchor_offset + drift * (t - anchor_ns)
+    uint64_t anchor_ns;
+    int64_t  anchor_offset_ns;
+    double   drift;                // ns of offset change per ns of host time
+    uint64_t err_ns;               // Bound on |offset(anchor_ns) - true offset|; not valid away from the anchor
+    uint64_t probes;
+    uint64_t lost;
+};
+
+static inline void clock_sync_init(struct clock_sync *cs, volatile uint32_t *seq, volatile uint64_t *t1,
+                                   volatile uint32_t *echo, volatile uint64_t *t2, volatile uint64_t *t3)
+{
+    memset(cs, 0, sizeof(*cs));
+    cs->seq = seq;
+    cs->t1 = t1;
+    cs->echo = echo;
+    cs->t2 = t2;
+    cs->t3 = t3;
+    cs->next_seq = __atomic_load_n(seq, __ATOMIC_ACQUIRE) + 1;
+}
+
+// One exchange. Returns false if the guest didn't answer within CLOCK_SYNC_TIMEOUT_NS.
+static inline bool clock_sync_probe(struct clock_sync *cs, const struct wait_policy *policy,
+                                    struct clock_sync_sample *sample)
+{
+    uint32_t seq = cs->next_seq++;
+    if (seq == 0) seq = cs->next_seq++;  // 0 is the idle value
+    cs->probes++;
+
+    uint64_t t1 = timing_shared_ns();
+    *cs->t1 = t1;
+    __atomic_store_n(cs->seq, seq, __ATOMIC_RELEASE);
+
+    struct wait_state ws;
+    wait_begin(&ws);
+    while (__atomic_load_n(cs->echo, __ATOMIC_ACQUIRE) != seq) {
+        if (timing_shared_ns() - t1 > CLOCK_SYNC_TIMEOUT_NS) {
+            cs->lost++;
+            return false;
+        }
+        wait_step(policy, &ws);
+    }
+    uint64_t t4 = timing_shared_ns();
+    uint64_t t2 = *cs->t2, t3 = *cs->t3;
+
+    sample->host_ns = t1 + (t4 - t1) / 2;
+    sample->offset_ns = ((int64_t)(t2 - t1) + (int64_t)(t3 - t4)) / 2;
+    uint64_t turnaround = t3 - t2;
+    sample->rtt_ns = t4 - t1 > turnaround ? (t4 - t1) - turnaround : 0;
+    return true;
+}
+
+// Least-squares line through the window, anchored at the newest sample
+static inline void clock_sync_fit(struct clock_sync *cs)
+{
+    int newest = (cs->head + CLOCK_SYNC_WINDOW - 1) % CLOCK_SYNC_WINDOW;
+    const struct clock_sync_sample *anchor = &cs->window[newest];
+    cs->anchor_ns = anchor->host_ns;
+    cs->anchor_offset_ns = anchor->offset_ns;
+    cs->drift = 0.0;
+
+    uint64_t oldest_ns = anchor->host_ns;
+    for (int i = 0; i < cs->count; i++) {
+        if ((int64_t)(cs->window[i].host_ns - oldest_ns) < 0) oldest_ns = cs->window[i].host_ns;
+    }
+
+    // Relative to the anchor, so the sums stay small enough for a double
+    if (cs->count >= 2 && anchor->host_ns - oldest_ns >= CLOCK_SYNC_MIN_SPAN_NS) {
+        double sx = 0, sy = 0, sxx = 0, sxy = 0;
+        for (int i = 0; i < cs->count; i++) {
+            double x = (double)(int64_t)(cs->window[i].host_ns - anchor->host_ns);
+            double y = (double)(cs->window[i].offset_ns - anchor->offset_ns);
+            sx += x;
+            sy += y;
+            sxx += x * x;
+            sxy += x * y;
+        }
+        double denom = cs->count * sxx - sx * sx;
+        if (denom > 0) cs->drift = (cs->count * sxy - sx * sy) / denom;
+    }
+
+    double spread = 0;
+    for (int i = 0; i < cs->count; i++) {
+        double x = (double)(int64_t)(cs->window[i].host_ns - anchor->host_ns);
+        double residual = (double)(cs->window[i].offset_ns - anchor->offset_ns) - cs->drift * x;
+        if (residual < 0) residual = -residual;
+        if (residual > spread) spread = residual;
+    }
+    cs->err_ns = anchor->rtt_ns / 2 + (uint64_t)spread;
+}
+
+// `probes` exchanges; the one with the smallest round trip joins the window.
+// Returns false (and leaves the estimate alone) if none was answered.
+static inline bool clock_sync_burst(struct clock_sync *cs, const struct wait_policy *policy, int probes,
+                                    struct clock_sync_sample *best)
+{
+    bool found = false;
+    for (int i = 0; i < probes; i++) {
+        struct clock_sync_sample sample;
+        if (!clock_sync_probe(cs, policy, &sample)) {
+            if (!found && cs->lost >= 3 && cs->lost == cs->probes) break;  // Nobody is answering
+            continue;
+        }
+        if (!found || sample.rtt_ns < best->rtt_ns) {
+            *best = sample;
+            found = true;
+        }
+    }
+    if (!found) return false;
+
+    cs->window[cs->head] = *best;
+    cs->head = (cs->head + 1) % CLOCK_SYNC_WINDOW;
+    if (cs->count < CLOCK_SYNC_WINDOW) cs->count++;
+    clock_sync_fit(cs);
+    return true;
+}
+
+static inline bool clock_sync_valid(const struct clock_sync *cs)
+{
+    return cs->count > 0;
+}
+
+// Guest clock - host clock at host time `host_ns`
+static inline int64_t clock_sync_offset_at(const struct clock_sync *cs, uint64_t host_ns)
+{
+    double dt = (double)(int64_t)(host_ns - cs->anchor_ns);
+    return cs->anchor_offset_ns + (int64_t)(cs->drift * dt);
+}
+
+// Guest clock - host clock at host time `host_ns`, between the kept samples of
+// two bursts. The true offset at each sample lies within its rtt / 2, so if it
+// moves linearly from one sample to the other, the interpolated offset is off
+// by at most the larger of the two, written to `err_ns`.
+static inline int64_t clock_sync_interpolate(const struct clock_sync_sample *before,
+                                             const struct clock_sync_sample *after, uint64_t host_ns,
+                                             uint64_t *err_ns)
+{
+    uint64_t half_before = before->rtt_ns / 2, half_after = after->rtt_ns / 2;
+    *err_ns = half_before > half_after ? half_before : half_after;
+
+    double span = (double)(int64_t)(after->host_ns - before->host_ns);
+    if (span <= 0) {
+        return before->offset_ns;
+    }
+    double f = (double)(int64_t)(host_ns - before->host_ns) / span;
+    if (f < 0) f = 0;
+    if (f > 1) f = 1;
+    return before->offset_ns + (int64_t)(f * (double)(after->offset_ns - before->offset_ns));
+}
+
+// Drift between the clocks in parts per million (guest fast > 0)
+static inline double clock_sync_drift_ppm(const struct clock_sync *cs)
+{
+    return cs->drift * 1e6;
+}
+
+// Guest: answer a pending probe, if any. `last` is the last probe answered.
+static inline bool clock_sync_respond(volatile uint32_t *seq, volatile uint32_t *echo, volatile uint64_t *t2,
+                                      volatile uint64_t *t3, uint32_t *last)
+{
+    uint32_t s = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+    if (s == *last) return false;
+    uint64_t received = timing_shared_ns();
+    *t2 = received;
+    *t3 = timing_shared_ns();
+    __atomic_store_n(echo, s, __ATOMIC_RELEASE);
+    *last = s;
+    return true;
+}
+
+#endif // CLOCK_SYNC_H
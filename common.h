@@ -10,7 +10,17 @@
 
 #include <stdint.h>
 
-#define MAGIC 0xDEADBEEF
+#define MAGIC 0x49565332           // "IVS2" - host has published a layout v2 control block
+#define MAGIC_V1 0xDEADBEEF        // Written by hosts built before layout v2
+
+// Layout of struct shared_data. Host and guest must agree: the host publishes
+// layout_version before MAGIC, the guest reports guest_layout_version, and
+// either side refuses to run against a different layout.
+#define SHM_LAYOUT_VERSION 2
+
+// Spacing between blocks written by different sides. Adjacent-line prefetch
+// pulls 64-byte lines in 128-byte pairs, so a 64-byte split still ping-pongs.
+#define SHM_LINE_PAIR 128
 
 // Host state machine states - only modified by host
 typedef enum {
@@ -59,49 +69,120 @@ struct performance_metrics {
 // Timing measurements structure for detailed overhead analysis
 // IMPORTANT: Host and guest clocks are NOT synchronized!
 // Guest measures durations and reports them; host measures its own durations.
-// Never compare absolute timestamps across host/guest boundary.
+// Never compare absolute timestamps across host/guest boundary, except through
+// a clock_sync.h offset estimate (guest_detect_ns).
 struct timing_data {
     // Guest-side DURATIONS (nanoseconds) - measured on guest clock
     // Legacy field for backward compatibility
     uint64_t guest_copy_duration;    // Time to memcpy from shared memory to local buffer (deprecated)
-    uint64_t guest_verify_duration;  // Time to compute SHA256 verification (testing only)
+    uint64_t guest_verify_duration;  // Time to verify the frame digest (algorithm in digest_algo)
     uint64_t guest_total_duration;   // Total processing time on guest
     
     // NEW: Detailed cache behavior analysis
     uint64_t guest_hot_cache_duration;   // Phase A: memcpy without cache flush (hot cache)
     uint64_t guest_cold_cache_duration;  // Phase B: memcpy after cache flush (cold cache)
     uint64_t guest_second_pass_duration; // Phase C: second memcpy after cold cache (warm cache)
-    uint64_t guest_cached_verify_duration; // Phase D: SHA256 with data already in cache
+    uint64_t guest_cached_verify_duration; // Phase D: digest verify with data already in cache
     
     // Hardware performance metrics from guest
     struct performance_metrics guest_perf;
     
-    // Reserved for future use
-    uint64_t reserved[1];  // Reduced from 2 to 1 due to added fields
+    // Phase E: fused copy + digest from shared memory (single pass; takes the old reserved slot)
+    uint64_t guest_fused_duration;
+    
+    // Message-rate test: host publish_ns to guest detection. The one exception to
+    // the rule above - only meaningful when both sides read the same clock.
+    uint64_t guest_notify_latency;
+    
+    // Message-rate test: guest clock when SENDING was detected. The host maps it onto
+    // its own clock with the clock_sync.h estimate for a one-way latency with an error bound.
+    uint64_t guest_detect_ns;
 };
 
-// Shared memory layout for cross-VM communication
+// Message-rate sweep: 0 B, then powers of two from 64 B to 64 KB
+#define MSG_RATE_MIN_SIZE 64
+#define MSG_RATE_STEPS 12
+
+static inline uint32_t msg_rate_size(int step)
+{
+    return step == 0 ? 0 : (uint32_t)MSG_RATE_MIN_SIZE << (step - 1);
+}
+
+// Wake-up benchmark control block, placed at the start of shared_data.buffer.
+// Per round the host sleeps WAKEUP_INTERVAL_US, bumps `ping` (and rings the
+// guest in the doorbell phase); the guest echoes it in `pong`. Between rounds
+// both sides sit in their wait loop, so the CPU they burn is the idle cost.
+#define WAKEUP_MAGIC 0x57414B45    // "WAKE"
+#define WAKEUP_INTERVAL_US 1000
+#define WAKEUP_PHASES 6            // spin, yield, backoff, usleep, futex, doorbell
+
+struct wakeup_block {
+    // Phase - host writes before publishing magic
+    uint32_t magic;                // WAKEUP_MAGIC once the phase is set up
+    uint32_t policy;               // wait_policy_kind_t both sides wait with
+    uint32_t spin_limit;           // Host's --wait-spins, used by both sides
+
+    // Host writes
+    uint32_t ping __attribute__((aligned(SHM_LINE_PAIR)));  // Round being timed (1-based)
+    uint32_t closed;
+
+    // Guest writes
+    uint32_t pong __attribute__((aligned(SHM_LINE_PAIR)));  // Last round echoed
+    uint64_t cpu_ns;               // Guest thread CPU time over the phase
+    uint64_t wall_ns;              // Guest wall time over the phase
+    uint64_t wakeups;              // Guest waits ended by a ring
+};
+
+// Shared memory layout for cross-VM communication (layout v2)
+//
+// Every field a side writes while the other side is polling lives in that
+// side's own 128-byte block, so set_guest_state() never invalidates the line
+// the host spins on, and vice versa. In layout v1 magic, test_complete,
+// host_state, guest_state, sequence, data_size and error_code shared one line.
 struct shared_data {
-    // Initialization and termination control
+    // Identity - host writes during initialization only
     uint32_t magic;           // Magic number to verify sync (0 = initializing, MAGIC = ready)
-    uint32_t test_complete;   // 1 to signal test completion
-    
-    // State machine tracking (each side only modifies their own state)
-    uint32_t host_state;      // Current host state (host_state_t) - host writes, guest reads
-    uint32_t guest_state;     // Current guest state (guest_state_t) - guest writes, host reads
+    uint32_t layout_version;  // SHM_LAYOUT_VERSION - host writes before magic
+    uint32_t v1_host_state;   // v1 offsets of host_state/guest_state, kept zero by v2 binaries
+    uint32_t v1_guest_state;  // so a v1 guest writing its state here can be detected
     
-    // Message data
+    // Host control block - host writes, guest reads
+    uint32_t host_state __attribute__((aligned(SHM_LINE_PAIR))); // Current host state (host_state_t)
+    uint32_t test_complete;   // 1 to signal test completion
     uint32_t sequence;        // Sequence number
     uint32_t data_size;       // Size of data in buffer
-    uint8_t  data_sha256[32]; // SHA256 of the data buffer
-    uint32_t error_code;      // Error code if processing failed
+    uint32_t digest_algo;     // Algorithm of data_digest (digest_algo_t, 0 = SHA256)
+    uint8_t  data_digest[32]; // Digest of the data buffer, zero padded (see integrity.h)
+    uint64_t publish_ns;      // Host timing_shared_ns() (CLOCK_MONOTONIC) at publish (message-rate test only)
+    uint32_t host_doorbell_peer; // Host's ivshmem peer ID, DOORBELL_NO_PEER when polling only - host writes before magic
+    uint32_t host_wake;       // Bumped after every host state change; futex word for -w futex waiters
+    uint32_t sync_seq;        // Clock sync probe number, 0 = idle (clock_sync.h)
+    uint64_t sync_t1;         // Host clock when probe sync_seq was sent
+    
+    // Guest control block - guest writes, host reads
+    uint32_t guest_state __attribute__((aligned(SHM_LINE_PAIR))); // Current guest state (guest_state_t)
+    uint32_t guest_layout_version; // SHM_LAYOUT_VERSION the guest was built with - guest writes at startup
+    uint32_t error_code;      // Error code if processing failed (host clears it before each message)
+    uint32_t guest_wait_policy; // Guest polling strategy (wait_policy_kind_t) - guest writes at startup
+    uint32_t guest_copy_threads; // Guest copy threads (--copy-threads) - guest writes at startup
+    uint32_t guest_local_pages; // Guest local buffer pages (page_kind_t) - guest writes at startup
+    uint32_t guest_shm_page_kb; // Page size of the guest's shared mapping in KB - guest writes at startup
+    uint32_t guest_doorbell_peer; // Guest's ivshmem peer ID, DOORBELL_NO_PEER when polling only - guest writes at startup
+    uint32_t guest_wake;      // Bumped after every guest state change (host-local regions only); futex word
+    uint32_t guest_futex;     // 1 when the guest maps a host-local region and can futex-wait - guest writes at startup
+    uint32_t guest_tsc_khz;   // Guest timer: calibrated TSC kHz, 0 = clock_gettime (timing.h) - guest writes at startup
+    uint32_t guest_timer_overhead_ns; // Guest timer overhead subtracted from its intervals - guest writes at startup
+    uint32_t guest_clock_sync; // 1 when a guest thread answers clock sync probes (-T) - guest writes at startup
+    uint32_t sync_echo;       // Last clock sync probe answered
+    uint64_t sync_t2;         // Guest clock when the probe was seen
+    uint64_t sync_t3;         // Guest clock when the reply was written
     
-    // Timing measurements for overhead analysis
-    struct timing_data timing;
+    // Timing measurements for overhead analysis - guest writes, host reads after the acknowledgement
+    struct timing_data timing __attribute__((aligned(SHM_LINE_PAIR)));
     
     // Alignment and buffer
     uint8_t  padding[0];      // Let compiler handle alignment
-    char     _align[0] __attribute__((aligned(64)));
+    char     _align[0] __attribute__((aligned(SHM_LINE_PAIR)));
     
     uint8_t  buffer[0];       // Actual data buffer
 };
@@ -0,0 +1,222 @@
+/*
+ * copy_kernels.h - Selectable copy kernels for writing frames into the BAR
+ *
+ * A plain memcpy() into shared memory uses regular stores: every destination
+ * line is read-for-ownership into the writer's cache and later has to be
+ * snooped back out when the guest reads it. Non-temporal (streaming) stores
+ * bypass the writer's cache and go straight to memory through the
+ * write-combining buffers, which is what we want for a frame the writer never
+ * touches again.
+ *
+ *   memcpy     - glibc default (baseline)
+ *   rep_movsb  - ERMS string copy, the kernel the CPU microcode picks
+ *   sse2_nt    - 16-byte movntdq stores + sfence
+ *   avx2_nt    - 32-byte vmovntdq stores + sfence
+ *   avx512_nt  - 64-byte vmovntdq stores + sfence
+ *
+ * The NT kernels are compiled with per-function target attributes so the
+ * rest of the program keeps the default -O2 ISA, and copy_kernel_select()
+ * checks the running CPU before handing one out.
+ *
+ * Unaligned heads/tails go through memcpy; the bulk loop uses unaligned loads
+ * and aligned streaming stores. Every NT kernel ends with sfence, so a caller
+ * publishing the frame via host_state (a full barrier) never exposes a
+ * partially drained write-combining buffer.
+ */
+
+#ifndef COPY_KERNELS_H
+#define COPY_KERNELS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+typedef enum {
+    COPY_KERNEL_AUTO = -1,
+    COPY_KERNEL_MEMCPY = 0,
+    COPY_KERNEL_REP_MOVSB = 1,
+    COPY_KERNEL_SSE2_NT = 2,
+    COPY_KERNEL_AVX2_NT = 3,
+    COPY_KERNEL_AVX512_NT = 4,
+    COPY_KERNEL_COUNT
+} copy_kernel_kind_t;
+
+typedef void (*copy_fn_t)(void *dst, const void *src, size_t size);
+
+struct copy_kernel {
+    copy_kernel_kind_t kind;
+    const char *name;
+    copy_fn_t copy;
+};
+
+static inline void copy_memcpy(void *dst, const void *src, size_t size)
+{
+    memcpy(dst, src, size);
+}
+
+#if defined(__x86_64__)
+
+static inline void copy_rep_movsb(void *dst, const void *src, size_t size)
+{
+    __asm__ __volatile__("rep movsb"
+                         : "+D"(dst), "+S"(src), "+c"(size)
+                         :
+                         : "memory");
+}
+
+// Bytes of plain copy needed to bring dst up to `align`
+static inline size_t copy_head_bytes(const void *dst, size_t align, size_t size)
+{
+    size_t head = (align - ((uintptr_t)dst & (align - 1))) & (align - 1);
+    return head < size ? head : size;
+}
+
+__attribute__((target("sse2")))
+static inline void copy_sse2_nt(void *dst, const void *src, size_t size)
+{
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+    size_t head = copy_head_bytes(d, 16, size);
+
+    memcpy(d, s, head);
+    d += head; s += head; size -= head;
+
+    for (; size >= 64; d += 64, s += 64, size -= 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + 0));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+        __m128i e = _mm_loadu_si128((const __m128i *)(s + 48));
+        _mm_stream_si128((__m128i *)(d + 0), a);
+        _mm_stream_si128((__m128i *)(d + 16), b);
+        _mm_stream_si128((__m128i *)(d + 32), c);
+        _mm_stream_si128((__m128i *)(d + 48), e);
+    }
+    memcpy(d, s, size);
+
+    // NT stores are weakly ordered: drain them before anyone publishes the frame
+    _mm_sfence();
+}
+
+__attribute__((target("avx2")))
+static inline void copy_avx2_nt(void *dst, const void *src, size_t size)
+{
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+    size_t head = copy_head_bytes(d, 32, size);
+
+    memcpy(d, s, head);
+    d += head; s += head; size -= head;
+
+    for (; size >= 128; d += 128, s += 128, size -= 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(s + 0));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(s + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(s + 64));
+        __m256i e = _mm256_loadu_si256((const __m256i *)(s + 96));
+        _mm256_stream_si256((__m256i *)(d + 0), a);
+        _mm256_stream_si256((__m256i *)(d + 32), b);
+        _mm256_stream_si256((__m256i *)(d + 64), c);
+        _mm256_stream_si256((__m256i *)(d + 96), e);
+    }
+    memcpy(d, s, size);
+
+    _mm_sfence();
+}
+
+__attribute__((target("avx512f")))
+static inline void copy_avx512_nt(void *dst, const void *src, size_t size)
+{
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+    size_t head = copy_head_bytes(d, 64, size);
+
+    memcpy(d, s, head);
+    d += head; s += head; size -= head;
+
+    for (; size >= 256; d += 256, s += 256, size -= 256) {
+        __m512i a = _mm512_loadu_si512((const void *)(s + 0));
+        __m512i b = _mm512_loadu_si512((const void *)(s + 64));
+        __m512i c = _mm512_loadu_si512((const void *)(s + 128));
+        __m512i e = _mm512_loadu_si512((const void *)(s + 192));
+        _mm512_stream_si512((void *)(d + 0), a);
+        _mm512_stream_si512((void *)(d + 64), b);
+        _mm512_stream_si512((void *)(d + 128), c);
+        _mm512_stream_si512((void *)(d + 192), e);
+    }
+    memcpy(d, s, size);
+
+    _mm_sfence();
+}
+
+#endif // __x86_64__
+
+static const struct copy_kernel copy_kernels[COPY_KERNEL_COUNT] = {
+    { COPY_KERNEL_MEMCPY,     "memcpy",    copy_memcpy },
+#if defined(__x86_64__)
+    { COPY_KERNEL_REP_MOVSB,  "rep_movsb", copy_rep_movsb },
+    { COPY_KERNEL_SSE2_NT,    "sse2_nt",   copy_sse2_nt },
+    { COPY_KERNEL_AVX2_NT,    "avx2_nt",   copy_avx2_nt },
+    { COPY_KERNEL_AVX512_NT,  "avx512_nt", copy_avx512_nt },
+#else
+    { COPY_KERNEL_REP_MOVSB,  "rep_movsb", NULL },
+    { COPY_KERNEL_SSE2_NT,    "sse2_nt",   NULL },
+    { COPY_KERNEL_AVX2_NT,    "avx2_nt",   NULL },
+    { COPY_KERNEL_AVX512_NT,  "avx512_nt", NULL },
+#endif
+};
+
+// True if the running CPU can execute the given kernel
+static inline bool copy_kernel_supported(copy_kernel_kind_t kind)
+{
+    if (kind < 0 || kind >= COPY_KERNEL_COUNT || !copy_kernels[kind].copy) {
+        return false;
+    }
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    switch (kind) {
+        case COPY_KERNEL_REP_MOVSB: return true;
+        case COPY_KERNEL_SSE2_NT: return __builtin_cpu_supports("sse2");
+        case COPY_KERNEL_AVX2_NT: return __builtin_cpu_supports("avx2");
+        case COPY_KERNEL_AVX512_NT: return __builtin_cpu_supports("avx512f");
+        default: break;
+    }
+#endif
+    return kind == COPY_KERNEL_MEMCPY;
+}
+
+// Parse a kernel name ("auto" allowed). Returns false if unknown.
+static inline bool copy_kernel_parse(const char *name, copy_kernel_kind_t *kind)
+{
+    if (strcasecmp(name, "auto") == 0) {
+        *kind = COPY_KERNEL_AUTO;
+        return true;
+    }
+    for (int k = 0; k < COPY_KERNEL_COUNT; k++) {
+        if (strcasecmp(name, copy_kernels[k].name) == 0) {
+            *kind = (copy_kernel_kind_t)k;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Resolve a requested kernel against the running CPU. AUTO picks AVX2 NT,
+// then SSE2 NT: AVX-512 stores trigger frequency drops on many parts and
+// don't beat 32-byte NT stores once the copy is memory bound, so they are
+// only used when asked for. An explicit request the CPU can't run returns NULL.
+static inline const struct copy_kernel *copy_kernel_select(copy_kernel_kind_t kind)
+{
+    if (kind == COPY_KERNEL_AUTO) {
+        if (copy_kernel_supported(COPY_KERNEL_AVX2_NT)) return &copy_kernels[COPY_KERNEL_AVX2_NT];
+        if (copy_kernel_supported(COPY_KERNEL_SSE2_NT)) return &copy_kernels[COPY_KERNEL_SSE2_NT];
+        return &copy_kernels[COPY_KERNEL_MEMCPY];
+    }
+    return copy_kernel_supported(kind) ? &copy_kernels[kind] : NULL;
+}
+
+#endif // COPY_KERNELS_H
@@ -0,0 +1,564 @@
+/*
+ * doorbell.h - Interrupt-driven notification through ivshmem doorbells
+ *
+ * Every wait loop polls host_state/guest_state, which costs a core per waiter
+ * while it spins. With the ivshmem-doorbell device a peer can block instead:
+ * ivshmem-server hands each peer one eventfd per interrupt vector, a peer
+ * rings another by writing to that peer's eventfd, and QEMU turns the
+ * guest's eventfd into an interrupt.
+ *
+ * Two backends, same ring/wait calls:
+ *
+ *   socket  a process on the host (host_writer, or guest_reader in loopback)
+ *           connects to the server's UNIX socket and gets the eventfds itself
+ *   uio     guest_reader inside the VM rings through the Doorbell register in
+ *           BAR0 and waits on the INTx interrupt through uio_pci_generic
+ *
+ * Server protocol (QEMU docs/specs/ivshmem-spec): every message is a
+ * little-endian int64, optionally carrying one fd as SCM_RIGHTS. On connect
+ * the server sends the protocol version (0), the new peer's ID, then -1 with
+ * the shared memory fd, then every other peer's ID once per vector with that
+ * vector's eventfd, then the new peer's own ID once per vector with its own
+ * eventfds. Later, a peer ID with an fd announces a vector of a new peer and
+ * a peer ID without one announces that the peer left.
+ *
+ * doorbell_server_start() runs a stand-in for ivshmem-server on a thread, so
+ * host_writer and a loopback guest_reader can exchange eventfds without QEMU.
+ *
+ * Waits block for at most DOORBELL_RECHECK_MS and the caller re-checks its
+ * condition either way, so a missed or coalesced ring costs latency, never a
+ * hang.
+ */
+
+#ifndef DOORBELL_H
+#define DOORBELL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#define IVSHMEM_PROTOCOL_VERSION 0
+#define DOORBELL_MAX_PEERS 16
+#define DOORBELL_MAX_VECTORS 8
+#define DOORBELL_NO_PEER 0xFFFFFFFFu   // Published peer ID when a side has no doorbell
+#define DOORBELL_RECHECK_MS 1          // Longest a wait blocks before the caller re-checks
+#define DOORBELL_CONNECT_MS 50000      // How long doorbell_connect() waits for the socket to appear
+
+// ivshmem-doorbell BAR0 registers (32-bit, index into the mapped BAR)
+#define IVSHMEM_REG_INTR_MASK 0
+#define IVSHMEM_REG_INTR_STATUS 1
+#define IVSHMEM_REG_IV_POSITION 2
+#define IVSHMEM_REG_DOORBELL 3
+#define IVSHMEM_BAR0_SIZE 256
+
+typedef enum {
+    DOORBELL_NONE = 0,
+    DOORBELL_SOCKET = 1,           // eventfds from an ivshmem-server socket
+    DOORBELL_UIO = 2               // BAR0 Doorbell register + UIO interrupt (inside the VM)
+} doorbell_kind_t;
+
+struct doorbell_peer {
+    int64_t  id;
+    uint32_t vectors;
+    int      fds[DOORBELL_MAX_VECTORS];
+};
+
+// One side's doorbell (process-local)
+struct doorbell {
+    doorbell_kind_t kind;
+    int64_t  id;                   // Our peer ID
+    int      sock;                 // Server connection (socket)
+    int      shm_fd;               // Region the server shares, -1 if none (socket)
+    uint32_t vectors;
+    int      own[DOORBELL_MAX_VECTORS];  // Our eventfds, the ones we wait on (socket)
+    struct doorbell_peer peers[DOORBELL_MAX_PEERS];
+    uint32_t peer_count;
+    int      uio_fd;               // /dev/uioN (uio)
+    volatile uint32_t *regs;       // BAR0 (uio)
+    uint64_t rings;                // Doorbells sent
+    uint64_t wakeups;              // Waits ended by a ring rather than the recheck timeout
+};
+
+static inline const char *doorbell_kind_name(doorbell_kind_t kind)
+{
+    switch (kind) {
+        case DOORBELL_SOCKET: return "eventfd";
+        case DOORBELL_UIO: return "uio";
+        default: return "none";
+    }
+}
+
+// Receive one protocol message. Returns 1 on a message, 0 on timeout, -1 on error or EOF.
+static inline int doorbell_recv(int sock, int64_t *value, int *fd, int timeout_ms)
+{
+    struct pollfd pfd = { .fd = sock, .events = POLLIN };
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready <= 0) {
+        return ready;
+    }
+
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec iov = { .iov_base = value, .iov_len = sizeof(*value) };
+    struct msghdr msg = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control.buf, .msg_controllen = sizeof(control.buf)
+    };
+
+    *fd = -1;
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (n != (ssize_t)sizeof(*value)) {
+        return -1;
+    }
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+            cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+            memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    return 1;
+}
+
+// Send one protocol message, with `fd` attached unless it is negative
+static inline bool doorbell_send(int sock, int64_t value, int fd)
+{
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec iov = { .iov_base = &value, .iov_len = sizeof(value) };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+    if (fd >= 0) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t)sizeof(value);
+}
+
+static inline struct doorbell_peer *doorbell_find_peer(struct doorbell *db, int64_t id)
+{
+    for (uint32_t i = 0; i < db->peer_count; i++) {
+        if (db->peers[i].id == id) {
+            return &db->peers[i];
+        }
+    }
+    return NULL;
+}
+
+// Apply one server message to our view of the peers
+static inline void doorbell_handle(struct doorbell *db, int64_t value, int fd)
+{
+    if (value == -1) {
+        if (db->shm_fd >= 0) close(db->shm_fd);
+        db->shm_fd = fd;
+        return;
+    }
+
+    if (value == db->id) {
+        if (fd >= 0 && db->vectors < DOORBELL_MAX_VECTORS) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            db->own[db->vectors++] = fd;
+        } else if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+
+    struct doorbell_peer *peer = doorbell_find_peer(db, value);
+    if (fd < 0) {
+        // Peer left: drop its eventfds
+        if (peer) {
+            for (uint32_t v = 0; v < peer->vectors; v++) close(peer->fds[v]);
+            *peer = db->peers[--db->peer_count];
+        }
+        return;
+    }
+    if (!peer && db->peer_count < DOORBELL_MAX_PEERS) {
+        peer = &db->peers[db->peer_count++];
+        peer->id = value;
+        peer->vectors = 0;
+    }
+    if (peer && peer->vectors < DOORBELL_MAX_VECTORS) {
+        peer->fds[peer->vectors++] = fd;
+    } else {
+        close(fd);
+    }
+}
+
+static inline void doorbell_reset(struct doorbell *db)
+{
+    memset(db, 0, sizeof(*db));
+    db->id = -1;
+    db->sock = -1;
+    db->shm_fd = -1;
+    db->uio_fd = -1;
+}
+
+// Connect to an ivshmem-server (or the stand-in) at `path` and take part as a peer.
+// Retries while the socket doesn't exist yet so either program may start first.
+static inline bool doorbell_connect(struct doorbell *db, const char *path)
+{
+    doorbell_reset(db);
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+
+    for (int waited = 0;; waited += 10) {
+        db->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (db->sock < 0) {
+            return false;
+        }
+        if (connect(db->sock, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            break;
+        }
+        int err = errno;
+        close(db->sock);
+        db->sock = -1;
+        if ((err != ENOENT && err != ECONNREFUSED) || waited >= DOORBELL_CONNECT_MS) {
+            errno = err;
+            return false;
+        }
+        usleep(10000);
+    }
+
+    int64_t version, id;
+    int fd;
+    if (doorbell_recv(db->sock, &version, &fd, 5000) != 1 || fd >= 0 || version != IVSHMEM_PROTOCOL_VERSION ||
+        doorbell_recv(db->sock, &id, &fd, 5000) != 1 || fd >= 0 || id < 0) {
+        close(db->sock);
+        db->sock = -1;
+        errno = EPROTO;
+        return false;
+    }
+    db->id = id;
+    db->kind = DOORBELL_SOCKET;
+
+    // Our own vectors come last; keep reading until they have arrived and the burst is over
+    int64_t value;
+    int rc;
+    while ((rc = doorbell_recv(db->sock, &value, &fd, db->vectors > 0 ? 50 : 5000)) == 1) {
+        doorbell_handle(db, value, fd);
+    }
+    if (rc < 0 || db->vectors == 0) {
+        errno = EPROTO;
+        return false;
+    }
+    return true;
+}
+
+// Socket: apply any peer join/leave messages the server has sent since
+static inline void doorbell_update(struct doorbell *db)
+{
+    int64_t value;
+    int fd;
+    if (db->kind != DOORBELL_SOCKET) {
+        return;
+    }
+    while (doorbell_recv(db->sock, &value, &fd, 0) == 1) {
+        doorbell_handle(db, value, fd);
+    }
+}
+
+// Inside the VM: ring and wait through the ivshmem-doorbell device at `pci_dir`
+// (e.g. /sys/bus/pci/devices/0000:00:03.0) bound to uio_pci_generic
+static inline bool doorbell_open_uio(struct doorbell *db, const char *pci_dir)
+{
+    doorbell_reset(db);
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/uio", pci_dir);
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return false;
+    }
+    struct dirent *entry;
+    char uio_name[64] = "";
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "uio", 3) == 0 && strlen(entry->d_name) < sizeof(uio_name)) {
+            strcpy(uio_name, entry->d_name);
+            break;
+        }
+    }
+    closedir(dir);
+    if (uio_name[0] == '\0') {
+        errno = ENODEV;
+        return false;
+    }
+
+    snprintf(path, sizeof(path), "/dev/%s", uio_name);
+    db->uio_fd = open(path, O_RDWR | O_CLOEXEC);
+    snprintf(path, sizeof(path), "%s/resource0", pci_dir);
+    int bar_fd = open(path, O_RDWR | O_SYNC | O_CLOEXEC);
+    if (db->uio_fd < 0 || bar_fd < 0) {
+        if (db->uio_fd >= 0) close(db->uio_fd);
+        if (bar_fd >= 0) close(bar_fd);
+        db->uio_fd = -1;
+        return false;
+    }
+    void *regs = mmap(NULL, IVSHMEM_BAR0_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, bar_fd, 0);
+    close(bar_fd);
+    if (regs == MAP_FAILED) {
+        close(db->uio_fd);
+        db->uio_fd = -1;
+        return false;
+    }
+
+    db->regs = (volatile uint32_t *)regs;
+    db->id = db->regs[IVSHMEM_REG_IV_POSITION];
+    db->regs[IVSHMEM_REG_INTR_MASK] = 1;
+    db->vectors = 1;
+    db->kind = DOORBELL_UIO;
+    return true;
+}
+
+// Ring `vector` of `peer`. The caller publishes its state first; the ring only wakes the peer.
+static inline bool doorbell_ring(struct doorbell *db, uint32_t peer, uint32_t vector)
+{
+    if (db->kind == DOORBELL_UIO) {
+        db->regs[IVSHMEM_REG_DOORBELL] = (peer << 16) | (vector & 0xFFFF);
+        db->rings++;
+        return true;
+    }
+    if (db->kind != DOORBELL_SOCKET) {
+        return false;
+    }
+
+    struct doorbell_peer *target = doorbell_find_peer(db, peer);
+    if (!target) {
+        // The peer may have joined after we connected
+        doorbell_update(db);
+        target = doorbell_find_peer(db, peer);
+    }
+    if (!target || vector >= target->vectors) {
+        return false;
+    }
+    uint64_t one = 1;
+    if (write(target->fds[vector], &one, sizeof(one)) != (ssize_t)sizeof(one)) {
+        return false;
+    }
+    db->rings++;
+    return true;
+}
+
+// Block until our vector 0 is rung or `timeout_ms` passes; true if it was rung
+static inline bool doorbell_wait(struct doorbell *db, int timeout_ms)
+{
+    if (db->kind == DOORBELL_UIO) {
+        // Re-enable the interrupt (uio_pci_generic masks it in its handler), wait, then
+        // clear IntrStatus so the next ring raises the line again
+        uint32_t enable = 1, count;
+        if (write(db->uio_fd, &enable, sizeof(enable)) != (ssize_t)sizeof(enable)) {
+            return false;
+        }
+        struct pollfd pfd = { .fd = db->uio_fd, .events = POLLIN };
+        if (poll(&pfd, 1, timeout_ms) <= 0 || read(db->uio_fd, &count, sizeof(count)) != (ssize_t)sizeof(count)) {
+            return false;
+        }
+        (void)db->regs[IVSHMEM_REG_INTR_STATUS];
+        db->wakeups++;
+        return true;
+    }
+    if (db->kind != DOORBELL_SOCKET) {
+        return false;
+    }
+
+    struct pollfd pfd = { .fd = db->own[0], .events = POLLIN };
+    uint64_t count;
+    if (poll(&pfd, 1, timeout_ms) <= 0 || read(db->own[0], &count, sizeof(count)) != (ssize_t)sizeof(count)) {
+        return false;
+    }
+    db->wakeups++;
+    return true;
+}
+
+static inline void doorbell_close(struct doorbell *db)
+{
+    for (uint32_t i = 0; i < db->peer_count; i++) {
+        for (uint32_t v = 0; v < db->peers[i].vectors; v++) close(db->peers[i].fds[v]);
+    }
+    for (uint32_t v = 0; v < db->vectors && db->kind == DOORBELL_SOCKET; v++) close(db->own[v]);
+    if (db->sock >= 0) close(db->sock);
+    if (db->shm_fd >= 0) close(db->shm_fd);
+    if (db->uio_fd >= 0) close(db->uio_fd);
+    if (db->regs) munmap((void *)db->regs, IVSHMEM_BAR0_SIZE);
+    doorbell_reset(db);
+}
+
+// Stand-in ivshmem-server: same protocol, one thread, peers are local processes
+struct doorbell_server {
+    int      listen_fd;
+    int      stop_fd;              // eventfd: doorbell_server_stop() wakes the loop
+    int      shm_fd;               // Region handed to every peer
+    uint32_t vectors;
+    int64_t  next_id;
+    char     path[108];
+    pthread_t thread;
+    struct {
+        int     sock;
+        int64_t id;
+        int     fds[DOORBELL_MAX_VECTORS];
+    } peers[DOORBELL_MAX_PEERS];
+    uint32_t peer_count;
+};
+
+static inline void doorbell_server_accept(struct doorbell_server *srv)
+{
+    int sock = accept(srv->listen_fd, NULL, NULL);
+    if (sock < 0) {
+        return;
+    }
+    if (srv->peer_count >= DOORBELL_MAX_PEERS) {
+        close(sock);
+        return;
+    }
+
+    uint32_t index = srv->peer_count;
+    for (uint32_t v = 0; v < srv->vectors; v++) {
+        srv->peers[index].fds[v] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (srv->peers[index].fds[v] < 0) {
+            // Refuse the peer rather than hand it (and everyone else) fd -1
+            while (v-- > 0) close(srv->peers[index].fds[v]);
+            close(sock);
+            return;
+        }
+    }
+    int64_t id = srv->next_id++;
+    srv->peers[index].sock = sock;
+    srv->peers[index].id = id;
+    srv->peer_count++;
+
+    doorbell_send(sock, IVSHMEM_PROTOCOL_VERSION, -1);
+    doorbell_send(sock, id, -1);
+    doorbell_send(sock, -1, srv->shm_fd);
+    for (uint32_t i = 0; i < index; i++) {
+        for (uint32_t v = 0; v < srv->vectors; v++) {
+            doorbell_send(srv->peers[i].sock, id, srv->peers[index].fds[v]);
+            doorbell_send(sock, srv->peers[i].id, srv->peers[i].fds[v]);
+        }
+    }
+    for (uint32_t v = 0; v < srv->vectors; v++) {
+        doorbell_send(sock, id, srv->peers[index].fds[v]);
+    }
+}
+
+static inline void doorbell_server_drop(struct doorbell_server *srv, uint32_t index)
+{
+    int64_t id = srv->peers[index].id;
+    close(srv->peers[index].sock);
+    for (uint32_t v = 0; v < srv->vectors; v++) close(srv->peers[index].fds[v]);
+    srv->peers[index] = srv->peers[--srv->peer_count];
+    for (uint32_t i = 0; i < srv->peer_count; i++) {
+        doorbell_send(srv->peers[i].sock, id, -1);
+    }
+}
+
+static inline void *doorbell_server_loop(void *arg)
+{
+    struct doorbell_server *srv = (struct doorbell_server *)arg;
+    struct pollfd pfds[DOORBELL_MAX_PEERS + 2];
+
+    for (;;) {
+        uint32_t count = srv->peer_count;
+        pfds[0] = (struct pollfd){ .fd = srv->stop_fd, .events = POLLIN };
+        pfds[1] = (struct pollfd){ .fd = srv->listen_fd, .events = POLLIN };
+        for (uint32_t i = 0; i < count; i++) {
+            pfds[i + 2] = (struct pollfd){ .fd = srv->peers[i].sock, .events = POLLIN };
+        }
+        if (poll(pfds, count + 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (pfds[0].revents) {
+            break;
+        }
+
+        // Peers never send anything, so readable means gone. Drop from the back so indices stay valid.
+        for (uint32_t i = count; i-- > 0;) {
+            if (pfds[i + 2].revents) {
+                char byte;
+                if (recv(srv->peers[i].sock, &byte, 1, MSG_DONTWAIT) <= 0) {
+                    doorbell_server_drop(srv, i);
+                }
+            }
+        }
+        if (pfds[1].revents & POLLIN) {
+            doorbell_server_accept(srv);
+        }
+    }
+    return NULL;
+}
+
+// Listen on `path` and hand out `shm_fd` and `vectors` eventfds per peer from a thread
+static inline bool doorbell_server_start(struct doorbell_server *srv, const char *path, int shm_fd, uint32_t vectors)
+{
+    memset(srv, 0, sizeof(*srv));
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path) || vectors == 0 || vectors > DOORBELL_MAX_VECTORS) {
+        errno = EINVAL;
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+    strcpy(srv->path, path);
+    srv->shm_fd = shm_fd;
+    srv->vectors = vectors;
+
+    srv->stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (srv->stop_fd < 0) {
+        return false;
+    }
+
+    unlink(path);
+    srv->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (srv->listen_fd < 0 ||
+        bind(srv->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(srv->listen_fd, 8) < 0 ||
+        pthread_create(&srv->thread, NULL, doorbell_server_loop, srv) != 0) {
+        int err = errno;
+        if (srv->listen_fd >= 0) close(srv->listen_fd);
+        close(srv->stop_fd);
+        unlink(path);
+        errno = err;
+        return false;
+    }
+    return true;
+}
+
+static inline void doorbell_server_stop(struct doorbell_server *srv)
+{
+    uint64_t one = 1;
+    if (write(srv->stop_fd, &one, sizeof(one)) == (ssize_t)sizeof(one)) {
+        pthread_join(srv->thread, NULL);
+    }
+    for (uint32_t i = 0; i < srv->peer_count; i++) {
+        close(srv->peers[i].sock);
+        for (uint32_t v = 0; v < srv->vectors; v++) close(srv->peers[i].fds[v]);
+    }
+    close(srv->listen_fd);
+    close(srv->stop_fd);
+    unlink(srv->path);
+}
+
+#endif // DOORBELL_H
@@ -0,0 +1,226 @@
+/*
+ * duplex.h - Two independent rings, one per direction, in one region
+ *
+ * The guest's only write-back path is timing_data and error_code. For
+ * guest->host traffic the data area is split in two: a host->guest ring and a
+ * guest->host ring, each an ordinary SPSC ring from ring_buffer.h with its own
+ * head/tail lines, so the directions share nothing but the memory controller.
+ *
+ *   buffer + 0                  duplex_header (one page)
+ *   buffer + ring_offset[H2G]   host->guest ring (host produces)
+ *   buffer + ring_offset[G2H]   guest->host ring (guest produces)
+ *
+ * The host formats both rings; each side then attaches as producer of one and
+ * consumer of the other. Producer and consumer loops are shared by both
+ * programs (duplex_produce / duplex_consume, pthread entry points), so the
+ * two directions run identical code. Producers push until the host sets
+ * `stop`, then publish their final count; consumers drain up to that count.
+ */
+
+#ifndef DUPLEX_H
+#define DUPLEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "ring_buffer.h"
+#include "timing.h"
+#include "wait_policy.h"
+
+#define DUPLEX_MAGIC 0x44555058    // "DUPX"
+#define DUPLEX_CACHE_LINE 64
+#define DUPLEX_HEADER_SIZE 4096
+
+// Directions (index into duplex_header.dir and .ring_offset, and bits in .directions)
+#define DUPLEX_H2G 0
+#define DUPLEX_G2H 1
+#define DUPLEX_BIT(dir) (1u << (dir))
+
+// Benchmark phases: host->guest alone, guest->host alone, both at once
+#define DUPLEX_PHASES 3
+
+// Per-direction completion and results
+struct duplex_end {
+    // Producer side
+    uint64_t sent __attribute__((aligned(DUPLEX_CACHE_LINE)));  // Frames pushed, final once `done` is set
+    uint32_t done;
+
+    // Consumer side
+    uint64_t received __attribute__((aligned(DUPLEX_CACHE_LINE)));
+    uint64_t rx_ns;                // Stream start -> last frame copied out (consumer clock)
+    uint32_t errors;               // Sequence gaps
+};
+
+// Duplex control block, placed at the start of shared_data.buffer
+struct duplex_header {
+    uint32_t magic;                // DUPLEX_MAGIC once both rings are formatted
+    uint32_t directions;           // DUPLEX_BIT() of the directions active in this phase
+    uint32_t frame_size;
+    uint32_t ring_offset[2];       // Ring headers, from the duplex header
+
+    uint32_t stop __attribute__((aligned(DUPLEX_CACHE_LINE)));  // Host: phase time is up
+
+    struct duplex_end dir[2];
+};
+
+// One direction as seen by one side (process-local)
+struct duplex_stream {
+    struct ring ring;
+    volatile struct duplex_end *end;
+    volatile uint32_t *stop;       // Producers stop once set
+    volatile uint32_t *abort;      // Both stop at once if set (test_complete)
+    const struct wait_policy *wait;
+    uint8_t *buffer;               // Source frame (producer) or destination (consumer)
+    uint32_t frame_size;
+
+    // Results
+    uint64_t frames;
+    uint64_t stall_ns;             // Ring full (producer) or empty (consumer)
+    uint64_t duration_ns;
+};
+
+// Largest slot count (up to RING_DEFAULT_MAX_SLOTS) for each of the two rings
+static inline uint32_t duplex_slots(size_t avail, uint32_t frame_size)
+{
+    if (avail <= DUPLEX_HEADER_SIZE) return 0;
+    size_t half = ((avail - DUPLEX_HEADER_SIZE) / 2) & ~(size_t)(RING_SLOT_ALIGN - 1);
+    uint32_t slots = ring_max_slots(half, frame_size);
+    return slots < RING_DEFAULT_MAX_SLOTS ? slots : RING_DEFAULT_MAX_SLOTS;
+}
+
+static inline void *duplex_ring_base(volatile struct duplex_header *hdr, int dir)
+{
+    return (uint8_t *)hdr + hdr->ring_offset[dir];
+}
+
+// Host: format the header and both rings for one phase. Returns false if two
+// rings of at least two slots don't fit.
+static inline bool duplex_init(volatile struct duplex_header *hdr, size_t avail, uint32_t frame_size,
+                               uint32_t directions)
+{
+    uint32_t slots = duplex_slots(avail, frame_size);
+    if (slots < 2) {
+        return false;
+    }
+
+    hdr->magic = 0;
+    __sync_synchronize();
+    memset((void *)hdr, 0, sizeof(struct duplex_header));
+    hdr->directions = directions;
+    hdr->frame_size = frame_size;
+
+    size_t half = ((avail - DUPLEX_HEADER_SIZE) / 2) & ~(size_t)(RING_SLOT_ALIGN - 1);
+    hdr->ring_offset[DUPLEX_H2G] = DUPLEX_HEADER_SIZE;
+    hdr->ring_offset[DUPLEX_G2H] = (uint32_t)(DUPLEX_HEADER_SIZE + half);
+
+    struct ring ring;
+    for (int dir = 0; dir < 2; dir++) {
+        if (!ring_init(&ring, duplex_ring_base(hdr, dir), half, slots, frame_size)) {
+            return false;
+        }
+    }
+
+    __atomic_store_n(&hdr->magic, DUPLEX_MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Either side: set up one direction. `produce` picks the end of the ring we drive.
+static inline bool duplex_stream_attach(struct duplex_stream *s, volatile struct duplex_header *hdr,
+                                        size_t avail, int dir, bool produce)
+{
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != DUPLEX_MAGIC ||
+        hdr->ring_offset[dir] >= avail) {
+        return false;
+    }
+    size_t ring_avail = avail - hdr->ring_offset[dir];
+    bool ok = produce ? ring_attach_producer(&s->ring, duplex_ring_base(hdr, dir), ring_avail)
+                      : ring_attach(&s->ring, duplex_ring_base(hdr, dir), ring_avail);
+    if (!ok) {
+        return false;
+    }
+    s->end = &hdr->dir[dir];
+    s->stop = &hdr->stop;
+    s->frame_size = hdr->frame_size;
+    s->frames = 0;
+    s->stall_ns = 0;
+    s->duration_ns = 0;
+    return true;
+}
+
+// Producer loop (pthread entry): push copies of s->buffer until `stop`
+static inline void *duplex_produce(void *arg)
+{
+    struct duplex_stream *s = (struct duplex_stream *)arg;
+    struct wait_state ws;
+    uint64_t start = get_time_ns();
+    uint32_t sequence = 0;
+
+    while (!__atomic_load_n(s->stop, __ATOMIC_ACQUIRE) && !*s->abort) {
+        if (ring_try_push(&s->ring, s->buffer, s->frame_size, sequence, NULL)) {
+            sequence++;
+            continue;
+        }
+        uint64_t stall_start = get_time_ns();
+        wait_begin(&ws);
+        while (!ring_has_space(&s->ring) && !__atomic_load_n(s->stop, __ATOMIC_ACQUIRE) && !*s->abort) {
+            wait_step(s->wait, &ws);
+        }
+        s->stall_ns += get_time_ns() - stall_start;
+    }
+
+    s->duration_ns = get_time_ns() - start;
+    s->frames = sequence;
+    s->end->sent = sequence;
+    __atomic_store_n(&s->end->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Consumer loop (pthread entry): copy frames out into s->buffer until the
+// producer is done and everything it sent has been drained
+static inline void *duplex_consume(void *arg)
+{
+    struct duplex_stream *s = (struct duplex_stream *)arg;
+    struct wait_state ws;
+    uint64_t start = get_time_ns();
+    uint64_t last = start;
+    uint32_t errors = 0;
+
+    for (;;) {
+        uint32_t size = 0, sequence = 0;
+        // Slots ring_try_pop() drops as oversized still use up a sequence number, and count as errors
+        if (ring_try_pop(&s->ring, s->buffer, s->frame_size, &size, &sequence, NULL)) {
+            if (sequence != (uint32_t)(s->frames + s->ring.dropped)) errors++;
+            s->frames++;
+            last = get_time_ns();
+            continue;
+        }
+        if (__atomic_load_n(&s->end->done, __ATOMIC_ACQUIRE) && s->frames + s->ring.dropped >= s->end->sent) {
+            break;
+        }
+        if (*s->abort) {
+            break;
+        }
+        uint64_t stall_start = get_time_ns();
+        wait_begin(&ws);
+        while (!ring_has_data(&s->ring) && !__atomic_load_n(&s->end->done, __ATOMIC_ACQUIRE) && !*s->abort) {
+            wait_step(s->wait, &ws);
+        }
+        s->stall_ns += get_time_ns() - stall_start;
+    }
+
+    s->duration_ns = last - start;
+    s->end->received = s->frames;
+    s->end->rx_ns = s->duration_ns;
+    s->end->errors = errors + (uint32_t)s->ring.dropped;
+    return NULL;
+}
+
+// MB/s for one direction from the consumer's view
+static inline double duplex_mbps(uint64_t frames, uint32_t frame_size, uint64_t ns)
+{
+    return ns > 0 ? frames * (frame_size / (1024.0 * 1024.0)) / (ns / 1e9) : 0.0;
+}
+
+#endif // DUPLEX_H
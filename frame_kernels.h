@@ -0,0 +1,157 @@
+/*
+ * frame_kernels.h - Consumer kernels for the in-place vs. copy benchmark
+ *
+ * A consumer that copies a frame out of the BAR before working on it reads
+ * every byte twice. With ring_lease() it can run its kernel directly on the
+ * slot instead. These are the kernels the zero-copy test runs on an RGB24
+ * frame, each returning a 64-bit fingerprint of its output so the host can
+ * check the guest's result against its own run on the same frame:
+ *
+ *   checksum   one streaming pass, 64-bit word sum (lower bound for any kernel)
+ *   histogram  256-bin luma histogram (one gather/increment per pixel)
+ *   downscale  2x2 box filter to half resolution (reads two rows per output row)
+ *
+ * The test's control block sits at the start of the data area with the ring
+ * one page after it. The host fills in the phase (kernel, mode, frame
+ * geometry, expected fingerprint); the guest writes its totals back once the
+ * host closes the phase.
+ */
+
+#ifndef FRAME_KERNELS_H
+#define FRAME_KERNELS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#define KBENCH_MAGIC 0x4B42454E    // "KBEN"
+#define KBENCH_CACHE_LINE 64
+#define KBENCH_HEADER_SIZE 4096    // Ring starts one page after the control block
+
+typedef enum {
+    KERNEL_CHECKSUM = 0,
+    KERNEL_HISTOGRAM = 1,
+    KERNEL_DOWNSCALE = 2,
+    KERNEL_COUNT
+} frame_kernel_t;
+
+typedef enum {
+    KBENCH_COPY = 0,               // memcpy the slot to a local buffer, then run the kernel
+    KBENCH_IN_PLACE = 1,           // Lease the slot and run the kernel on shared memory
+    KBENCH_MODE_COUNT
+} kbench_mode_t;
+
+// Zero-copy test control block, placed at the start of shared_data.buffer
+struct kbench_header {
+    // Phase - host writes before publishing magic
+    uint32_t magic;                // KBENCH_MAGIC once the phase and ring are formatted
+    uint32_t kernel;               // frame_kernel_t
+    uint32_t mode;                 // kbench_mode_t
+    uint32_t width;
+    uint32_t height;
+    uint32_t ring_offset;          // Ring header, from this header
+    uint64_t expected;             // Fingerprint of the kernel's output on the host's frame
+
+    // End of phase - host writes
+    uint32_t closed __attribute__((aligned(KBENCH_CACHE_LINE)));
+
+    // Results - guest writes before acknowledging
+    uint64_t frames __attribute__((aligned(KBENCH_CACHE_LINE)));
+    uint64_t copy_ns;              // Copy out of the slot (copy mode only)
+    uint64_t process_ns;           // Kernel time
+    uint64_t hold_ns;              // Lease/pop -> release, i.e. how long the producer lost the slot
+    uint32_t mismatches;           // Frames whose fingerprint differed from `expected`
+};
+
+static inline const char *frame_kernel_name(uint32_t kernel)
+{
+    static const char *names[KERNEL_COUNT] = { "checksum", "histogram", "downscale" };
+    return kernel < KERNEL_COUNT ? names[kernel] : "unknown";
+}
+
+static inline const char *kbench_mode_name(uint32_t mode)
+{
+    return mode == KBENCH_IN_PLACE ? "in-place" : "copy";
+}
+
+// Scratch a kernel needs besides its input: histogram bins or the downscaled frame
+static inline size_t frame_kernel_scratch_size(uint32_t width, uint32_t height)
+{
+    size_t downscaled = (size_t)(width / 2) * (height / 2) * 3;
+    return downscaled > 256 * sizeof(uint32_t) ? downscaled : 256 * sizeof(uint32_t);
+}
+
+static inline uint64_t kernel_mix(uint64_t hash, uint64_t value)
+{
+    hash ^= value;
+    return hash * 0x100000001B3ULL;
+}
+
+static inline uint64_t kernel_checksum(const uint8_t *src, size_t size)
+{
+    uint64_t sum0 = 0, sum1 = 0;
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        uint64_t a, b;
+        memcpy(&a, src + i, 8);
+        memcpy(&b, src + i + 8, 8);
+        sum0 += a;
+        sum1 += b;
+    }
+    for (; i < size; i++) {
+        sum0 += src[i];
+    }
+    return sum0 + sum1;
+}
+
+static inline uint64_t kernel_histogram(const uint8_t *rgb, uint32_t width, uint32_t height, uint32_t *bins)
+{
+    memset(bins, 0, 256 * sizeof(uint32_t));
+    size_t pixels = (size_t)width * height;
+    for (size_t p = 0; p < pixels; p++) {
+        const uint8_t *px = rgb + p * 3;
+        bins[(77u * px[0] + 150u * px[1] + 29u * px[2]) >> 8]++;
+    }
+
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (int b = 0; b < 256; b++) {
+        hash = kernel_mix(hash, bins[b]);
+    }
+    return hash;
+}
+
+static inline uint64_t kernel_downscale(const uint8_t *rgb, uint32_t width, uint32_t height, uint8_t *out)
+{
+    uint32_t out_w = width / 2, out_h = height / 2;
+    size_t stride = (size_t)width * 3;
+
+    for (uint32_t y = 0; y < out_h; y++) {
+        const uint8_t *row0 = rgb + (size_t)(2 * y) * stride;
+        const uint8_t *row1 = row0 + stride;
+        uint8_t *dst = out + (size_t)y * out_w * 3;
+        for (uint32_t x = 0; x < out_w; x++) {
+            const uint8_t *a = row0 + (size_t)x * 6, *b = row1 + (size_t)x * 6;
+            for (int c = 0; c < 3; c++) {
+                dst[x * 3 + c] = (uint8_t)((a[c] + a[c + 3] + b[c] + b[c + 3] + 2) >> 2);
+            }
+        }
+    }
+    return kernel_checksum(out, (size_t)out_w * out_h * 3);
+}
+
+// Run `kernel` on one RGB24 frame; `scratch` holds frame_kernel_scratch_size() bytes
+static inline uint64_t frame_kernel_run(uint32_t kernel, const uint8_t *frame, uint32_t width, uint32_t height,
+                                        void *scratch)
+{
+    switch (kernel) {
+    case KERNEL_HISTOGRAM:
+        return kernel_histogram(frame, width, height, (uint32_t *)scratch);
+    case KERNEL_DOWNSCALE:
+        return kernel_downscale(frame, width, height, (uint8_t *)scratch);
+    default:
+        return kernel_checksum(frame, (size_t)width * height * 3);
+    }
+}
+
+#endif // FRAME_KERNELS_H
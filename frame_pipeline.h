@@ -0,0 +1,206 @@
+/*
+ * frame_pipeline.h - Double/triple-buffered frame slots with ownership flags
+ *
+ * The slot ring (ring_buffer.h) is built for many small-to-medium messages
+ * and tracks occupancy with two free-running indices. For a sustained stream
+ * of full frames only two or three slots fit in the region (a 4K frame is
+ * ~25 MB, so a 64 MB region holds two), and the simplest protocol is one
+ * ownership flag per slot: the host fills a slot it owns and hands it to the
+ * guest; the guest drains it and hands it back. Both sides walk the slots in
+ * the same round-robin order, so while the guest reads slot N the host is
+ * already writing slot N+1.
+ *
+ * Each flag lives on its own cache line together with the slot's sequence
+ * and size, so handing off one slot never invalidates the line the other
+ * side is polling for the next one. The host closes the stream by setting
+ * `closed` after its last hand-off; the guest stops once it has drained every
+ * slot it was given.
+ */
+
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#define PIPE_MAGIC 0x50495045      // "PIPE"
+#define PIPE_CACHE_LINE 64
+#define PIPE_SLOT_ALIGN 4096       // Slot payloads are page aligned
+#define PIPE_MIN_SLOTS 2
+#define PIPE_MAX_SLOTS 3
+
+// Slot owner values
+#define PIPE_OWNER_HOST 0          // Free: host may fill it
+#define PIPE_OWNER_GUEST 1         // Published: guest may drain it
+
+// Per-slot control (one cache line each)
+struct pipe_slot_ctl {
+    uint32_t owner;                // PIPE_OWNER_*; written by whichever side owns the slot
+    uint32_t sequence;             // Frame number (host writes before hand-off)
+    uint32_t data_size;            // Valid bytes in the payload (host writes before hand-off)
+    uint8_t  _pad[PIPE_CACHE_LINE - 12];
+} __attribute__((aligned(PIPE_CACHE_LINE)));
+
+// Pipeline control block, placed at the start of shared_data.buffer
+struct pipe_header {
+    // Geometry - written once by the host in pipe_init()
+    uint32_t magic;                // PIPE_MAGIC once geometry is valid
+    uint32_t slot_count;           // 2 or 3
+    uint32_t slot_size;            // Payload capacity per slot (bytes)
+    uint32_t data_offset;          // Offset of first payload from the pipeline header
+
+    // End of stream - host writes after its last hand-off
+    uint32_t closed __attribute__((aligned(PIPE_CACHE_LINE)));
+    uint32_t frames;               // Frames handed off in total
+
+    struct pipe_slot_ctl slots[PIPE_MAX_SLOTS] __attribute__((aligned(PIPE_CACHE_LINE)));
+};
+
+// Process-local view of a pipeline (never placed in shared memory)
+struct pipeline {
+    volatile struct pipe_header *hdr;
+    uint8_t *data;                 // Base of the slot payload area
+    uint32_t slot_count;
+    uint32_t slot_size;
+    size_t   slot_stride;          // Distance between payloads (page aligned)
+    uint64_t next;                 // Next frame number to fill (host) or drain (guest)
+};
+
+static inline size_t pipe_align_up(size_t value, size_t align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+
+// Bytes needed for a pipeline with the given geometry
+static inline size_t pipe_required_size(uint32_t slot_count, uint32_t slot_size)
+{
+    return pipe_align_up(sizeof(struct pipe_header), PIPE_SLOT_ALIGN) +
+           (size_t)slot_count * pipe_align_up(slot_size, PIPE_SLOT_ALIGN);
+}
+
+// Largest slot count (up to PIPE_MAX_SLOTS) that fits in `avail` bytes
+static inline uint32_t pipe_max_slots(size_t avail, uint32_t slot_size)
+{
+    uint32_t count = 0;
+    while (count < PIPE_MAX_SLOTS && pipe_required_size(count + 1, slot_size) <= avail) {
+        count++;
+    }
+    return count;
+}
+
+static inline void pipe_setup_view(struct pipeline *p, void *base)
+{
+    p->hdr = (volatile struct pipe_header *)base;
+    p->slot_count = p->hdr->slot_count;
+    p->slot_size = p->hdr->slot_size;
+    p->slot_stride = pipe_align_up(p->slot_size, PIPE_SLOT_ALIGN);
+    p->data = (uint8_t *)base + p->hdr->data_offset;
+    p->next = 0;
+}
+
+// Host: format a pipeline in [base, base + avail) with every slot host-owned.
+// Returns false if the geometry is invalid or doesn't fit.
+static inline bool pipe_init(struct pipeline *p, void *base, size_t avail, uint32_t slot_count, uint32_t slot_size)
+{
+    if (slot_count < PIPE_MIN_SLOTS || slot_count > PIPE_MAX_SLOTS || slot_size == 0 ||
+        pipe_required_size(slot_count, slot_size) > avail) {
+        return false;
+    }
+
+    volatile struct pipe_header *hdr = (volatile struct pipe_header *)base;
+    hdr->magic = 0;
+    __sync_synchronize();
+
+    memset((void *)hdr, 0, sizeof(struct pipe_header));
+    hdr->slot_count = slot_count;
+    hdr->slot_size = slot_size;
+    hdr->data_offset = (uint32_t)pipe_align_up(sizeof(struct pipe_header), PIPE_SLOT_ALIGN);
+    for (uint32_t s = 0; s < slot_count; s++) {
+        hdr->slots[s].owner = PIPE_OWNER_HOST;
+    }
+
+    // Publish geometry last so the guest never attaches to a half-built pipeline
+    __atomic_store_n(&hdr->magic, PIPE_MAGIC, __ATOMIC_RELEASE);
+
+    pipe_setup_view(p, base);
+    return true;
+}
+
+// Guest: attach to a pipeline formatted by the host. Returns false if absent or invalid.
+static inline bool pipe_attach(struct pipeline *p, void *base, size_t avail)
+{
+    volatile struct pipe_header *hdr = (volatile struct pipe_header *)base;
+
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != PIPE_MAGIC) {
+        return false;
+    }
+    if (hdr->slot_count < PIPE_MIN_SLOTS || hdr->slot_count > PIPE_MAX_SLOTS ||
+        pipe_required_size(hdr->slot_count, hdr->slot_size) > avail) {
+        return false;
+    }
+
+    pipe_setup_view(p, base);
+    return true;
+}
+
+// Slot the next frame goes through
+static inline uint32_t pipe_slot(const struct pipeline *p)
+{
+    return (uint32_t)(p->next % p->slot_count);
+}
+
+static inline uint8_t *pipe_slot_data(const struct pipeline *p, uint32_t slot)
+{
+    return p->data + slot * p->slot_stride;
+}
+
+// True once `owner` holds the slot. Acquire: the previous owner's payload
+// writes (host) or reads (guest) are complete.
+static inline bool pipe_slot_owned(const struct pipeline *p, uint32_t slot, uint32_t owner)
+{
+    return __atomic_load_n(&p->hdr->slots[slot].owner, __ATOMIC_ACQUIRE) == owner;
+}
+
+// Host: publish the filled slot to the guest and move to the next one
+static inline void pipe_publish(struct pipeline *p, uint32_t slot, uint32_t size)
+{
+    volatile struct pipe_slot_ctl *ctl = &p->hdr->slots[slot];
+    ctl->sequence = (uint32_t)p->next;
+    ctl->data_size = size;
+    __atomic_store_n(&ctl->owner, PIPE_OWNER_GUEST, __ATOMIC_RELEASE);
+    p->next++;
+}
+
+// Guest: hand the drained slot back to the host and move to the next one
+static inline void pipe_release(struct pipeline *p, uint32_t slot)
+{
+    __atomic_store_n(&p->hdr->slots[slot].owner, PIPE_OWNER_HOST, __ATOMIC_RELEASE);
+    p->next++;
+}
+
+// Host: mark the end of the stream after the last pipe_publish()
+static inline void pipe_close(struct pipeline *p)
+{
+    p->hdr->frames = (uint32_t)p->next;
+    __atomic_store_n(&p->hdr->closed, 1, __ATOMIC_RELEASE);
+}
+
+static inline bool pipe_closed(const struct pipeline *p)
+{
+    return __atomic_load_n(&p->hdr->closed, __ATOMIC_ACQUIRE) != 0;
+}
+
+// Host: true once the guest has handed every slot back
+static inline bool pipe_drained(const struct pipeline *p)
+{
+    for (uint32_t s = 0; s < p->slot_count; s++) {
+        if (!pipe_slot_owned(p, s, PIPE_OWNER_HOST)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif // FRAME_PIPELINE_H
@@ -0,0 +1,152 @@
+/*
+ * frame_stripes.h - Striped frame transfer with per-stripe ready flags
+ *
+ * With one ready flag per frame (host_state = SENDING) the guest cannot start
+ * on a 24 MB frame until the host has written all of it, so the copy in and
+ * the copy out run back to back. Here the frame is split into K page-aligned
+ * stripes, each with its own ready flag on its own cache line. The host
+ * publishes stripe i as soon as it is written; the guest copies stripe i out
+ * while the host writes stripe i+1, so the two copies overlap and a frame
+ * completes roughly one stripe after the host finishes writing it.
+ *
+ *   buffer + 0             stripe_header (flags and guest progress)
+ *   buffer + data_offset   frame, stripe i at data_offset + i * stripe_size
+ *
+ * ready[i] holds the number (1-based) of the last frame whose stripe i is
+ * complete. The guest counts every stripe it has consumed in `consumed`; the
+ * host doesn't touch stripe i of frame n+1 until the guest has consumed all
+ * of frame n, and reads `consumed` to time first-stripe and whole-frame
+ * completion on its own clock.
+ */
+
+#ifndef FRAME_STRIPES_H
+#define FRAME_STRIPES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#define STRIPE_MAGIC 0x53545250    // "STRP"
+#define STRIPE_CACHE_LINE 64
+#define STRIPE_ALIGN 4096          // Stripes are page aligned
+#define STRIPE_MAX_STRIPES 32
+
+// Stripe counts swept by the benchmark; 1 stripe is the monolithic transfer
+static const uint32_t stripe_sweep[] = { 1, 2, 4, 8, 16, 32 };
+#define STRIPE_SWEEP_COUNT 6
+
+struct stripe_flag {
+    uint32_t frame;                // Last frame (1-based) whose stripe is written
+    uint8_t  _pad[STRIPE_CACHE_LINE - 4];
+} __attribute__((aligned(STRIPE_CACHE_LINE)));
+
+// Striped transfer control block, placed at the start of shared_data.buffer
+struct stripe_header {
+    // Geometry - written once by the host in stripe_init()
+    uint32_t magic;                // STRIPE_MAGIC once geometry is valid
+    uint32_t stripe_count;
+    uint32_t stripe_size;          // Bytes per stripe (the last one may be shorter)
+    uint32_t frame_size;
+    uint32_t data_offset;          // Frame, from the stripe header
+
+    // End of stream - host writes
+    uint32_t closed __attribute__((aligned(STRIPE_CACHE_LINE)));
+
+    // Per-stripe ready flags - host writes, guest reads
+    struct stripe_flag ready[STRIPE_MAX_STRIPES];
+
+    // Guest progress - guest writes, host reads
+    uint64_t consumed __attribute__((aligned(STRIPE_CACHE_LINE)));  // Stripes copied out so far
+    uint32_t errors;               // Stripes whose frame stamp didn't match
+};
+
+static inline uint32_t stripe_data_offset(void)
+{
+    return (uint32_t)((sizeof(struct stripe_header) + STRIPE_ALIGN - 1) & ~(size_t)(STRIPE_ALIGN - 1));
+}
+
+// Host: format the header for `stripes` stripes of a `frame_size` frame
+static inline bool stripe_init(volatile struct stripe_header *hdr, size_t avail, uint32_t frame_size,
+                               uint32_t stripes)
+{
+    if (stripes == 0 || stripes > STRIPE_MAX_STRIPES || frame_size == 0 ||
+        stripe_data_offset() + (size_t)frame_size > avail) {
+        return false;
+    }
+
+    uint32_t stripe_size = (frame_size + stripes - 1) / stripes;
+    stripe_size = (stripe_size + STRIPE_ALIGN - 1) & ~(uint32_t)(STRIPE_ALIGN - 1);
+
+    hdr->magic = 0;
+    __sync_synchronize();
+    memset((void *)hdr, 0, sizeof(struct stripe_header));
+    hdr->stripe_count = (frame_size + stripe_size - 1) / stripe_size;
+    hdr->stripe_size = stripe_size;
+    hdr->frame_size = frame_size;
+    hdr->data_offset = stripe_data_offset();
+
+    // Publish geometry last so the guest never attaches to a half-built header
+    __atomic_store_n(&hdr->magic, STRIPE_MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Guest: validate a header formatted by the host. Every stripe must start
+// inside the frame, or stripe_length() underflows and stripe copies run past it.
+static inline bool stripe_attach(volatile struct stripe_header *hdr, size_t avail)
+{
+    return __atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) == STRIPE_MAGIC &&
+           hdr->stripe_count > 0 && hdr->stripe_count <= STRIPE_MAX_STRIPES &&
+           hdr->stripe_size > 0 &&
+           (uint64_t)(hdr->stripe_count - 1) * hdr->stripe_size < hdr->frame_size &&
+           (size_t)hdr->data_offset + hdr->frame_size <= avail;
+}
+
+static inline uint8_t *stripe_data(volatile struct stripe_header *hdr, uint32_t stripe)
+{
+    return (uint8_t *)hdr + hdr->data_offset + (size_t)stripe * hdr->stripe_size;
+}
+
+static inline uint32_t stripe_length(volatile struct stripe_header *hdr, uint32_t stripe)
+{
+    uint32_t start = stripe * hdr->stripe_size;
+    uint32_t left = hdr->frame_size - start;
+    return left < hdr->stripe_size ? left : hdr->stripe_size;
+}
+
+// Host: stripe `stripe` of frame `frame` (1-based) is written
+static inline void stripe_publish(volatile struct stripe_header *hdr, uint32_t stripe, uint32_t frame)
+{
+    // Release: the stripe's bytes are visible before its flag
+    __atomic_store_n(&hdr->ready[stripe].frame, frame, __ATOMIC_RELEASE);
+}
+
+// Guest: true once stripe `stripe` of frame `frame` may be read
+static inline bool stripe_ready(volatile struct stripe_header *hdr, uint32_t stripe, uint32_t frame)
+{
+    return __atomic_load_n(&hdr->ready[stripe].frame, __ATOMIC_ACQUIRE) == frame;
+}
+
+// Guest: one more stripe copied out. Release: our reads finish before the host rewrites it.
+static inline void stripe_consumed(volatile struct stripe_header *hdr, uint64_t total)
+{
+    __atomic_store_n(&hdr->consumed, total, __ATOMIC_RELEASE);
+}
+
+// Host: stripes the guest has consumed so far
+static inline uint64_t stripe_progress(volatile struct stripe_header *hdr)
+{
+    return __atomic_load_n(&hdr->consumed, __ATOMIC_ACQUIRE);
+}
+
+static inline void stripe_close(volatile struct stripe_header *hdr)
+{
+    __atomic_store_n(&hdr->closed, 1, __ATOMIC_RELEASE);
+}
+
+static inline bool stripe_closed(volatile struct stripe_header *hdr)
+{
+    return __atomic_load_n(&hdr->closed, __ATOMIC_ACQUIRE) != 0;
+}
+
+#endif // FRAME_STRIPES_H
@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -22,19 +23,51 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <ctype.h>
+#include <pthread.h>
 
 #include "common.h"
+#include "timing.h"
 #include "performance_counters.h"
+#include "ring_buffer.h"
+#include "broadcast_ring.h"
+#include "duplex.h"
+#include "frame_pipeline.h"
+#include "mailbox.h"
+#include "message_queue.h"
+#include "channel_directory.h"
+#include "region_alloc.h"
+#include "frame_kernels.h"
+#include "frame_stripes.h"
+#include "doorbell.h"
+#include "wait_policy.h"
+#include "clock_sync.h"
+#include "parallel_copy.h"
+#include "integrity.h"
+#include "hugepages.h"
+#include "numa.h"
 
-#define PCI_RESOURCE_PATH "/sys/bus/pci/devices/0000:00:03.0/resource2"
+#define PCI_DEVICE_PATH "/sys/bus/pci/devices/0000:00:03.0"
+#define PCI_RESOURCE_PATH PCI_DEVICE_PATH "/resource2"
 #define SHMEM_PATH "/dev/shm/ivshmem"
 
-static inline uint64_t get_time_ns(void)
-{
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
-}
+// Polling strategy for every wait loop (selected with -w/--wait)
+static struct wait_policy guest_wait;
+
+// Mapped --shm instead of the PCI BAR: host and guest share host pages, so futex waits work
+static bool guest_local_shm = false;
+
+// Doorbell to the host (--doorbell): eventfds from an ivshmem-server, or the device's BAR0 + UIO in the VM
+static struct doorbell guest_doorbell;
+
+// Worker pool that stripes the Phase C copy across --copy-threads threads
+static struct copy_pool guest_pool;
+
+// Production receive path: one fused copy+digest pass instead of Phases A-E (--production)
+static bool guest_production = false;
+
+// Page kind for local buffers (--pages); downgraded to thp if the hugetlb pool runs dry
+static page_kind_t guest_pages = PAGES_4K;
+static uint32_t guest_shm_kb;
 
 // Debug logging helper
 static void debug_log(const char *format, ...)
@@ -56,6 +89,12 @@ static void set_guest_state(volatile struct shared_data *shm, guest_state_t new_
         printf("GUEST STATE: %s -> %s\n", guest_state_name(old_state), guest_state_name(new_state));
         shm->guest_state = (uint32_t)new_state;
         __sync_synchronize();
+        if (guest_local_shm) {
+            wait_notify(&shm->guest_wake);
+        }
+        if (guest_doorbell.kind != DOORBELL_NONE && shm->magic == MAGIC && shm->host_doorbell_peer != DOORBELL_NO_PEER) {
+            doorbell_ring(&guest_doorbell, shm->host_doorbell_peer, 0);
+        }
     }
 }
 
@@ -69,25 +108,20 @@ static host_state_t get_host_state(volatile struct shared_data *shm)
     return (host_state_t)shm->host_state;
 }
 
-// Verify data integrity using SHA256
-static bool verify_data_integrity(const uint8_t *data, uint32_t size, const uint8_t *expected_hash)
+// Verify data integrity with the digest algorithm the host tagged the frame with
+static bool verify_data_integrity(digest_algo_t algo, const uint8_t *data, uint32_t size, const uint8_t *expected_hash)
 {
-    uint8_t calculated_hash[32];
-    SHA256_CTX ctx;
-    SHA256_Init(&ctx);
-    SHA256_Update(&ctx, data, size);
-    SHA256_Final(calculated_hash, &ctx);
-    
-    return memcmp(calculated_hash, expected_hash, 32) == 0;
+    return digest_verify(algo, data, size, expected_hash);
 }
 
 // Print hash comparison for debugging
-static void print_hash_comparison(const uint8_t *expected, const uint8_t *calculated)
+static void print_hash_comparison(digest_algo_t algo, const uint8_t *expected, const uint8_t *calculated)
 {
+    int len = (int)digest_size(algo);
     printf("  Expected: ");
-    for (int i = 0; i < 32; i++) printf("%02x", expected[i]);
+    for (int i = 0; i < len; i++) printf("%02x", expected[i]);
     printf("\n  Got:      ");
-    for (int i = 0; i < 32; i++) printf("%02x", calculated[i]);
+    for (int i = 0; i < len; i++) printf("%02x", calculated[i]);
     printf("\n");
 }
 
@@ -104,6 +138,12 @@ static void flush_cache_range(void *addr, size_t len) {
     #endif
 }
 
+// memcpy with the pool's copy signature
+static void guest_memcpy(void *dst, const void *src, size_t size)
+{
+    memcpy(dst, src, size);
+}
+
 // Force read of buffer
 static void force_buffer_read(const uint8_t *data, uint32_t size)
 {
@@ -121,24 +161,45 @@ static void print_usage(const char *program_name)
     printf("Options:\n");
     printf("  -l, --latency [COUNT]     Expect latency test (default: 100 messages)\n");
     printf("  -b, --bandwidth [COUNT]   Expect bandwidth test (default: 10 iterations)\n");
+    printf("  -r, --ring [COUNT]        Expect ring buffer streaming test (default: 100 frames)\n");
+    printf("  -F, --fanout              Expect fan-out stream as one of several readers (runs until the host closes it)\n");
+    printf("  -p, --pipeline            Expect pipelined frame stream (runs until the host closes it)\n");
+    printf("  -m, --message-rate [N]    Expect small-message sweep, N messages per size (default: 10000)\n");
+    printf("  -B, --batch               Expect batched message queue (runs until the host closes it)\n");
+    printf("  -D, --duplex              Expect full duplex test: consume host->guest, produce guest->host\n");
+    printf("  -C, --channels            Expect channel directory: serve every channel the host lists (until closed)\n");
+    printf("  -A, --alloc               Expect region allocator stream: read blocks in place and free them\n");
+    printf("  -Z, --zero-copy           Expect zero-copy test: run kernels on copied and on leased frames\n");
+    printf("  -S, --stripes             Expect striped transfer test: copy each stripe out as soon as it's ready\n");
+    printf("  -M, --mailbox             Expect mailbox stream: newest frame only (runs until the host closes it)\n");
+    printf("      --fps N               Mailbox: take at most N frames/s like a display refresh (default: 0 = unpaced)\n");
     printf("  -c, --count COUNT         Number of messages/iterations to expect\n");
+    printf("  -w, --wait POLICY         Polling strategy: spin, yield, backoff, usleep, doorbell, futex,\n"
+           "                            pause, umwait (default: backoff)\n");
+    printf("                            (futex: only on the host-local --shm region, not through the PCI device)\n");
+    printf("      --doorbell SOCKET|uio Ring the host on every state change: join the ivshmem-server at SOCKET\n");
+    printf("                            (loopback), or use the ivshmem-doorbell device through uio_pci_generic (VM)\n");
+    printf("  -W, --wakeup              Expect wake-up test: echo pings with each wait policy the host picks\n");
+    printf("  -T, --clock-sync          Answer clock sync probes from a thread: alone for host -T, or with -m\n");
+    printf("                            for a one-way latency mapped across the two clocks\n");
+    printf("      --wait-spins N        Pause iterations before yield/backoff kicks in (default: %d)\n", WAIT_DEFAULT_SPIN_LIMIT);
+    printf("      --pause-count N       Pause hints per re-check for pause/umwait (default: %d)\n", WAIT_DEFAULT_PAUSE_COUNT);
+    printf("      --copy-threads N      Threads striping the Phase C copy (default: 1)\n");
+    printf("      --production          Receive with one fused copy+digest pass (no Phase A-E breakdown)\n");
+    printf("      --pages KIND          Local buffer pages: 4k, thp, hugetlb (default: 4k)\n");
+    printf("      --shm PATH            Shared memory file when no ivshmem device is present (default: %s)\n", SHMEM_PATH);
+    printf("      --numa-node N         Run on node N's CPUs and first-touch local buffers there (vNUMA guests)\n");
+    printf("      --cpu N               Pin the reader thread to CPU N\n");
+    printf("  -s, --copy-scaling [ITER] Sweep copy threads 1..N reading the region, no host needed (default: 20)\n");
     printf("  -h, --help               Show this help\n");
     printf("\n");
 }
 
-void monitor_latency(volatile struct shared_data *shm, bool expect_latency, bool expect_bandwidth, int expected_count)
+// Run the initialization handshake: wait until the host has published MAGIC and is READY
+static void wait_for_host_init(volatile struct shared_data *shm)
 {
-    printf("Guest Reader - Monitoring for messages from host...\n");
-    printf("Expected: %s%s%s (count: %d)\n", 
-           expect_latency ? "latency " : "",
-           (expect_latency && expect_bandwidth) ? "+ " : "",
-           expect_bandwidth ? "bandwidth" : "",
-           expected_count);
-    printf("Will measure: memcpy from shared memory to local buffer (actual transmission)\n");
-    printf("Plus SHA256 verification time (testing only, not real overhead)\n\n");
-    fflush(stdout);
-    
-    int message_count = 0;
+    // Report our layout first so the host can refuse a mismatch
+    shm->guest_layout_version = SHM_LAYOUT_VERSION;
     
     // STATE: GUEST_STATE_UNINITIALIZED -> GUEST_STATE_WAITING_HOST_INIT
     set_guest_state(shm, GUEST_STATE_WAITING_HOST_INIT);
@@ -156,6 +217,16 @@ void monitor_latency(volatile struct shared_data *shm, bool expect_latency, bool
     bool host_ready = false;
     
     while (!host_ready && init_timeout < 5000) {
+        if (shm->magic == MAGIC_V1) {
+            printf("GUEST: ERROR - Host uses shared memory layout v1, this guest needs v%d (rebuild host_writer)\n",
+                   SHM_LAYOUT_VERSION);
+            exit(1);
+        }
+        if (shm->magic == MAGIC && shm->layout_version != SHM_LAYOUT_VERSION) {
+            printf("GUEST: ERROR - Host uses shared memory layout v%u, this guest needs v%d\n",
+                   shm->layout_version, SHM_LAYOUT_VERSION);
+            exit(1);
+        }
         if (shm->magic == MAGIC && get_host_state(shm) == HOST_STATE_READY) {
             host_ready = true;
             break;
@@ -178,13 +249,68 @@ void monitor_latency(volatile struct shared_data *shm, bool expect_latency, bool
     
     printf("GUEST: ✓ Host initialization complete - ready for messages.\n\n");
     
+    // Report our polling strategy so the host can record it alongside results
+    shm->guest_wait_policy = (uint32_t)guest_wait.kind;
+    shm->guest_copy_threads = (uint32_t)guest_pool.threads;
+    shm->guest_local_pages = (uint32_t)guest_pages;
+    shm->guest_shm_page_kb = guest_shm_kb;
+    
     // STATE: GUEST_STATE_WAITING_HOST_INIT -> GUEST_STATE_READY
     set_guest_state(shm, GUEST_STATE_READY);
+}
+
+// Allocate a local buffer with --pages and keep the reported page kind current
+static uint8_t *guest_buffer_alloc(volatile struct shared_data *shm, size_t size)
+{
+    uint8_t *ptr = page_alloc(size, &guest_pages);
+    shm->guest_local_pages = (uint32_t)guest_pages;
+    return ptr;
+}
+
+// Write performance metrics (convert floating point to fixed-point for shared memory)
+static void publish_guest_perf(volatile struct shared_data *shm, const struct perf_results *results)
+{
+    shm->timing.guest_perf.l1_cache_misses = results->l1_cache_misses;
+    shm->timing.guest_perf.l1_cache_references = results->l1_cache_references;
+    shm->timing.guest_perf.llc_misses = results->llc_misses;
+    shm->timing.guest_perf.llc_references = results->llc_references;
+    shm->timing.guest_perf.memory_loads = results->memory_loads;
+    shm->timing.guest_perf.memory_stores = results->memory_stores;
+    shm->timing.guest_perf.tlb_misses = results->tlb_misses;
+    shm->timing.guest_perf.cpu_cycles = results->cpu_cycles;
+    shm->timing.guest_perf.instructions = results->instructions;
+    shm->timing.guest_perf.context_switches = results->context_switches;
+    
+    // Convert rates to fixed-point integers (multiply by 10000)
+    shm->timing.guest_perf.l1_cache_miss_rate_x10000 = (uint32_t)(results->l1_cache_miss_rate * 10000.0);
+    shm->timing.guest_perf.llc_cache_miss_rate_x10000 = (uint32_t)(results->llc_cache_miss_rate * 10000.0);
+    shm->timing.guest_perf.instructions_per_cycle_x10000 = (uint32_t)(results->instructions_per_cycle * 10000.0);
+    shm->timing.guest_perf.cycles_per_byte_x10000 = (uint32_t)(results->cycles_per_byte * 10000.0);
+    shm->timing.guest_perf.tlb_miss_rate_x10000 = (uint32_t)(results->tlb_miss_rate * 10000.0);
+}
+
+void monitor_latency(volatile struct shared_data *shm, bool expect_latency, bool expect_bandwidth, int expected_count)
+{
+    printf("Guest Reader - Monitoring for messages from host...\n");
+    printf("Expected: %s%s%s (count: %d)\n", 
+           expect_latency ? "latency " : "",
+           (expect_latency && expect_bandwidth) ? "+ " : "",
+           expect_bandwidth ? "bandwidth" : "",
+           expected_count);
+    printf("Will measure: memcpy from shared memory to local buffer (actual transmission)\n");
+    printf("Plus digest verification time (algorithm chosen by the host with --verify)\n");
+    printf("Plus a fused single-pass copy+digest (Phase E, or the whole receive with --production)\n\n");
+    fflush(stdout);
+    
+    int message_count = 0;
+    struct wait_state ws;
+    
+    wait_for_host_init(shm);
     
     // Allocate local buffer for memcpy (reuse for all messages)
     // Max size for 4K frame
     size_t max_buffer_size = 3840 * 2160 * 3;
-    uint8_t *local_buffer = malloc(max_buffer_size);
+    uint8_t *local_buffer = guest_buffer_alloc(shm, max_buffer_size);
     if (!local_buffer) {
         printf("GUEST: ERROR - Failed to allocate local buffer\n");
         exit(1);
@@ -207,8 +333,9 @@ void monitor_latency(volatile struct shared_data *shm, bool expect_latency, bool
         }
         
         // Wait for host to start sending (HOST_STATE_SENDING)
+        wait_begin(&ws);
         while (get_host_state(shm) != HOST_STATE_SENDING && shm->test_complete == 0) {
-            usleep(10);
+            wait_step(&guest_wait, &ws);
         }
         
         if (shm->test_complete == 1) {
@@ -226,8 +353,9 @@ void monitor_latency(volatile struct shared_data *shm, bool expect_latency, bool
         uint32_t sequence = shm->sequence;
         uint32_t data_size = shm->data_size;
         
-        uint8_t expected_hash[32];
-        memcpy(expected_hash, (const void *)shm->data_sha256, 32);
+        digest_algo_t digest_algo = (digest_algo_t)shm->digest_algo;
+        uint8_t expected_hash[DIGEST_MAX_SIZE];
+        memcpy(expected_hash, (const void *)shm->data_digest, DIGEST_MAX_SIZE);
         
         message_count++;
         
@@ -243,8 +371,47 @@ void monitor_latency(volatile struct shared_data *shm, bool expect_latency, bool
         // Get data pointer from shared memory
         uint8_t *data_ptr = (uint8_t *)&shm->buffer[0];
         
+        if (guest_production) {
+            // PRODUCTION: one fused copy+digest pass - every byte of the BAR is read exactly once
+            struct perf_results production_perf = {0};
+            if (perf_available) {
+                perf_counters_start(&perf_counters);
+            }
+            
+            uint64_t fused_start = get_time_ns();
+            bool fused_match = digest_copy_verify(digest_algo, local_buffer, data_ptr, data_size, expected_hash);
+            uint64_t fused_duration = get_time_ns() - fused_start;
+            
+            if (perf_available) {
+                perf_counters_stop(&perf_counters, &production_perf, data_size);
+            }
+            
+            // Copy and verify are one pass: report it as the copy, verify as zero
+            shm->timing.guest_copy_duration = fused_duration;
+            shm->timing.guest_verify_duration = 0;
+            shm->timing.guest_total_duration = get_time_ns() - processing_start;
+            shm->timing.guest_hot_cache_duration = 0;
+            shm->timing.guest_cold_cache_duration = 0;
+            shm->timing.guest_second_pass_duration = 0;
+            shm->timing.guest_cached_verify_duration = 0;
+            shm->timing.guest_fused_duration = fused_duration;
+            publish_guest_perf(shm, &production_perf);
+            __sync_synchronize();
+            
+            printf("  Fused copy+%s: %lu ns (%.2f µs) [%6.0f MB/s] - single pass over shared memory\n",
+                   digest_name(digest_algo), fused_duration, fused_duration / 1000.0,
+                   (data_size / (1024.0 * 1024.0)) / (fused_duration / 1e9));
+            
+            if (!fused_match) {
+                printf("✗ Data integrity check FAILED: %s mismatch\n", digest_name(digest_algo));
+                success = false;
+                error_code = 1;
+            }
+            goto cleanup_and_continue;
+        }
+        
         // Pre-allocate measurement buffer (reuse for consistent measurements)
-        measurement_buffer = malloc(data_size);
+        measurement_buffer = guest_buffer_alloc(shm, data_size);
         if (!measurement_buffer) {
             printf("Error: Failed to allocate measurement buffer\n");
             success = false;
@@ -304,7 +471,7 @@ void monitor_latency(volatile struct shared_data *shm, bool expect_latency, bool
         
         uint64_t memcpy_start = get_time_ns();
         
-        memcpy(measurement_buffer, data_ptr, data_size);
+        copy_pool_run(&guest_pool, measurement_buffer, data_ptr, data_size);
         __sync_synchronize(); // Ensure memcpy completes
         
         uint64_t memcpy_end = get_time_ns();
@@ -318,14 +485,24 @@ void monitor_latency(volatile struct shared_data *shm, bool expect_latency, bool
         // Copy final data to local buffer for verification (using the memcpy result)
         memcpy(local_buffer, measurement_buffer, data_size);
         
-        // PHASE D: SHA256 INTEGRITY CHECK - SHA256 with data in local cache
+        // PHASE D: INTEGRITY CHECK - digest (host-selected algorithm) with data in local cache
         uint64_t verify_start = get_time_ns();
         
-        bool hash_match = verify_data_integrity(local_buffer, data_size, expected_hash);
+        bool hash_match = verify_data_integrity(digest_algo, local_buffer, data_size, expected_hash);
         
         uint64_t verify_end = get_time_ns();
         uint64_t cached_verify_duration = verify_end - verify_start;
         
+        // PHASE E: FUSED COPY + DIGEST (COLD CACHE) - the production receive path, one read of the BAR
+        flush_cache_range(data_ptr, data_size);
+        
+        uint64_t fused_start = get_time_ns();
+        
+        bool fused_match = digest_copy_verify(digest_algo, measurement_buffer, data_ptr, data_size, expected_hash);
+        
+        uint64_t fused_end = get_time_ns();
+        uint64_t fused_duration = fused_end - fused_start;
+        
         // Calculate legacy timing for backward compatibility
         uint64_t memcpy_duration = second_pass_duration; // Use memcpy (read+write) measurement
         uint64_t verify_duration = cached_verify_duration;
@@ -345,25 +522,9 @@ void monitor_latency(volatile struct shared_data *shm, bool expect_latency, bool
         shm->timing.guest_cold_cache_duration = cold_cache_duration;
         shm->timing.guest_second_pass_duration = second_pass_duration;
         shm->timing.guest_cached_verify_duration = cached_verify_duration;
+        shm->timing.guest_fused_duration = fused_duration;
         
-        // Write performance metrics (convert floating point to fixed-point for shared memory)
-        shm->timing.guest_perf.l1_cache_misses = guest_perf_results.l1_cache_misses;
-        shm->timing.guest_perf.l1_cache_references = guest_perf_results.l1_cache_references;
-        shm->timing.guest_perf.llc_misses = guest_perf_results.llc_misses;
-        shm->timing.guest_perf.llc_references = guest_perf_results.llc_references;
-        shm->timing.guest_perf.memory_loads = guest_perf_results.memory_loads;
-        shm->timing.guest_perf.memory_stores = guest_perf_results.memory_stores;
-        shm->timing.guest_perf.tlb_misses = guest_perf_results.tlb_misses;
-        shm->timing.guest_perf.cpu_cycles = guest_perf_results.cpu_cycles;
-        shm->timing.guest_perf.instructions = guest_perf_results.instructions;
-        shm->timing.guest_perf.context_switches = guest_perf_results.context_switches;
-        
-        // Convert rates to fixed-point integers (multiply by 10000)
-        shm->timing.guest_perf.l1_cache_miss_rate_x10000 = (uint32_t)(guest_perf_results.l1_cache_miss_rate * 10000.0);
-        shm->timing.guest_perf.llc_cache_miss_rate_x10000 = (uint32_t)(guest_perf_results.llc_cache_miss_rate * 10000.0);
-        shm->timing.guest_perf.instructions_per_cycle_x10000 = (uint32_t)(guest_perf_results.instructions_per_cycle * 10000.0);
-        shm->timing.guest_perf.cycles_per_byte_x10000 = (uint32_t)(guest_perf_results.cycles_per_byte * 10000.0);
-        shm->timing.guest_perf.tlb_miss_rate_x10000 = (uint32_t)(guest_perf_results.tlb_miss_rate * 10000.0);
+        publish_guest_perf(shm, &guest_perf_results);
         
         __sync_synchronize();
         
@@ -378,8 +539,12 @@ void monitor_latency(volatile struct shared_data *shm, bool expect_latency, bool
         printf("  Phase C (Read+Write):      %lu ns (%.2f µs) [%6.0f MB/s] - memcpy (read+write)\n", 
                second_pass_duration, second_pass_duration / 1000.0, 
                (data_size / (1024.0 * 1024.0)) / (second_pass_duration / 1e9));
-        printf("  Phase D (SHA256 Verify):   %lu ns (%.2f µs) [testing only] - Integrity check\n", 
-               cached_verify_duration, cached_verify_duration / 1000.0);
+        printf("  Phase D (%-6s Verify):   %lu ns (%.2f µs) [%6.0f MB/s] - Integrity check\n", 
+               digest_name(digest_algo), cached_verify_duration, cached_verify_duration / 1000.0,
+               (data_size / (1024.0 * 1024.0)) / (cached_verify_duration / 1e9));
+        printf("  Phase E (Fused Copy+%-6s): %lu ns (%.2f µs) [%6.0f MB/s] - Single pass (cold cache)\n",
+               digest_name(digest_algo), fused_duration, fused_duration / 1000.0,
+               (data_size / (1024.0 * 1024.0)) / (fused_duration / 1e9));
         
         if (perf_available) {
             printf("    Performance (2 reads + 1 memcpy):  L1 cache %.1f%% miss, LLC cache %.1f%% miss, TLB %.3f%% miss\n",
@@ -404,19 +569,26 @@ void monitor_latency(volatile struct shared_data *shm, bool expect_latency, bool
         printf("  Legacy memcpy:         %lu ns (%.2f µs) [%6.0f MB/s] (Phase C)\n", 
                memcpy_duration, memcpy_duration / 1000.0, 
                (data_size / (1024.0 * 1024.0)) / (memcpy_duration / 1e9));
+        printf("  Fused saving (C+D-E):  %+ld ns (%+.2f µs)\n",
+               (int64_t)(second_pass_duration + cached_verify_duration - fused_duration),
+               ((int64_t)(second_pass_duration + cached_verify_duration - fused_duration)) / 1000.0);
         printf("  Total:                 %lu ns (%.2f µs)\n", 
                total_duration, total_duration / 1000.0);
         
-        if (hash_match) {
-            printf("✓ Data integrity verified: SHA256 match\n");
+        if (digest_algo == DIGEST_NONE) {
+            printf("⚠ Data integrity not checked (host sent --verify none)\n");
+        } else if (hash_match) {
+            printf("✓ Data integrity verified: %s match\n", digest_name(digest_algo));
         } else {
-            printf("✗ Data integrity check FAILED: SHA256 mismatch\n");
-            uint8_t calculated_hash[32];
-            SHA256_CTX ctx;
-            SHA256_Init(&ctx);
-            SHA256_Update(&ctx, local_buffer, data_size);
-            SHA256_Final(calculated_hash, &ctx);
-            print_hash_comparison(expected_hash, calculated_hash);
+            printf("✗ Data integrity check FAILED: %s mismatch\n", digest_name(digest_algo));
+            uint8_t calculated_hash[DIGEST_MAX_SIZE];
+            digest_compute(digest_algo, local_buffer, data_size, calculated_hash);
+            print_hash_comparison(digest_algo, expected_hash, calculated_hash);
+            success = false;
+            error_code = 1;
+        }
+        if (hash_match && !fused_match) {
+            printf("✗ Fused copy+%s check FAILED (Phase D passed)\n", digest_name(digest_algo));
             success = false;
             error_code = 1;
         }
@@ -426,7 +598,7 @@ void monitor_latency(volatile struct shared_data *shm, bool expect_latency, bool
 cleanup_and_continue:
         // Cleanup measurement buffer
         if (measurement_buffer) {
-            free(measurement_buffer);
+            page_free(measurement_buffer, data_size, guest_pages);
             measurement_buffer = NULL;
         }
         
@@ -439,8 +611,9 @@ cleanup_and_continue:
         set_guest_state(shm, GUEST_STATE_ACKNOWLEDGED);
         
         // Wait for host to finish with this message
+        wait_begin(&ws);
         while (get_host_state(shm) != HOST_STATE_READY && shm->test_complete == 0) {
-            usleep(10);
+            wait_step(&guest_wait, &ws);
         }
         
         // STATE: GUEST_STATE_ACKNOWLEDGED -> GUEST_STATE_READY
@@ -450,147 +623,2205 @@ cleanup_and_continue:
     printf("Guest monitoring loop ended after %d messages\n", message_count);
     
     // Cleanup
-    free(local_buffer);
+    page_free(local_buffer, max_buffer_size, guest_pages);
     
     if (perf_available) {
         perf_counters_cleanup(&perf_counters);
     }
 }
 
-int main(int argc, char *argv[])
+void monitor_ring(volatile struct shared_data *shm, size_t shm_size, int expected_count)
 {
-    printf("Guest Reader - ivshmem Performance Test with Timing Analysis\n");
-    printf("============================================================\n\n");
+    printf("Guest Reader - Ring buffer streaming consumer\n");
+    printf("Expected: %d frames through the slot ring\n", expected_count);
+    printf("Will measure: memcpy out of each ring slot into a local buffer\n");
+    printf("Digest is checked on the first and last frame only (sequence checked on all)\n\n");
+    fflush(stdout);
     
-    // Parse command line arguments
-    bool expect_latency = false;
-    bool expect_bandwidth = false;
-    int latency_count = 1000;
-    int bandwidth_count = 10;
-    int custom_count = -1;
+    struct wait_state ws;
+    wait_for_host_init(shm);
     
-    for (int i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
-            print_usage(argv[0]);
-            return 0;
-        } else if (strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "--latency") == 0) {
-            expect_latency = true;
-            if (i + 1 < argc && isdigit(argv[i + 1][0])) {
-                latency_count = atoi(argv[++i]);
-            }
-        } else if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--bandwidth") == 0) {
-            expect_bandwidth = true;
-            if (i + 1 < argc && isdigit(argv[i + 1][0])) {
-                bandwidth_count = atoi(argv[++i]);
-            }
-        } else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--count") == 0) {
-            if (i + 1 < argc) {
-                custom_count = atoi(argv[++i]);
-            } else {
-                fprintf(stderr, "Error: -c requires a count argument\n");
-                return 1;
+    // Wait for the host to format the ring (HOST_STATE_SENDING)
+    wait_begin(&ws);
+    while (get_host_state(shm) != HOST_STATE_SENDING && shm->test_complete == 0) {
+        wait_step(&guest_wait, &ws);
+    }
+    
+    if (shm->test_complete == 1) {
+        printf("Test completion signal received before the stream started. Exiting...\n");
+        return;
+    }
+    
+    size_t avail = shm_size - offsetof(struct shared_data, buffer);
+    struct ring ring;
+    if (!ring_attach(&ring, (void *)&shm->buffer[0], avail)) {
+        printf("GUEST: ERROR - No valid ring in shared memory (is the host running with -r?)\n");
+        shm->error_code = 3;
+        __sync_synchronize();
+        set_guest_state(shm, GUEST_STATE_ACKNOWLEDGED);
+        return;
+    }
+    
+    printf("GUEST: ✓ Attached to ring: %u slots x %u bytes (%.2f MB)\n\n",
+           ring.slot_count, ring.slot_size, ring.slot_size / (1024.0 * 1024.0));
+    
+    uint8_t *local_buffer = guest_buffer_alloc(shm, ring.slot_size);
+    if (!local_buffer) {
+        printf("GUEST: ERROR - Failed to allocate local buffer\n");
+        exit(1);
+    }
+    
+    // STATE: GUEST_STATE_READY -> GUEST_STATE_PROCESSING (attached, consuming)
+    set_guest_state(shm, GUEST_STATE_PROCESSING);
+    
+    uint64_t total_copy = 0, total_stall = 0, total_verify = 0;
+    uint32_t error_code = 0;
+    int consumed = 0;
+    uint32_t last_size = 0;
+    
+    uint64_t stream_start = get_time_ns();
+    
+    while (consumed < expected_count) {
+        // Wait for the host to publish a slot
+        uint64_t stall_start = get_time_ns();
+        wait_begin(&ws);
+        while (!ring_has_data(&ring) && shm->test_complete == 0) {
+            wait_step(&guest_wait, &ws);
+        }
+        
+        if (shm->test_complete == 1 && !ring_has_data(&ring)) {
+            printf("Test completion signal received during stream. Exiting...\n");
+            break;
+        }
+        
+        uint64_t copy_start = get_time_ns();
+        
+        uint32_t size = 0, sequence = 0;
+        uint8_t expected_hash[DIGEST_MAX_SIZE];
+        if (!ring_try_pop(&ring, local_buffer, ring.slot_size, &size, &sequence, expected_hash)) {
+            printf("GUEST: ERROR - Slot descriptor claims more than a slot, frame dropped\n");
+            error_code = 2;
+            break;
+        }
+        
+        uint64_t copy_end = get_time_ns();
+        
+        total_stall += copy_start - stall_start;
+        total_copy += copy_end - copy_start;
+        last_size = size;
+        
+        if (sequence != (uint32_t)consumed) {
+            printf("GUEST: ERROR - Out of order frame: got sequence %u, expected %d\n", sequence, consumed);
+            error_code = 4;
+        }
+        
+        // Sample integrity on the first and last frame
+        if (consumed == 0 || consumed == expected_count - 1) {
+            uint64_t verify_start = get_time_ns();
+            bool hash_match = verify_data_integrity((digest_algo_t)shm->digest_algo, local_buffer, size, expected_hash);
+            total_verify += get_time_ns() - verify_start;
+            
+            if (!hash_match) {
+                printf("✗ Data integrity check FAILED on frame %u\n", sequence);
+                error_code = 1;
             }
-        } else {
-            fprintf(stderr, "Unknown argument: %s\n", argv[i]);
-            print_usage(argv[0]);
-            return 1;
+        }
+        
+        consumed++;
+        
+        if (expected_count <= 10 || consumed % 100 == 0) {
+            printf("  [%u] copy %.2f µs [%.0f MB/s]\n", sequence,
+                   (copy_end - copy_start) / 1000.0,
+                   (size / (1024.0 * 1024.0)) / ((copy_end - copy_start) / 1e9));
         }
     }
     
-    if (!expect_latency && !expect_bandwidth) {
-        expect_latency = true;
-        expect_bandwidth = true;
+    uint64_t stream_end = get_time_ns();
+    
+    // WRITE DURATIONS to shared memory for host to read (totals over the stream)
+    shm->timing.guest_copy_duration = total_copy;
+    shm->timing.guest_verify_duration = total_verify;
+    shm->timing.guest_total_duration = stream_end - stream_start;
+    if (error_code != 0) {
+        shm->error_code = error_code;
     }
+    __sync_synchronize();
     
-    int expected_count;
-    if (custom_count > 0) {
-        expected_count = custom_count;
-    } else if (expect_latency && expect_bandwidth) {
-        expected_count = latency_count + bandwidth_count;
-    } else if (expect_latency) {
-        expected_count = latency_count;
-    } else {
-        expected_count = bandwidth_count;
+    if (consumed > 0) {
+        double size_mb = last_size / (1024.0 * 1024.0);
+        double stream_s = (stream_end - stream_start) / 1e9;
+        printf("\n=== Guest Ring Results ===\n");
+        printf("Frames consumed:    %d/%d\n", consumed, expected_count);
+        printf("Guest copy (avg):   %.2f µs [%.0f MB/s]\n",
+               (total_copy / consumed) / 1000.0, size_mb / ((total_copy / consumed) / 1e9));
+        printf("Guest stall (avg):  %.2f µs - waiting for the host to publish\n",
+               (total_stall / consumed) / 1000.0);
+        printf("Stream throughput:  %.1f frames/s, %.0f MB/s (guest clock)\n",
+               consumed / stream_s, consumed * size_mb / stream_s);
+        printf("%s\n\n", error_code == 0 ? "✓ Sequence and sampled digest checks passed" : "✗ Stream had errors");
     }
     
-    printf("Configuration:\n");
-    printf("  Expect latency: %s (%d messages)\n", expect_latency ? "yes" : "no", latency_count);
-    printf("  Expect bandwidth: %s (%d iterations)\n", expect_bandwidth ? "yes" : "no", bandwidth_count);
-    printf("  Total expected messages: %d\n\n", expected_count);
+    // STATE: GUEST_STATE_PROCESSING -> GUEST_STATE_ACKNOWLEDGED
+    set_guest_state(shm, GUEST_STATE_ACKNOWLEDGED);
+    
+    // Wait for host to finish with this stream
+    wait_begin(&ws);
+    while (get_host_state(shm) != HOST_STATE_READY && shm->test_complete == 0) {
+        wait_step(&guest_wait, &ws);
+    }
+    
+    // STATE: GUEST_STATE_ACKNOWLEDGED -> GUEST_STATE_READY
+    set_guest_state(shm, GUEST_STATE_READY);
+    
+    page_free(local_buffer, ring.slot_size, guest_pages);
+}
+
+// One of several readers on a broadcast ring. Guest state stays READY (the
+// single guest_state word can't describe several guests); progress, statistics
+// and completion live in this reader's line of the broadcast header.
+void monitor_fanout(volatile struct shared_data *shm, size_t shm_size)
+{
+    printf("Guest Reader - Fan-out reader\n");
+    printf("Will measure: copy out of every broadcast frame, lag behind the producer\n");
+    printf("Runs until the host closes the stream (host -F sets the frame count)\n\n");
     fflush(stdout);
     
-    // Check device
-    int fd;
-    struct stat st;
-    const char *device_path = PCI_RESOURCE_PATH;
+    struct wait_state ws;
+    wait_for_host_init(shm);
     
-    if (access(PCI_RESOURCE_PATH, F_OK) != 0) {
-        printf("INFO: PCI device not found, trying shared memory for host testing...\n");
-        device_path = SHMEM_PATH;
+    // Wait for the host to format the ring (HOST_STATE_SENDING)
+    wait_begin(&ws);
+    while (get_host_state(shm) != HOST_STATE_SENDING && shm->test_complete == 0) {
+        wait_step(&guest_wait, &ws);
+    }
+    
+    if (shm->test_complete == 1) {
+        printf("Test completion signal received before the stream started. Exiting...\n");
+        return;
+    }
+    
+    size_t avail = shm_size - offsetof(struct shared_data, buffer);
+    struct bcast bcast;
+    if (!bcast_attach(&bcast, (void *)&shm->buffer[0], avail)) {
+        printf("GUEST: ERROR - No valid broadcast ring in shared memory (is the host running with -F?)\n");
+        return;
+    }
+    
+    uint8_t *local_buffer = guest_buffer_alloc(shm, bcast.slot_size);
+    if (!local_buffer) {
+        printf("GUEST: ERROR - Failed to allocate local buffer\n");
+        exit(1);
+    }
+    
+    int reader = bcast_register(&bcast);
+    if (reader < 0) {
+        printf("GUEST: ERROR - Registration closed or all %d reader slots taken\n", BCAST_MAX_READERS);
+        page_free(local_buffer, bcast.slot_size, guest_pages);
+        return;
+    }
+    
+    printf("GUEST: ✓ Registered as reader %d on broadcast ring: %u slots x %u bytes (%.2f MB)\n\n",
+           reader, bcast.slot_count, bcast.slot_size, bcast.slot_size / (1024.0 * 1024.0));
+    
+    volatile struct bcast_reader *stats = bcast_reader_stats(&bcast, (uint32_t)reader);
+    uint32_t error_code = 0;
+    uint32_t last_size = 0;
+    
+    uint64_t stream_start = get_time_ns();
+    
+    for (;;) {
+        // Wait for the host to publish, or to close the stream
+        uint64_t stall_start = get_time_ns();
+        wait_begin(&ws);
+        while (!bcast_has_data(&bcast) && !bcast_closed(&bcast) && shm->test_complete == 0) {
+            wait_step(&guest_wait, &ws);
+        }
         
-        if (access(SHMEM_PATH, F_OK) != 0) {
-            printf("ERROR: Neither PCI device nor shared memory found\n");
-            printf("Make sure you're running this inside the VM or have shared memory set up.\n");
-            return 1;
+        // The close is published after the last frame, so look once more
+        if (!bcast_has_data(&bcast)) {
+            if (shm->test_complete == 1 && !bcast_closed(&bcast)) {
+                printf("Test completion signal received during stream. Exiting...\n");
+            }
+            break;
+        }
+        
+        uint64_t index = bcast.local_index;
+        uint64_t lag = bcast.peer_index - index;
+        volatile struct bcast_slot_desc *desc = bcast_slot_desc(&bcast, index);
+        uint32_t size = desc->data_size;
+        uint32_t sequence = desc->sequence;
+        if (size > bcast.slot_size) {
+            printf("GUEST: ERROR - Frame larger than a slot\n");
+            error_code = 2;
+            break;
+        }
+        
+        uint64_t copy_start = get_time_ns();
+        copy_pool_run(&guest_pool, local_buffer, bcast_slot_data(&bcast, index), size);
+        uint64_t copy_end = get_time_ns();
+        
+        bcast_release(&bcast);
+        
+        stats->stall_ns += copy_start - stall_start;
+        stats->copy_ns += copy_end - copy_start;
+        stats->lag_sum += lag;
+        if (lag > stats->lag_max) stats->lag_max = lag;
+        last_size = size;
+        
+        if (sequence != (uint32_t)index) {
+            printf("GUEST: ERROR - Out of order frame: got sequence %u, expected %lu\n",
+                   sequence, (unsigned long)index);
+            error_code = 4;
+        }
+        
+        // Sample integrity on the first frame (after the release, off the host's path)
+        if (index == 0) {
+            uint8_t expected_hash[DIGEST_MAX_SIZE];
+            memcpy(expected_hash, (const void *)shm->data_digest, DIGEST_MAX_SIZE);
+            if (!verify_data_integrity((digest_algo_t)shm->digest_algo, local_buffer, size, expected_hash)) {
+                printf("✗ Data integrity check FAILED on frame %u\n", sequence);
+                error_code = 1;
+            }
         }
     }
     
-    // Open resource
-    fd = open(device_path, O_RDWR | O_SYNC);
-    if (fd < 0) {
-        perror("Failed to open device resource");
-        printf("\nTry running with sudo:\n");
-        printf("  sudo %s\n", argv[0]);
-        return 1;
-    }
+    uint64_t stream_end = get_time_ns();
+    uint64_t consumed = bcast.local_index;
     
-    // Get resource size
-    if (fstat(fd, &st) < 0) {
-        perror("fstat");
-        close(fd);
-        return 1;
+    stats->error_code = error_code;
+    bcast_done(&bcast);
+    
+    if (consumed > 0) {
+        double size_mb = last_size / (1024.0 * 1024.0);
+        printf("=== Guest Fan-out Results (reader %d) ===\n", reader);
+        printf("Frames consumed:    %lu\n", (unsigned long)consumed);
+        printf("Guest copy (avg):   %.2f µs [%.0f MB/s]\n",
+               (stats->copy_ns / consumed) / 1000.0, size_mb / ((stats->copy_ns / consumed) / 1e9));
+        printf("Guest stall (avg):  %.2f µs - waiting for the host to publish\n",
+               (stats->stall_ns / consumed) / 1000.0);
+        printf("Lag (avg / max):    %.2f / %lu frames behind the producer\n",
+               (double)stats->lag_sum / consumed, (unsigned long)stats->lag_max);
+        printf("Stream throughput:  %.1f frames/s (guest clock)\n", consumed / ((stream_end - stream_start) / 1e9));
+        printf("%s\n\n", error_code == 0 ? "✓ Sequence and sampled digest checks passed" : "✗ Stream had errors");
     }
     
-    printf("Resource: %s\n", device_path);
-    printf("Resource size: %ld bytes (%ld MB)\n", 
-           st.st_size, st.st_size / (1024 * 1024));
+    page_free(local_buffer, bcast.slot_size, guest_pages);
+}
+
+void monitor_pipeline(volatile struct shared_data *shm, size_t shm_size)
+{
+    printf("Guest Reader - Pipelined frame consumer\n");
+    printf("Will measure: copy out of each guest-owned slot, then hand it back to the host\n");
+    printf("Runs until the host closes the stream (host -p sets the duration)\n");
+    printf("Digest is checked on the first and last frame only (sequence checked on all)\n\n");
     fflush(stdout);
     
-    // Map memory
-    void *ptr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, 
-                     MAP_SHARED, fd, 0);
-    if (ptr == MAP_FAILED) {
-        perror("mmap");
-        printf("\nTry running with sudo:\n");
-        printf("  sudo %s\n", argv[0]);
-        close(fd);
-        return 1;
+    struct wait_state ws;
+    wait_for_host_init(shm);
+    
+    // Wait for the host to format the pipeline (HOST_STATE_SENDING)
+    wait_begin(&ws);
+    while (get_host_state(shm) != HOST_STATE_SENDING && shm->test_complete == 0) {
+        wait_step(&guest_wait, &ws);
     }
     
-    volatile struct shared_data *shm = (volatile struct shared_data *)ptr;
+    if (shm->test_complete == 1) {
+        printf("Test completion signal received before the stream started. Exiting...\n");
+        return;
+    }
     
-    // Initialize guest state
-    set_guest_state(shm, GUEST_STATE_UNINITIALIZED);
+    size_t avail = shm_size - offsetof(struct shared_data, buffer);
+    struct pipeline pipeline;
+    if (!pipe_attach(&pipeline, (void *)&shm->buffer[0], avail)) {
+        printf("GUEST: ERROR - No valid frame pipeline in shared memory (is the host running with -p?)\n");
+        shm->error_code = 3;
+        __sync_synchronize();
+        set_guest_state(shm, GUEST_STATE_ACKNOWLEDGED);
+        return;
+    }
     
-    printf("Mapped at address: %p\n", ptr);
-    printf("Ready to receive data from host.\n\n");
-    fflush(stdout);
+    printf("GUEST: ✓ Attached to pipeline: %u slots x %u bytes (%.2f MB)\n\n",
+           pipeline.slot_count, pipeline.slot_size, pipeline.slot_size / (1024.0 * 1024.0));
     
-    printf("Initial values:\n");
-    printf("  Magic: 0x%08X\n", shm->magic);
-    printf("  Sequence: %u\n", shm->sequence);
-    printf("  Data size: %u\n", shm->data_size);
-    printf("  Error code: %u\n", shm->error_code);
-    printf("  Test complete: %u\n", shm->test_complete);
-    printf("  Host state: %u (%s)\n", shm->host_state, host_state_name((host_state_t)shm->host_state));
-    printf("  Guest state: %u (%s)\n", shm->guest_state, guest_state_name((guest_state_t)shm->guest_state));
-    printf("\n");
-    fflush(stdout);
+    uint8_t *local_buffer = guest_buffer_alloc(shm, pipeline.slot_size);
+    if (!local_buffer) {
+        printf("GUEST: ERROR - Failed to allocate local buffer\n");
+        exit(1);
+    }
     
-    // Start monitoring
-    monitor_latency(shm, expect_latency, expect_bandwidth, expected_count);
+    // STATE: GUEST_STATE_READY -> GUEST_STATE_PROCESSING (attached, consuming)
+    set_guest_state(shm, GUEST_STATE_PROCESSING);
     
-    // Cleanup
+    uint64_t total_copy = 0, total_stall = 0, total_verify = 0;
+    uint32_t error_code = 0;
+    uint32_t last_size = 0;
+    
+    uint64_t stream_start = get_time_ns();
+    
+    for (;;) {
+        uint32_t slot = pipe_slot(&pipeline);
+        
+        // Wait for the host to hand this slot over, or to close the stream
+        uint64_t stall_start = get_time_ns();
+        wait_begin(&ws);
+        while (!pipe_slot_owned(&pipeline, slot, PIPE_OWNER_GUEST) && !pipe_closed(&pipeline) &&
+               shm->test_complete == 0) {
+            wait_step(&guest_wait, &ws);
+        }
+        
+        // The close is published after the last hand-off, so re-check ownership
+        if (!pipe_slot_owned(&pipeline, slot, PIPE_OWNER_GUEST)) {
+            if (shm->test_complete == 1 && !pipe_closed(&pipeline)) {
+                printf("Test completion signal received during stream. Exiting...\n");
+            }
+            break;
+        }
+        
+        volatile struct pipe_slot_ctl *ctl = &pipeline.hdr->slots[slot];
+        uint32_t size = ctl->data_size;
+        uint32_t sequence = ctl->sequence;
+        if (size > pipeline.slot_size) {
+            printf("GUEST: ERROR - Frame larger than a slot\n");
+            error_code = 2;
+            break;
+        }
+        
+        uint64_t copy_start = get_time_ns();
+        copy_pool_run(&guest_pool, local_buffer, pipe_slot_data(&pipeline, slot), size);
+        uint64_t copy_end = get_time_ns();
+        
+        bool last = pipe_closed(&pipeline) && sequence + 1 == pipeline.hdr->frames;
+        pipe_release(&pipeline, slot);
+        
+        total_stall += copy_start - stall_start;
+        total_copy += copy_end - copy_start;
+        last_size = size;
+        
+        if (sequence != (uint32_t)(pipeline.next - 1)) {
+            printf("GUEST: ERROR - Out of order frame: got sequence %u, expected %lu\n",
+                   sequence, (unsigned long)(pipeline.next - 1));
+            error_code = 4;
+        }
+        
+        // Sample integrity on the first and last frame (after the hand-back, off the host's path)
+        if (sequence == 0 || last) {
+            uint8_t expected_hash[DIGEST_MAX_SIZE];
+            memcpy(expected_hash, (const void *)shm->data_digest, DIGEST_MAX_SIZE);
+            uint64_t verify_start = get_time_ns();
+            bool hash_match = verify_data_integrity((digest_algo_t)shm->digest_algo, local_buffer, size, expected_hash);
+            total_verify += get_time_ns() - verify_start;
+            
+            if (!hash_match) {
+                printf("✗ Data integrity check FAILED on frame %u\n", sequence);
+                error_code = 1;
+            }
+        }
+    }
+    
+    uint64_t stream_end = get_time_ns();
+    uint64_t consumed = pipeline.next;
+    
+    // WRITE DURATIONS to shared memory for host to read (totals over the stream)
+    shm->timing.guest_copy_duration = total_copy;
+    shm->timing.guest_verify_duration = total_verify;
+    shm->timing.guest_total_duration = stream_end - stream_start;
+    if (error_code != 0) {
+        shm->error_code = error_code;
+    }
+    __sync_synchronize();
+    
+    if (consumed > 0) {
+        double size_mb = last_size / (1024.0 * 1024.0);
+        double stream_s = (stream_end - stream_start) / 1e9;
+        printf("=== Guest Pipeline Results ===\n");
+        printf("Frames consumed:    %lu\n", (unsigned long)consumed);
+        printf("Guest copy (avg):   %.2f µs [%.0f MB/s]\n",
+               (total_copy / consumed) / 1000.0, size_mb / ((total_copy / consumed) / 1e9));
+        printf("Guest stall (avg):  %.2f µs - waiting for the host to hand over a slot\n",
+               (total_stall / consumed) / 1000.0);
+        printf("Stream throughput:  %.1f frames/s, %.2f GB/s (guest clock)\n",
+               consumed / stream_s, consumed * size_mb / 1024.0 / stream_s);
+        printf("%s\n\n", error_code == 0 ? "✓ Sequence and sampled digest checks passed" : "✗ Stream had errors");
+    }
+    
+    // STATE: GUEST_STATE_PROCESSING -> GUEST_STATE_ACKNOWLEDGED
+    set_guest_state(shm, GUEST_STATE_ACKNOWLEDGED);
+    
+    // Wait for host to finish with this stream
+    wait_begin(&ws);
+    while (get_host_state(shm) != HOST_STATE_READY && shm->test_complete == 0) {
+        wait_step(&guest_wait, &ws);
+    }
+    
+    // STATE: GUEST_STATE_ACKNOWLEDGED -> GUEST_STATE_READY
+    set_guest_state(shm, GUEST_STATE_READY);
+    
+    page_free(local_buffer, pipeline.slot_size, guest_pages);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Latest-frame-wins consumer. With `display_hz` > 0 the guest takes at most one
+// frame per refresh, like a compositor; everything published in between is dropped.
+void monitor_mailbox(volatile struct shared_data *shm, size_t shm_size, int display_hz)
+{
+    printf("Guest Reader - Mailbox (latest frame wins) consumer\n");
+    printf("Will measure: age of each frame when its copy into a local buffer completes\n");
+    printf("Runs until the host closes the stream (host -m sets the duration)\n");
+    printf("Digest is checked on the first and last frame only\n\n");
+    fflush(stdout);
+    
+    struct wait_state ws;
+    wait_for_host_init(shm);
+    
+    // Wait for the host to format the mailbox (HOST_STATE_SENDING)
+    wait_begin(&ws);
+    while (get_host_state(shm) != HOST_STATE_SENDING && shm->test_complete == 0) {
+        wait_step(&guest_wait, &ws);
+    }
+    
+    if (shm->test_complete == 1) {
+        printf("Test completion signal received before the stream started. Exiting...\n");
+        return;
+    }
+    
+    size_t avail = shm_size - offsetof(struct shared_data, buffer);
+    struct mailbox mbox;
+    if (!mailbox_attach(&mbox, (void *)&shm->buffer[0], avail)) {
+        printf("GUEST: ERROR - No valid mailbox in shared memory (is the host running with -M?)\n");
+        shm->error_code = 3;
+        __sync_synchronize();
+        set_guest_state(shm, GUEST_STATE_ACKNOWLEDGED);
+        return;
+    }
+    
+    printf("GUEST: ✓ Attached to mailbox: %d slots x %u bytes (%.2f MB)%s\n\n",
+           MAILBOX_SLOTS, mbox.slot_size, mbox.slot_size / (1024.0 * 1024.0),
+           display_hz > 0 ? " - paced to the display refresh" : "");
+    
+    uint8_t *local_buffer = guest_buffer_alloc(shm, mbox.slot_size);
+    size_t age_capacity = 4096;
+    uint64_t *ages = malloc(age_capacity * sizeof(uint64_t));
+    if (!local_buffer || !ages) {
+        printf("GUEST: ERROR - Failed to allocate local buffers\n");
+        exit(1);
+    }
+    
+    volatile struct mailbox_guest_stats *gs = &mbox.hdr->guest;
+    uint64_t period = display_hz > 0 ? 1000000000ULL / display_hz : 0;
+    uint32_t error_code = 0;
+    uint64_t consumed = 0, dropped = 0, age_sum = 0, age_max = 0, lag_max = 0;
+    uint64_t total_copy = 0, total_verify = 0;
+    int64_t last_sequence = -1;
+    
+    // STATE: GUEST_STATE_READY -> GUEST_STATE_PROCESSING (attached, consuming)
+    set_guest_state(shm, GUEST_STATE_PROCESSING);
+    
+    uint64_t stream_start = get_time_ns();
+    
+    for (;;) {
+        // Wait for a fresh frame, or for the host to close the stream
+        wait_begin(&ws);
+        while (!mailbox_has_fresh(&mbox) && !mailbox_closed(&mbox) && shm->test_complete == 0) {
+            wait_step(&guest_wait, &ws);
+        }
+        
+        // The close is published after the last frame, so take anything still fresh first
+        if (!mailbox_take(&mbox)) {
+            if (shm->test_complete == 1 && !mailbox_closed(&mbox)) {
+                printf("Test completion signal received during stream. Exiting...\n");
+            }
+            break;
+        }
+        
+        volatile struct mailbox_slot_desc *desc = mailbox_desc(&mbox);
+        uint32_t size = desc->data_size;
+        uint32_t sequence = desc->sequence;
+        uint64_t publish_ns = desc->publish_ns;
+        if (size > mbox.slot_size) {
+            printf("GUEST: ERROR - Frame larger than a slot\n");
+            error_code = 2;
+            break;
+        }
+        
+        uint64_t copy_start = get_time_ns();
+        copy_pool_run(&guest_pool, local_buffer, mailbox_data(&mbox), size);
+        uint64_t copy_end = get_time_ns();
+        uint64_t consumed_ns = timing_shared_ns();
+        
+        uint64_t age = consumed_ns > publish_ns ? consumed_ns - publish_ns : 0;
+        uint64_t published = mbox.hdr->published;
+        uint64_t lag = published > (uint64_t)sequence + 1 ? published - sequence - 1 : 0;
+        
+        if ((int64_t)sequence <= last_sequence) {
+            printf("GUEST: ERROR - Stale frame: got sequence %u after %ld\n", sequence, (long)last_sequence);
+            error_code = 4;
+        } else {
+            dropped += sequence - last_sequence - 1;
+        }
+        last_sequence = sequence;
+        
+        if (consumed == age_capacity) {
+            uint64_t *grown = realloc(ages, 2 * age_capacity * sizeof(uint64_t));
+            if (grown) {
+                ages = grown;
+                age_capacity *= 2;
+            }
+        }
+        if (consumed < age_capacity) {
+            ages[consumed] = age;
+        }
+        
+        consumed++;
+        age_sum += age;
+        total_copy += copy_end - copy_start;
+        if (age > age_max) age_max = age;
+        if (lag > lag_max) lag_max = lag;
+        
+        // Running counters for the host's per-second report
+        gs->consumed = consumed;
+        gs->dropped = dropped;
+        gs->age_sum_ns = age_sum;
+        gs->age_max_ns = age_max;
+        gs->age_last_ns = age;
+        gs->lag_max = lag_max;
+        
+        if (consumed == 1 || (mailbox_closed(&mbox) && !mailbox_has_fresh(&mbox))) {
+            uint8_t expected_hash[DIGEST_MAX_SIZE];
+            memcpy(expected_hash, (const void *)shm->data_digest, DIGEST_MAX_SIZE);
+            uint64_t verify_start = get_time_ns();
+            bool hash_match = verify_data_integrity((digest_algo_t)shm->digest_algo, local_buffer, size, expected_hash);
+            total_verify += get_time_ns() - verify_start;
+            
+            if (!hash_match) {
+                printf("✗ Data integrity check FAILED on frame %u\n", sequence);
+                error_code = 1;
+            }
+        }
+        
+        // Hold the frame until the next refresh
+        if (period > 0) {
+            uint64_t deadline = stream_start + (consumed * period);
+            struct timespec ts = { (time_t)(deadline / 1000000000ULL), (long)(deadline % 1000000000ULL) };
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+            }
+        }
+    }
+    
+    uint64_t stream_end = get_time_ns();
+    
+    // Frames published after the last one consumed were never seen either
+    uint64_t published = mbox.hdr->published;
+    if (published > (uint64_t)(last_sequence + 1)) {
+        dropped += published - (uint64_t)(last_sequence + 1);
+    }
+    
+    uint64_t samples = consumed < age_capacity ? consumed : age_capacity;
+    if (samples > 0) {
+        qsort(ages, samples, sizeof(uint64_t), compare_u64);
+        gs->age_p50_ns = ages[samples / 2];
+        gs->age_p99_ns = ages[(samples * 99) / 100];
+    }
+    gs->dropped = dropped;
+    
+    // WRITE DURATIONS to shared memory for host to read (totals over the stream)
+    shm->timing.guest_copy_duration = total_copy;
+    shm->timing.guest_verify_duration = total_verify;
+    shm->timing.guest_total_duration = stream_end - stream_start;
+    if (error_code != 0) {
+        shm->error_code = error_code;
+    }
+    __sync_synchronize();
+    
+    if (consumed > 0) {
+        double size_mb = mbox.slot_size / (1024.0 * 1024.0);
+        printf("=== Guest Mailbox Results ===\n");
+        printf("Frames consumed:    %lu of %lu published (%lu dropped)\n",
+               (unsigned long)consumed, (unsigned long)published, (unsigned long)dropped);
+        printf("Guest copy (avg):   %.2f µs [%.0f MB/s]\n",
+               (total_copy / consumed) / 1000.0, size_mb / ((total_copy / consumed) / 1e9));
+        printf("Frame age:          avg %.0f µs | p50 %.0f µs | p99 %.0f µs | max %.0f µs\n",
+               (age_sum / consumed) / 1000.0, gs->age_p50_ns / 1000.0, gs->age_p99_ns / 1000.0, age_max / 1000.0);
+        printf("%s\n\n", error_code == 0 ? "✓ Ordering and sampled digest checks passed" : "✗ Stream had errors");
+    }
+    
+    // STATE: GUEST_STATE_PROCESSING -> GUEST_STATE_ACKNOWLEDGED
+    set_guest_state(shm, GUEST_STATE_ACKNOWLEDGED);
+    
+    // Wait for host to finish with this stream
+    wait_begin(&ws);
+    while (get_host_state(shm) != HOST_STATE_READY && shm->test_complete == 0) {
+        wait_step(&guest_wait, &ws);
+    }
+    
+    // STATE: GUEST_STATE_ACKNOWLEDGED -> GUEST_STATE_READY
+    set_guest_state(shm, GUEST_STATE_READY);
+    
+    free(ages);
+    page_free(local_buffer, mbox.slot_size, guest_pages);
+}
+
+// Small-message sweep consumer: `count` messages per size, every size in the
+// host's sweep. State transitions skip the logging set_guest_state() does.
+void monitor_message_rate(volatile struct shared_data *shm, int count)
+{
+    printf("Guest Reader - Message rate consumer\n");
+    printf("Expected: %d messages x %d sizes (0 B, %d B .. %u KB)\n",
+           count, MSG_RATE_STEPS, MSG_RATE_MIN_SIZE, msg_rate_size(MSG_RATE_STEPS - 1) / 1024);
+    printf("Will measure: detection latency per message and CPU cycles per size\n\n");
+    fflush(stdout);
+    
+    struct perf_counters perf_counters;
+    bool perf_available = perf_counters_init(&perf_counters);
+    
+    const uint32_t max_size = msg_rate_size(MSG_RATE_STEPS - 1);
+    uint8_t *local_buffer = guest_buffer_alloc(shm, max_size);
+    if (!local_buffer) {
+        printf("GUEST: ERROR - Failed to allocate local buffer\n");
+        exit(1);
+    }
+    
+    struct wait_state ws;
+    wait_for_host_init(shm);
+    
+    const uint8_t *data_ptr = (const uint8_t *)&shm->buffer[0];
+    uint32_t expected_sequence = 0;
+    uint32_t error_code = 0;
+    int received = 0;
+    
+    for (int step = 0; step < MSG_RATE_STEPS && shm->test_complete == 0; step++) {
+        for (int i = 0; i < count; i++) {
+            wait_begin(&ws);
+            while (__atomic_load_n(&shm->host_state, __ATOMIC_ACQUIRE) != HOST_STATE_SENDING &&
+                   shm->test_complete == 0) {
+                wait_step(&guest_wait, &ws);
+            }
+            uint64_t detected = timing_shared_ns();
+            if (shm->test_complete == 1) {
+                break;
+            }
+            
+            if (i == 0 && perf_available) {
+                perf_counters_start(&perf_counters);
+            }
+            
+            uint32_t size = shm->data_size;
+            if (size > max_size) {
+                printf("GUEST: ERROR - Message of %u B larger than the %u B sweep maximum\n", size, max_size);
+                error_code = 2;
+            } else if (size > 0) {
+                memcpy(local_buffer, data_ptr, size);
+            }
+            
+            if (error_code != 2 && (shm->sequence != expected_sequence || size != msg_rate_size(step))) {
+                printf("GUEST: ERROR - Got message %u of %u B, expected %u of %u B\n",
+                       shm->sequence, size, expected_sequence, msg_rate_size(step));
+                error_code = 4;
+            }
+            expected_sequence = shm->sequence + 1;
+            
+            uint64_t publish_ns = shm->publish_ns;
+            shm->timing.guest_notify_latency = detected > publish_ns ? detected - publish_ns : 0;
+            shm->timing.guest_detect_ns = detected;
+            
+            // Cycles for the whole size block, published with its last acknowledgement
+            if (i == count - 1 && perf_available) {
+                struct perf_results results = {0};
+                perf_counters_stop(&perf_counters, &results, (size_t)size * count);
+                publish_guest_perf(shm, &results);
+            }
+            if (error_code != 0) {
+                shm->error_code = error_code;
+            }
+            
+            // STATE: GUEST_STATE_READY -> GUEST_STATE_ACKNOWLEDGED (release: results first)
+            __atomic_store_n(&shm->guest_state, GUEST_STATE_ACKNOWLEDGED, __ATOMIC_RELEASE);
+            
+            wait_begin(&ws);
+            while (__atomic_load_n(&shm->host_state, __ATOMIC_ACQUIRE) != HOST_STATE_READY &&
+                   shm->test_complete == 0) {
+                wait_step(&guest_wait, &ws);
+            }
+            
+            // STATE: GUEST_STATE_ACKNOWLEDGED -> GUEST_STATE_READY
+            __atomic_store_n(&shm->guest_state, GUEST_STATE_READY, __ATOMIC_RELEASE);
+            received++;
+        }
+        
+        printf("  %6u B: %d messages received\n", msg_rate_size(step), count);
+        fflush(stdout);
+    }
+    
+    printf("\nGuest message rate loop ended after %d messages%s\n", received,
+           error_code == 0 ? "" : " (with errors)");
+    
+    if (perf_available) {
+        perf_counters_cleanup(&perf_counters);
+    }
+    page_free(local_buffer, max_size, guest_pages);
+}
+
+void monitor_batch(volatile struct shared_data *shm, size_t shm_size)
+{
+    printf("Guest Reader - Batched message consumer\n");
+    printf("Will measure: drain every published message, then acknowledge once per drain\n");
+    printf("Runs until the host closes the queue (host -B sets the sweep)\n\n");
+    fflush(stdout);
+    
+    struct wait_state ws;
+    wait_for_host_init(shm);
+    
+    // Wait for the host to format the queue (HOST_STATE_SENDING)
+    wait_begin(&ws);
+    while (get_host_state(shm) != HOST_STATE_SENDING && shm->test_complete == 0) {
+        wait_step(&guest_wait, &ws);
+    }
+    
+    if (shm->test_complete == 1) {
+        printf("Test completion signal received before the stream started. Exiting...\n");
+        return;
+    }
+    
+    size_t avail = shm_size - offsetof(struct shared_data, buffer);
+    struct msgq queue;
+    if (!msgq_attach(&queue, (void *)&shm->buffer[0], avail)) {
+        printf("GUEST: ERROR - No valid message queue in shared memory (is the host running with -B?)\n");
+        shm->error_code = 3;
+        __sync_synchronize();
+        set_guest_state(shm, GUEST_STATE_ACKNOWLEDGED);
+        return;
+    }
+    
+    printf("GUEST: ✓ Attached to message queue: %lu KB\n\n", (unsigned long)(queue.capacity / 1024));
+    
+    uint8_t *local_buffer = guest_buffer_alloc(shm, MSGQ_MAX_MESSAGE);
+    if (!local_buffer) {
+        printf("GUEST: ERROR - Failed to allocate local buffer\n");
+        exit(1);
+    }
+    
+    // STATE: GUEST_STATE_READY -> GUEST_STATE_PROCESSING (attached, consuming)
+    set_guest_state(shm, GUEST_STATE_PROCESSING);
+    
+    uint64_t total_drain = 0, messages = 0, drains = 0, max_drain = 0;
+    uint32_t expected_sequence = 0;
+    uint32_t error_code = 0;
+    
+    uint64_t stream_start = get_time_ns();
+    
+    for (;;) {
+        // Wait for the host to publish, or to close the queue
+        const struct msgq_record *rec;
+        wait_begin(&ws);
+        while ((rec = msgq_peek(&queue)) == NULL && !msgq_closed(&queue) && shm->test_complete == 0) {
+            wait_step(&guest_wait, &ws);
+        }
+        
+        // The close is published after the last batch, so look once more
+        if (rec == NULL && (rec = msgq_peek(&queue)) == NULL) {
+            if (shm->test_complete == 1 && !msgq_closed(&queue)) {
+                printf("Test completion signal received during stream. Exiting...\n");
+            }
+            break;
+        }
+        
+        // Drain everything available, then acknowledge it all with one store
+        uint64_t drain_start = get_time_ns();
+        uint64_t drained = 0;
+        do {
+            if (rec->size > MSGQ_MAX_MESSAGE) {
+                printf("GUEST: ERROR - Message larger than %d bytes\n", MSGQ_MAX_MESSAGE);
+                error_code = 2;
+                break;
+            }
+            if (rec->size > 0) memcpy(local_buffer, msgq_payload(rec), rec->size);
+            if (rec->sequence != expected_sequence && error_code == 0) {
+                printf("GUEST: ERROR - Out of order message: got sequence %u, expected %u\n",
+                       rec->sequence, expected_sequence);
+                error_code = 4;
+            }
+            expected_sequence = rec->sequence + 1;
+            msgq_consume(&queue, rec);
+            drained++;
+        } while ((rec = msgq_peek(&queue)) != NULL);
+        
+        if (error_code != 0) {
+            shm->error_code = error_code;
+        }
+        msgq_ack(&queue);
+        total_drain += get_time_ns() - drain_start;
+        
+        messages += drained;
+        drains++;
+        if (drained > max_drain) max_drain = drained;
+        if (error_code == 2) break;
+    }
+    
+    uint64_t stream_end = get_time_ns();
+    
+    // WRITE DURATIONS to shared memory for host to read (totals over the stream)
+    shm->timing.guest_copy_duration = total_drain;
+    shm->timing.guest_total_duration = stream_end - stream_start;
+    __sync_synchronize();
+    
+    if (messages > 0) {
+        printf("=== Guest Batch Results ===\n");
+        printf("Messages consumed:  %lu in %lu drains (avg %.1f, max %lu per acknowledgement)\n",
+               (unsigned long)messages, (unsigned long)drains, (double)messages / drains, (unsigned long)max_drain);
+        printf("Guest drain (avg):  %.1f ns per message\n", (double)total_drain / messages);
+        printf("%s\n\n", error_code == 0 ? "✓ Sequence checks passed" : "✗ Stream had errors");
+    }
+    
+    // STATE: GUEST_STATE_PROCESSING -> GUEST_STATE_ACKNOWLEDGED
+    set_guest_state(shm, GUEST_STATE_ACKNOWLEDGED);
+    
+    // Wait for host to finish with this stream
+    wait_begin(&ws);
+    while (get_host_state(shm) != HOST_STATE_READY && shm->test_complete == 0) {
+        wait_step(&guest_wait, &ws);
+    }
+    
+    // STATE: GUEST_STATE_ACKNOWLEDGED -> GUEST_STATE_READY
+    set_guest_state(shm, GUEST_STATE_READY);
+    
+    page_free(local_buffer, MSGQ_MAX_MESSAGE, guest_pages);
+}
+
+// Guest half of the full duplex test: consume host->guest and produce
+// guest->host with the same loops the host runs, one phase at a time
+void monitor_duplex(volatile struct shared_data *shm, size_t shm_size)
+{
+    printf("Guest Reader - Full duplex endpoint\n");
+    printf("Will run: host->guest consumer and guest->host producer threads, %d phases\n\n", DUPLEX_PHASES);
+    fflush(stdout);
+    
+    struct wait_state ws;
+    wait_for_host_init(shm);
+    
+    size_t avail = shm_size - offsetof(struct shared_data, buffer);
+    volatile struct duplex_header *hdr = (volatile struct duplex_header *)&shm->buffer[0];
+    uint8_t *rx_frame = NULL, *tx_frame = NULL;
+    uint32_t frame_size = 0;
+    
+    for (int phase = 0; phase < DUPLEX_PHASES; phase++) {
+        // Wait for the host to format the rings (HOST_STATE_SENDING)
+        wait_begin(&ws);
+        while (get_host_state(shm) != HOST_STATE_SENDING && shm->test_complete == 0) {
+            wait_step(&guest_wait, &ws);
+        }
+        if (shm->test_complete == 1) {
+            printf("Test completion signal received. Exiting...\n");
+            break;
+        }
+        
+        if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != DUPLEX_MAGIC) {
+            printf("GUEST: ERROR - No duplex rings in shared memory (is the host running with -D?)\n");
+            shm->error_code = 3;
+            __sync_synchronize();
+            set_guest_state(shm, GUEST_STATE_ACKNOWLEDGED);
+            break;
+        }
+        // Only read the header after the magic acquire, it orders the host's header stores
+        uint32_t directions = hdr->directions;
+        
+        if (!rx_frame) {
+            frame_size = hdr->frame_size;
+            rx_frame = guest_buffer_alloc(shm, frame_size);
+            tx_frame = guest_buffer_alloc(shm, frame_size);
+            if (!rx_frame || !tx_frame) {
+                printf("GUEST: ERROR - Failed to allocate frame buffers\n");
+                exit(1);
+            }
+            for (uint32_t i = 0; i < frame_size; i++) {
+                tx_frame[i] = (uint8_t)(i * 31 + 7);
+            }
+        }
+        
+        struct duplex_stream rx = { .abort = &shm->test_complete, .wait = &guest_wait, .buffer = rx_frame };
+        struct duplex_stream tx = { .abort = &shm->test_complete, .wait = &guest_wait, .buffer = tx_frame };
+        pthread_t rx_thread, tx_thread;
+        bool rx_running = false, tx_running = false;
+        
+        if (directions & DUPLEX_BIT(DUPLEX_H2G)) {
+            rx_running = duplex_stream_attach(&rx, hdr, avail, DUPLEX_H2G, false) &&
+                         pthread_create(&rx_thread, NULL, duplex_consume, &rx) == 0;
+        }
+        if (directions & DUPLEX_BIT(DUPLEX_G2H)) {
+            tx_running = duplex_stream_attach(&tx, hdr, avail, DUPLEX_G2H, true) &&
+                         pthread_create(&tx_thread, NULL, duplex_produce, &tx) == 0;
+        }
+        if (!rx_running && !tx_running) {
+            printf("GUEST: ERROR - Failed to start the guest side of phase %d\n", phase);
+            shm->error_code = 3;
+        }
+        
+        // STATE: GUEST_STATE_READY -> GUEST_STATE_PROCESSING (threads running)
+        set_guest_state(shm, GUEST_STATE_PROCESSING);
+        
+        if (rx_running) pthread_join(rx_thread, NULL);
+        if (tx_running) pthread_join(tx_thread, NULL);
+        
+        printf("  Phase %d: host->guest %lu frames (%.0f MB/s), guest->host %lu frames (%.1f%% stalled)\n",
+               phase, (unsigned long)rx.frames, duplex_mbps(rx.frames, frame_size, rx.duration_ns),
+               (unsigned long)tx.frames, tx.duration_ns > 0 ? 100.0 * tx.stall_ns / tx.duration_ns : 0.0);
+        fflush(stdout);
+        
+        // STATE: GUEST_STATE_PROCESSING -> GUEST_STATE_ACKNOWLEDGED (results in the duplex header)
+        set_guest_state(shm, GUEST_STATE_ACKNOWLEDGED);
+        
+        wait_begin(&ws);
+        while (get_host_state(shm) != HOST_STATE_READY && shm->test_complete == 0) {
+            wait_step(&guest_wait, &ws);
+        }
+        
+        // STATE: GUEST_STATE_ACKNOWLEDGED -> GUEST_STATE_READY
+        set_guest_state(shm, GUEST_STATE_READY);
+    }
+    
+    if (rx_frame) page_free(rx_frame, frame_size, guest_pages);
+    if (tx_frame) page_free(tx_frame, frame_size, guest_pages);
+}
+
+// Clock sync responder (-T): answers the host's clock_sync.h probes from its
+// own thread, so it runs alongside any test. It polls with backoff whatever
+// the -w policy is, since it shares the guest's CPUs with the test. A burst
+// of probes finds it still in its spin phase, so the min-RTT probe doesn't
+// pay a sleep.
+static pthread_t clock_sync_thread;
+static volatile bool clock_sync_stop = false;
+static uint64_t clock_sync_answered = 0;
+
+static void *clock_sync_responder(void *arg)
+{
+    volatile struct shared_data *shm = (volatile struct shared_data *)arg;
+    struct wait_policy policy = guest_wait;
+    policy.kind = WAIT_POLICY_BACKOFF;
+    
+    uint32_t last = __atomic_load_n(&shm->sync_seq, __ATOMIC_ACQUIRE);
+    struct wait_state ws;
+    wait_begin(&ws);
+    while (!clock_sync_stop) {
+        if (clock_sync_respond(&shm->sync_seq, &shm->sync_echo, &shm->sync_t2, &shm->sync_t3, &last)) {
+            clock_sync_answered++;
+            wait_begin(&ws);
+        } else {
+            wait_step(&policy, &ws);
+        }
+    }
+    return NULL;
+}
+
+// Clock sync on its own: the responder thread does the work, the main thread
+// just keeps the handshake until the host completes
+void monitor_clock_sync(volatile struct shared_data *shm)
+{
+    printf("Guest Reader - Clock sync responder\n");
+    printf("Will run: answer clock sync probes until the host completes\n\n");
+    fflush(stdout);
+    
+    struct wait_state ws;
+    wait_for_host_init(shm);
+    
+    wait_begin(&ws);
+    while (shm->test_complete == 0) {
+        wait_step(&guest_wait, &ws);
+    }
+    printf("Test completion signal received. Exiting...\n");
+}
+
+// Wake-up test: echo every ping the host sends, waiting with the policy the
+// host picked for the phase, and report this thread's CPU time over the phase
+void monitor_wakeup(volatile struct shared_data *shm)
+{
+    printf("Guest Reader - Wake-up responder\n");
+    printf("Will run: one phase per wait policy, echoing ping -> pong (futex: %s, doorbell: %s)\n\n",
+           guest_local_shm ? "yes" : "no", doorbell_kind_name(guest_doorbell.kind));
+    fflush(stdout);
+    
+    struct wait_state ws;
+    wait_for_host_init(shm);
+    
+    volatile struct wakeup_block *blk = (volatile struct wakeup_block *)&shm->buffer[0];
+    
+    for (int phase = 0; phase < WAKEUP_PHASES; phase++) {
+        // Wait for the host to set up the phase (HOST_STATE_SENDING)
+        wait_begin(&ws);
+        while (get_host_state(shm) != HOST_STATE_SENDING && shm->test_complete == 0) {
+            wait_step(&guest_wait, &ws);
+        }
+        if (shm->test_complete == 1) {
+            printf("Test completion signal received. Exiting...\n");
+            break;
+        }
+        
+        if (__atomic_load_n(&blk->magic, __ATOMIC_ACQUIRE) != WAKEUP_MAGIC || blk->policy > WAIT_POLICY_FUTEX) {
+            printf("GUEST: ERROR - No wake-up phase in shared memory (is the host running with -W?)\n");
+            shm->error_code = 3;
+            __sync_synchronize();
+            set_guest_state(shm, GUEST_STATE_ACKNOWLEDGED);
+            break;
+        }
+        
+        struct wait_policy policy = guest_wait;
+        policy.kind = (wait_policy_kind_t)blk->policy;
+        policy.spin_limit = blk->spin_limit;
+        policy.doorbell = guest_doorbell.kind != DOORBELL_NONE ? &guest_doorbell : NULL;
+        wait_policy_apply(&policy);
+        bool ring = policy.kind == WAIT_POLICY_DOORBELL && policy.doorbell;
+        uint64_t wakeups_start = guest_doorbell.wakeups;
+        
+        // STATE: GUEST_STATE_READY -> GUEST_STATE_PROCESSING (responding)
+        set_guest_state(shm, GUEST_STATE_PROCESSING);
+        
+        struct timespec cpu_start, cpu_end;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+        uint64_t wall_start = get_time_ns();
+        uint32_t rounds = 0;
+        
+        for (uint32_t round = 1;; round++) {
+            wait_begin(&ws);
+            while (__atomic_load_n(&blk->ping, __ATOMIC_ACQUIRE) != round &&
+                   !__atomic_load_n(&blk->closed, __ATOMIC_ACQUIRE) && shm->test_complete == 0) {
+                wait_step(&policy, &ws);
+            }
+            if (__atomic_load_n(&blk->ping, __ATOMIC_ACQUIRE) != round) {
+                break;
+            }
+            __atomic_store_n(&blk->pong, round, __ATOMIC_RELEASE);
+            if (policy.kind == WAIT_POLICY_FUTEX) {
+                wait_notify(&shm->guest_wake);
+            } else if (ring) {
+                doorbell_ring(&guest_doorbell, shm->host_doorbell_peer, 0);
+            }
+            rounds = round;
+        }
+        
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+        
+        // Results for the host, then acknowledge
+        blk->wall_ns = get_time_ns() - wall_start;
+        blk->cpu_ns = (uint64_t)(cpu_end.tv_sec - cpu_start.tv_sec) * 1000000000ULL + cpu_end.tv_nsec - cpu_start.tv_nsec;
+        blk->wakeups = guest_doorbell.wakeups - wakeups_start;
+        __sync_synchronize();
+        
+        printf("  %-8s %6u rounds, %5.1f%% CPU%s\n", wait_policy_name(policy.kind), rounds,
+               blk->wall_ns > 0 ? 100.0 * blk->cpu_ns / blk->wall_ns : 0.0,
+               ring ? ", woken by doorbell" : "");
+        fflush(stdout);
+        
+        // STATE: GUEST_STATE_PROCESSING -> GUEST_STATE_ACKNOWLEDGED
+        set_guest_state(shm, GUEST_STATE_ACKNOWLEDGED);
+        
+        wait_begin(&ws);
+        while (get_host_state(shm) != HOST_STATE_READY && shm->test_complete == 0) {
+            wait_step(&guest_wait, &ws);
+        }
+        
+        // STATE: GUEST_STATE_ACKNOWLEDGED -> GUEST_STATE_READY
+        set_guest_state(shm, GUEST_STATE_READY);
+    }
+    
+    wait_policy_apply(&guest_wait);
+}
+
+// Striped transfer consumer: copy each stripe out as soon as its ready flag
+// carries the current frame number, check the host's stamp and count it in
+// `consumed`, once per stripe count the host sweeps
+void monitor_stripes(volatile struct shared_data *shm, size_t shm_size)
+{
+    printf("Guest Reader - Striped frame consumer\n");
+    printf("Will run: %d stripe counts, copying every stripe out as soon as it is published\n\n", STRIPE_SWEEP_COUNT);
+    fflush(stdout);
+    
+    struct wait_state ws;
+    wait_for_host_init(shm);
+    
+    size_t avail = shm_size - offsetof(struct shared_data, buffer);
+    volatile struct stripe_header *hdr = (volatile struct stripe_header *)&shm->buffer[0];
+    uint8_t *local_frame = NULL;
+    size_t local_size = 0;
+    
+    for (int phase = 0; phase < STRIPE_SWEEP_COUNT; phase++) {
+        // Wait for the host to format the phase (HOST_STATE_SENDING)
+        wait_begin(&ws);
+        while (get_host_state(shm) != HOST_STATE_SENDING && shm->test_complete == 0) {
+            wait_step(&guest_wait, &ws);
+        }
+        if (shm->test_complete == 1) {
+            printf("Test completion signal received. Exiting...\n");
+            break;
+        }
+        
+        if (!stripe_attach(hdr, avail)) {
+            printf("GUEST: ERROR - No striped frame in shared memory (is the host running with -S?)\n");
+            shm->error_code = 3;
+            __sync_synchronize();
+            set_guest_state(shm, GUEST_STATE_ACKNOWLEDGED);
+            break;
+        }
+        
+        uint32_t stripes = hdr->stripe_count;
+        uint32_t stripe_size = hdr->stripe_size;
+        if (hdr->frame_size > local_size) {
+            if (local_frame) page_free(local_frame, local_size, guest_pages);
+            local_size = hdr->frame_size;
+            local_frame = guest_buffer_alloc(shm, local_size);
+            if (!local_frame) {
+                printf("GUEST: ERROR - Failed to allocate frame buffer\n");
+                exit(1);
+            }
+        }
+        
+        // STATE: GUEST_STATE_READY -> GUEST_STATE_PROCESSING (attached, consuming)
+        set_guest_state(shm, GUEST_STATE_PROCESSING);
+        
+        uint64_t consumed = 0, copy_ns = 0;
+        uint32_t errors = 0, frames = 0;
+        bool closed = false;
+        
+        for (uint32_t number = 1; !closed; number++) {
+            for (uint32_t i = 0; i < stripes; i++) {
+                wait_begin(&ws);
+                while (!stripe_ready(hdr, i, number)) {
+                    // The host only closes between frames, once every stripe is consumed
+                    if (stripe_closed(hdr) || shm->test_complete != 0) {
+                        closed = true;
+                        break;
+                    }
+                    wait_step(&guest_wait, &ws);
+                }
+                if (closed) break;
+                
+                uint8_t *dst = local_frame + (size_t)i * stripe_size;
+                uint64_t t0 = get_time_ns();
+                copy_pool_run(&guest_pool, dst, stripe_data(hdr, i), stripe_length(hdr, i));
+                copy_ns += get_time_ns() - t0;
+                
+                uint32_t stamp;
+                memcpy(&stamp, dst, sizeof(stamp));
+                if (stamp != number) {
+                    errors++;
+                }
+                stripe_consumed(hdr, ++consumed);
+            }
+            if (!closed) frames++;
+        }
+        
+        // Results for the host, then acknowledge
+        hdr->errors = errors;
+        shm->timing.guest_copy_duration = copy_ns;
+        if (errors > 0) {
+            shm->error_code = 4;
+        }
+        __sync_synchronize();
+        
+        printf("  %2u stripes of %5u KB: %5u frames, %8.1f µs copy per frame%s\n",
+               stripes, stripe_size / 1024, frames, frames > 0 ? copy_ns / 1000.0 / frames : 0.0,
+               errors > 0 ? " ✗ stamp mismatch" : "");
+        fflush(stdout);
+        
+        // STATE: GUEST_STATE_PROCESSING -> GUEST_STATE_ACKNOWLEDGED
+        set_guest_state(shm, GUEST_STATE_ACKNOWLEDGED);
+        
+        wait_begin(&ws);
+        while (get_host_state(shm) != HOST_STATE_READY && shm->test_complete == 0) {
+            wait_step(&guest_wait, &ws);
+        }
+        
+        // STATE: GUEST_STATE_ACKNOWLEDGED -> GUEST_STATE_READY
+        set_guest_state(shm, GUEST_STATE_READY);
+    }
+    
+    if (local_frame) page_free(local_frame, local_size, guest_pages);
+}
+
+// Zero-copy consume: run the host's chosen kernel on every frame, either on a
+// local copy (slot released after the memcpy) or in place on a leased slot
+// (released after the kernel), once per kernel and mode
+void monitor_zerocopy(volatile struct shared_data *shm, size_t shm_size)
+{
+    printf("Guest Reader - Zero-copy consumer\n");
+    printf("Will run: %d kernels x copy/in-place on every frame of each phase\n\n", KERNEL_COUNT);
+    fflush(stdout);
+    
+    struct wait_state ws;
+    wait_for_host_init(shm);
+    
+    size_t avail = shm_size - offsetof(struct shared_data, buffer);
+    volatile struct kbench_header *hdr = (volatile struct kbench_header *)&shm->buffer[0];
+    uint8_t *local_frame = NULL;
+    void *scratch = NULL;
+    size_t frame_size = 0;
+    
+    for (int phase = 0; phase < KERNEL_COUNT * KBENCH_MODE_COUNT; phase++) {
+        // Wait for the host to format the phase (HOST_STATE_SENDING)
+        wait_begin(&ws);
+        while (get_host_state(shm) != HOST_STATE_SENDING && shm->test_complete == 0) {
+            wait_step(&guest_wait, &ws);
+        }
+        if (shm->test_complete == 1) {
+            printf("Test completion signal received. Exiting...\n");
+            break;
+        }
+        
+        struct ring ring;
+        if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != KBENCH_MAGIC || hdr->ring_offset >= avail ||
+            !ring_attach(&ring, (uint8_t *)hdr + hdr->ring_offset, avail - hdr->ring_offset) ||
+            (size_t)hdr->width * hdr->height * 3 > ring.slot_size) {
+            printf("GUEST: ERROR - No zero-copy phase in shared memory (is the host running with -Z?)\n");
+            shm->error_code = 3;
+            __sync_synchronize();
+            set_guest_state(shm, GUEST_STATE_ACKNOWLEDGED);
+            break;
+        }
+        
+        uint32_t kernel = hdr->kernel, mode = hdr->mode;
+        uint32_t width = hdr->width, height = hdr->height;
+        uint64_t expected = hdr->expected;
+        
+        if (!local_frame) {
+            frame_size = ring.slot_size;
+            local_frame = guest_buffer_alloc(shm, frame_size);
+            scratch = malloc(frame_kernel_scratch_size(width, height));
+            if (!local_frame || !scratch) {
+                printf("GUEST: ERROR - Failed to allocate frame buffers\n");
+                exit(1);
+            }
+        }
+        
+        // STATE: GUEST_STATE_READY -> GUEST_STATE_PROCESSING (attached, consuming)
+        set_guest_state(shm, GUEST_STATE_PROCESSING);
+        
+        uint64_t frames = 0, copy_ns = 0, process_ns = 0, hold_ns = 0;
+        uint32_t mismatches = 0;
+        
+        for (;;) {
+            struct ring_lease lease;
+            bool leased;
+            wait_begin(&ws);
+            while (!(leased = ring_lease(&ring, &lease)) && !__atomic_load_n(&hdr->closed, __ATOMIC_ACQUIRE) &&
+                   shm->test_complete == 0) {
+                wait_step(&guest_wait, &ws);
+            }
+            
+            // The close is published after the last frame, so look once more
+            if (!leased && !ring_lease(&ring, &lease)) {
+                break;
+            }
+            
+            uint64_t t0 = get_time_ns();
+            uint64_t result;
+            if (mode == KBENCH_COPY) {
+                memcpy(local_frame, lease.data, lease.size);
+                ring_release(&ring);
+                uint64_t t1 = get_time_ns();
+                result = frame_kernel_run(kernel, local_frame, width, height, scratch);
+                uint64_t t2 = get_time_ns();
+                copy_ns += t1 - t0;
+                process_ns += t2 - t1;
+                hold_ns += t1 - t0;
+            } else {
+                result = frame_kernel_run(kernel, lease.data, width, height, scratch);
+                ring_release(&ring);
+                uint64_t t1 = get_time_ns();
+                process_ns += t1 - t0;
+                hold_ns += t1 - t0;
+            }
+            
+            if (result != expected) {
+                mismatches++;
+            }
+            frames++;
+        }
+        
+        // Results for the host, then acknowledge
+        hdr->frames = frames;
+        hdr->copy_ns = copy_ns;
+        hdr->process_ns = process_ns;
+        hdr->hold_ns = hold_ns;
+        hdr->mismatches = mismatches;
+        if (mismatches > 0) {
+            shm->error_code = 4;
+        }
+        __sync_synchronize();
+        
+        printf("  %-9s %-8s %5lu frames: %8.1f µs copy + %8.1f µs kernel per frame%s\n",
+               frame_kernel_name(kernel), kbench_mode_name(mode), (unsigned long)frames,
+               frames > 0 ? copy_ns / 1000.0 / frames : 0.0, frames > 0 ? process_ns / 1000.0 / frames : 0.0,
+               mismatches > 0 ? " ✗ result mismatch" : "");
+        fflush(stdout);
+        
+        // STATE: GUEST_STATE_PROCESSING -> GUEST_STATE_ACKNOWLEDGED
+        set_guest_state(shm, GUEST_STATE_ACKNOWLEDGED);
+        
+        wait_begin(&ws);
+        while (get_host_state(shm) != HOST_STATE_READY && shm->test_complete == 0) {
+            wait_step(&guest_wait, &ws);
+        }
+        
+        // STATE: GUEST_STATE_ACKNOWLEDGED -> GUEST_STATE_READY
+        set_guest_state(shm, GUEST_STATE_READY);
+    }
+    
+    if (local_frame) page_free(local_frame, frame_size, guest_pages);
+    free(scratch);
+}
+
+// Region allocator consumer: read each submitted block in place, check its
+// sequence stamp and free it back to the host, once per phase
+void monitor_alloc(volatile struct shared_data *shm, size_t shm_size)
+{
+    printf("Guest Reader - Region allocator consumer\n");
+    printf("Will run: read each block in place, free it through the return queue, %d phases\n\n", RALLOC_PHASES);
+    fflush(stdout);
+    
+    struct wait_state ws;
+    wait_for_host_init(shm);
+    
+    size_t avail = shm_size - offsetof(struct shared_data, buffer);
+    uint8_t *local_buffer = NULL;
+    size_t local_size = 0;
+    
+    for (int phase = 0; phase < RALLOC_PHASES; phase++) {
+        // Wait for the host to format the allocator (HOST_STATE_SENDING)
+        wait_begin(&ws);
+        while (get_host_state(shm) != HOST_STATE_SENDING && shm->test_complete == 0) {
+            wait_step(&guest_wait, &ws);
+        }
+        if (shm->test_complete == 1) {
+            printf("Test completion signal received. Exiting...\n");
+            break;
+        }
+        
+        struct ralloc_reader reader;
+        if (!ralloc_attach(&reader, (void *)&shm->buffer[0], avail)) {
+            printf("GUEST: ERROR - No region allocator in shared memory (is the host running with -A?)\n");
+            shm->error_code = 3;
+            __sync_synchronize();
+            set_guest_state(shm, GUEST_STATE_ACKNOWLEDGED);
+            break;
+        }
+        
+        if (!local_buffer) {
+            // No block is larger than the arena
+            local_size = reader.hdr->arena_size;
+            local_buffer = guest_buffer_alloc(shm, local_size);
+            if (!local_buffer) {
+                printf("GUEST: ERROR - Failed to allocate local buffer\n");
+                exit(1);
+            }
+        }
+        
+        // STATE: GUEST_STATE_READY -> GUEST_STATE_PROCESSING (attached, consuming)
+        set_guest_state(shm, GUEST_STATE_PROCESSING);
+        
+        uint64_t messages = 0, bytes = 0, copy_ns = 0;
+        uint32_t expected_sequence = 0;
+        uint32_t error_code = 0;
+        uint64_t stream_start = get_time_ns();
+        
+        for (;;) {
+            struct ralloc_desc d;
+            bool received;
+            wait_begin(&ws);
+            while (!(received = ralloc_receive(&reader, &d)) && !ralloc_closed(&reader) && shm->test_complete == 0) {
+                wait_step(&guest_wait, &ws);
+            }
+            
+            // The close is published after the last submit, so look once more
+            if (!received && !ralloc_receive(&reader, &d)) {
+                if (shm->test_complete == 1 && !ralloc_closed(&reader)) {
+                    printf("Test completion signal received during stream. Exiting...\n");
+                }
+                break;
+            }
+            
+            if (d.size > d.capacity || d.size > local_size || d.offset + d.capacity > reader.hdr->region_size) {
+                printf("GUEST: ERROR - Block %u outside the region (offset %lu, %u B)\n",
+                       d.sequence, (unsigned long)d.offset, d.size);
+                error_code = 2;
+                break;
+            }
+            
+            // Read the message in place, then check the sequence stamp it starts with
+            uint64_t copy_start = get_time_ns();
+            memcpy(local_buffer, ralloc_ptr(reader.base, d.offset), d.size);
+            copy_ns += get_time_ns() - copy_start;
+            
+            uint32_t stamp = d.sequence;
+            if (d.size >= sizeof(stamp)) memcpy(&stamp, local_buffer, sizeof(stamp));
+            if ((stamp != d.sequence || d.sequence != expected_sequence) && error_code == 0) {
+                printf("GUEST: ERROR - Block stamped %u with sequence %u, expected %u\n",
+                       stamp, d.sequence, expected_sequence);
+                error_code = 4;
+            }
+            expected_sequence = d.sequence + 1;
+            
+            wait_begin(&ws);
+            while (!ralloc_free(&reader, &d) && shm->test_complete == 0) {
+                wait_step(&guest_wait, &ws);
+            }
+            messages++;
+            bytes += d.size;
+        }
+        
+        uint64_t stream_end = get_time_ns();
+        if (error_code != 0) {
+            shm->error_code = error_code;
+        }
+        
+        // WRITE DURATIONS to shared memory for host to read (totals over the stream)
+        shm->timing.guest_copy_duration = copy_ns;
+        shm->timing.guest_total_duration = stream_end - stream_start;
+        __sync_synchronize();
+        
+        printf("  Phase %d: %lu blocks, %.1f MB read in place (%.0f MB/s copy), %s\n", phase,
+               (unsigned long)messages, bytes / (1024.0 * 1024.0),
+               copy_ns > 0 ? bytes / (1024.0 * 1024.0) / (copy_ns / 1e9) : 0.0,
+               error_code == 0 ? "✓ sequence stamps passed" : "✗ stream had errors");
+        fflush(stdout);
+        
+        // STATE: GUEST_STATE_PROCESSING -> GUEST_STATE_ACKNOWLEDGED (every block freed)
+        set_guest_state(shm, GUEST_STATE_ACKNOWLEDGED);
+        
+        wait_begin(&ws);
+        while (get_host_state(shm) != HOST_STATE_READY && shm->test_complete == 0) {
+            wait_step(&guest_wait, &ws);
+        }
+        
+        // STATE: GUEST_STATE_ACKNOWLEDGED -> GUEST_STATE_READY
+        set_guest_state(shm, GUEST_STATE_READY);
+        
+        if (error_code == 2) break;
+    }
+    
+    if (local_buffer) page_free(local_buffer, local_size, guest_pages);
+}
+
+// Control echo (pthread entry): return every control message on its reply channel
+struct chan_echo {
+    struct chan_worker in;         // Host->guest control channel
+    struct ring out;               // Its guest->host reply channel
+};
+
+static void *chan_echo_loop(void *arg)
+{
+    struct chan_echo *e = (struct chan_echo *)arg;
+    struct chan_worker *w = &e->in;
+    struct wait_state ws;
+    
+    for (;;) {
+        uint32_t size = 0, sequence = 0;
+        wait_begin(&ws);
+        while (!ring_try_pop(&w->ring, w->buffer, w->size, &size, &sequence, NULL)) {
+            if (__atomic_load_n(w->stop, __ATOMIC_ACQUIRE) && !ring_has_data(&w->ring)) {
+                return NULL;
+            }
+            wait_step(w->wait, &ws);
+        }
+        wait_begin(&ws);
+        while (!ring_try_push(&e->out, w->buffer, size, sequence, NULL)) {
+            if (__atomic_load_n(w->stop, __ATOMIC_ACQUIRE)) {
+                return NULL;
+            }
+            wait_step(w->wait, &ws);
+        }
+        __atomic_store_n(&w->messages, w->messages + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&w->bytes, w->bytes + size, __ATOMIC_RELAXED);
+    }
+}
+
+// Discover the host's channel directory and serve every channel in it: one
+// consumer per host->guest channel, an echo per control channel with a reply,
+// and a paced producer per remaining guest->host channel (telemetry).
+void monitor_channels(volatile struct shared_data *shm, size_t shm_size)
+{
+    printf("Guest Reader - Channel directory endpoint\n");
+    printf("Will run: one thread per channel found in the directory\n\n");
+    fflush(stdout);
+    
+    struct wait_state ws;
+    wait_for_host_init(shm);
+    
+    // Wait for the host to publish the directory (HOST_STATE_SENDING)
+    wait_begin(&ws);
+    while (get_host_state(shm) != HOST_STATE_SENDING && shm->test_complete == 0) {
+        wait_step(&guest_wait, &ws);
+    }
+    if (shm->test_complete == 1) {
+        printf("Test completion signal received. Exiting...\n");
+        return;
+    }
+    
+    size_t avail = shm_size - offsetof(struct shared_data, buffer);
+    volatile struct chan_directory *dir = (volatile struct chan_directory *)&shm->buffer[0];
+    if (!chandir_attach(dir, avail)) {
+        printf("GUEST: ERROR - No channel directory in shared memory (is the host running with -C?)\n");
+        shm->error_code = 3;
+        __sync_synchronize();
+        set_guest_state(shm, GUEST_STATE_ACKNOWLEDGED);
+        return;
+    }
+    
+    uint32_t count = dir->count;
+    struct chan_echo workers[CHANDIR_MAX_CHANNELS];
+    pthread_t threads[CHANDIR_MAX_CHANNELS];
+    bool running[CHANDIR_MAX_CHANNELS] = {false};
+    bool is_reply[CHANDIR_MAX_CHANNELS] = {false};
+    const char *roles[CHANDIR_MAX_CHANNELS] = {NULL};
+    
+    for (uint32_t i = 0; i < count; i++) {
+        if (dir->entries[i].reply != CHANNEL_NO_REPLY) {
+            is_reply[dir->entries[i].reply] = true;
+        }
+    }
+    
+    printf("Channel directory (%u channels):\n", count);
+    for (uint32_t i = 0; i < count; i++) {
+        volatile struct chan_entry *entry = &dir->entries[i];
+        struct chan_echo *e = &workers[i];
+        bool to_guest = entry->direction == CHANNEL_HOST_TO_GUEST;
+        void *(*loop)(void *) = NULL;
+        
+        memset(e, 0, sizeof(*e));
+        e->in.wait = &guest_wait;
+        e->in.stop = &dir->closed;
+        e->in.size = entry->slot_size;
+        
+        if (is_reply[i]) {
+            roles[i] = "reply";                  // Driven by its control channel's echo
+        } else if (to_guest && entry->reply != CHANNEL_NO_REPLY) {
+            roles[i] = "echo";
+            loop = chan_echo_loop;
+            if (!chandir_open(dir, entry->reply, &e->out, true)) loop = NULL;
+        } else if (to_guest) {
+            roles[i] = "consume";
+            loop = chan_consume;
+        } else {
+            roles[i] = "produce";
+            loop = chan_produce;
+            e->in.period_ns = entry->period_us * 1000ULL;
+        }
+        
+        printf("  %-14s %-9s %s  %2u x %8u B  period %6u us  -> %s\n", (const char *)entry->name,
+               channel_type_name(entry->type), to_guest ? "host->guest" : "guest->host",
+               entry->slot_count, entry->slot_size, entry->period_us, roles[i]);
+        
+        if (!loop) {
+            continue;
+        }
+        e->in.buffer = guest_buffer_alloc(shm, entry->slot_size);
+        if (!e->in.buffer) {
+            printf("GUEST: ERROR - Failed to allocate a buffer for channel %s\n", (const char *)entry->name);
+            exit(1);
+        }
+        memset(e->in.buffer, (int)i, entry->slot_size);
+        if (!chandir_open(dir, i, &e->in.ring, !to_guest) || pthread_create(&threads[i], NULL, loop, e) != 0) {
+            printf("GUEST: ERROR - Failed to start channel %s\n", (const char *)entry->name);
+            shm->error_code = 3;
+            page_free(e->in.buffer, entry->slot_size, guest_pages);
+            e->in.buffer = NULL;
+            continue;
+        }
+        running[i] = true;
+    }
+    printf("\n");
+    fflush(stdout);
+    
+    // STATE: GUEST_STATE_READY -> GUEST_STATE_PROCESSING (channel threads running)
+    set_guest_state(shm, GUEST_STATE_PROCESSING);
+    
+    for (uint32_t i = 0; i < count; i++) {
+        if (running[i]) pthread_join(threads[i], NULL);
+    }
+    
+    printf("Channels closed by host:\n");
+    for (uint32_t i = 0; i < count; i++) {
+        if (!workers[i].in.buffer) {
+            continue;
+        }
+        printf("  %-14s %-7s %10lu messages  %10.1f MB\n", (const char *)dir->entries[i].name, roles[i],
+               (unsigned long)workers[i].in.messages, workers[i].in.bytes / (1024.0 * 1024.0));
+        page_free(workers[i].in.buffer, dir->entries[i].slot_size, guest_pages);
+    }
+    fflush(stdout);
+    
+    // STATE: GUEST_STATE_PROCESSING -> GUEST_STATE_ACKNOWLEDGED
+    set_guest_state(shm, GUEST_STATE_ACKNOWLEDGED);
+    
+    wait_begin(&ws);
+    while (get_host_state(shm) != HOST_STATE_READY && shm->test_complete == 0) {
+        wait_step(&guest_wait, &ws);
+    }
+    
+    // STATE: GUEST_STATE_ACKNOWLEDGED -> GUEST_STATE_READY
+    set_guest_state(shm, GUEST_STATE_READY);
+}
+
+// Cold-cache read throughput from the shared region for 1..max_threads copy
+// threads. Standalone (no host involved): shows where the BAR stops scaling.
+void guest_copy_scaling(volatile struct shared_data *shm, size_t shm_size, int iterations, int max_threads)
+{
+    size_t data_size = shm_size - offsetof(struct shared_data, buffer);
+    uint8_t *data_ptr = (uint8_t *)&shm->buffer[0];
+    
+    // Same size as the largest bandwidth frame (4K) when it fits
+    size_t frame_size = 3840 * 2160 * 3;
+    if (frame_size > data_size) frame_size = data_size;
+    double size_mb = frame_size / (1024.0 * 1024.0);
+    
+    uint8_t *local_buffer = page_alloc(frame_size, &guest_pages);
+    if (!local_buffer) {
+        printf("GUEST: ERROR - Failed to allocate local buffer\n");
+        return;
+    }
+    
+    printf("Guest Reader - Copy scaling from the shared region\n");
+    printf("Frame: %.2f MB | Threads: 1..%d | Iterations per point: %d (cold cache)\n\n",
+           size_mb, max_threads, iterations);
+    printf("  Threads | Read from region | Speedup\n");
+    printf("  --------+------------------+--------\n");
+    
+    double base_bw = 0;
+    
+    // Powers of two, always ending on max_threads
+    for (int threads = 1; ; threads = threads * 2 < max_threads ? threads * 2 : max_threads) {
+        struct copy_pool pool;
+        if (!copy_pool_init(&pool, threads, guest_memcpy)) {
+            printf("  %7d | failed to start worker threads\n", threads);
+            copy_pool_destroy(&pool);
+            break;
+        }
+        
+        copy_pool_run(&pool, local_buffer, data_ptr, frame_size);
+        
+        double bw_sum = 0;
+        for (int iter = 0; iter < iterations; iter++) {
+            flush_cache_range(data_ptr, frame_size);
+            
+            uint64_t start = get_time_ns();
+            copy_pool_run(&pool, local_buffer, data_ptr, frame_size);
+            __sync_synchronize();
+            uint64_t duration = get_time_ns() - start;
+            
+            bw_sum += size_mb / (duration / 1e9);
+        }
+        copy_pool_destroy(&pool);
+        
+        double bw = bw_sum / iterations;
+        if (threads == 1) base_bw = bw;
+        printf("  %7d | %11.0f MB/s | %6.2fx\n", threads, bw, bw / base_bw);
+        fflush(stdout);
+        
+        if (threads == max_threads) break;
+    }
+    
+    page_free(local_buffer, frame_size, guest_pages);
+}
+
+int main(int argc, char *argv[])
+{
+    printf("Guest Reader - ivshmem Performance Test with Timing Analysis\n");
+    printf("============================================================\n\n");
+    
+    // Parse command line arguments
+    bool expect_latency = false;
+    bool expect_bandwidth = false;
+    bool expect_ring = false;
+    bool expect_pipeline = false;
+    bool expect_fanout = false;
+    bool expect_mailbox = false;
+    bool expect_message_rate = false;
+    bool expect_batch = false;
+    bool expect_duplex = false;
+    bool expect_channels = false;
+    bool expect_alloc = false;
+    bool expect_zerocopy = false;
+    bool expect_stripes = false;
+    bool expect_wakeup = false;
+    bool expect_clock_sync = false;
+    const char *doorbell_path = NULL;
+    int message_count = 10000;
+    int display_hz = 0;
+    int latency_count = 1000;
+    int bandwidth_count = 10;
+    int ring_count = 100;
+    int custom_count = -1;
+    
+    bool copy_scaling = false;
+    int scaling_count = 20;
+    int copy_threads = 1;
+    const char *shm_path = SHMEM_PATH;
+    int numa_node = -1;
+    int guest_cpu = -1;
+    
+    wait_policy_defaults(&guest_wait, WAIT_POLICY_BACKOFF);
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        } else if (strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "--latency") == 0) {
+            expect_latency = true;
+            if (i + 1 < argc && isdigit(argv[i + 1][0])) {
+                latency_count = atoi(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--bandwidth") == 0) {
+            expect_bandwidth = true;
+            if (i + 1 < argc && isdigit(argv[i + 1][0])) {
+                bandwidth_count = atoi(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--ring") == 0) {
+            expect_ring = true;
+            if (i + 1 < argc && isdigit(argv[i + 1][0])) {
+                ring_count = atoi(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "-F") == 0 || strcmp(argv[i], "--fanout") == 0) {
+            expect_fanout = true;
+        } else if (strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--pipeline") == 0) {
+            expect_pipeline = true;
+        } else if (strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "--message-rate") == 0) {
+            expect_message_rate = true;
+            if (i + 1 < argc && isdigit(argv[i + 1][0])) {
+                message_count = atoi(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "-B") == 0 || strcmp(argv[i], "--batch") == 0) {
+            expect_batch = true;
+        } else if (strcmp(argv[i], "-D") == 0 || strcmp(argv[i], "--duplex") == 0) {
+            expect_duplex = true;
+        } else if (strcmp(argv[i], "-C") == 0 || strcmp(argv[i], "--channels") == 0) {
+            expect_channels = true;
+        } else if (strcmp(argv[i], "-A") == 0 || strcmp(argv[i], "--alloc") == 0) {
+            expect_alloc = true;
+        } else if (strcmp(argv[i], "-Z") == 0 || strcmp(argv[i], "--zero-copy") == 0) {
+            expect_zerocopy = true;
+        } else if (strcmp(argv[i], "-S") == 0 || strcmp(argv[i], "--stripes") == 0) {
+            expect_stripes = true;
+        } else if (strcmp(argv[i], "-W") == 0 || strcmp(argv[i], "--wakeup") == 0) {
+            expect_wakeup = true;
+        } else if (strcmp(argv[i], "-T") == 0 || strcmp(argv[i], "--clock-sync") == 0) {
+            expect_clock_sync = true;
+        } else if (strcmp(argv[i], "--doorbell") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --doorbell needs a socket path or uio\n");
+                return 1;
+            }
+            doorbell_path = argv[++i];
+        } else if (strcmp(argv[i], "-M") == 0 || strcmp(argv[i], "--mailbox") == 0) {
+            expect_mailbox = true;
+        } else if (strcmp(argv[i], "--fps") == 0) {
+            if (i + 1 < argc) {
+                display_hz = atoi(argv[++i]);
+            }
+            if (display_hz < 0) {
+                fprintf(stderr, "Error: invalid frame rate (0 = unpaced)\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "--wait") == 0) {
+            if (i + 1 >= argc || !wait_policy_parse(argv[++i], &guest_wait)) {
+                fprintf(stderr, "Error: invalid wait policy (use spin, yield, backoff, usleep, doorbell, futex, pause or umwait)\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--production") == 0) {
+            guest_production = true;
+        } else if (strcmp(argv[i], "--pages") == 0) {
+            if (i + 1 >= argc || !page_kind_parse(argv[++i], &guest_pages)) {
+                fprintf(stderr, "Error: invalid page kind (use 4k, thp or hugetlb)\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--shm") == 0) {
+            if (i + 1 < argc) {
+                shm_path = argv[++i];
+            }
+        } else if (strcmp(argv[i], "--numa-node") == 0) {
+            if (i + 1 < argc) {
+                numa_node = atoi(argv[++i]);
+            }
+            if (numa_node < 0 || numa_node >= numa_node_count()) {
+                fprintf(stderr, "Error: invalid NUMA node (0-%d)\n", numa_node_count() - 1);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cpu") == 0) {
+            if (i + 1 < argc) {
+                guest_cpu = atoi(argv[++i]);
+            }
+            if (numa_cpu_node(guest_cpu) < 0) {
+                fprintf(stderr, "Error: invalid CPU (not online)\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--copy-threads") == 0) {
+            if (i + 1 < argc) {
+                copy_threads = atoi(argv[++i]);
+            }
+            if (copy_threads < 1 || copy_threads > COPY_POOL_MAX_THREADS) {
+                fprintf(stderr, "Error: copy thread count must be 1-%d\n", COPY_POOL_MAX_THREADS);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--copy-scaling") == 0) {
+            copy_scaling = true;
+            if (i + 1 < argc && isdigit(argv[i + 1][0])) {
+                scaling_count = atoi(argv[++i]);
+                if (scaling_count <= 0) scaling_count = 1;
+            }
+        } else if (strcmp(argv[i], "--wait-spins") == 0) {
+            if (i + 1 < argc) {
+                guest_wait.spin_limit = (uint32_t)atoi(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--pause-count") == 0) {
+            if (i + 1 < argc) {
+                guest_wait.pause_count = (uint32_t)atoi(argv[++i]);
+                if (guest_wait.pause_count == 0) guest_wait.pause_count = 1;
+            }
+        } else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--count") == 0) {
+            if (i + 1 < argc) {
+                custom_count = atoi(argv[++i]);
+            } else {
+                fprintf(stderr, "Error: -c requires a count argument\n");
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    if (expect_ring && (expect_latency || expect_bandwidth)) {
+        fprintf(stderr, "Error: the ring streaming test runs on its own\n");
+        return 1;
+    }
+    
+    if (expect_fanout && (expect_latency || expect_bandwidth || expect_ring)) {
+        fprintf(stderr, "Error: the fan-out test runs on its own\n");
+        return 1;
+    }
+    
+    if (expect_pipeline && (expect_latency || expect_bandwidth || expect_ring || expect_fanout)) {
+        fprintf(stderr, "Error: the pipelined frame test runs on its own\n");
+        return 1;
+    }
+    
+    if (expect_mailbox && (expect_latency || expect_bandwidth || expect_ring || expect_fanout || expect_pipeline)) {
+        fprintf(stderr, "Error: the mailbox test runs on its own\n");
+        return 1;
+    }
+    
+    if (expect_message_rate && (expect_latency || expect_bandwidth || expect_ring || expect_fanout || expect_pipeline ||
+                                expect_mailbox)) {
+        fprintf(stderr, "Error: the message rate test runs on its own\n");
+        return 1;
+    }
+    
+    if (expect_batch && (expect_latency || expect_bandwidth || expect_ring || expect_fanout || expect_pipeline ||
+                         expect_mailbox || expect_message_rate)) {
+        fprintf(stderr, "Error: the batched submission test runs on its own\n");
+        return 1;
+    }
+    
+    if (expect_duplex && (expect_latency || expect_bandwidth || expect_ring || expect_fanout || expect_pipeline ||
+                          expect_mailbox || expect_message_rate || expect_batch)) {
+        fprintf(stderr, "Error: the full duplex test runs on its own\n");
+        return 1;
+    }
+    
+    if (expect_channels && (expect_latency || expect_bandwidth || expect_ring || expect_fanout || expect_pipeline ||
+                            expect_mailbox || expect_message_rate || expect_batch || expect_duplex)) {
+        fprintf(stderr, "Error: the channel directory test runs on its own\n");
+        return 1;
+    }
+    
+    if (expect_alloc && (expect_latency || expect_bandwidth || expect_ring || expect_fanout || expect_pipeline ||
+                         expect_mailbox || expect_message_rate || expect_batch || expect_duplex || expect_channels)) {
+        fprintf(stderr, "Error: the region allocator test runs on its own\n");
+        return 1;
+    }
+    
+    if (expect_zerocopy && (expect_latency || expect_bandwidth || expect_ring || expect_fanout || expect_pipeline ||
+                            expect_mailbox || expect_message_rate || expect_batch || expect_duplex ||
+                            expect_channels || expect_alloc)) {
+        fprintf(stderr, "Error: the zero-copy test runs on its own\n");
+        return 1;
+    }
+    
+    if (expect_stripes && (expect_latency || expect_bandwidth || expect_ring || expect_fanout || expect_pipeline ||
+                           expect_mailbox || expect_message_rate || expect_batch || expect_duplex ||
+                           expect_channels || expect_alloc || expect_zerocopy)) {
+        fprintf(stderr, "Error: the striped transfer test runs on its own\n");
+        return 1;
+    }
+    
+    if (expect_wakeup && (expect_latency || expect_bandwidth || expect_ring || expect_fanout || expect_pipeline ||
+                          expect_mailbox || expect_message_rate || expect_batch || expect_duplex ||
+                          expect_channels || expect_alloc || expect_zerocopy || expect_stripes)) {
+        fprintf(stderr, "Error: the wake-up test runs on its own\n");
+        return 1;
+    }
+    
+    if (guest_wait.kind == WAIT_POLICY_DOORBELL && !doorbell_path) {
+        fprintf(stderr, "Error: the doorbell wait policy needs --doorbell\n");
+        return 1;
+    }
+    
+    if (!expect_latency && !expect_bandwidth && !expect_ring && !expect_fanout && !expect_pipeline && !expect_mailbox &&
+        !expect_message_rate && !expect_batch && !expect_duplex && !expect_channels &&
+        !expect_alloc && !expect_zerocopy && !expect_stripes && !expect_wakeup && !expect_clock_sync) {
+        expect_latency = true;
+        expect_bandwidth = true;
+    }
+    
+    int expected_count;
+    if (custom_count > 0) {
+        expected_count = custom_count;
+    } else if (expect_ring) {
+        expected_count = ring_count;
+    } else if (expect_message_rate) {
+        expected_count = message_count * MSG_RATE_STEPS;
+    } else if (expect_latency && expect_bandwidth) {
+        expected_count = latency_count + bandwidth_count;
+    } else if (expect_latency) {
+        expected_count = latency_count;
+    } else {
+        expected_count = bandwidth_count;
+    }
+    
+    printf("Configuration:\n");
+    printf("  Expect latency: %s (%d messages)\n", expect_latency ? "yes" : "no", latency_count);
+    printf("  Expect bandwidth: %s (%d iterations)\n", expect_bandwidth ? "yes" : "no", bandwidth_count);
+    printf("  Expect ring stream: %s (%d frames)\n", expect_ring ? "yes" : "no", ring_count);
+    printf("  Expect fan-out stream: %s (until closed by host)\n", expect_fanout ? "yes" : "no");
+    printf("  Expect pipeline stream: %s (until closed by host)\n", expect_pipeline ? "yes" : "no");
+    printf("  Expect mailbox stream: %s (until closed by host)\n", expect_mailbox ? "yes" : "no");
+    printf("  Expect message rate sweep: %s (%d messages per size)\n", expect_message_rate ? "yes" : "no", message_count);
+    printf("  Expect batched messages: %s (until closed by host)\n", expect_batch ? "yes" : "no");
+    printf("  Expect full duplex: %s (%d phases)\n", expect_duplex ? "yes" : "no", DUPLEX_PHASES);
+    printf("  Expect channel directory: %s (until closed by host)\n", expect_channels ? "yes" : "no");
+    printf("  Expect region allocator: %s (%d phases)\n", expect_alloc ? "yes" : "no", RALLOC_PHASES);
+    printf("  Expect zero-copy kernels: %s (%d phases)\n", expect_zerocopy ? "yes" : "no",
+           KERNEL_COUNT * KBENCH_MODE_COUNT);
+    printf("  Expect striped transfer: %s (%d phases)\n", expect_stripes ? "yes" : "no", STRIPE_SWEEP_COUNT);
+    printf("  Expect wake-up test: %s (up to %d phases)\n", expect_wakeup ? "yes" : "no", WAKEUP_PHASES);
+    printf("  Clock sync responder: %s\n", expect_clock_sync ? "yes (answers host probes alongside the test)" : "no");
+    printf("  Doorbell: %s\n", doorbell_path ? doorbell_path : "off (polling only)");
+    printf("  Wait policy: %s (spin limit %u)\n", wait_policy_name(guest_wait.kind), guest_wait.spin_limit);
+    timing_init();
+    if (timing.tsc) {
+        printf("  Timer: TSC %.3f MHz, overhead %u ns, resolution %.2f ns (clock_gettime: %u ns)\n",
+               timing.tsc_hz / 1e6, timing.overhead_ns, timing.resolution_ns, timing.clock_overhead_ns);
+    } else {
+        printf("  Timer: clock_gettime, overhead %u ns, resolution %.0f ns (no invariant TSC)\n",
+               timing.overhead_ns, timing.resolution_ns);
+    }
+    if (guest_wait.kind == WAIT_POLICY_UMWAIT && !wait_umwait_supported()) {
+        printf("  Note: no WAITPKG on this CPU, umwait falls back to pause (%u per re-check)\n", guest_wait.pause_count);
+    }
+    printf("  Copy threads: %d\n", copy_threads);
+    printf("  Receive path: %s\n", guest_production ? "production (fused copy+digest)" : "measurement (Phases A-E)");
+    printf("  NUMA: %d node%s, reader on node %d%s\n", numa_node_count(), numa_node_count() == 1 ? "" : "s",
+           guest_cpu >= 0 ? numa_cpu_node(guest_cpu) : numa_node >= 0 ? numa_node : numa_current_node(),
+           guest_cpu >= 0 ? " (pinned CPU)" : "");
+    printf("  Total expected messages: %d\n\n", expected_count);
+    fflush(stdout);
+    
+    wait_policy_apply(&guest_wait);
+    
+    // Node placement before the pool starts, so copy workers inherit it
+    if (numa_node >= 0 && (!numa_pin_node(numa_node) || !numa_prefer_node(numa_node))) {
+        fprintf(stderr, "Error: cannot place the reader on node %d: %s\n", numa_node, strerror(errno));
+        return 1;
+    }
+    
+    if (!copy_scaling && !copy_pool_init(&guest_pool, copy_threads, guest_memcpy)) {
+        fprintf(stderr, "Error: failed to start %d copy threads\n", copy_threads);
+        return 1;
+    }
+    
+    if (guest_cpu >= 0 && !numa_pin_cpu(guest_cpu)) {
+        fprintf(stderr, "Error: cannot pin the reader to CPU %d: %s\n", guest_cpu, strerror(errno));
+        return 1;
+    }
+    
+    // Check device
+    int fd;
+    struct stat st;
+    const char *device_path = PCI_RESOURCE_PATH;
+    
+    if (access(PCI_RESOURCE_PATH, F_OK) != 0) {
+        printf("INFO: PCI device not found, trying shared memory for host testing...\n");
+        device_path = shm_path;
+        guest_local_shm = true;
+        
+        if (access(shm_path, F_OK) != 0) {
+            printf("ERROR: Neither PCI device nor shared memory found\n");
+            printf("Make sure you're running this inside the VM or have shared memory set up.\n");
+            return 1;
+        }
+    }
+    
+    // Open resource
+    fd = open(device_path, O_RDWR | O_SYNC);
+    if (fd < 0) {
+        perror("Failed to open device resource");
+        printf("\nTry running with sudo:\n");
+        printf("  sudo %s\n", argv[0]);
+        return 1;
+    }
+    
+    // Get resource size
+    if (fstat(fd, &st) < 0) {
+        perror("fstat");
+        close(fd);
+        return 1;
+    }
+    
+    printf("Resource: %s\n", device_path);
+    printf("Resource size: %ld bytes (%ld MB)\n", 
+           st.st_size, st.st_size / (1024 * 1024));
+    guest_shm_kb = shm_page_kb(fd);
+    printf("Resource pages: %u KB | Local buffers: %s pages\n", guest_shm_kb, page_kind_name(guest_pages));
+    fflush(stdout);
+    
+    // Map memory
+    void *ptr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, 
+                     MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        perror("mmap");
+        printf("\nTry running with sudo:\n");
+        printf("  sudo %s\n", argv[0]);
+        close(fd);
+        return 1;
+    }
+    
+    volatile struct shared_data *shm = (volatile struct shared_data *)ptr;
+    
+    // Join the doorbell before the handshake so the host can ring us from the first state change
+    if (doorbell_path) {
+        bool uio = strcmp(doorbell_path, "uio") == 0;
+        if (uio ? !doorbell_open_uio(&guest_doorbell, PCI_DEVICE_PATH) : !doorbell_connect(&guest_doorbell, doorbell_path)) {
+            printf("ERROR: Cannot open the doorbell (%s): %s\n", uio ? PCI_DEVICE_PATH " via UIO" : doorbell_path,
+                   strerror(errno));
+            munmap(ptr, st.st_size);
+            close(fd);
+            return 1;
+        }
+        guest_wait.doorbell = &guest_doorbell;
+        printf("Doorbell: %s peer %ld\n", doorbell_kind_name(guest_doorbell.kind), (long)guest_doorbell.id);
+    }
+    shm->guest_doorbell_peer = guest_doorbell.kind != DOORBELL_NONE ? (uint32_t)guest_doorbell.id : DOORBELL_NO_PEER;
+    
+    // Umwait monitors the host's state line; other waits re-check on the UMWAIT timeout
+    guest_wait.monitor_word = &shm->host_state;
+    
+    // Futex waits only reach the host when both sides map the same host pages
+    if (guest_local_shm) {
+        guest_wait.futex_word = &shm->host_wake;
+    } else if (guest_wait.kind == WAIT_POLICY_FUTEX) {
+        printf("ERROR: The futex wait policy needs the host-local region (--shm), not the PCI device\n");
+        munmap(ptr, st.st_size);
+        close(fd);
+        return 1;
+    }
+    shm->guest_futex = guest_local_shm ? 1 : 0;
+    shm->guest_tsc_khz = timing_tsc_khz();
+    shm->guest_timer_overhead_ns = timing.overhead_ns;
+    
+    shm->guest_clock_sync = 0;
+    if (expect_clock_sync) {
+        // A previous run's echo could match a fresh probe number
+        __atomic_store_n(&shm->sync_echo, 0, __ATOMIC_RELEASE);
+        if (pthread_create(&clock_sync_thread, NULL, clock_sync_responder, (void *)shm) != 0) {
+            printf("ERROR: Failed to start the clock sync responder\n");
+            munmap(ptr, st.st_size);
+            close(fd);
+            return 1;
+        }
+        shm->guest_clock_sync = 1;
+    }
+    
+    // Initialize guest state
+    set_guest_state(shm, GUEST_STATE_UNINITIALIZED);
+    
+    printf("Mapped at address: %p\n", ptr);
+    printf("Ready to receive data from host.\n\n");
+    fflush(stdout);
+    
+    printf("Initial values:\n");
+    printf("  Magic: 0x%08X\n", shm->magic);
+    printf("  Sequence: %u\n", shm->sequence);
+    printf("  Data size: %u\n", shm->data_size);
+    printf("  Error code: %u\n", shm->error_code);
+    printf("  Test complete: %u\n", shm->test_complete);
+    printf("  Host state: %u (%s)\n", shm->host_state, host_state_name((host_state_t)shm->host_state));
+    printf("  Guest state: %u (%s)\n", shm->guest_state, guest_state_name((guest_state_t)shm->guest_state));
+    printf("\n");
+    fflush(stdout);
+    
+    if (copy_scaling) {
+        int max_threads = copy_threads;
+        if (max_threads == 1) {
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            max_threads = cpus < 1 ? 1 : cpus > COPY_POOL_MAX_THREADS ? COPY_POOL_MAX_THREADS : (int)cpus;
+        }
+        guest_copy_scaling(shm, st.st_size, scaling_count, max_threads);
+        munmap(ptr, st.st_size);
+        close(fd);
+        return 0;
+    }
+    
+    // Start monitoring
+    if (expect_ring) {
+        monitor_ring(shm, st.st_size, expected_count);
+    } else if (expect_fanout) {
+        monitor_fanout(shm, st.st_size);
+    } else if (expect_pipeline) {
+        monitor_pipeline(shm, st.st_size);
+    } else if (expect_message_rate) {
+        monitor_message_rate(shm, custom_count > 0 ? custom_count : message_count);
+    } else if (expect_batch) {
+        monitor_batch(shm, st.st_size);
+    } else if (expect_duplex) {
+        monitor_duplex(shm, st.st_size);
+    } else if (expect_channels) {
+        monitor_channels(shm, st.st_size);
+    } else if (expect_alloc) {
+        monitor_alloc(shm, st.st_size);
+    } else if (expect_zerocopy) {
+        monitor_zerocopy(shm, st.st_size);
+    } else if (expect_stripes) {
+        monitor_stripes(shm, st.st_size);
+    } else if (expect_wakeup) {
+        monitor_wakeup(shm);
+    } else if (expect_mailbox) {
+        monitor_mailbox(shm, st.st_size, display_hz);
+    } else if (!expect_latency && !expect_bandwidth) {
+        monitor_clock_sync(shm);
+    } else {
+        monitor_latency(shm, expect_latency, expect_bandwidth, expected_count);
+    }
+    
+    // Cleanup
+    if (expect_clock_sync) {
+        // The host may still probe after the last message; answer until it completes
+        uint64_t linger_start = get_time_ns();
+        struct wait_state ws;
+        wait_begin(&ws);
+        while (shm->test_complete == 0 && get_time_ns() - linger_start < 5000000000ULL) {
+            wait_step(&guest_wait, &ws);
+        }
+        clock_sync_stop = true;
+        pthread_join(clock_sync_thread, NULL);
+        shm->guest_clock_sync = 0;
+        printf("Clock sync: %lu probes answered\n", (unsigned long)clock_sync_answered);
+    }
+    if (guest_doorbell.kind != DOORBELL_NONE) {
+        printf("Doorbell: %lu rings sent, %lu waits woken by the host\n", (unsigned long)guest_doorbell.rings,
+               (unsigned long)guest_doorbell.wakeups);
+        doorbell_close(&guest_doorbell);
+    }
+    copy_pool_destroy(&guest_pool);
     munmap(ptr, st.st_size);
     close(fd);
     
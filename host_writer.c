@@ -23,20 +23,85 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "common.h"
+#include "timing.h"
 #include "performance_counters.h"
+#include "ring_buffer.h"
+#include "broadcast_ring.h"
+#include "duplex.h"
+#include "frame_pipeline.h"
+#include "mailbox.h"
+#include "message_queue.h"
+#include "channel_directory.h"
+#include "region_alloc.h"
+#include "frame_kernels.h"
+#include "frame_stripes.h"
+#include "doorbell.h"
+#include "wait_policy.h"
+#include "clock_sync.h"
+#include "copy_kernels.h"
+#include "parallel_copy.h"
+#include "integrity.h"
+#include "hugepages.h"
+#include "numa.h"
 
 #define SHMEM_PATH "/dev/shm/ivshmem"
 #define SHMEM_SIZE (64 * 1024 * 1024)  // 64MB
 #define FRAME_SIZE (3840 * 2160 * 4)    // 4K RGBA frame (33MB)
 
-static inline uint64_t get_time_ns(void)
-{
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
-}
+// Frame formats used by the bandwidth and streaming tests
+static const struct {
+    int width, height, bpp;
+    const char *name;
+} test_frames[] = {
+    {1920, 1080, 3, "1080p"},
+    {2560, 1440, 3, "1440p"},
+    {3840, 2160, 3, "4K"},
+    {0, 0, 0, NULL}
+};
+
+// Polling strategy for every wait loop (selected with -w/--wait)
+static struct wait_policy host_wait;
+
+// Kernel used to write frames into shared memory (selected with --copy-kernel)
+static const struct copy_kernel *host_copy;
+
+// Worker pool that stripes frame writes across --copy-threads threads
+static struct copy_pool host_pool;
+
+// Frame digest the guest verifies against (selected with --verify)
+static digest_algo_t host_verify = DIGEST_SHA256;
+
+// Page kind for local frame buffers (--pages) and page size of the shared region's backing file
+static page_kind_t host_pages = PAGES_4K;
+static uint32_t host_shm_page_kb;
+
+// NUMA node the writer runs on and node holding the shared region (-1 = unknown)
+static int host_node = -1;
+static int shm_node = -1;
+
+// Bandwidth test producer: copy a pre-rendered frame in (false), or render
+// straight into the reserved shared buffer (true, --produce direct)
+static bool host_direct_write = false;
+
+// Doorbell to the guest (--doorbell), and the stand-in ivshmem-server if we run it (--doorbell-server)
+static struct doorbell host_doorbell;
+static struct doorbell_server host_doorbell_server;
+static bool host_doorbell_serving = false;
+
+// Append to existing CSVs instead of truncating them (set between --numa-matrix passes)
+static bool csv_append = false;
+
+// Per-frame averages from one test_bandwidth() run
+#define MAX_TEST_FRAMES 8
+struct bandwidth_summary {
+    int successful[MAX_TEST_FRAMES];
+    double host_mbps[MAX_TEST_FRAMES];
+    double guest_mbps[MAX_TEST_FRAMES];
+    double total_mbps[MAX_TEST_FRAMES];
+};
 
 // Debug logging function
 static void debug_log(const char *format, ...)
@@ -58,6 +123,10 @@ static void set_host_state(volatile struct shared_data *shm, host_state_t new_st
         printf("HOST STATE: %s -> %s\n", host_state_name(old_state), host_state_name(new_state));
         shm->host_state = (uint32_t)new_state;
         __sync_synchronize();
+        wait_notify(&shm->host_wake);
+        if (host_doorbell.kind != DOORBELL_NONE && shm->guest_doorbell_peer != DOORBELL_NO_PEER) {
+            doorbell_ring(&host_doorbell, shm->guest_doorbell_peer, 0);
+        }
     }
 }
 
@@ -71,6 +140,18 @@ static guest_state_t get_guest_state(volatile struct shared_data *shm)
     return (guest_state_t)shm->guest_state;
 }
 
+// Name of the polling strategy the guest reported at startup
+static const char *guest_wait_name(volatile struct shared_data *shm)
+{
+    return wait_policy_name((wait_policy_kind_t)shm->guest_wait_policy);
+}
+
+// Name of the page kind backing the guest's local buffers
+static const char *guest_pages_name(volatile struct shared_data *shm)
+{
+    return page_kind_name((page_kind_t)shm->guest_local_pages);
+}
+
 // CSV result logging helper
 typedef struct {
     FILE *file;
@@ -82,10 +163,10 @@ static csv_logger_t* csv_create(const char *filename, const char *header)
     csv_logger_t *logger = malloc(sizeof(csv_logger_t));
     if (!logger) return NULL;
     
-    logger->file = fopen(filename, "w");
+    logger->file = fopen(filename, csv_append ? "a" : "w");
     logger->filename = filename;
     
-    if (logger->file && header) {
+    if (logger->file && header && !csv_append) {
         fprintf(logger->file, "%s\n", header);
     }
     
@@ -95,8 +176,9 @@ static csv_logger_t* csv_create(const char *filename, const char *header)
 static void csv_write_bandwidth_result(csv_logger_t *logger, int iteration, const char *frame_name,
                                      int width, int height, int bpp, size_t size_bytes,
                                      uint64_t write_ns, uint64_t roundtrip_ns, 
-                                     uint64_t guest_read_ns, uint64_t guest_verify_ns,
-                                     bool success)
+                                     uint64_t guest_read_ns, uint64_t guest_verify_ns, uint64_t guest_fused_ns,
+                                     const char *guest_wait, uint32_t guest_copy_threads, bool success,
+                                     uint64_t staged_ns)
 {
     if (logger && logger->file) {
         double size_mb = size_bytes / (1024.0 * 1024.0);
@@ -104,15 +186,19 @@ static void csv_write_bandwidth_result(csv_logger_t *logger, int iteration, cons
         double read_bw = success && guest_read_ns > 0 ? (size_mb / (guest_read_ns / 1e9)) : 0.0;
         uint64_t total_ns = write_ns + roundtrip_ns;
         double total_bw = success && total_ns > 0 ? (size_mb / (total_ns / 1e9)) : 0.0;
+        double fused_bw = success && guest_fused_ns > 0 ? (size_mb / (guest_fused_ns / 1e9)) : 0.0;
         
-        fprintf(logger->file, "%d,%s,%d,%d,%d,%zu,%.2f,%lu,%.2f,%.2f,%lu,%.2f,%lu,%.2f,%.2f,%lu,%.2f,%lu,%.2f,%.2f,%d\n",
+        fprintf(logger->file, "%d,%s,%d,%d,%d,%zu,%.2f,%lu,%.2f,%.2f,%lu,%.2f,%lu,%.2f,%.2f,%lu,%.2f,%lu,%.2f,%.2f,%d,%s,%s,%s,%d,%u,%s,%lu,%.2f,%.2f,%d,%d,%s,%lu\n",
                 iteration, frame_name, width, height, bpp, size_bytes, size_mb,
                 write_ns, write_ns / 1000000.0, write_bw,
                 roundtrip_ns, roundtrip_ns / 1000000.0,
                 guest_read_ns, guest_read_ns / 1000000.0, read_bw,
                 guest_verify_ns, guest_verify_ns / 1000000.0,
                 total_ns, total_ns / 1000000.0, total_bw,
-                success ? 1 : 0);
+                success ? 1 : 0, wait_policy_name(host_wait.kind), guest_wait,
+                host_copy->name, host_pool.threads, guest_copy_threads, digest_name(host_verify),
+                guest_fused_ns, guest_fused_ns / 1000000.0, fused_bw, host_node, shm_node,
+                host_direct_write ? "direct" : "copy", staged_ns);
     }
 }
 
@@ -127,13 +213,11 @@ static void csv_close(csv_logger_t *logger)
     }
 }
 
-// Calculate SHA256 hash of buffer
-static void calculate_sha256(const uint8_t *data, size_t len, uint8_t *hash)
+// Publish the digest of the current frame (algorithm tag first)
+static void publish_digest(volatile struct shared_data *shm, const uint8_t *digest)
 {
-    SHA256_CTX ctx;
-    SHA256_Init(&ctx);
-    SHA256_Update(&ctx, data, len);
-    SHA256_Final(hash, &ctx);
+    shm->digest_algo = (uint32_t)host_verify;
+    memcpy((void *)shm->data_digest, digest, DIGEST_MAX_SIZE);
 }
 
 // Generate random frame buffer (width x height x 24bpp)
@@ -155,20 +239,63 @@ static void generate_random_frame(uint8_t *buffer, int width, int height) {
     }
 }
 
+// Synthetic capture source: fill a frame with a cheap pseudo-random stream so
+// rendering costs about one write pass, like a decoder or capture DMA would
+static void render_frame(uint8_t *dst, size_t size, uint64_t seed)
+{
+    uint64_t x = seed | 1;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        memcpy(dst + i, &x, 8);
+    }
+    for (; i < size; i++) {
+        dst[i] = (uint8_t)(x >> (8 * (i & 7)));
+    }
+}
+
+// Single-buffer producer API. The data area is the one slot of the basic
+// protocol and is free whenever both sides are READY: reserve it, write the
+// frame in place, then commit publishes size, sequence and digest and hands
+// it to the guest (HOST_STATE_SENDING).
+static uint8_t *frame_reserve(volatile struct shared_data *shm, size_t size)
+{
+    if (size > SHMEM_SIZE - offsetof(struct shared_data, buffer) || get_guest_state(shm) != GUEST_STATE_READY) {
+        return NULL;
+    }
+    return (uint8_t *)&shm->buffer[0];
+}
+
+static void frame_commit(volatile struct shared_data *shm, uint32_t size, uint32_t sequence, const uint8_t *digest)
+{
+    shm->sequence = sequence;
+    shm->data_size = size;
+    publish_digest(shm, digest);
+    __sync_synchronize();
+    set_host_state(shm, HOST_STATE_SENDING);
+}
+
 // Wait for guest state change with timeout
 static bool wait_for_guest_state(volatile struct shared_data *shm, guest_state_t expected_state, 
                                   uint64_t timeout_ns, const char *description)
 {
     uint64_t start_time = get_time_ns();
+    struct wait_state ws;
+    wait_begin(&ws);
     
-    while (get_guest_state(shm) != expected_state) {
+    // A fast guest (e.g. --production) can finish and acknowledge before we
+    // ever observe PROCESSING, so ACKNOWLEDGED satisfies a wait for PROCESSING
+    while (get_guest_state(shm) != expected_state &&
+           !(expected_state == GUEST_STATE_PROCESSING && get_guest_state(shm) == GUEST_STATE_ACKNOWLEDGED)) {
         if (get_time_ns() - start_time > timeout_ns) {
             debug_log("TIMEOUT waiting for guest state %s (current: %s)", 
                      guest_state_name(expected_state), 
                      guest_state_name(get_guest_state(shm)));
             return false;
         }
-        usleep(10); // 10 microsecond polling interval
+        wait_step(&host_wait, &ws);
     }
     
     return true;
@@ -179,14 +306,14 @@ void test_latency(volatile struct shared_data *shm, int iterations)
     printf("\n=== Latency Test - Measuring Actual Transmission Overhead ===\n");
     printf("Measuring %d messages with 4K frame data...\n", iterations);
     printf("Host: memcpy to shared memory | Guest: memcpy from shared memory\n");
-    printf("(Data generation and SHA256 done outside measurement)\n\n");
+    printf("(Data generation and digest done outside measurement)\n\n");
     
     // Create CSV loggers - separate files for timing and performance metrics
     csv_logger_t *csv = csv_create("latency_results.csv", 
-        "iteration,host_memcpy_ns,host_memcpy_us,roundtrip_ns,roundtrip_us,guest_memcpy_ns,guest_memcpy_us,guest_verify_ns,guest_verify_us,guest_hot_cache_ns,guest_hot_cache_us,guest_cold_cache_ns,guest_cold_cache_us,guest_second_pass_ns,guest_second_pass_us,guest_cached_verify_ns,guest_cached_verify_us,notification_est_ns,notification_est_us,total_ns,total_us,success");
+        "iteration,host_memcpy_ns,host_memcpy_us,roundtrip_ns,roundtrip_us,guest_memcpy_ns,guest_memcpy_us,guest_verify_ns,guest_verify_us,guest_hot_cache_ns,guest_hot_cache_us,guest_cold_cache_ns,guest_cold_cache_us,guest_second_pass_ns,guest_second_pass_us,guest_cached_verify_ns,guest_cached_verify_us,notification_est_ns,notification_est_us,total_ns,total_us,success,host_wait_policy,guest_wait_policy,verify_algo,guest_fused_ns,guest_fused_us");
     
     csv_logger_t *perf_csv = csv_create("latency_performance.csv",
-        "iteration,host_l1_cache_misses,host_l1_cache_references,host_l1_miss_rate,host_llc_misses,host_llc_references,host_llc_miss_rate,host_tlb_misses,host_cpu_cycles,host_instructions,host_ipc,host_cycles_per_byte,host_context_switches,guest_l1_cache_misses,guest_l1_cache_references,guest_l1_miss_rate,guest_llc_misses,guest_llc_references,guest_llc_miss_rate,guest_tlb_misses,guest_cpu_cycles,guest_instructions,guest_ipc,guest_cycles_per_byte,guest_context_switches");
+        "iteration,host_l1_cache_misses,host_l1_cache_references,host_l1_miss_rate,host_llc_misses,host_llc_references,host_llc_miss_rate,host_tlb_misses,host_cpu_cycles,host_instructions,host_ipc,host_cycles_per_byte,host_context_switches,guest_l1_cache_misses,guest_l1_cache_references,guest_l1_miss_rate,guest_llc_misses,guest_llc_references,guest_llc_miss_rate,guest_tlb_misses,guest_cpu_cycles,guest_instructions,guest_ipc,guest_cycles_per_byte,guest_context_switches,shm_page_kb,host_pages,guest_shm_page_kb,guest_pages");
     
     // Calculate available buffer size and use 4K frame for latency test
     size_t header_size = offsetof(struct shared_data, buffer);
@@ -207,7 +334,7 @@ void test_latency(volatile struct shared_data *shm, int iterations)
     
     // PRE-GENERATE test data (do this ONCE, outside measurements)
     printf("Pre-generating test frame data...\n");
-    uint8_t *test_frame = malloc(frame_size);
+    uint8_t *test_frame = page_alloc(frame_size, &host_pages);
     if (!test_frame) {
         printf("ERROR: Failed to allocate test frame buffer\n");
         csv_close(csv);
@@ -216,9 +343,9 @@ void test_latency(volatile struct shared_data *shm, int iterations)
     
     generate_random_frame(test_frame, width, height);
     
-    // Pre-calculate SHA256 of test data
-    uint8_t expected_hash[32];
-    calculate_sha256(test_frame, frame_size, expected_hash);
+    // Pre-calculate digest of test data
+    uint8_t expected_hash[DIGEST_MAX_SIZE];
+    digest_compute(host_verify, test_frame, frame_size, expected_hash);
     
     printf("Test data ready. Starting measurements...\n\n");
     
@@ -255,7 +382,7 @@ void test_latency(volatile struct shared_data *shm, int iterations)
         // Prepare message headers BEFORE timing
         shm->sequence = i;
         shm->data_size = frame_size;
-        memcpy((void*)shm->data_sha256, expected_hash, 32);
+        publish_digest(shm, expected_hash);
         __sync_synchronize();
         
         // MEASUREMENT 1: Host memcpy time + performance counters - THIS IS THE ACTUAL WRITE OVERHEAD
@@ -268,7 +395,7 @@ void test_latency(volatile struct shared_data *shm, int iterations)
         
         uint64_t memcpy_start = get_time_ns();
         
-        memcpy((void*)data_ptr, test_frame, frame_size);
+        copy_pool_run(&host_pool, (void*)data_ptr, test_frame, frame_size);
         __sync_synchronize(); // Ensure write completes before timing ends
         
         uint64_t memcpy_end = get_time_ns();
@@ -288,10 +415,12 @@ void test_latency(volatile struct shared_data *shm, int iterations)
         if (!wait_for_guest_state(shm, GUEST_STATE_PROCESSING, 1000000000ULL, "guest processing")) {
             printf("  [%d] TIMEOUT (guest didn't start processing)\n", i);
             if (csv && csv->file) {
-                fprintf(csv->file, "%d,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0\n", i);
+                fprintf(csv->file, "%d,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,%s,%s,%s,0,0\n", i,
+                        wait_policy_name(host_wait.kind), guest_wait_name(shm), digest_name(host_verify));
             }
             if (perf_csv && perf_csv->file) {
-                fprintf(perf_csv->file, "%d,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0\n", i);
+                fprintf(perf_csv->file, "%d,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,%u,%s,%u,%s\n", i,
+                        host_shm_page_kb, page_kind_name(host_pages), shm->guest_shm_page_kb, guest_pages_name(shm));
             }
             continue;
         }
@@ -300,10 +429,12 @@ void test_latency(volatile struct shared_data *shm, int iterations)
         if (!wait_for_guest_state(shm, GUEST_STATE_ACKNOWLEDGED, 10000000000ULL, "guest acknowledged")) {
             printf("  [%d] TIMEOUT (guest didn't finish processing)\n", i);
             if (csv && csv->file) {
-                fprintf(csv->file, "%d,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0\n", i);
+                fprintf(csv->file, "%d,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,%s,%s,%s,0,0\n", i,
+                        wait_policy_name(host_wait.kind), guest_wait_name(shm), digest_name(host_verify));
             }
             if (perf_csv && perf_csv->file) {
-                fprintf(perf_csv->file, "%d,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0\n", i);
+                fprintf(perf_csv->file, "%d,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,%u,%s,%u,%s\n", i,
+                        host_shm_page_kb, page_kind_name(host_pages), shm->guest_shm_page_kb, guest_pages_name(shm));
             }
             continue;
         }
@@ -314,10 +445,12 @@ void test_latency(volatile struct shared_data *shm, int iterations)
         if (shm->error_code != 0) {
             printf("  [%d] ERROR: %u\n", i, shm->error_code);
             if (csv && csv->file) {
-                fprintf(csv->file, "%d,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0\n", i);
+                fprintf(csv->file, "%d,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,%s,%s,%s,0,0\n", i,
+                        wait_policy_name(host_wait.kind), guest_wait_name(shm), digest_name(host_verify));
             }
             if (perf_csv && perf_csv->file) {
-                fprintf(perf_csv->file, "%d,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0\n", i);
+                fprintf(perf_csv->file, "%d,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,%u,%s,%u,%s\n", i,
+                        host_shm_page_kb, page_kind_name(host_pages), shm->guest_shm_page_kb, guest_pages_name(shm));
             }
             continue;
         }
@@ -336,6 +469,7 @@ void test_latency(volatile struct shared_data *shm, int iterations)
         uint64_t guest_cold_cache_time = shm->timing.guest_cold_cache_duration;
         uint64_t guest_second_pass_time = shm->timing.guest_second_pass_duration;
         uint64_t guest_cached_verify_time = shm->timing.guest_cached_verify_duration;
+        uint64_t guest_fused_time = shm->timing.guest_fused_duration;
         
         // Estimate notification overhead
         uint64_t notification_est = (roundtrip_time > guest_total_time) ? 
@@ -372,7 +506,7 @@ void test_latency(volatile struct shared_data *shm, int iterations)
         
         // Write timing data to main CSV (clean and readable)
         if (csv && csv->file) {
-            fprintf(csv->file, "%d,%lu,%.2f,%lu,%.2f,%lu,%.2f,%lu,%.2f,%lu,%.2f,%lu,%.2f,%lu,%.2f,%lu,%.2f,%lu,%.2f,%lu,%.2f,%d\n",
+            fprintf(csv->file, "%d,%lu,%.2f,%lu,%.2f,%lu,%.2f,%lu,%.2f,%lu,%.2f,%lu,%.2f,%lu,%.2f,%lu,%.2f,%lu,%.2f,%lu,%.2f,%d,%s,%s,%s,%lu,%.2f\n",
                     i, 
                     memcpy_time, memcpy_time / 1000.0,
                     roundtrip_time, roundtrip_time / 1000.0,
@@ -384,12 +518,13 @@ void test_latency(volatile struct shared_data *shm, int iterations)
                     guest_cached_verify_time, guest_cached_verify_time / 1000.0,
                     notification_est, notification_est / 1000.0,
                     total_time, total_time / 1000.0,
-                    1);
+                    1, wait_policy_name(host_wait.kind), guest_wait_name(shm), digest_name(host_verify),
+                    guest_fused_time, guest_fused_time / 1000.0);
         }
         
         // Write performance metrics to separate CSV
         if (perf_csv && perf_csv->file) {
-            fprintf(perf_csv->file, "%d,%lu,%lu,%.4f,%lu,%lu,%.4f,%lu,%lu,%lu,%.2f,%.2f,%lu,%lu,%lu,%.4f,%lu,%lu,%.4f,%lu,%lu,%lu,%.2f,%.2f,%lu\n",
+            fprintf(perf_csv->file, "%d,%lu,%lu,%.4f,%lu,%lu,%.4f,%lu,%lu,%lu,%.2f,%.2f,%lu,%lu,%lu,%.4f,%lu,%lu,%.4f,%lu,%lu,%lu,%.2f,%.2f,%lu,%u,%s,%u,%s\n",
                     i,
                     // Host performance metrics
                     host_perf_results.l1_cache_misses, host_perf_results.l1_cache_references, host_perf_results.l1_cache_miss_rate,
@@ -400,7 +535,8 @@ void test_latency(volatile struct shared_data *shm, int iterations)
                     shm->timing.guest_perf.l1_cache_misses, shm->timing.guest_perf.l1_cache_references, guest_l1_miss_rate,
                     shm->timing.guest_perf.llc_misses, shm->timing.guest_perf.llc_references, guest_llc_miss_rate,
                     shm->timing.guest_perf.tlb_misses, shm->timing.guest_perf.cpu_cycles, shm->timing.guest_perf.instructions,
-                    guest_ipc, guest_cycles_per_byte, shm->timing.guest_perf.context_switches);
+                    guest_ipc, guest_cycles_per_byte, shm->timing.guest_perf.context_switches,
+                    host_shm_page_kb, page_kind_name(host_pages), shm->guest_shm_page_kb, guest_pages_name(shm));
         }
         
         if (successful % 100 == 0 || iterations <= 10) {
@@ -458,13 +594,13 @@ void test_latency(volatile struct shared_data *shm, int iterations)
         
         printf("\nNote: Notification time is estimated as (round-trip - guest_total)\n");
         printf("      Includes polling delay and state machine overhead\n");
-        printf("      SHA256 verification is for testing only, not part of real transmission\n");
+        printf("      Verify uses the %s digest (--verify)\n", digest_name(host_verify));
     } else {
         printf("\nNo successful measurements. Is the guest program running?\n");
     }
     
     // Cleanup
-    free(test_frame);
+    page_free(test_frame, frame_size, host_pages);
     csv_close(csv);
     csv_close(perf_csv);
     
@@ -473,11 +609,16 @@ void test_latency(volatile struct shared_data *shm, int iterations)
     }
 }
 
-void test_bandwidth(volatile struct shared_data *shm, int iterations)
+void test_bandwidth(volatile struct shared_data *shm, int iterations, struct bandwidth_summary *summary)
 {
     printf("\n=== Bandwidth Test - Measuring Actual Memory Copy Bandwidth ===\n");
-    printf("Host: memcpy to shared memory | Guest: memcpy from shared memory\n");
-    printf("(Data generation and SHA256 done outside measurement)\n\n");
+    if (host_direct_write) {
+        printf("Host: render frame in place into the reserved shared buffer | Guest: memcpy from shared memory\n");
+        printf("(Digest done outside measurement; render into a heap buffer + copy timed separately for reference)\n\n");
+    } else {
+        printf("Host: memcpy to shared memory | Guest: memcpy from shared memory\n");
+        printf("(Data generation and digest done outside measurement)\n\n");
+    }
     
     // Initialize performance counters for bandwidth test
     struct perf_counters perf_counters;
@@ -493,23 +634,12 @@ void test_bandwidth(volatile struct shared_data *shm, int iterations)
     size_t header_size = offsetof(struct shared_data, buffer);
     size_t max_data_size = SHMEM_SIZE - header_size;
     
-    // Test different frame sizes
-    struct {
-        int width, height, bpp;
-        const char *name;
-    } test_frames[] = {
-        {1920, 1080, 3, "1080p"},
-        {2560, 1440, 3, "1440p"},
-        {3840, 2160, 3, "4K"},
-        {0, 0, 0, NULL}
-    };
-    
     // Create CSV loggers - separate files for timing and performance metrics
     csv_logger_t *csv = csv_create("bandwidth_results.csv", 
-        "iteration,frame_type,width,height,bpp,size_bytes,size_mb,host_memcpy_ns,host_memcpy_ms,host_memcpy_mbps,roundtrip_ns,roundtrip_ms,guest_memcpy_ns,guest_memcpy_ms,guest_memcpy_mbps,guest_verify_ns,guest_verify_ms,total_ns,total_ms,total_mbps,success");
+        "iteration,frame_type,width,height,bpp,size_bytes,size_mb,host_memcpy_ns,host_memcpy_ms,host_memcpy_mbps,roundtrip_ns,roundtrip_ms,guest_memcpy_ns,guest_memcpy_ms,guest_memcpy_mbps,guest_verify_ns,guest_verify_ms,total_ns,total_ms,total_mbps,success,host_wait_policy,guest_wait_policy,copy_kernel,copy_threads,guest_copy_threads,verify_algo,guest_fused_ns,guest_fused_ms,guest_fused_mbps,host_node,shm_node,produce_mode,staged_write_ns");
     
     csv_logger_t *perf_csv = csv_create("bandwidth_performance.csv",
-        "iteration,frame_type,host_l1_cache_misses,host_l1_cache_references,host_l1_miss_rate,host_llc_misses,host_llc_references,host_llc_miss_rate,host_tlb_misses,host_cpu_cycles,host_instructions,host_ipc,host_cycles_per_byte,host_context_switches,guest_l1_cache_misses,guest_l1_cache_references,guest_l1_miss_rate,guest_llc_misses,guest_llc_references,guest_llc_miss_rate,guest_tlb_misses,guest_cpu_cycles,guest_instructions,guest_ipc,guest_cycles_per_byte,guest_context_switches");
+        "iteration,frame_type,host_l1_cache_misses,host_l1_cache_references,host_l1_miss_rate,host_llc_misses,host_llc_references,host_llc_miss_rate,host_tlb_misses,host_cpu_cycles,host_instructions,host_ipc,host_cycles_per_byte,host_context_switches,guest_l1_cache_misses,guest_l1_cache_references,guest_l1_miss_rate,guest_llc_misses,guest_llc_references,guest_llc_miss_rate,guest_tlb_misses,guest_cpu_cycles,guest_instructions,guest_ipc,guest_cycles_per_byte,guest_context_switches,shm_page_kb,host_pages,guest_shm_page_kb,guest_pages");
     
     for (int frame_idx = 0; test_frames[frame_idx].name != NULL; frame_idx++) {
         int width = test_frames[frame_idx].width;
@@ -528,18 +658,19 @@ void test_bandwidth(volatile struct shared_data *shm, int iterations)
         
         // PRE-GENERATE test data for this frame size
         printf("Pre-generating test frame...\n");
-        uint8_t *test_frame = malloc(frame_size);
+        uint8_t *test_frame = page_alloc(frame_size, &host_pages);
         if (!test_frame) {
             printf("ERROR: Failed to allocate test frame\n");
             continue;
         }
         
-        generate_random_frame(test_frame, width, height);
-        
-        uint8_t expected_hash[32];
-        calculate_sha256(test_frame, frame_size, expected_hash);
+        uint8_t expected_hash[DIGEST_MAX_SIZE];
+        if (!host_direct_write) {
+            generate_random_frame(test_frame, width, height);
+            digest_compute(host_verify, test_frame, frame_size, expected_hash);
+        }
         
-        double total_host_bw = 0.0, total_guest_bw = 0.0, total_overall_bw = 0.0;
+        double total_host_bw = 0.0, total_guest_bw = 0.0, total_overall_bw = 0.0, total_staged_bw = 0.0;
         int successful = 0;
         
         for (int iter = 0; iter < iterations; iter++) {
@@ -550,15 +681,17 @@ void test_bandwidth(volatile struct shared_data *shm, int iterations)
             shm->error_code = 0;
             __sync_synchronize();
             
-            uint8_t *data_ptr = (uint8_t *)&shm->buffer[0];
-            
-            // Prepare headers BEFORE timing
-            shm->sequence = 0xFFFF + iter;
-            shm->data_size = frame_size;
-            memcpy((void *)shm->data_sha256, expected_hash, 32);
-            __sync_synchronize();
+            uint8_t *data_ptr = frame_reserve(shm, frame_size);
+            if (!data_ptr) {
+                printf("  [%d] Shared buffer not free (guest is %s)\n", iter + 1, guest_state_name(get_guest_state(shm)));
+                csv_write_bandwidth_result(csv, iter + 1, test_frames[frame_idx].name,
+                                         width, height, 24, frame_size, 0, 0, 0, 0, 0,
+                                         guest_wait_name(shm), shm->guest_copy_threads, false, 0);
+                continue;
+            }
+            uint64_t render_seed = ((uint64_t)(frame_idx + 1) << 32) ^ (uint64_t)(iter + 1);
             
-            // MEASURE: Host memcpy bandwidth + performance counters
+            // MEASURE: Host memcpy (or in-place render) bandwidth + performance counters
             struct perf_results host_perf_results = {0};
             
             // Start performance counters
@@ -567,7 +700,11 @@ void test_bandwidth(volatile struct shared_data *shm, int iterations)
             }
             
             uint64_t memcpy_start = get_time_ns();
-            memcpy((void*)data_ptr, test_frame, frame_size);
+            if (host_direct_write) {
+                render_frame(data_ptr, frame_size, render_seed);
+            } else {
+                copy_pool_run(&host_pool, (void*)data_ptr, test_frame, frame_size);
+            }
             __sync_synchronize();
             uint64_t memcpy_end = get_time_ns();
             
@@ -576,17 +713,23 @@ void test_bandwidth(volatile struct shared_data *shm, int iterations)
                 perf_counters_stop(&perf_counters, &host_perf_results, frame_size);
             }
             
+            if (host_direct_write) {
+                digest_compute(host_verify, data_ptr, frame_size, expected_hash);
+            }
+            
             // MEASURE: Round-trip time
             uint64_t roundtrip_start = get_time_ns();
-            set_host_state(shm, HOST_STATE_SENDING);
+            frame_commit(shm, frame_size, 0xFFFF + iter, expected_hash);
             
             if (!wait_for_guest_state(shm, GUEST_STATE_PROCESSING, 2000000000ULL, "guest processing")) {
                 printf("  [%d] TIMEOUT\n", iter + 1);
                 csv_write_bandwidth_result(csv, iter + 1, test_frames[frame_idx].name,
-                                         width, height, 24, frame_size, 0, 0, 0, 0, false);
+                                         width, height, 24, frame_size, 0, 0, 0, 0, 0,
+                                         guest_wait_name(shm), shm->guest_copy_threads, false, 0);
                 if (perf_csv && perf_csv->file) {
-                    fprintf(perf_csv->file, "%d,%s,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0\n", 
-                            iter + 1, test_frames[frame_idx].name);
+                    fprintf(perf_csv->file, "%d,%s,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,%u,%s,%u,%s\n", 
+                            iter + 1, test_frames[frame_idx].name,
+                            host_shm_page_kb, page_kind_name(host_pages), shm->guest_shm_page_kb, guest_pages_name(shm));
                 }
                 continue;
             }
@@ -594,23 +737,39 @@ void test_bandwidth(volatile struct shared_data *shm, int iterations)
             if (!wait_for_guest_state(shm, GUEST_STATE_ACKNOWLEDGED, 10000000000ULL, "guest acknowledged")) {
                 printf("  [%d] TIMEOUT (processing)\n", iter + 1);
                 csv_write_bandwidth_result(csv, iter + 1, test_frames[frame_idx].name,
-                                         width, height, 24, frame_size, 0, 0, 0, 0, false);
+                                         width, height, 24, frame_size, 0, 0, 0, 0, 0,
+                                         guest_wait_name(shm), shm->guest_copy_threads, false, 0);
                 if (perf_csv && perf_csv->file) {
-                    fprintf(perf_csv->file, "%d,%s,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0\n", 
-                            iter + 1, test_frames[frame_idx].name);
+                    fprintf(perf_csv->file, "%d,%s,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,%u,%s,%u,%s\n", 
+                            iter + 1, test_frames[frame_idx].name,
+                            host_shm_page_kb, page_kind_name(host_pages), shm->guest_shm_page_kb, guest_pages_name(shm));
                 }
                 continue;
             }
             
             uint64_t roundtrip_end = get_time_ns();
             
+            // Reference for direct mode: the same frame rendered into a heap buffer
+            // and copied in. The guest is done with the buffer, and it is in the
+            // same just-read state the in-place render found it in.
+            uint64_t staged_ns = 0;
+            if (host_direct_write) {
+                uint64_t staged_start = get_time_ns();
+                render_frame(test_frame, frame_size, render_seed);
+                copy_pool_run(&host_pool, (void*)data_ptr, test_frame, frame_size);
+                __sync_synchronize();
+                staged_ns = get_time_ns() - staged_start;
+            }
+            
             if (shm->error_code != 0) {
                 printf("  [%d] FAILED (error: %u)\n", iter + 1, shm->error_code);
                 csv_write_bandwidth_result(csv, iter + 1, test_frames[frame_idx].name,
-                                         width, height, 24, frame_size, 0, 0, 0, 0, false);
+                                         width, height, 24, frame_size, 0, 0, 0, 0, 0,
+                                         guest_wait_name(shm), shm->guest_copy_threads, false, 0);
                 if (perf_csv && perf_csv->file) {
-                    fprintf(perf_csv->file, "%d,%s,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0\n", 
-                            iter + 1, test_frames[frame_idx].name);
+                    fprintf(perf_csv->file, "%d,%s,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,%u,%s,%u,%s\n", 
+                            iter + 1, test_frames[frame_idx].name,
+                            host_shm_page_kb, page_kind_name(host_pages), shm->guest_shm_page_kb, guest_pages_name(shm));
                 }
                 continue;
             }
@@ -626,6 +785,7 @@ void test_bandwidth(volatile struct shared_data *shm, int iterations)
             uint64_t guest_cold_cache_time = shm->timing.guest_cold_cache_duration;
             uint64_t guest_second_pass_time = shm->timing.guest_second_pass_duration;
             uint64_t guest_cached_verify_time = shm->timing.guest_cached_verify_duration;
+            uint64_t guest_fused_time = shm->timing.guest_fused_duration;
             uint64_t total_time = host_memcpy_time + roundtrip_time;
             
             double size_mb = frame_size / (1024.0 * 1024.0);
@@ -633,13 +793,21 @@ void test_bandwidth(volatile struct shared_data *shm, int iterations)
             double guest_bw = size_mb / (guest_memcpy_time / 1e9);
             double total_bw = size_mb / (total_time / 1e9);
             
+            double staged_bw = staged_ns > 0 ? size_mb / (staged_ns / 1e9) : 0.0;
+            
             total_host_bw += host_bw;
             total_guest_bw += guest_bw;
             total_overall_bw += total_bw;
+            total_staged_bw += staged_bw;
             successful++;
             
-            printf("  [%d] Host: %.0f MB/s | Guest: %.0f MB/s | Verify: %.1f ms | Total: %.0f MB/s\n",
-                   iter + 1, host_bw, guest_bw, guest_verify_time / 1000000.0, total_bw);
+            if (host_direct_write) {
+                printf("  [%d] Host: %.0f MB/s in place (render+copy %.0f MB/s) | Guest: %.0f MB/s | Verify: %.1f ms | Total: %.0f MB/s\n",
+                       iter + 1, host_bw, staged_bw, guest_bw, guest_verify_time / 1000000.0, total_bw);
+            } else {
+                printf("  [%d] Host: %.0f MB/s | Guest: %.0f MB/s | Verify: %.1f ms | Total: %.0f MB/s\n",
+                       iter + 1, host_bw, guest_bw, guest_verify_time / 1000000.0, total_bw);
+            }
             
             // Extract guest performance metrics
             double guest_l1_miss_rate = shm->timing.guest_perf.l1_cache_miss_rate_x10000 / 10000.0;
@@ -651,11 +819,12 @@ void test_bandwidth(volatile struct shared_data *shm, int iterations)
             csv_write_bandwidth_result(csv, iter + 1, test_frames[frame_idx].name,
                                      width, height, 24, frame_size, 
                                      host_memcpy_time, roundtrip_time, 
-                                     guest_memcpy_time, guest_verify_time, true);
+                                     guest_memcpy_time, guest_verify_time, guest_fused_time,
+                                     guest_wait_name(shm), shm->guest_copy_threads, true, staged_ns);
             
             // Write to bandwidth performance CSV
             if (perf_csv && perf_csv->file) {
-                fprintf(perf_csv->file, "%d,%s,%lu,%lu,%.4f,%lu,%lu,%.4f,%lu,%lu,%lu,%.2f,%.2f,%lu,%lu,%lu,%.4f,%lu,%lu,%.4f,%lu,%lu,%lu,%.2f,%.2f,%lu\n",
+                fprintf(perf_csv->file, "%d,%s,%lu,%lu,%.4f,%lu,%lu,%.4f,%lu,%lu,%lu,%.2f,%.2f,%lu,%lu,%lu,%.4f,%lu,%lu,%.4f,%lu,%lu,%lu,%.2f,%.2f,%lu,%u,%s,%u,%s\n",
                         iter + 1, test_frames[frame_idx].name,
                         // Host performance metrics
                         host_perf_results.l1_cache_misses, host_perf_results.l1_cache_references, host_perf_results.l1_cache_miss_rate,
@@ -666,7 +835,8 @@ void test_bandwidth(volatile struct shared_data *shm, int iterations)
                         shm->timing.guest_perf.l1_cache_misses, shm->timing.guest_perf.l1_cache_references, guest_l1_miss_rate,
                         shm->timing.guest_perf.llc_misses, shm->timing.guest_perf.llc_references, guest_llc_miss_rate,
                         shm->timing.guest_perf.tlb_misses, shm->timing.guest_perf.cpu_cycles, shm->timing.guest_perf.instructions,
-                        guest_ipc, guest_cycles_per_byte, shm->timing.guest_perf.context_switches);
+                        guest_ipc, guest_cycles_per_byte, shm->timing.guest_perf.context_switches,
+                        host_shm_page_kb, page_kind_name(host_pages), shm->guest_shm_page_kb, guest_pages_name(shm));
             }
             
             set_host_state(shm, HOST_STATE_READY);
@@ -678,6 +848,13 @@ void test_bandwidth(volatile struct shared_data *shm, int iterations)
             usleep(100000);
         }
         
+        if (summary && frame_idx < MAX_TEST_FRAMES) {
+            summary->successful[frame_idx] = successful;
+            summary->host_mbps[frame_idx] = successful > 0 ? total_host_bw / successful : 0.0;
+            summary->guest_mbps[frame_idx] = successful > 0 ? total_guest_bw / successful : 0.0;
+            summary->total_mbps[frame_idx] = successful > 0 ? total_overall_bw / successful : 0.0;
+        }
+        
         if (successful > 0) {
             printf("\n  %s Results (%d/%d successful):\n", test_frames[frame_idx].name, successful, iterations);
             printf("    Avg Host memcpy BW:   %.0f MB/s (%.2f GB/s)\n", 
@@ -686,9 +863,16 @@ void test_bandwidth(volatile struct shared_data *shm, int iterations)
                    total_guest_bw / successful, (total_guest_bw / successful) / 1024.0);
             printf("    Avg Overall BW:       %.0f MB/s (%.2f GB/s)\n", 
                    total_overall_bw / successful, (total_overall_bw / successful) / 1024.0);
+            if (host_direct_write && total_staged_bw > 0) {
+                double direct = total_host_bw / successful, staged = total_staged_bw / successful;
+                printf("    Render + copy in:     %.0f MB/s -> render in place %.0f MB/s (%.0f%% less host write time,\n",
+                       staged, direct, 100.0 * (1.0 - staged / direct));
+                printf("                          %.2f MB less memory traffic per frame: no heap write and read-back)\n",
+                       2.0 * frame_size / (1024.0 * 1024.0));
+            }
         }
         
-        free(test_frame);
+        page_free(test_frame, frame_size, host_pages);
     }
     
     csv_close(csv);
@@ -699,154 +883,3863 @@ void test_bandwidth(volatile struct shared_data *shm, int iterations)
     }
 }
 
-void print_usage(const char *prog_name) {
-    printf("Usage: %s [OPTIONS]\n", prog_name);
-    printf("Options:\n");
-    printf("  -l, --latency [COUNT]     Run latency test (default: 100 messages)\n");
-    printf("  -b, --bandwidth [COUNT]   Run bandwidth test (default: 10 iterations)\n");
-    printf("  -c, --count COUNT         Number of messages/iterations\n");
-    printf("  -h, --help               Show this help\n");
-    printf("\nExamples:\n");
-    printf("  %s -l 1                  Send single latency message\n", prog_name);
-    printf("  %s -l 100                Send 100 latency messages\n", prog_name);
-    printf("  %s -b 5                  Run 5 bandwidth iterations\n", prog_name);
-    printf("  %s -l -b                 Run both tests with defaults\n", prog_name);
+// Restrict the calling thread to `node` (CPUs and first-touch memory) and
+// restart the copy pool so its workers inherit the new affinity
+static bool place_on_node(int node, int copy_threads)
+{
+    if (!numa_pin_node(node) || !numa_prefer_node(node)) {
+        printf("WARNING: Cannot place the writer on node %d: %s\n", node, strerror(errno));
+        return false;
+    }
+    copy_pool_destroy(&host_pool);
+    if (!copy_pool_init(&host_pool, copy_threads, host_copy->copy)) {
+        printf("ERROR: Failed to restart %d copy threads on node %d\n", copy_threads, node);
+        return false;
+    }
+    host_node = node;
+    return true;
 }
 
-void init_shared_memory(volatile struct shared_data *shm) {
-    printf("HOST: Starting initialization...\n");
-    
-    guest_state_t guest_state = get_guest_state(shm);
-    if (guest_state != GUEST_STATE_UNINITIALIZED) {
-        printf("HOST: Detected guest started first (state: %s), clearing...\n", 
-               guest_state_name(guest_state));
+// Bind the shared region to `node` and record where its pages actually are
+static void bind_region(volatile struct shared_data *shm, size_t shm_size, int node)
+{
+    if (!numa_bind_memory((void *)shm, shm_size, node)) {
+        printf("WARNING: mbind of the shared region to node %d failed: %s\n", node, strerror(errno));
+    }
+    shm_node = numa_page_node((const void *)&shm->buffer[0]);
+    if (shm_node != node) {
+        printf("WARNING: Shared region is on node %d, not %d (pages mapped by QEMU need CAP_SYS_NICE to move)\n",
+               shm_node, node);
+    }
+}
+
+// Nodes the writer can run on and nodes that can hold the region
+static void numa_matrix_nodes(int *cpu_nodes, int *cpu_count, int *mem_nodes, int *mem_count)
+{
+    numa_cpumask_t mask;
+    *cpu_count = 0;
+    *mem_count = 0;
+    for (int n = 0; n < numa_node_count(); n++) {
+        if (numa_node_cpus(n, &mask)) cpu_nodes[(*cpu_count)++] = n;
+        if (numa_node_has_memory(n)) mem_nodes[(*mem_count)++] = n;
     }
+}
+
+// Full bandwidth test for every (writer node, region node) pair. Rows from
+// every pair go to bandwidth_results.csv; per-pair averages to numa_matrix.csv.
+void test_numa_matrix(volatile struct shared_data *shm, size_t shm_size, int iterations, int copy_threads)
+{
+    int cpu_nodes[NUMA_MAX_NODES], mem_nodes[NUMA_MAX_NODES];
+    int cpu_count, mem_count;
+    numa_matrix_nodes(cpu_nodes, &cpu_count, mem_nodes, &mem_count);
     
-    shm->magic = 0;
-    set_host_state(shm, HOST_STATE_INITIALIZING);
-    __sync_synchronize();
+    printf("\n=== NUMA Matrix - Bandwidth for Every Writer/Region Node Pair ===\n");
+    printf("Nodes: %d with CPUs, %d with memory -> %d pairs x %d iterations\n",
+           cpu_count, mem_count, cpu_count * mem_count, iterations);
     
-    shm->sequence = 0;
-    shm->data_size = 0;
-    shm->error_code = 0;
-    shm->test_complete = 0;
-    memset((void*)shm->data_sha256, 0, 32);
-    memset((void*)&shm->timing, 0, sizeof(struct timing_data));
-    __sync_synchronize();
+    static struct bandwidth_summary results[NUMA_MAX_NODES][NUMA_MAX_NODES];
+    memset(results, 0, sizeof(results));
     
-    shm->magic = MAGIC;
-    set_host_state(shm, HOST_STATE_READY);
-    __sync_synchronize();
+    for (int m = 0; m < mem_count; m++) {
+        bind_region(shm, shm_size, mem_nodes[m]);
+        for (int c = 0; c < cpu_count; c++) {
+            if (!place_on_node(cpu_nodes[c], copy_threads)) continue;
+            printf("\n--- Writer on node %d, region on node %d ---\n", host_node, shm_node);
+            test_bandwidth(shm, iterations, &results[c][m]);
+            csv_append = true;
+        }
+    }
+    csv_append = false;
     
-    printf("HOST: Initialization complete - waiting for guest...\n");
+    csv_logger_t *csv = csv_create("numa_matrix.csv",
+        "cpu_node,mem_node,frame_type,successful,host_memcpy_mbps,guest_memcpy_mbps,total_mbps,host_vs_local_pct");
     
-    if (!wait_for_guest_state(shm, GUEST_STATE_READY, 10000000000ULL, "guest ready")) {
-        printf("HOST: WARNING - Guest not ready within 10 seconds\n");
-        printf("HOST: Current guest state: %s\n", guest_state_name(get_guest_state(shm)));
-        printf("HOST: Proceeding anyway...\n");
-    } else {
-        printf("HOST: ✓ Guest ready - synchronization complete\n");
+    printf("\n=== NUMA Matrix Results (host memcpy MB/s; %% vs. region on the writer's node) ===\n");
+    for (int f = 0; test_frames[f].name != NULL && f < MAX_TEST_FRAMES; f++) {
+        printf("\n  %s\n  cpu\\mem", test_frames[f].name);
+        for (int m = 0; m < mem_count; m++) printf(" | %16d", mem_nodes[m]);
+        printf("\n");
+        
+        for (int c = 0; c < cpu_count; c++) {
+            // Local reference: region on the writer's own node (if that node has memory)
+            double local = 0.0;
+            for (int m = 0; m < mem_count; m++) {
+                if (mem_nodes[m] == cpu_nodes[c]) local = results[c][m].host_mbps[f];
+            }
+            
+            printf("  %7d", cpu_nodes[c]);
+            for (int m = 0; m < mem_count; m++) {
+                struct bandwidth_summary *r = &results[c][m];
+                double pct = local > 0.0 ? 100.0 * r->host_mbps[f] / local : 0.0;
+                printf(" | %7.0f (%5.1f%%)", r->host_mbps[f], pct);
+                if (csv && csv->file) {
+                    fprintf(csv->file, "%d,%d,%s,%d,%.2f,%.2f,%.2f,%.1f\n",
+                            cpu_nodes[c], mem_nodes[m], test_frames[f].name, r->successful[f],
+                            r->host_mbps[f], r->guest_mbps[f], r->total_mbps[f], pct);
+                }
+            }
+            printf("\n");
+        }
     }
+    
+    csv_close(csv);
 }
 
-int main(int argc, char *argv[])
+void test_ring(volatile struct shared_data *shm, int frames, int slot_count, const char *frame_name)
 {
-    bool run_latency = false;
-    bool run_bandwidth = false;
-    int latency_count = 100;
-    int bandwidth_count = 10;
+    printf("\n=== Ring Buffer Streaming Test - Pipelined Host->Guest Frames ===\n");
+    printf("Host: memcpy into free ring slot | Guest: memcpy out of oldest slot\n");
+    printf("(Host keeps writing while the guest is still reading earlier frames)\n\n");
     
-    for (int i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "--latency") == 0) {
-            run_latency = true;
-            if (i + 1 < argc && argv[i + 1][0] != '-') {
-                latency_count = atoi(argv[++i]);
-                if (latency_count <= 0) latency_count = 1;
-            }
-        } else if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--bandwidth") == 0) {
-            run_bandwidth = true;
-            if (i + 1 < argc && argv[i + 1][0] != '-') {
-                bandwidth_count = atoi(argv[++i]);
-                if (bandwidth_count <= 0) bandwidth_count = 1;
-            }
-        } else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--count") == 0) {
-            if (i + 1 < argc) {
-                int count = atoi(argv[++i]);
-                if (count > 0) {
-                    latency_count = count;
-                    bandwidth_count = count;
-                }
-            }
-        } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
-            print_usage(argv[0]);
-            return 0;
-        } else {
-            printf("Unknown option: %s\n", argv[i]);
-            print_usage(argv[0]);
-            return 1;
-        }
+    int frame_idx = 0;
+    while (test_frames[frame_idx].name != NULL && strcmp(test_frames[frame_idx].name, frame_name) != 0) {
+        frame_idx++;
+    }
+    if (test_frames[frame_idx].name == NULL) {
+        printf("ERROR: Unknown frame type '%s' (use 1080p, 1440p or 4K)\n", frame_name);
+        return;
     }
     
-    if (!run_latency && !run_bandwidth) {
-        run_latency = true;
-        run_bandwidth = true;
+    int width = test_frames[frame_idx].width;
+    int height = test_frames[frame_idx].height;
+    int bpp = test_frames[frame_idx].bpp;
+    size_t frame_size = width * height * bpp;
+    
+    // Calculate available buffer size and ring geometry
+    size_t header_size = offsetof(struct shared_data, buffer);
+    size_t max_data_size = SHMEM_SIZE - header_size;
+    uint32_t max_slots = ring_max_slots(max_data_size, frame_size);
+    
+    if (slot_count <= 0) {
+        slot_count = max_slots < RING_DEFAULT_MAX_SLOTS ? max_slots : RING_DEFAULT_MAX_SLOTS;
+    }
+    if (slot_count < 2 || (uint32_t)slot_count > max_slots) {
+        printf("ERROR: %d slots of %s (%.2f MB) don't fit in %zu bytes (max %u slots, need at least 2)\n",
+               slot_count, frame_name, frame_size / (1024.0 * 1024.0), max_data_size, max_slots);
+        return;
     }
     
-    printf("Host Writer - ivshmem Performance Test with Overhead Analysis\n");
-    printf("=============================================================\n\n");
+    printf("Streaming %d x %s frames (%dx%d, %.2f MB) through %d slots (%.2f MB ring)\n",
+           frames, frame_name, width, height, frame_size / (1024.0 * 1024.0),
+           slot_count, ring_required_size(slot_count, frame_size) / (1024.0 * 1024.0));
     
-    int fd = open(SHMEM_PATH, O_RDWR);
-    if (fd < 0) {
-        perror("Failed to open shared memory");
-        printf("Make sure the VM setup script has been run.\n");
-        return 1;
+    // PRE-GENERATE test data (do this ONCE, outside measurements)
+    printf("Pre-generating test frame data...\n");
+    uint8_t *test_frame = page_alloc(frame_size, &host_pages);
+    if (!test_frame) {
+        printf("ERROR: Failed to allocate test frame buffer\n");
+        return;
     }
     
-    struct stat st;
-    if (fstat(fd, &st) < 0) {
-        perror("fstat");
-        close(fd);
-        return 1;
+    generate_random_frame(test_frame, width, height);
+    
+    uint8_t expected_hash[DIGEST_MAX_SIZE];
+    digest_compute(host_verify, test_frame, frame_size, expected_hash);
+    
+    csv_logger_t *csv = csv_create("ring_results.csv",
+        "iteration,frame_type,slot_count,slot,size_bytes,host_write_ns,host_write_us,host_write_mbps,host_stall_ns,host_stall_us,occupancy,success,host_wait_policy,guest_wait_policy");
+    
+    // Clear timing and format the ring in the data area
+    memset((void *)&shm->timing, 0, sizeof(struct timing_data));
+    shm->error_code = 0;
+    shm->sequence = 0;
+    shm->data_size = frame_size;
+    publish_digest(shm, expected_hash);
+    
+    struct ring ring;
+    if (!ring_init(&ring, (void *)&shm->buffer[0], max_data_size, slot_count, frame_size)) {
+        printf("ERROR: Failed to initialize ring buffer\n");
+        page_free(test_frame, frame_size, host_pages);
+        csv_close(csv);
+        return;
     }
+    __sync_synchronize();
     
-    printf("Shared memory: %s (%ld bytes)\n", SHMEM_PATH, st.st_size);
+    // STATE: HOST_STATE_READY -> HOST_STATE_SENDING (ring is formatted)
+    set_host_state(shm, HOST_STATE_SENDING);
     
-    void *ptr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (ptr == MAP_FAILED) {
-        perror("mmap");
-        close(fd);
-        return 1;
+    if (!wait_for_guest_state(shm, GUEST_STATE_PROCESSING, 10000000000ULL, "guest attached to ring")) {
+        printf("ERROR: Guest did not attach to the ring (is it running with -r?)\n");
+        set_host_state(shm, HOST_STATE_READY);
+        page_free(test_frame, frame_size, host_pages);
+        csv_close(csv);
+        return;
     }
     
-    volatile struct shared_data *shm = (volatile struct shared_data *)ptr;
+    printf("Guest attached. Streaming...\n\n");
     
-    printf("Mapped at address: %p\n", ptr);
-    printf("Data buffer size: %zu bytes\n", 
-           st.st_size - offsetof(struct shared_data, buffer));
+    uint64_t total_write = 0, total_stall = 0;
+    uint64_t min_write = UINT64_MAX, max_write = 0, max_stall = 0;
+    int sent = 0;
+    double size_mb = frame_size / (1024.0 * 1024.0);
     
-    printf("\nInitializing shared memory protocol...\n");
-    init_shared_memory(shm);
+    uint64_t stream_start = get_time_ns();
     
-    printf("\nMake sure the guest program is running!\n");
-    printf("Press Enter to start tests...\n");
-    getchar();
+    for (int i = 0; i < frames; i++) {
+        // Wait for a free slot (back-pressure from the guest)
+        uint64_t stall_start = get_time_ns();
+        bool timed_out = false;
+        struct wait_state ws;
+        wait_begin(&ws);
+        while (!ring_has_space(&ring)) {
+            if (get_time_ns() - stall_start > 10000000000ULL) {
+                timed_out = true;
+                break;
+            }
+            wait_step(&host_wait, &ws);
+        }
+        uint64_t stall_time = get_time_ns() - stall_start;
+        
+        if (timed_out) {
+            printf("  [%d] TIMEOUT (no free slot - guest stopped consuming)\n", i);
+            if (csv && csv->file) {
+                fprintf(csv->file, "%d,%s,%d,0,%zu,0,0,0,0,0,0,0,%s,%s\n", i, frame_name, slot_count, frame_size,
+                        wait_policy_name(host_wait.kind), guest_wait_name(shm));
+            }
+            break;
+        }
+        
+        uint32_t slot = (uint32_t)(ring.local_index % ring.slot_count);
+        
+        uint64_t write_start = get_time_ns();
+        ring_try_push(&ring, test_frame, frame_size, i, expected_hash);
+        uint64_t write_end = get_time_ns();
+        
+        uint64_t write_time = write_end - write_start;
+        uint32_t occupancy = ring_occupancy(&ring);
+        
+        total_write += write_time;
+        total_stall += stall_time;
+        if (write_time < min_write) min_write = write_time;
+        if (write_time > max_write) max_write = write_time;
+        if (stall_time > max_stall) max_stall = stall_time;
+        sent++;
+        
+        if (csv && csv->file) {
+            fprintf(csv->file, "%d,%s,%d,%u,%zu,%lu,%.2f,%.2f,%lu,%.2f,%u,%d,%s,%s\n",
+                    i, frame_name, slot_count, slot, frame_size,
+                    write_time, write_time / 1000.0, size_mb / (write_time / 1e9),
+                    stall_time, stall_time / 1000.0, occupancy, 1,
+                    wait_policy_name(host_wait.kind), guest_wait_name(shm));
+        }
+        
+        if (frames <= 10 || (i + 1) % 100 == 0) {
+            printf("  [%d] slot %u | write %.2f µs | stall %.2f µs | occupancy %u/%d\n",
+                   i, slot, write_time / 1000.0, stall_time / 1000.0, occupancy, slot_count);
+        }
+    }
     
-    if (run_latency) {
-        test_latency(shm, latency_count);
+    // Wait for the guest to drain the ring
+    uint64_t drain_start = get_time_ns();
+    struct wait_state drain_ws;
+    wait_begin(&drain_ws);
+    while (ring_occupancy(&ring) > 0 && get_time_ns() - drain_start < 10000000000ULL) {
+        wait_step(&host_wait, &drain_ws);
     }
+    uint64_t stream_end = get_time_ns();
     
-    if (run_bandwidth) {
-        if (run_latency) {
-            printf("\nPress Enter to run bandwidth test...\n");
-            getchar();
+    bool guest_done = wait_for_guest_state(shm, GUEST_STATE_ACKNOWLEDGED, 10000000000ULL, "guest finished stream");
+    
+    if (sent > 0) {
+        uint64_t stream_time = stream_end - stream_start;
+        double fps = sent / (stream_time / 1e9);
+        
+        printf("\n=== Ring Streaming Results ===\n");
+        printf("Frames: %d/%d sent, %d slots, %.2f MB per frame\n", sent, frames, slot_count, size_mb);
+        printf("Stream duration:      %.2f ms\n", stream_time / 1000000.0);
+        printf("Throughput:           %.1f frames/s, %.0f MB/s (%.2f GB/s)\n",
+               fps, fps * size_mb, fps * size_mb / 1024.0);
+        printf("Host write (avg):     %.2f µs [%.0f MB/s] (min %.2f, max %.2f µs)\n",
+               (total_write / sent) / 1000.0, size_mb / ((total_write / sent) / 1e9),
+               min_write / 1000.0, max_write / 1000.0);
+        printf("Host stall (avg):     %.2f µs (max %.2f µs) - waiting for a free slot\n",
+               (total_stall / sent) / 1000.0, max_stall / 1000.0);
+        
+        if (guest_done) {
+            uint64_t guest_copy = shm->timing.guest_copy_duration;
+            uint64_t guest_total = shm->timing.guest_total_duration;
+            printf("Guest copy (avg):     %.2f µs [%.0f MB/s]\n",
+                   (guest_copy / sent) / 1000.0, size_mb / ((guest_copy / sent) / 1e9));
+            printf("Guest stream time:    %.2f ms (guest clock)\n", guest_total / 1000000.0);
+            if (shm->error_code != 0) {
+                printf("Guest reported error: %u\n", shm->error_code);
+            }
+        } else {
+            printf("WARNING: Guest did not acknowledge the end of the stream\n");
         }
-        test_bandwidth(shm, bandwidth_count);
+        
+        printf("\nNote: a stop-and-wait protocol is capped at 1 / (write + round trip) frames/s;\n");
+        printf("      the ring is capped by the slower of host write and guest copy.\n");
     }
     
-    set_host_state(shm, HOST_STATE_COMPLETED);
-    shm->test_complete = 1;
-    __sync_synchronize();
+    // STATE: HOST_STATE_SENDING -> HOST_STATE_READY
+    set_host_state(shm, HOST_STATE_READY);
+    
+    if (!wait_for_guest_state(shm, GUEST_STATE_READY, 1000000000ULL, "guest ready")) {
+        printf("WARNING: Guest didn't return to ready state\n");
+    }
+    
+    page_free(test_frame, frame_size, host_pages);
+    csv_close(csv);
+}
+
+// Fan-out: one producer, `readers` guests mapping the same region. Every
+// reader consumes every frame; the host reuses a slot only once the slowest
+// reader has released it. Per-reader lag and copy bandwidth show how reads
+// degrade as readers are added on the same host memory.
+void test_fanout(volatile struct shared_data *shm, int frames, int slot_count, const char *frame_name, int readers)
+{
+    printf("\n=== Fan-out Test - One Producer, %d Reader%s ===\n", readers, readers == 1 ? "" : "s");
+    printf("Host: memcpy into a slot every reader has released | Guests: each copies every frame out\n");
+    printf("(The host is paced by the slowest reader)\n\n");
+    
+    int frame_idx = 0;
+    while (test_frames[frame_idx].name != NULL && strcmp(test_frames[frame_idx].name, frame_name) != 0) {
+        frame_idx++;
+    }
+    if (test_frames[frame_idx].name == NULL) {
+        printf("ERROR: Unknown frame type '%s' (use 1080p, 1440p or 4K)\n", frame_name);
+        return;
+    }
+    
+    int width = test_frames[frame_idx].width;
+    int height = test_frames[frame_idx].height;
+    int bpp = test_frames[frame_idx].bpp;
+    size_t frame_size = width * height * bpp;
+    double size_mb = frame_size / (1024.0 * 1024.0);
+    
+    size_t header_size = offsetof(struct shared_data, buffer);
+    size_t max_data_size = SHMEM_SIZE - header_size;
+    uint32_t max_slots = bcast_max_slots(max_data_size, frame_size);
+    
+    if (slot_count <= 0) {
+        slot_count = max_slots < RING_DEFAULT_MAX_SLOTS ? max_slots : RING_DEFAULT_MAX_SLOTS;
+    }
+    if (slot_count < 2 || (uint32_t)slot_count > max_slots) {
+        printf("ERROR: %d slots of %s (%.2f MB) don't fit in %zu bytes (max %u slots, need at least 2)\n",
+               slot_count, frame_name, size_mb, max_data_size, max_slots);
+        return;
+    }
+    
+    printf("Broadcasting %d x %s frames (%dx%d, %.2f MB) through %d slots\n",
+           frames, frame_name, width, height, size_mb, slot_count);
+    
+    uint8_t *test_frame = page_alloc(frame_size, &host_pages);
+    if (!test_frame) {
+        printf("ERROR: Failed to allocate test frame buffer\n");
+        return;
+    }
+    generate_random_frame(test_frame, width, height);
+    
+    uint8_t expected_hash[DIGEST_MAX_SIZE];
+    digest_compute(host_verify, test_frame, frame_size, expected_hash);
+    
+    memset((void *)&shm->timing, 0, sizeof(struct timing_data));
+    shm->error_code = 0;
+    shm->sequence = 0;
+    shm->data_size = frame_size;
+    publish_digest(shm, expected_hash);
+    
+    struct bcast bcast;
+    if (!bcast_init(&bcast, (void *)&shm->buffer[0], max_data_size, slot_count, frame_size)) {
+        printf("ERROR: Failed to initialize broadcast ring\n");
+        page_free(test_frame, frame_size, host_pages);
+        return;
+    }
+    __sync_synchronize();
+    
+    // STATE: HOST_STATE_READY -> HOST_STATE_SENDING (ring is formatted, registration open)
+    set_host_state(shm, HOST_STATE_SENDING);
+    
+    // Hold the stream until every expected reader has registered
+    printf("Waiting for %d reader%s to register...\n", readers, readers == 1 ? "" : "s");
+    uint64_t reg_start = get_time_ns();
+    struct wait_state ws;
+    wait_begin(&ws);
+    while (bcast_registered(&bcast) < (uint32_t)readers && get_time_ns() - reg_start < 30000000000ULL) {
+        wait_step(&host_wait, &ws);
+    }
+    uint32_t admitted = bcast_close_registration(&bcast);
+    
+    if (admitted == 0) {
+        printf("ERROR: No reader registered (are the guests running with -F?)\n");
+        set_host_state(shm, HOST_STATE_READY);
+        page_free(test_frame, frame_size, host_pages);
+        return;
+    }
+    if (admitted < (uint32_t)readers) {
+        printf("WARNING: Only %u of %d readers registered within 30 s - streaming to %u\n",
+               admitted, readers, admitted);
+    }
+    printf("%u reader%s registered. Streaming...\n\n", admitted, admitted == 1 ? "" : "s");
+    
+    uint64_t total_write = 0, total_stall = 0, max_stall = 0;
+    uint32_t slowest_counts[BCAST_MAX_READERS] = {0};
+    int sent = 0;
+    
+    uint64_t stream_start = get_time_ns();
+    
+    for (int i = 0; i < frames; i++) {
+        // Wait until the slowest reader frees a slot
+        uint64_t stall_start = get_time_ns();
+        bool timed_out = false;
+        wait_begin(&ws);
+        while (!bcast_has_space(&bcast)) {
+            if (get_time_ns() - stall_start > 10000000000ULL) {
+                timed_out = true;
+                break;
+            }
+            wait_step(&host_wait, &ws);
+        }
+        uint64_t stall_time = get_time_ns() - stall_start;
+        
+        if (timed_out) {
+            printf("  [%d] TIMEOUT (no free slot - a reader stopped consuming)\n", i);
+            break;
+        }
+        
+        // Attribute real stalls to the reader holding the oldest slot
+        if (stall_time > 1000) {
+            uint32_t slowest = 0;
+            bcast_min_tail(&bcast, &slowest);
+            slowest_counts[slowest]++;
+        }
+        
+        uint64_t write_start = get_time_ns();
+        copy_pool_run(&host_pool, bcast_slot_data(&bcast, bcast.local_index), test_frame, frame_size);
+        bcast_publish(&bcast, frame_size, i);
+        total_write += get_time_ns() - write_start;
+        
+        total_stall += stall_time;
+        if (stall_time > max_stall) max_stall = stall_time;
+        sent++;
+    }
+    
+    // Wait for every reader to drain the stream
+    bcast_close(&bcast);
+    uint64_t drain_start = get_time_ns();
+    wait_begin(&ws);
+    while (!bcast_all_done(&bcast) && get_time_ns() - drain_start < 10000000000ULL) {
+        wait_step(&host_wait, &ws);
+    }
+    uint64_t stream_end = get_time_ns();
+    bool all_done = bcast_all_done(&bcast);
+    
+    csv_logger_t *csv = csv_create("fanout_results.csv",
+        "readers,reader,frame_type,slot_count,size_bytes,frames,consumed,reader_copy_mbps,reader_stall_avg_us,lag_avg,lag_max,slowest_stalls,host_fps,host_write_mbps,host_stall_avg_us,aggregate_read_mbps,success,host_wait_policy,guest_wait_policy");
+    
+    if (sent > 0) {
+        double stream_s = (stream_end - stream_start) / 1e9;
+        double fps = sent / stream_s;
+        uint64_t total_consumed = 0;
+        for (uint32_t r = 0; r < admitted; r++) {
+            total_consumed += bcast_reader_stats(&bcast, r)->tail;
+        }
+        double aggregate = total_consumed * size_mb / stream_s;
+        
+        printf("=== Fan-out Results ===\n");
+        printf("Frames: %d/%d sent to %u reader%s, %d slots, %.2f MB per frame\n",
+               sent, frames, admitted, admitted == 1 ? "" : "s", slot_count, size_mb);
+        printf("Throughput:           %.1f frames/s, %.0f MB/s written\n", fps, fps * size_mb);
+        printf("Host write (avg):     %.2f µs [%.0f MB/s]\n",
+               (total_write / sent) / 1000.0, size_mb / ((total_write / sent) / 1e9));
+        printf("Host stall (avg):     %.2f µs (max %.2f µs) - waiting for the slowest reader\n",
+               (total_stall / sent) / 1000.0, max_stall / 1000.0);
+        printf("Aggregate read:       %.0f MB/s across all readers (host clock)\n\n", aggregate);
+        
+        printf("  Reader | Consumed | Copy MB/s | Stall avg | Lag avg | Lag max | Slowest\n");
+        printf("  -------+----------+-----------+-----------+---------+---------+--------\n");
+        for (uint32_t r = 0; r < admitted; r++) {
+            volatile struct bcast_reader *rs = bcast_reader_stats(&bcast, r);
+            uint64_t consumed = rs->tail;
+            double copy_mbps = rs->copy_ns > 0 ? consumed * size_mb / (rs->copy_ns / 1e9) : 0.0;
+            double stall_us = consumed > 0 ? rs->stall_ns / 1000.0 / consumed : 0.0;
+            double lag_avg = consumed > 0 ? (double)rs->lag_sum / consumed : 0.0;
+            
+            printf("  %6u | %8lu | %9.0f | %6.1f µs | %7.2f | %7lu | %7u%s\n",
+                   r, (unsigned long)consumed, copy_mbps, stall_us, lag_avg, (unsigned long)rs->lag_max,
+                   slowest_counts[r], rs->error_code ? "  (error)" : "");
+            
+            if (csv && csv->file) {
+                fprintf(csv->file, "%u,%u,%s,%d,%zu,%d,%lu,%.0f,%.2f,%.2f,%lu,%u,%.1f,%.0f,%.2f,%.0f,%d,%s,%s\n",
+                        admitted, r, frame_name, slot_count, frame_size, sent, (unsigned long)consumed,
+                        copy_mbps, stall_us, lag_avg, (unsigned long)rs->lag_max, slowest_counts[r],
+                        fps, size_mb / ((total_write / sent) / 1e9), (total_stall / sent) / 1000.0, aggregate,
+                        rs->done && rs->error_code == 0 && consumed == (uint64_t)sent,
+                        wait_policy_name(host_wait.kind), guest_wait_name(shm));
+            }
+        }
+        
+        printf("\nLag: frames published but not yet taken by that reader, sampled as it takes each frame.\n");
+        printf("Slowest: host stalls during which that reader held the oldest slot.\n");
+        if (!all_done) {
+            printf("WARNING: Not every reader acknowledged the end of the stream\n");
+        }
+    }
+    
+    // STATE: HOST_STATE_SENDING -> HOST_STATE_READY
+    set_host_state(shm, HOST_STATE_READY);
+    
+    page_free(test_frame, frame_size, host_pages);
+    csv_close(csv);
+}
+
+// Sustained double/triple-buffered stream: the host fills one slot while the
+// guest drains another, for `seconds` seconds with no sleeps between frames.
+void test_pipeline(volatile struct shared_data *shm, int seconds, int slot_count, const char *frame_name)
+{
+    printf("\n=== Pipelined Frame Test - Sustained Host->Guest Throughput ===\n");
+    printf("Host: fill a host-owned slot, hand it to the guest | Guest: drain it, hand it back\n");
+    printf("(Per-slot ownership flags, no sleeps: writing and reading overlap)\n\n");
+    
+    int frame_idx = 0;
+    while (test_frames[frame_idx].name != NULL && strcmp(test_frames[frame_idx].name, frame_name) != 0) {
+        frame_idx++;
+    }
+    if (test_frames[frame_idx].name == NULL) {
+        printf("ERROR: Unknown frame type '%s' (use 1080p, 1440p or 4K)\n", frame_name);
+        return;
+    }
+    
+    int width = test_frames[frame_idx].width;
+    int height = test_frames[frame_idx].height;
+    int bpp = test_frames[frame_idx].bpp;
+    size_t frame_size = width * height * bpp;
+    
+    size_t header_size = offsetof(struct shared_data, buffer);
+    size_t max_data_size = SHMEM_SIZE - header_size;
+    uint32_t max_slots = pipe_max_slots(max_data_size, frame_size);
+    
+    if (slot_count <= 0) {
+        slot_count = max_slots;
+    }
+    if (slot_count < PIPE_MIN_SLOTS || slot_count > PIPE_MAX_SLOTS || (uint32_t)slot_count > max_slots) {
+        printf("ERROR: %d slots of %s (%.2f MB) don't fit in %zu bytes (pipeline takes %d-%d slots, %u fit)\n",
+               slot_count, frame_name, frame_size / (1024.0 * 1024.0), max_data_size,
+               PIPE_MIN_SLOTS, PIPE_MAX_SLOTS, max_slots);
+        return;
+    }
+    
+    printf("Streaming %s frames (%dx%d, %.2f MB) through %d slots (%s buffering) for %d s\n",
+           frame_name, width, height, frame_size / (1024.0 * 1024.0), slot_count,
+           slot_count == 2 ? "double" : "triple", seconds);
+    
+    printf("Pre-generating test frame data...\n");
+    uint8_t *test_frame = page_alloc(frame_size, &host_pages);
+    if (!test_frame) {
+        printf("ERROR: Failed to allocate test frame buffer\n");
+        return;
+    }
+    
+    generate_random_frame(test_frame, width, height);
+    
+    uint8_t expected_hash[DIGEST_MAX_SIZE];
+    digest_compute(host_verify, test_frame, frame_size, expected_hash);
+    
+    csv_logger_t *csv = csv_create("pipeline_results.csv",
+        "interval,elapsed_s,frame_type,slot_count,size_bytes,frames,frames_per_s,mbps,gbps,host_write_avg_us,host_stall_avg_us,host_stall_pct,host_wait_policy,guest_wait_policy,copy_kernel,copy_threads,guest_copy_threads");
+    
+    memset((void *)&shm->timing, 0, sizeof(struct timing_data));
+    shm->error_code = 0;
+    shm->sequence = 0;
+    shm->data_size = frame_size;
+    publish_digest(shm, expected_hash);
+    
+    struct pipeline pipeline;
+    if (!pipe_init(&pipeline, (void *)&shm->buffer[0], max_data_size, slot_count, frame_size)) {
+        printf("ERROR: Failed to initialize frame pipeline\n");
+        page_free(test_frame, frame_size, host_pages);
+        csv_close(csv);
+        return;
+    }
+    __sync_synchronize();
+    
+    // STATE: HOST_STATE_READY -> HOST_STATE_SENDING (pipeline is formatted)
+    set_host_state(shm, HOST_STATE_SENDING);
+    
+    if (!wait_for_guest_state(shm, GUEST_STATE_PROCESSING, 10000000000ULL, "guest attached to pipeline")) {
+        printf("ERROR: Guest did not attach to the pipeline (is it running with -p?)\n");
+        set_host_state(shm, HOST_STATE_READY);
+        page_free(test_frame, frame_size, host_pages);
+        csv_close(csv);
+        return;
+    }
+    
+    printf("Guest attached. Streaming...\n\n");
+    printf("  Second | Frames/s |     GB/s | Write (avg) | Stall (avg)\n");
+    printf("  -------+----------+----------+-------------+------------\n");
+    
+    double size_mb = frame_size / (1024.0 * 1024.0);
+    uint64_t duration = (uint64_t)seconds * 1000000000ULL;
+    uint64_t total_write = 0, total_stall = 0;
+    uint64_t interval_write = 0, interval_stall = 0;
+    int interval_frames = 0, interval = 0;
+    bool timed_out = false;
+    
+    uint64_t stream_start = get_time_ns();
+    uint64_t interval_start = stream_start;
+    uint64_t now = stream_start;
+    
+    while (now - stream_start < duration) {
+        uint32_t slot = pipe_slot(&pipeline);
+        
+        // Wait for the guest to hand this slot back
+        uint64_t stall_start = now;
+        struct wait_state ws;
+        wait_begin(&ws);
+        while (!pipe_slot_owned(&pipeline, slot, PIPE_OWNER_HOST)) {
+            if (get_time_ns() - stall_start > 10000000000ULL) {
+                timed_out = true;
+                break;
+            }
+            wait_step(&host_wait, &ws);
+        }
+        if (timed_out) {
+            printf("  TIMEOUT (slot %u not returned - guest stopped consuming)\n", slot);
+            break;
+        }
+        
+        uint64_t write_start = get_time_ns();
+        copy_pool_run(&host_pool, pipe_slot_data(&pipeline, slot), test_frame, frame_size);
+        pipe_publish(&pipeline, slot, frame_size);
+        now = get_time_ns();
+        
+        interval_stall += write_start - stall_start;
+        interval_write += now - write_start;
+        interval_frames++;
+        
+        // One report line per second of stream
+        if (now - interval_start >= 1000000000ULL || now - stream_start >= duration) {
+            double interval_s = (now - interval_start) / 1e9;
+            double fps = interval_frames / interval_s;
+            uint64_t busy = interval_write + interval_stall;
+            
+            printf("  %6d | %8.1f | %8.2f | %8.2f µs | %8.2f µs\n", interval + 1, fps, fps * size_mb / 1024.0,
+                   (interval_write / interval_frames) / 1000.0, (interval_stall / interval_frames) / 1000.0);
+            
+            if (csv && csv->file) {
+                fprintf(csv->file, "%d,%.3f,%s,%d,%zu,%d,%.1f,%.0f,%.3f,%.2f,%.2f,%.1f,%s,%s,%s,%d,%u\n",
+                        interval, (now - stream_start) / 1e9, frame_name, slot_count, frame_size,
+                        interval_frames, fps, fps * size_mb, fps * size_mb / 1024.0,
+                        (interval_write / interval_frames) / 1000.0, (interval_stall / interval_frames) / 1000.0,
+                        busy > 0 ? 100.0 * interval_stall / busy : 0.0,
+                        wait_policy_name(host_wait.kind), guest_wait_name(shm), host_copy->name,
+                        host_pool.threads, shm->guest_copy_threads);
+            }
+            
+            total_write += interval_write;
+            total_stall += interval_stall;
+            interval_write = interval_stall = 0;
+            interval_frames = 0;
+            interval_start = now;
+            interval++;
+        }
+    }
+    total_write += interval_write;
+    total_stall += interval_stall;
+    
+    int sent = (int)pipeline.next;
+    pipe_close(&pipeline);
+    
+    // Wait for the guest to hand back every slot
+    uint64_t drain_start = get_time_ns();
+    struct wait_state drain_ws;
+    wait_begin(&drain_ws);
+    while (!pipe_drained(&pipeline) && get_time_ns() - drain_start < 10000000000ULL) {
+        wait_step(&host_wait, &drain_ws);
+    }
+    uint64_t stream_end = get_time_ns();
+    
+    bool guest_done = wait_for_guest_state(shm, GUEST_STATE_ACKNOWLEDGED, 10000000000ULL, "guest finished stream");
+    
+    if (sent > 0) {
+        uint64_t stream_time = stream_end - stream_start;
+        double fps = sent / (stream_time / 1e9);
+        
+        printf("\n=== Pipelined Stream Results ===\n");
+        printf("Frames: %d x %.2f MB through %d slots\n", sent, size_mb, slot_count);
+        printf("Stream duration:      %.2f s\n", stream_time / 1e9);
+        printf("Sustained throughput: %.1f frames/s, %.0f MB/s (%.2f GB/s)\n",
+               fps, fps * size_mb, fps * size_mb / 1024.0);
+        printf("Host write (avg):     %.2f µs [%.0f MB/s]\n",
+               (total_write / sent) / 1000.0, size_mb / ((total_write / sent) / 1e9));
+        printf("Host stall (avg):     %.2f µs (%.1f%% of host time) - waiting for a slot to come back\n",
+               (total_stall / sent) / 1000.0,
+               total_write + total_stall > 0 ? 100.0 * total_stall / (total_write + total_stall) : 0.0);
+        
+        if (guest_done) {
+            uint64_t guest_copy = shm->timing.guest_copy_duration;
+            printf("Guest copy (avg):     %.2f µs [%.0f MB/s]\n",
+                   (guest_copy / sent) / 1000.0, size_mb / ((guest_copy / sent) / 1e9));
+            printf("Guest stream time:    %.2f s (guest clock)\n", shm->timing.guest_total_duration / 1e9);
+            if (shm->error_code != 0) {
+                printf("Guest reported error: %u\n", shm->error_code);
+            }
+        } else {
+            printf("WARNING: Guest did not acknowledge the end of the stream\n");
+        }
+        
+        printf("\nNote: with %d slots the stream runs at the slower of host write and guest copy;\n", slot_count);
+        printf("      a high stall share means the guest side is the bottleneck.\n");
+    }
+    
+    // STATE: HOST_STATE_SENDING -> HOST_STATE_READY
+    set_host_state(shm, HOST_STATE_READY);
+    
+    if (!wait_for_guest_state(shm, GUEST_STATE_READY, 1000000000ULL, "guest ready")) {
+        printf("WARNING: Guest didn't return to ready state\n");
+    }
+    
+    page_free(test_frame, frame_size, host_pages);
+    csv_close(csv);
+}
+
+// Latest-frame-wins stream: the host publishes at `fps` (0 = as fast as it can)
+// into a triple-buffered mailbox and never waits for the guest. The guest
+// reports each frame's age at consume time and the frames it never saw.
+void test_mailbox(volatile struct shared_data *shm, int seconds, int fps, const char *frame_name)
+{
+    printf("\n=== Mailbox Test - Latest Frame Wins ===\n");
+    printf("Host: fill back slot, swap it into 'latest' | Guest: swap 'latest' out, copy it\n");
+    printf("(Stale frames are dropped, never queued; the host never waits for the guest)\n\n");
+    
+    int frame_idx = 0;
+    while (test_frames[frame_idx].name != NULL && strcmp(test_frames[frame_idx].name, frame_name) != 0) {
+        frame_idx++;
+    }
+    if (test_frames[frame_idx].name == NULL) {
+        printf("ERROR: Unknown frame type '%s' (use 1080p, 1440p or 4K)\n", frame_name);
+        return;
+    }
+    
+    int width = test_frames[frame_idx].width;
+    int height = test_frames[frame_idx].height;
+    int bpp = test_frames[frame_idx].bpp;
+    size_t frame_size = width * height * bpp;
+    
+    size_t header_size = offsetof(struct shared_data, buffer);
+    size_t max_data_size = SHMEM_SIZE - header_size;
+    
+    if (mailbox_required_size(frame_size) > max_data_size) {
+        printf("ERROR: %d slots of %s (%.2f MB) don't fit in %zu bytes\n",
+               MAILBOX_SLOTS, frame_name, frame_size / (1024.0 * 1024.0), max_data_size);
+        return;
+    }
+    
+    if (fps > 0) {
+        printf("Publishing %s frames (%dx%d, %.2f MB) at %d frames/s for %d s\n",
+               frame_name, width, height, frame_size / (1024.0 * 1024.0), fps, seconds);
+    } else {
+        printf("Publishing %s frames (%dx%d, %.2f MB) as fast as possible for %d s\n",
+               frame_name, width, height, frame_size / (1024.0 * 1024.0), seconds);
+    }
+    
+    printf("Pre-generating test frame data...\n");
+    uint8_t *test_frame = page_alloc(frame_size, &host_pages);
+    if (!test_frame) {
+        printf("ERROR: Failed to allocate test frame buffer\n");
+        return;
+    }
+    
+    generate_random_frame(test_frame, width, height);
+    
+    uint8_t expected_hash[DIGEST_MAX_SIZE];
+    digest_compute(host_verify, test_frame, frame_size, expected_hash);
+    
+    csv_logger_t *csv = csv_create("mailbox_results.csv",
+        "interval,elapsed_s,frame_type,target_fps,published,published_per_s,host_overwritten,guest_consumed,guest_consumed_per_s,guest_dropped,age_avg_us,age_last_us,age_max_us,host_write_avg_us,host_wait_policy,guest_wait_policy,copy_kernel,copy_threads");
+    
+    memset((void *)&shm->timing, 0, sizeof(struct timing_data));
+    shm->error_code = 0;
+    shm->sequence = 0;
+    shm->data_size = frame_size;
+    publish_digest(shm, expected_hash);
+    
+    struct mailbox mbox;
+    if (!mailbox_init(&mbox, (void *)&shm->buffer[0], max_data_size, frame_size)) {
+        printf("ERROR: Failed to initialize mailbox\n");
+        page_free(test_frame, frame_size, host_pages);
+        csv_close(csv);
+        return;
+    }
+    volatile struct mailbox_guest_stats *gs = &mbox.hdr->guest;
+    __sync_synchronize();
+    
+    // STATE: HOST_STATE_READY -> HOST_STATE_SENDING (mailbox is formatted)
+    set_host_state(shm, HOST_STATE_SENDING);
+    
+    if (!wait_for_guest_state(shm, GUEST_STATE_PROCESSING, 10000000000ULL, "guest attached to mailbox")) {
+        printf("ERROR: Guest did not attach to the mailbox (is it running with -M?)\n");
+        set_host_state(shm, HOST_STATE_READY);
+        page_free(test_frame, frame_size, host_pages);
+        csv_close(csv);
+        return;
+    }
+    
+    printf("Guest attached. Streaming...\n\n");
+    printf("  Second | Published/s | Consumed/s | Dropped | Age (avg) | Age (max)\n");
+    printf("  -------+-------------+------------+---------+-----------+----------\n");
+    
+    uint64_t duration = (uint64_t)seconds * 1000000000ULL;
+    uint64_t period = fps > 0 ? 1000000000ULL / fps : 0;
+    uint64_t total_write = 0, interval_write = 0;
+    uint64_t prev_consumed = 0, prev_dropped = 0, prev_age_sum = 0, prev_overwritten = 0;
+    uint32_t sent = 0, interval_sent = 0;
+    int interval = 0;
+    
+    uint64_t stream_start = get_time_ns();
+    uint64_t pace_start = timing_shared_ns();  // clock_nanosleep() deadlines are CLOCK_MONOTONIC
+    uint64_t interval_start = stream_start;
+    uint64_t now = stream_start;
+    
+    while (now - stream_start < duration) {
+        uint64_t write_start = get_time_ns();
+        copy_pool_run(&host_pool, mailbox_data(&mbox), test_frame, frame_size);
+        uint64_t write_end = get_time_ns();
+        mailbox_publish(&mbox, sent, frame_size, timing_shared_ns());
+        
+        interval_write += write_end - write_start;
+        sent++;
+        interval_sent++;
+        
+        // Pace to the target frame rate on absolute deadlines, so write time doesn't drift the rate
+        if (period > 0) {
+            uint64_t deadline = pace_start + (uint64_t)sent * period;
+            struct timespec ts = { (time_t)(deadline / 1000000000ULL), (long)(deadline % 1000000000ULL) };
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+            }
+        }
+        now = get_time_ns();
+        
+        // One report line per second of stream, from the guest's running counters
+        if (now - interval_start >= 1000000000ULL || now - stream_start >= duration) {
+            double interval_s = (now - interval_start) / 1e9;
+            uint64_t consumed = gs->consumed, dropped = gs->dropped, age_sum = gs->age_sum_ns;
+            uint64_t overwritten = mbox.hdr->overwritten;
+            uint64_t d_consumed = consumed - prev_consumed;
+            double age_avg = d_consumed > 0 ? (double)(age_sum - prev_age_sum) / d_consumed : 0.0;
+            
+            printf("  %6d | %11.1f | %10.1f | %7lu | %6.0f µs | %6.0f µs\n", interval + 1,
+                   interval_sent / interval_s, d_consumed / interval_s, dropped - prev_dropped,
+                   age_avg / 1000.0, gs->age_max_ns / 1000.0);
+            
+            if (csv && csv->file) {
+                fprintf(csv->file, "%d,%.3f,%s,%d,%u,%.1f,%lu,%lu,%.1f,%lu,%.2f,%.2f,%.2f,%.2f,%s,%s,%s,%d\n",
+                        interval, (now - stream_start) / 1e9, frame_name, fps, interval_sent,
+                        interval_sent / interval_s, overwritten - prev_overwritten, d_consumed, d_consumed / interval_s,
+                        dropped - prev_dropped, age_avg / 1000.0, gs->age_last_ns / 1000.0, gs->age_max_ns / 1000.0,
+                        (interval_write / interval_sent) / 1000.0,
+                        wait_policy_name(host_wait.kind), guest_wait_name(shm), host_copy->name, host_pool.threads);
+            }
+            
+            prev_consumed = consumed;
+            prev_dropped = dropped;
+            prev_age_sum = age_sum;
+            prev_overwritten = overwritten;
+            total_write += interval_write;
+            interval_write = 0;
+            interval_sent = 0;
+            interval_start = now;
+            interval++;
+        }
+    }
+    total_write += interval_write;
+    uint64_t stream_end = get_time_ns();
+    
+    mailbox_close(&mbox);
+    
+    bool guest_done = wait_for_guest_state(shm, GUEST_STATE_ACKNOWLEDGED, 10000000000ULL, "guest finished stream");
+    
+    if (sent > 0) {
+        double size_mb = frame_size / (1024.0 * 1024.0);
+        double stream_s = (stream_end - stream_start) / 1e9;
+        
+        printf("\n=== Mailbox Results ===\n");
+        printf("Published:            %u frames (%.1f frames/s, %.2f MB each)\n", sent, sent / stream_s, size_mb);
+        printf("Host write (avg):     %.2f µs [%.0f MB/s]\n",
+               (total_write / sent) / 1000.0, size_mb / ((total_write / sent) / 1e9));
+        printf("Overwritten unseen:   %lu (host view: fresh frame replaced before the guest took it)\n",
+               mbox.hdr->overwritten);
+        
+        if (guest_done) {
+            uint64_t consumed = gs->consumed;
+            printf("Consumed:             %lu frames (%.1f frames/s)\n", consumed, consumed / stream_s);
+            printf("Dropped:              %lu (guest view: sequence gaps)\n", gs->dropped);
+            if (consumed > 0) {
+                printf("Frame age at consume: avg %.0f µs | p50 %.0f µs | p99 %.0f µs | max %.0f µs\n",
+                       (gs->age_sum_ns / consumed) / 1000.0, gs->age_p50_ns / 1000.0,
+                       gs->age_p99_ns / 1000.0, gs->age_max_ns / 1000.0);
+                printf("Frame lag (max):      %lu frames published behind the one being consumed\n", gs->lag_max);
+            }
+            if (shm->error_code != 0) {
+                printf("Guest reported error: %u\n", shm->error_code);
+            }
+        } else {
+            printf("WARNING: Guest did not acknowledge the end of the stream\n");
+        }
+        
+        printf("\nNote: age = guest clock after the copy - host clock when the frame was complete;\n");
+        printf("      it is only meaningful when host and guest read the same clock.\n");
+    }
+    
+    // STATE: HOST_STATE_SENDING -> HOST_STATE_READY
+    set_host_state(shm, HOST_STATE_READY);
+    
+    if (!wait_for_guest_state(shm, GUEST_STATE_READY, 1000000000ULL, "guest ready")) {
+        printf("WARNING: Guest didn't return to ready state\n");
+    }
+    
+    page_free(test_frame, frame_size, host_pages);
+    csv_close(csv);
+}
+
+// Full duplex: host->guest and guest->host rings driven at once. Three
+// phases of `seconds` each - host->guest alone, guest->host alone, both - so
+// the last one shows what each direction loses when both write together.
+void test_duplex(volatile struct shared_data *shm, int seconds, const char *frame_name)
+{
+    printf("\n=== Full Duplex Test - Host->Guest and Guest->Host Rings ===\n");
+    printf("Each direction: producer memcpy into its own ring | consumer memcpy out\n");
+    printf("Phases: host->guest alone, guest->host alone, both at once (%d s each)\n\n", seconds);
+    
+    int frame_idx = 0;
+    while (test_frames[frame_idx].name != NULL && strcmp(test_frames[frame_idx].name, frame_name) != 0) {
+        frame_idx++;
+    }
+    if (test_frames[frame_idx].name == NULL) {
+        printf("ERROR: Unknown frame type '%s' (use 1080p, 1440p or 4K)\n", frame_name);
+        return;
+    }
+    
+    int width = test_frames[frame_idx].width;
+    int height = test_frames[frame_idx].height;
+    int bpp = test_frames[frame_idx].bpp;
+    uint32_t frame_size = width * height * bpp;
+    
+    size_t max_data_size = SHMEM_SIZE - offsetof(struct shared_data, buffer);
+    uint32_t slots = duplex_slots(max_data_size, frame_size);
+    if (slots < 2) {
+        printf("ERROR: Two rings of 2 x %s (%.2f MB) don't fit in %zu bytes\n",
+               frame_name, frame_size / (1024.0 * 1024.0), max_data_size);
+        return;
+    }
+    printf("Frame: %s (%.2f MB) | %u slots per direction\n\n", frame_name, frame_size / (1024.0 * 1024.0), slots);
+    
+    uint8_t *tx_frame = page_alloc(frame_size, &host_pages);
+    uint8_t *rx_frame = page_alloc(frame_size, &host_pages);
+    if (!tx_frame || !rx_frame) {
+        printf("ERROR: Failed to allocate frame buffers\n");
+        if (tx_frame) page_free(tx_frame, frame_size, host_pages);
+        if (rx_frame) page_free(rx_frame, frame_size, host_pages);
+        return;
+    }
+    generate_random_frame(tx_frame, width, height);
+    memset(rx_frame, 0, frame_size);
+    
+    csv_logger_t *csv = csv_create("duplex_results.csv",
+        "phase,frame_type,size_bytes,seconds,h2g_frames,h2g_mbps,g2h_frames,g2h_mbps,aggregate_mbps,host_tx_stall_pct,host_rx_stall_pct,success,host_wait_policy,guest_wait_policy");
+    
+    static const struct {
+        const char *name;
+        uint32_t directions;
+    } phases[DUPLEX_PHASES] = {
+        { "h2g",    DUPLEX_BIT(DUPLEX_H2G) },
+        { "g2h",    DUPLEX_BIT(DUPLEX_G2H) },
+        { "duplex", DUPLEX_BIT(DUPLEX_H2G) | DUPLEX_BIT(DUPLEX_G2H) },
+    };
+    double h2g_mbps[DUPLEX_PHASES] = {0}, g2h_mbps[DUPLEX_PHASES] = {0};
+    int completed = 0;
+    
+    printf("     Phase | H2G frames |  H2G MB/s | G2H frames |  G2H MB/s | Aggregate MB/s\n");
+    printf("  ---------+------------+-----------+------------+-----------+---------------\n");
+    
+    volatile struct duplex_header *hdr = (volatile struct duplex_header *)&shm->buffer[0];
+    
+    for (int p = 0; p < DUPLEX_PHASES; p++) {
+        uint32_t directions = phases[p].directions;
+        
+        memset((void *)&shm->timing, 0, sizeof(struct timing_data));
+        shm->error_code = 0;
+        if (!duplex_init(hdr, max_data_size, frame_size, directions)) {
+            printf("ERROR: Failed to format the duplex rings\n");
+            break;
+        }
+        __sync_synchronize();
+        
+        // STATE: HOST_STATE_READY -> HOST_STATE_SENDING (rings are formatted)
+        set_host_state(shm, HOST_STATE_SENDING);
+        
+        if (!wait_for_guest_state(shm, GUEST_STATE_PROCESSING, 10000000000ULL, "guest attached to rings")) {
+            printf("ERROR: Guest did not attach to the duplex rings (is it running with -D?)\n");
+            set_host_state(shm, HOST_STATE_READY);
+            break;
+        }
+        
+        struct duplex_stream tx = { .abort = &shm->test_complete, .wait = &host_wait, .buffer = tx_frame };
+        struct duplex_stream rx = { .abort = &shm->test_complete, .wait = &host_wait, .buffer = rx_frame };
+        pthread_t tx_thread, rx_thread;
+        bool tx_running = false, rx_running = false;
+        
+        if (directions & DUPLEX_BIT(DUPLEX_H2G)) {
+            tx_running = duplex_stream_attach(&tx, hdr, max_data_size, DUPLEX_H2G, true) &&
+                         pthread_create(&tx_thread, NULL, duplex_produce, &tx) == 0;
+        }
+        if (directions & DUPLEX_BIT(DUPLEX_G2H)) {
+            rx_running = duplex_stream_attach(&rx, hdr, max_data_size, DUPLEX_G2H, false) &&
+                         pthread_create(&rx_thread, NULL, duplex_consume, &rx) == 0;
+        }
+        
+        if (tx_running || rx_running) {
+            sleep(seconds);
+        } else {
+            printf("ERROR: Failed to start the host side of phase %s\n", phases[p].name);
+        }
+        __atomic_store_n(&hdr->stop, 1, __ATOMIC_RELEASE);
+        
+        if (tx_running) pthread_join(tx_thread, NULL);
+        if (rx_running) pthread_join(rx_thread, NULL);
+        
+        bool guest_done = wait_for_guest_state(shm, GUEST_STATE_ACKNOWLEDGED, 10000000000ULL, "guest finished phase");
+        
+        uint64_t h2g_frames = 0, g2h_frames = 0;
+        uint32_t errors = 0;
+        if (directions & DUPLEX_BIT(DUPLEX_H2G)) {
+            h2g_frames = hdr->dir[DUPLEX_H2G].received;
+            h2g_mbps[p] = duplex_mbps(h2g_frames, frame_size, hdr->dir[DUPLEX_H2G].rx_ns);
+            errors += hdr->dir[DUPLEX_H2G].errors;
+        }
+        if (rx_running) {
+            g2h_frames = rx.frames;
+            g2h_mbps[p] = duplex_mbps(g2h_frames, frame_size, rx.duration_ns);
+            errors += hdr->dir[DUPLEX_G2H].errors;
+        }
+        double aggregate = h2g_mbps[p] + g2h_mbps[p];
+        double tx_stall = tx_running && tx.duration_ns > 0 ? 100.0 * tx.stall_ns / tx.duration_ns : 0.0;
+        double rx_stall = rx_running && rx.duration_ns > 0 ? 100.0 * rx.stall_ns / rx.duration_ns : 0.0;
+        bool success = guest_done && errors == 0 && shm->error_code == 0;
+        
+        printf("  %8s | %10lu | %9.0f | %10lu | %9.0f | %14.0f%s\n",
+               phases[p].name, (unsigned long)h2g_frames, h2g_mbps[p], (unsigned long)g2h_frames, g2h_mbps[p],
+               aggregate, success ? "" : "  (errors)");
+        fflush(stdout);
+        
+        if (csv && csv->file) {
+            fprintf(csv->file, "%s,%s,%u,%d,%lu,%.0f,%lu,%.0f,%.0f,%.1f,%.1f,%d,%s,%s\n",
+                    phases[p].name, frame_name, frame_size, seconds, (unsigned long)h2g_frames, h2g_mbps[p],
+                    (unsigned long)g2h_frames, g2h_mbps[p], aggregate, tx_stall, rx_stall, success,
+                    wait_policy_name(host_wait.kind), guest_wait_name(shm));
+        }
+        
+        // STATE: HOST_STATE_SENDING -> HOST_STATE_READY
+        set_host_state(shm, HOST_STATE_READY);
+        
+        if (!wait_for_guest_state(shm, GUEST_STATE_READY, 1000000000ULL, "guest ready")) {
+            printf("WARNING: Guest didn't return to ready state\n");
+        }
+        if (!guest_done) {
+            printf("WARNING: Guest did not acknowledge the end of phase %s\n", phases[p].name);
+            break;
+        }
+        completed++;
+    }
+    
+    if (completed == DUPLEX_PHASES && h2g_mbps[0] > 0 && g2h_mbps[1] > 0) {
+        printf("\nBoth directions at once vs. alone:\n");
+        printf("  Host->guest:  %.0f%% of its solo rate\n", 100.0 * h2g_mbps[2] / h2g_mbps[0]);
+        printf("  Guest->host:  %.0f%% of its solo rate\n", 100.0 * g2h_mbps[2] / g2h_mbps[1]);
+        printf("  Aggregate:    %.0f MB/s vs. %.0f MB/s best single direction\n",
+               h2g_mbps[2] + g2h_mbps[2], h2g_mbps[0] > g2h_mbps[1] ? h2g_mbps[0] : g2h_mbps[1]);
+    }
+    printf("MB/s per direction: frames received / consumer's stream time (consumer clock).\n");
+    
+    page_free(tx_frame, frame_size, host_pages);
+    page_free(rx_frame, frame_size, host_pages);
+    csv_close(csv);
+}
+
+// Copy throughput over the shared region for 1..max_threads copy threads.
+// Standalone (no guest involved): shows where the region stops scaling.
+void test_copy_scaling(volatile struct shared_data *shm, size_t shm_size, int iterations, int max_threads)
+{
+    printf("\n=== Copy Scaling Test - Striped copies over the shared region ===\n");
+    printf("Kernel: %s | Threads: 1..%d | Iterations per point: %d\n\n", host_copy->name, max_threads, iterations);
+    
+    // Largest test frame that fits in the data area
+    size_t max_data_size = shm_size - offsetof(struct shared_data, buffer);
+    size_t frame_size = 0;
+    const char *frame_name = NULL;
+    for (int f = 0; test_frames[f].name; f++) {
+        size_t size = (size_t)test_frames[f].width * test_frames[f].height * test_frames[f].bpp;
+        if (size <= max_data_size) {
+            frame_size = size;
+            frame_name = test_frames[f].name;
+        }
+    }
+    if (!frame_name) {
+        printf("ERROR: Shared region too small for any test frame\n");
+        return;
+    }
+    
+    uint8_t *local_frame = page_alloc(frame_size, &host_pages);
+    uint8_t *readback = page_alloc(frame_size, &host_pages);
+    if (!local_frame || !readback) {
+        printf("ERROR: Failed to allocate %zu byte buffers\n", frame_size);
+        page_free(local_frame, frame_size, host_pages);
+        page_free(readback, frame_size, host_pages);
+        return;
+    }
+    RAND_bytes(local_frame, frame_size);
+    memset(readback, 0, frame_size);
+    
+    uint8_t *region = (uint8_t *)&shm->buffer[0];
+    double size_mb = frame_size / (1024.0 * 1024.0);
+    
+    csv_logger_t *csv = csv_create("copy_scaling.csv",
+        "threads,direction,iteration,frame_type,size_bytes,copy_ns,copy_ms,copy_mbps,copy_kernel,shm_page_kb,host_pages");
+    
+    printf("Frame: %s (%.2f MB)\n\n", frame_name, size_mb);
+    printf("  Threads | Write to region | Read from region | Write speedup | Read speedup\n");
+    printf("  --------+-----------------+------------------+---------------+-------------\n");
+    
+    double base_write_bw = 0, base_read_bw = 0;
+    
+    // Powers of two, always ending on max_threads
+    for (int threads = 1; ; threads = threads * 2 < max_threads ? threads * 2 : max_threads) {
+        struct copy_pool pool;
+        if (!copy_pool_init(&pool, threads, host_copy->copy)) {
+            printf("  %7d | failed to start worker threads\n", threads);
+            copy_pool_destroy(&pool);
+            break;
+        }
+        
+        // Warm-up: fault in both sides and wake the workers once
+        copy_pool_run(&pool, region, local_frame, frame_size);
+        copy_pool_run(&pool, readback, region, frame_size);
+        
+        double write_bw_sum = 0, read_bw_sum = 0;
+        for (int iter = 0; iter < iterations; iter++) {
+            uint64_t write_start = get_time_ns();
+            copy_pool_run(&pool, region, local_frame, frame_size);
+            __sync_synchronize();
+            uint64_t write_time = get_time_ns() - write_start;
+            
+            uint64_t read_start = get_time_ns();
+            copy_pool_run(&pool, readback, region, frame_size);
+            __sync_synchronize();
+            uint64_t read_time = get_time_ns() - read_start;
+            
+            double write_bw = size_mb / (write_time / 1e9);
+            double read_bw = size_mb / (read_time / 1e9);
+            write_bw_sum += write_bw;
+            read_bw_sum += read_bw;
+            
+            if (csv && csv->file) {
+                fprintf(csv->file, "%d,write,%d,%s,%zu,%lu,%.3f,%.2f,%s,%u,%s\n",
+                        threads, iter + 1, frame_name, frame_size,
+                        write_time, write_time / 1000000.0, write_bw, host_copy->name,
+                        host_shm_page_kb, page_kind_name(host_pages));
+                fprintf(csv->file, "%d,read,%d,%s,%zu,%lu,%.3f,%.2f,%s,%u,%s\n",
+                        threads, iter + 1, frame_name, frame_size,
+                        read_time, read_time / 1000000.0, read_bw, host_copy->name,
+                        host_shm_page_kb, page_kind_name(host_pages));
+            }
+        }
+        copy_pool_destroy(&pool);
+        
+        double write_bw = write_bw_sum / iterations;
+        double read_bw = read_bw_sum / iterations;
+        if (threads == 1) {
+            base_write_bw = write_bw;
+            base_read_bw = read_bw;
+        }
+        printf("  %7d | %10.0f MB/s | %11.0f MB/s | %12.2fx | %11.2fx\n",
+               threads, write_bw, read_bw, write_bw / base_write_bw, read_bw / base_read_bw);
+        
+        if (threads == max_threads) break;
+    }
+    
+    if (memcmp(readback, local_frame, frame_size) != 0) {
+        printf("\n⚠ Read-back mismatch - striped copy is broken\n");
+    } else {
+        printf("\n✓ Read-back matches the source frame\n");
+    }
+    
+    page_free(local_frame, frame_size, host_pages);
+    page_free(readback, frame_size, host_pages);
+    csv_close(csv);
+}
+
+// State words of one control block layout, for the ping-pong microbenchmark
+struct pingpong_block {
+    const char *layout;
+    volatile uint32_t *host_state;
+    volatile uint32_t *guest_state;
+    volatile uint32_t *sequence;
+    int cpu;                       // Responder CPU (-1 = not pinned)
+};
+
+// Layout v1 offsets: host_state, guest_state and sequence shared one line
+#define V1_HOST_STATE_OFFSET 8
+#define V1_GUEST_STATE_OFFSET 12
+#define V1_SEQUENCE_OFFSET 32
+
+static void pingpong_wait(volatile uint32_t *word, uint32_t value, uint32_t or_value)
+{
+    struct wait_state ws;
+    wait_begin(&ws);
+    for (;;) {
+        uint32_t seen = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+        if (seen == value || seen == or_value) return;
+        wait_step(&host_wait, &ws);
+    }
+}
+
+// Plays the guest side of the state machine until the host side completes
+static void *pingpong_responder(void *arg)
+{
+    struct pingpong_block *block = (struct pingpong_block *)arg;
+    if (block->cpu >= 0) numa_pin_cpu(block->cpu);
+    
+    for (;;) {
+        pingpong_wait(block->host_state, HOST_STATE_SENDING, HOST_STATE_COMPLETED);
+        if (__atomic_load_n(block->host_state, __ATOMIC_ACQUIRE) == HOST_STATE_COMPLETED) break;
+        (void)*block->sequence;
+        __atomic_store_n(block->guest_state, GUEST_STATE_ACKNOWLEDGED, __ATOMIC_RELEASE);
+        pingpong_wait(block->host_state, HOST_STATE_READY, HOST_STATE_READY);
+        __atomic_store_n(block->guest_state, GUEST_STATE_READY, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+// One message worth of state transitions: SENDING -> ACKNOWLEDGED -> READY -> READY
+static uint64_t pingpong_round(struct pingpong_block *block, uint32_t sequence)
+{
+    uint64_t start = get_time_ns();
+    *block->sequence = sequence;
+    __atomic_store_n(block->host_state, HOST_STATE_SENDING, __ATOMIC_RELEASE);
+    pingpong_wait(block->guest_state, GUEST_STATE_ACKNOWLEDGED, GUEST_STATE_ACKNOWLEDGED);
+    __atomic_store_n(block->host_state, HOST_STATE_READY, __ATOMIC_RELEASE);
+    pingpong_wait(block->guest_state, GUEST_STATE_READY, GUEST_STATE_READY);
+    return timing_elapsed_ns(start, get_time_ns());
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int compare_i64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// State-transition round trip with the v1 (one shared line) and v2 (one
+// 128-byte block per side) control block layouts. Both run over scratch space
+// in the shared region with a second thread playing the guest; no guest needed.
+void test_state_pingpong(volatile struct shared_data *shm, int rounds, int host_cpu)
+{
+    printf("\n=== State Ping-Pong - Control Block Layout v1 vs v2 ===\n");
+    printf("Round trip: host SENDING -> guest ACKNOWLEDGED -> host READY -> guest READY\n");
+    printf("Wait policy: %s | Rounds per layout: %d\n", wait_policy_name(host_wait.kind), rounds);
+    
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int responder_cpu = -1;
+    if (cpus > 1) {
+        if (host_cpu < 0) host_cpu = 0;
+        responder_cpu = (int)((host_cpu + 1) % cpus);
+        if (!numa_pin_cpu(host_cpu)) {
+            printf("ERROR: Cannot pin the host side to CPU %d: %s\n", host_cpu, strerror(errno));
+            return;
+        }
+        printf("Host side on CPU %d (node %d), guest side on CPU %d (node %d)\n\n",
+               host_cpu, numa_cpu_node(host_cpu), responder_cpu, numa_cpu_node(responder_cpu));
+    } else {
+        printf("WARNING: one CPU online - both sides share it, so this measures the scheduler\n\n");
+    }
+    
+    uint64_t *samples = malloc((size_t)rounds * sizeof(uint64_t));
+    if (!samples) {
+        printf("ERROR: Failed to allocate %d samples\n", rounds);
+        return;
+    }
+    
+    uint8_t *scratch = (uint8_t *)&shm->buffer[0];
+    struct pingpong_block blocks[2] = {
+        { "v1", (volatile uint32_t *)(scratch + V1_HOST_STATE_OFFSET),
+                (volatile uint32_t *)(scratch + V1_GUEST_STATE_OFFSET),
+                (volatile uint32_t *)(scratch + V1_SEQUENCE_OFFSET), responder_cpu },
+        { "v2", (volatile uint32_t *)(scratch + 4096 + offsetof(struct shared_data, host_state)),
+                (volatile uint32_t *)(scratch + 4096 + offsetof(struct shared_data, guest_state)),
+                (volatile uint32_t *)(scratch + 4096 + offsetof(struct shared_data, sequence)), responder_cpu },
+    };
+    
+    csv_logger_t *csv = csv_create("state_pingpong.csv",
+        "layout,rounds,avg_ns,p50_ns,p99_ns,max_ns,host_wait_policy,host_cpu,guest_cpu,same_line,timer,tsc_khz,timer_overhead_ns,timer_resolution_ns");
+    
+    printf("  Layout | Host/guest state |   Avg (ns) |   p50 (ns) |   p99 (ns) |   Max (ns)\n");
+    printf("  -------+------------------+------------+------------+------------+-----------\n");
+    
+    double avg_v1 = 0;
+    
+    for (int b = 0; b < 2; b++) {
+        struct pingpong_block *block = &blocks[b];
+        memset(scratch + b * 4096, 0, 4096);
+        *block->host_state = HOST_STATE_READY;
+        *block->guest_state = GUEST_STATE_READY;
+        __sync_synchronize();
+        
+        pthread_t responder;
+        if (pthread_create(&responder, NULL, pingpong_responder, block) != 0) {
+            printf("ERROR: Failed to start the responder thread\n");
+            break;
+        }
+        
+        // Warm-up: both threads running, lines resident
+        for (int i = 0; i < 1000; i++) {
+            pingpong_round(block, i);
+        }
+        
+        uint64_t sum = 0;
+        for (int i = 0; i < rounds; i++) {
+            samples[i] = pingpong_round(block, i);
+            sum += samples[i];
+        }
+        
+        __atomic_store_n(block->host_state, HOST_STATE_COMPLETED, __ATOMIC_RELEASE);
+        pthread_join(responder, NULL);
+        
+        qsort(samples, rounds, sizeof(uint64_t), compare_u64);
+        double avg = (double)sum / rounds;
+        uint64_t p50 = samples[rounds / 2];
+        uint64_t p99 = samples[((size_t)rounds * 99) / 100];
+        uint64_t max = samples[rounds - 1];
+        bool same_line = ((uintptr_t)block->host_state / 64) == ((uintptr_t)block->guest_state / 64);
+        if (b == 0) avg_v1 = avg;
+        
+        printf("  %6s | %-16s | %10.0f | %10lu | %10lu | %10lu\n", block->layout,
+               same_line ? "same line" : "128 B apart", avg, p50, p99, max);
+        
+        if (csv && csv->file) {
+            fprintf(csv->file, "%s,%d,%.0f,%lu,%lu,%lu,%s,%d,%d,%d,%s,%u,%u,%.2f\n", block->layout, rounds, avg, p50, p99,
+                    max, wait_policy_name(host_wait.kind), host_cpu, responder_cpu, same_line ? 1 : 0, timing_source(),
+                    timing_tsc_khz(), timing.overhead_ns, timing.resolution_ns);
+        }
+        
+        if (b == 1 && avg_v1 > 0) {
+            printf("\nv2 round trip: %.2fx the v1 time (%.0f ns %s per message)\n",
+                   avg / avg_v1, avg > avg_v1 ? avg - avg_v1 : avg_v1 - avg, avg > avg_v1 ? "slower" : "saved");
+        }
+    }
+    
+    free(samples);
+    csv_close(csv);
+}
+
+// Small-message sweep over the single-message protocol: `count` back-to-back
+// messages per size, 0 B then 64 B..64 KB. Per-message overhead dominates here,
+// so state transitions skip the logging set_host_state() does.
+void test_message_rate(volatile struct shared_data *shm, int count)
+{
+    printf("\n=== Message Rate Test - Small Messages, Back-to-Back ===\n");
+    printf("Host: memcpy payload, SENDING, wait ACKNOWLEDGED, READY | Guest: copy payload out, acknowledge\n");
+    printf("Sizes: 0 B, %d B .. %u KB | Messages per size: %d\n\n",
+           MSG_RATE_MIN_SIZE, msg_rate_size(MSG_RATE_STEPS - 1) / 1024, count);
+    
+    struct perf_counters perf_counters;
+    bool perf_available = perf_counters_init(&perf_counters);
+    if (!perf_available) {
+        printf("⚠ Hardware performance counters not available - cycles per message not reported\n\n");
+    }
+    
+    size_t max_size = msg_rate_size(MSG_RATE_STEPS - 1);
+    uint8_t *payload = malloc(max_size);
+    uint64_t *rtt = malloc((size_t)count * sizeof(uint64_t));
+    uint64_t *oneway = malloc((size_t)count * sizeof(uint64_t));
+    uint64_t *publish = malloc((size_t)count * sizeof(uint64_t));
+    uint64_t *detect = malloc((size_t)count * sizeof(uint64_t));
+    int64_t *synced = malloc((size_t)count * sizeof(int64_t));
+    if (!payload || !rtt || !oneway || !publish || !detect || !synced) {
+        printf("ERROR: Failed to allocate message buffers\n");
+        free(payload);
+        free(rtt);
+        free(oneway);
+        free(publish);
+        free(detect);
+        free(synced);
+        return;
+    }
+    
+    // Synced one-way latency: guest detection time mapped onto the host clock with
+    // the offset interpolated between the probe bursts either side of each size block
+    struct clock_sync sync;
+    struct clock_sync_sample sample, before;
+    bool synced_clocks = shm->guest_clock_sync != 0;
+    if (synced_clocks) {
+        clock_sync_init(&sync, &shm->sync_seq, &shm->sync_t1, &shm->sync_echo, &shm->sync_t2, &shm->sync_t3);
+        synced_clocks = clock_sync_burst(&sync, &host_wait, CLOCK_SYNC_PROBES, &sample);
+        before = sample;
+    }
+    if (synced_clocks) {
+        printf("Clock sync: guest - host = %+ld ns ± %lu ns (min-RTT probe of %d)\n\n", (long)sync.anchor_offset_ns,
+               (unsigned long)sync.err_ns, CLOCK_SYNC_PROBES);
+    } else {
+        printf("Clock sync: off (start the guest with -T for one-way latency across clocks)\n\n");
+    }
+    
+    csv_logger_t *csv = csv_create("message_rate.csv",
+        "size_bytes,messages,messages_per_s,rtt_avg_ns,rtt_p50_ns,rtt_p99_ns,rtt_p999_ns,rtt_max_ns,oneway_p50_ns,oneway_p99_ns,oneway_max_ns,host_cycles_per_msg,guest_cycles_per_msg,success,host_wait_policy,guest_wait_policy,host_timer,host_tsc_khz,host_timer_overhead_ns,host_timer_resolution_ns,guest_tsc_khz,guest_timer_overhead_ns,synced_oneway_p50_ns,synced_oneway_p99_ns,synced_oneway_max_ns,clock_offset_ns,clock_offset_err_ns,clock_drift_ppm");
+    
+    printf("     Size |   Msgs/s | RTT p50 | RTT p99 | RTT p99.9 | 1-way p50 | 1-way p99 | Synced 1-way p50 | Host cyc/msg | Guest cyc/msg\n");
+    printf("  --------+----------+---------+---------+-----------+-----------+-----------+------------------+--------------+--------------\n");
+    
+    uint8_t *data_ptr = (uint8_t *)&shm->buffer[0];
+    uint32_t sequence = 0;
+    
+    for (int step = 0; step < MSG_RATE_STEPS; step++) {
+        uint32_t size = msg_rate_size(step);
+        RAND_bytes(payload, max_size);
+        
+        memset((void *)&shm->timing, 0, sizeof(struct timing_data));
+        shm->error_code = 0;
+        __sync_synchronize();
+        
+        struct perf_results host_perf = {0};
+        if (perf_available) {
+            perf_counters_start(&perf_counters);
+        }
+        
+        int sent = 0;
+        uint64_t block_start = get_time_ns();
+        
+        for (int i = 0; i < count; i++) {
+            uint64_t t0 = get_time_ns();
+            uint64_t publish_ns = timing_shared_ns();
+            if (size > 0) memcpy(data_ptr, payload, size);
+            shm->sequence = sequence++;
+            shm->data_size = size;
+            shm->publish_ns = publish_ns;
+            
+            // STATE: HOST_STATE_READY -> HOST_STATE_SENDING (release: payload first)
+            __atomic_store_n(&shm->host_state, HOST_STATE_SENDING, __ATOMIC_RELEASE);
+            
+            if (!wait_for_guest_state(shm, GUEST_STATE_ACKNOWLEDGED, 5000000000ULL, "guest acknowledged")) {
+                printf("  [%u B] TIMEOUT on message %d (is the guest running with -m?)\n", size, i);
+                break;
+            }
+            rtt[i] = timing_elapsed_ns(t0, get_time_ns());
+            oneway[i] = shm->timing.guest_notify_latency;
+            publish[i] = publish_ns;
+            detect[i] = shm->timing.guest_detect_ns;
+            
+            // STATE: HOST_STATE_SENDING -> HOST_STATE_READY
+            __atomic_store_n(&shm->host_state, HOST_STATE_READY, __ATOMIC_RELEASE);
+            
+            if (!wait_for_guest_state(shm, GUEST_STATE_READY, 5000000000ULL, "guest ready")) {
+                printf("  [%u B] TIMEOUT waiting for the guest to return to ready\n", size);
+                break;
+            }
+            sent++;
+        }
+        
+        uint64_t block_end = get_time_ns();
+        if (perf_available) {
+            perf_counters_stop(&perf_counters, &host_perf, (size_t)size * count);
+        }
+        
+        if (sent == 0) {
+            if (csv && csv->file) {
+                fprintf(csv->file, "%u,0,0,0,0,0,0,0,0,0,0,0,0,0,%s,%s,%s,%u,%u,%.2f,%u,%u,,,,,,\n", size,
+                        wait_policy_name(host_wait.kind), guest_wait_name(shm), timing_source(), timing_tsc_khz(),
+                        timing.overhead_ns, timing.resolution_ns, shm->guest_tsc_khz, shm->guest_timer_overhead_ns);
+            }
+            break;
+        }
+        
+        uint64_t rtt_sum = 0;
+        for (int i = 0; i < sent; i++) rtt_sum += rtt[i];
+        qsort(rtt, sent, sizeof(uint64_t), compare_u64);
+        qsort(oneway, sent, sizeof(uint64_t), compare_u64);
+        
+        double rate = sent / ((block_end - block_start) / 1e9);
+        uint64_t rtt_p50 = rtt[sent / 2], rtt_p99 = rtt[((size_t)sent * 99) / 100];
+        uint64_t rtt_p999 = rtt[((size_t)sent * 999) / 1000], rtt_max = rtt[sent - 1];
+        uint64_t ow_p50 = oneway[sent / 2], ow_p99 = oneway[((size_t)sent * 99) / 100], ow_max = oneway[sent - 1];
+        double host_cycles = perf_available ? (double)host_perf.cpu_cycles / sent : 0.0;
+        double guest_cycles = (double)shm->timing.guest_perf.cpu_cycles / sent;
+        
+        // Probe again after the block, then map every detection onto the host clock
+        // with the offset interpolated between the bursts before and after it
+        int64_t sync_p50 = 0, sync_p99 = 0, sync_max = 0, sync_offset = 0;
+        uint64_t sync_err = 0;
+        if (synced_clocks && clock_sync_burst(&sync, &host_wait, CLOCK_SYNC_PROBES, &sample)) {
+            for (int i = 0; i < sent; i++) {
+                synced[i] = (int64_t)(detect[i] - publish[i]) -
+                            clock_sync_interpolate(&before, &sample, publish[i], &sync_err);
+            }
+            // Reported offset: the interpolated one at the middle of the block
+            uint64_t block_mid = publish[0] + (publish[sent - 1] - publish[0]) / 2;
+            sync_offset = clock_sync_interpolate(&before, &sample, block_mid, &sync_err);
+            before = sample;
+            qsort(synced, sent, sizeof(int64_t), compare_i64);
+            sync_p50 = synced[sent / 2];
+            sync_p99 = synced[((size_t)sent * 99) / 100];
+            sync_max = synced[sent - 1];
+        } else if (synced_clocks) {
+            printf("  [%u B] Clock sync probes unanswered - synced one-way latency off\n", size);
+            synced_clocks = false;
+        }
+        
+        char host_cyc[32] = "n/a", guest_cyc[32] = "n/a", sync_col[32] = "n/a";
+        if (host_cycles > 0) snprintf(host_cyc, sizeof(host_cyc), "%.0f", host_cycles);
+        if (guest_cycles > 0) snprintf(guest_cyc, sizeof(guest_cyc), "%.0f", guest_cycles);
+        if (synced_clocks) {
+            snprintf(sync_col, sizeof(sync_col), "%.1f ± %.1f µs", sync_p50 / 1000.0, sync_err / 1000.0);
+        }
+        
+        printf("  %7u | %8.0f | %5.1f µs | %5.1f µs | %7.1f µs | %7.1f µs | %7.1f µs | %16s | %12s | %12s\n",
+               size, rate, rtt_p50 / 1000.0, rtt_p99 / 1000.0, rtt_p999 / 1000.0,
+               ow_p50 / 1000.0, ow_p99 / 1000.0, sync_col, host_cyc, guest_cyc);
+        fflush(stdout);
+        
+        // Synced columns stay empty once the clocks are not (or no longer) synced
+        char sync_fields[128] = ",,,,,";
+        if (synced_clocks) {
+            snprintf(sync_fields, sizeof(sync_fields), "%ld,%ld,%ld,%ld,%lu,%.3f", (long)sync_p50, (long)sync_p99,
+                     (long)sync_max, (long)sync_offset, (unsigned long)sync_err, clock_sync_drift_ppm(&sync));
+        }
+        
+        if (csv && csv->file) {
+            fprintf(csv->file, "%u,%d,%.0f,%.0f,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%.0f,%.0f,%d,%s,%s,%s,%u,%u,%.2f,%u,%u,%s\n",
+                    size, sent, rate, (double)rtt_sum / sent, rtt_p50, rtt_p99, rtt_p999, rtt_max,
+                    ow_p50, ow_p99, ow_max, host_cycles, guest_cycles, sent == count && shm->error_code == 0,
+                    wait_policy_name(host_wait.kind), guest_wait_name(shm), timing_source(), timing_tsc_khz(),
+                    timing.overhead_ns, timing.resolution_ns, shm->guest_tsc_khz, shm->guest_timer_overhead_ns,
+                    sync_fields);
+        }
+        
+        if (shm->error_code != 0) {
+            printf("  Guest reported error %u at %u B\n", shm->error_code, size);
+        }
+        if (sent < count) break;
+    }
+    
+    printf("\nRTT: host publish -> guest acknowledgement seen (host clock, %u ns timer overhead subtracted).\n",
+           timing.overhead_ns);
+    printf("1-way: host publish -> guest detection; only meaningful when host and guest share a clock.\n");
+    printf("Synced 1-way: guest detection mapped onto the host clock by the clock sync estimate (-T on the guest);\n");
+    printf("the offset is interpolated between the bursts before and after each size, bounded by their larger half round trip.\n");
+    
+    if (perf_available) {
+        perf_counters_cleanup(&perf_counters);
+    }
+    free(payload);
+    free(rtt);
+    free(oneway);
+    free(publish);
+    free(detect);
+    free(synced);
+    csv_close(csv);
+}
+
+// Batch sizes swept by test_batch(): 1, 2, 4 .. BATCH_SWEEP_MAX
+#define BATCH_SWEEP_MAX 1024
+
+// Queue big enough for two of the largest batches, so a batch never waits for space
+static uint64_t batch_queue_capacity(uint32_t msg_size, size_t avail)
+{
+    uint64_t want = 2 * BATCH_SWEEP_MAX * msgq_record_bytes(msg_size);
+    uint64_t capacity = 4096;
+    while (capacity < want) capacity *= 2;
+    uint64_t max_capacity = msgq_max_capacity(avail);
+    return capacity < max_capacity ? capacity : max_capacity;
+}
+
+// Batched submission: the host enqueues K messages, publishes them with one
+// index store and waits for the guest's single acknowledgement before the next
+// batch. Sweeps K = 1..1024 with `count` messages per point. Latency is per
+// message, from enqueue to the acknowledgement that covers it (host clock), so
+// it includes the time a message waits for the rest of its batch.
+void test_batch(volatile struct shared_data *shm, int count, uint32_t msg_size)
+{
+    printf("\n=== Batched Submission Test - One Notification per Batch ===\n");
+    printf("Host: enqueue K messages, publish head once, wait for tail | Guest: drain all, acknowledge once\n");
+    printf("Message size: %u B | Batch sizes: 1 .. %d | Messages per batch size: ~%d\n\n",
+           msg_size, BATCH_SWEEP_MAX, count);
+    
+    size_t avail = SHMEM_SIZE - offsetof(struct shared_data, buffer);
+    uint64_t capacity = batch_queue_capacity(msg_size, avail);
+    
+    uint8_t *payload = malloc(msg_size > 0 ? msg_size : 1);
+    uint64_t *enqueue_ns = malloc(BATCH_SWEEP_MAX * sizeof(uint64_t));
+    uint64_t *latency = malloc(((size_t)count + BATCH_SWEEP_MAX) * sizeof(uint64_t));
+    if (!payload || !enqueue_ns || !latency) {
+        printf("ERROR: Failed to allocate message buffers\n");
+        free(payload);
+        free(enqueue_ns);
+        free(latency);
+        return;
+    }
+    RAND_bytes(payload, msg_size > 0 ? msg_size : 1);
+    
+    memset((void *)&shm->timing, 0, sizeof(struct timing_data));
+    shm->error_code = 0;
+    
+    struct msgq queue;
+    if (!msgq_init(&queue, (void *)&shm->buffer[0], avail, capacity)) {
+        printf("ERROR: Failed to initialize the message queue (%lu bytes)\n", (unsigned long)capacity);
+        free(payload);
+        free(enqueue_ns);
+        free(latency);
+        return;
+    }
+    __sync_synchronize();
+    
+    // STATE: HOST_STATE_READY -> HOST_STATE_SENDING (queue is formatted)
+    set_host_state(shm, HOST_STATE_SENDING);
+    
+    if (!wait_for_guest_state(shm, GUEST_STATE_PROCESSING, 10000000000ULL, "guest attached to queue")) {
+        printf("ERROR: Guest did not attach to the message queue (is it running with -B?)\n");
+        set_host_state(shm, HOST_STATE_READY);
+        free(payload);
+        free(enqueue_ns);
+        free(latency);
+        return;
+    }
+    
+    printf("Guest attached. Queue: %lu KB\n\n", (unsigned long)(capacity / 1024));
+    
+    csv_logger_t *csv = csv_create("batch_results.csv",
+        "batch_size,message_bytes,messages,batches,messages_per_s,mb_per_s,batch_rtt_avg_ns,latency_avg_ns,latency_p50_ns,latency_p99_ns,latency_p999_ns,latency_max_ns,messages_per_ack,success,host_wait_policy,guest_wait_policy,host_timer,host_tsc_khz,host_timer_overhead_ns,host_timer_resolution_ns");
+    
+    printf("    Batch |   Msgs/s |    MB/s | Batch RTT |   Lat p50 |   Lat p99 | Lat p99.9 |   Lat max | Msgs/ack\n");
+    printf("  --------+----------+---------+-----------+-----------+-----------+-----------+-----------+---------\n");
+    
+    uint32_t sequence = 0;
+    bool failed = false;
+    
+    for (int batch = 1; batch <= BATCH_SWEEP_MAX && !failed; batch *= 2) {
+        // Whole batches only, at least one
+        int batches = count / batch > 0 ? count / batch : 1;
+        if ((uint64_t)(batch + 1) * msgq_record_bytes(msg_size) > capacity) {
+            printf("  %7d | skipped: batch doesn't fit in the %lu KB queue\n", batch, (unsigned long)(capacity / 1024));
+            break;
+        }
+        uint64_t acks_before = queue.hdr->acks;
+        uint64_t rtt_sum = 0;
+        size_t measured = 0;
+        
+        uint64_t point_start = get_time_ns();
+        
+        for (int b = 0; b < batches; b++) {
+            for (int k = 0; k < batch; k++) {
+                enqueue_ns[k] = get_time_ns();
+                if (!msgq_enqueue(&queue, payload, msg_size, sequence)) {
+                    printf("  [K=%d] ERROR: Queue full (the guest has not acknowledged earlier batches)\n", batch);
+                    failed = true;
+                    break;
+                }
+                sequence++;
+            }
+            if (failed) break;
+            
+            uint64_t publish = get_time_ns();
+            msgq_publish(&queue);
+            
+            struct wait_state ws;
+            wait_begin(&ws);
+            while (!msgq_acked(&queue)) {
+                if (get_time_ns() - publish > 5000000000ULL) {
+                    printf("  [K=%d] TIMEOUT on batch %d (is the guest running with -B?)\n", batch, b);
+                    failed = true;
+                    break;
+                }
+                wait_step(&host_wait, &ws);
+            }
+            if (failed) break;
+            
+            uint64_t acked = get_time_ns();
+            rtt_sum += timing_elapsed_ns(publish, acked);
+            for (int k = 0; k < batch; k++) {
+                latency[measured++] = timing_elapsed_ns(enqueue_ns[k], acked);
+            }
+        }
+        
+        uint64_t point_end = get_time_ns();
+        
+        if (measured == 0) {
+            if (csv && csv->file) {
+                fprintf(csv->file, "%d,%u,0,0,0,0,0,0,0,0,0,0,0,0,%s,%s,%s,%u,%u,%.2f\n", batch, msg_size,
+                        wait_policy_name(host_wait.kind), guest_wait_name(shm), timing_source(), timing_tsc_khz(),
+                        timing.overhead_ns, timing.resolution_ns);
+            }
+            break;
+        }
+        
+        size_t done_batches = measured / batch;
+        uint64_t lat_sum = 0;
+        for (size_t i = 0; i < measured; i++) lat_sum += latency[i];
+        qsort(latency, measured, sizeof(uint64_t), compare_u64);
+        
+        double rate = measured / ((point_end - point_start) / 1e9);
+        double mbps = rate * msg_size / (1024.0 * 1024.0);
+        uint64_t rtt_avg = rtt_sum / done_batches;
+        uint64_t p50 = latency[measured / 2], p99 = latency[(measured * 99) / 100];
+        uint64_t p999 = latency[(measured * 999) / 1000], lat_max = latency[measured - 1];
+        uint64_t acks = queue.hdr->acks - acks_before;
+        double per_ack = acks > 0 ? (double)measured / acks : 0.0;
+        
+        printf("  %7d | %8.0f | %7.1f | %6.1f µs | %6.1f µs | %6.1f µs | %6.1f µs | %6.1f µs | %8.1f\n",
+               batch, rate, mbps, rtt_avg / 1000.0, p50 / 1000.0, p99 / 1000.0, p999 / 1000.0,
+               lat_max / 1000.0, per_ack);
+        fflush(stdout);
+        
+        if (csv && csv->file) {
+            fprintf(csv->file, "%d,%u,%zu,%zu,%.0f,%.2f,%lu,%.0f,%lu,%lu,%lu,%lu,%.1f,%d,%s,%s,%s,%u,%u,%.2f\n",
+                    batch, msg_size, measured, done_batches, rate, mbps, rtt_avg, (double)lat_sum / measured,
+                    p50, p99, p999, lat_max, per_ack, !failed && shm->error_code == 0,
+                    wait_policy_name(host_wait.kind), guest_wait_name(shm), timing_source(), timing_tsc_khz(),
+                    timing.overhead_ns, timing.resolution_ns);
+        }
+        
+        if (shm->error_code != 0) {
+            printf("  Guest reported error %u at batch size %d\n", shm->error_code, batch);
+            failed = true;
+        }
+    }
+    
+    msgq_close(&queue);
+    bool guest_done = wait_for_guest_state(shm, GUEST_STATE_ACKNOWLEDGED, 10000000000ULL, "guest finished stream");
+    
+    printf("\nLatency: enqueue -> acknowledgement covering the message seen (host clock).\n");
+    printf("Msgs/ack: messages the guest drained per acknowledgement (equals the batch size\n");
+    printf("          when every batch is drained in one pass).\n");
+    if (guest_done && sequence > 0) {
+        printf("Guest drain (avg):    %.1f ns per message (guest clock)\n",
+               (double)shm->timing.guest_copy_duration / sequence);
+    } else if (!guest_done) {
+        printf("WARNING: Guest did not acknowledge the end of the stream\n");
+    }
+    
+    // STATE: HOST_STATE_SENDING -> HOST_STATE_READY
+    set_host_state(shm, HOST_STATE_READY);
+    
+    if (!wait_for_guest_state(shm, GUEST_STATE_READY, 1000000000ULL, "guest ready")) {
+        printf("WARNING: Guest didn't return to ready state\n");
+    }
+    
+    free(payload);
+    free(enqueue_ns);
+    free(latency);
+    csv_close(csv);
+}
+
+// Several named channels in one region: video (bulk), audio (paced), control
+// (request/echo) and telemetry (guest->host). The host times control round
+// trips at 1 kHz first with only control traffic, then with video and audio
+// running, to show whether a bulk channel inflates control latency.
+void test_channels(volatile struct shared_data *shm, int seconds)
+{
+    printf("\n=== Channel Directory Test - Control Latency Under Bulk Traffic ===\n");
+    printf("Channels: video (bulk frames), audio (10 ms buffers), control + reply (echo), telemetry (guest->host)\n");
+    printf("Phases: control alone, then control with video and audio (%d s each)\n\n", seconds);
+    
+    size_t avail = SHMEM_SIZE - offsetof(struct shared_data, buffer);
+    volatile struct chan_directory *dir = (volatile struct chan_directory *)&shm->buffer[0];
+    uint32_t video_size = 1920 * 1080 * 3;
+    
+    memset((void *)&shm->timing, 0, sizeof(struct timing_data));
+    shm->error_code = 0;
+    
+    int video = -1, audio = -1, control = -1, reply = -1, telemetry = -1;
+    if (chandir_init(dir, avail)) {
+        video = chandir_add(dir, "video", CHANNEL_VIDEO, CHANNEL_HOST_TO_GUEST, 4, video_size);
+        audio = chandir_add(dir, "audio", CHANNEL_AUDIO, CHANNEL_HOST_TO_GUEST, 32, CHANNEL_AUDIO_BYTES);
+        control = chandir_add(dir, "control", CHANNEL_CONTROL, CHANNEL_HOST_TO_GUEST, 16, CHANNEL_CONTROL_BYTES);
+        reply = chandir_add(dir, "control-reply", CHANNEL_CONTROL, CHANNEL_GUEST_TO_HOST, 16, CHANNEL_CONTROL_BYTES);
+        telemetry = chandir_add(dir, "telemetry", CHANNEL_TELEMETRY, CHANNEL_GUEST_TO_HOST, 16, CHANNEL_TELEMETRY_BYTES);
+    }
+    if (video < 0 || audio < 0 || control < 0 || reply < 0 || telemetry < 0) {
+        printf("ERROR: Channels don't fit in %zu bytes\n", avail);
+        return;
+    }
+    dir->entries[control].reply = (uint32_t)reply;
+    chandir_set_period(dir, audio, 10000);
+    chandir_set_period(dir, control, 1000);
+    chandir_set_period(dir, telemetry, 100000);
+    chandir_publish(dir);
+    
+    printf("Channel directory (%u channels):\n", dir->count);
+    for (uint32_t i = 0; i < dir->count; i++) {
+        volatile struct chan_entry *e = &dir->entries[i];
+        printf("  %-14s %-9s %s  %2u x %8u B  at +%-9lu (%.2f MB)\n", (const char *)e->name,
+               channel_type_name(e->type), e->direction == CHANNEL_HOST_TO_GUEST ? "host->guest" : "guest->host",
+               e->slot_count, e->slot_size, (unsigned long)e->offset, e->size / (1024.0 * 1024.0));
+    }
+    printf("\n");
+    
+    uint64_t samples_max = (uint64_t)seconds * 1000 + 16;
+    uint8_t *video_frame = page_alloc(video_size, &host_pages);
+    uint8_t *audio_buf = malloc(CHANNEL_AUDIO_BYTES);
+    uint8_t *telemetry_buf = malloc(CHANNEL_TELEMETRY_BYTES);
+    uint64_t *rtt = malloc(samples_max * sizeof(uint64_t));
+    if (!video_frame || !audio_buf || !telemetry_buf || !rtt) {
+        printf("ERROR: Failed to allocate channel buffers\n");
+        if (video_frame) page_free(video_frame, video_size, host_pages);
+        free(audio_buf);
+        free(telemetry_buf);
+        free(rtt);
+        return;
+    }
+    generate_random_frame(video_frame, 1920, 1080);
+    RAND_bytes(audio_buf, CHANNEL_AUDIO_BYTES);
+    
+    struct ring control_ring, reply_ring;
+    uint32_t phase_stop = 0;
+    struct chan_worker video_w = { .wait = &host_wait, .stop = &phase_stop, .buffer = video_frame, .size = video_size };
+    struct chan_worker audio_w = { .wait = &host_wait, .stop = &phase_stop, .buffer = audio_buf,
+                                   .size = CHANNEL_AUDIO_BYTES, .period_ns = 10000000ULL };
+    struct chan_worker telemetry_w = { .wait = &host_wait, .stop = &dir->closed, .buffer = telemetry_buf,
+                                       .size = CHANNEL_TELEMETRY_BYTES };
+    
+    if (!chandir_open(dir, control, &control_ring, true) || !chandir_open(dir, reply, &reply_ring, false) ||
+        !chandir_open(dir, video, &video_w.ring, true) || !chandir_open(dir, audio, &audio_w.ring, true) ||
+        !chandir_open(dir, telemetry, &telemetry_w.ring, false)) {
+        printf("ERROR: Failed to open channel rings\n");
+        page_free(video_frame, video_size, host_pages);
+        free(audio_buf);
+        free(telemetry_buf);
+        free(rtt);
+        return;
+    }
+    
+    // STATE: HOST_STATE_READY -> HOST_STATE_SENDING (directory published)
+    set_host_state(shm, HOST_STATE_SENDING);
+    
+    if (!wait_for_guest_state(shm, GUEST_STATE_PROCESSING, 10000000000ULL, "guest opened channels")) {
+        printf("ERROR: Guest did not open the channels (is it running with -C?)\n");
+        set_host_state(shm, HOST_STATE_READY);
+        page_free(video_frame, video_size, host_pages);
+        free(audio_buf);
+        free(telemetry_buf);
+        free(rtt);
+        return;
+    }
+    
+    pthread_t telemetry_thread;
+    bool telemetry_running = pthread_create(&telemetry_thread, NULL, chan_consume, &telemetry_w) == 0;
+    
+    csv_logger_t *csv = csv_create("channel_results.csv",
+        "phase,channel,type,direction,slot_size,messages,mb_per_s,rtt_p50_ns,rtt_p99_ns,rtt_p999_ns,rtt_max_ns,success,host_wait_policy,guest_wait_policy");
+    
+    static const char *phase_names[2] = { "control-only", "with-bulk" };
+    uint64_t p50[2] = {0}, p99[2] = {0};
+    uint32_t sequence = 0;
+    bool failed = false;
+    
+    printf("         Phase | Ctrl msgs |    RTT p50 |    RTT p99 |  RTT p99.9 |    RTT max | Video MB/s | Audio msgs | Telemetry\n");
+    printf("  -------------+-----------+------------+------------+------------+------------+------------+------------+----------\n");
+    
+    for (int phase = 0; phase < 2 && !failed; phase++) {
+        bool bulk = phase == 1;
+        pthread_t video_thread, audio_thread;
+        bool video_running = false, audio_running = false;
+        
+        phase_stop = 0;
+        video_w.messages = video_w.bytes = 0;
+        audio_w.messages = audio_w.bytes = 0;
+        uint64_t telemetry_before = __atomic_load_n(&telemetry_w.messages, __ATOMIC_RELAXED);
+        
+        if (bulk) {
+            video_running = pthread_create(&video_thread, NULL, chan_produce, &video_w) == 0;
+            audio_running = pthread_create(&audio_thread, NULL, chan_produce, &audio_w) == 0;
+        }
+        
+        // Control round trips at 1 kHz on this thread
+        uint8_t message[CHANNEL_CONTROL_BYTES] = {0};
+        uint8_t echo[CHANNEL_CONTROL_BYTES];
+        uint64_t count = 0;
+        uint64_t phase_start = get_time_ns();
+        uint64_t phase_end = phase_start + (uint64_t)seconds * 1000000000ULL;
+        struct timespec next;
+        clock_gettime(CLOCK_MONOTONIC, &next);
+        
+        while (get_time_ns() < phase_end && count < samples_max) {
+            next.tv_nsec += 1000000;
+            if (next.tv_nsec >= 1000000000L) {
+                next.tv_sec++;
+                next.tv_nsec -= 1000000000L;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+            
+            memcpy(message, &sequence, sizeof(sequence));
+            uint64_t t0 = get_time_ns();
+            if (!ring_try_push(&control_ring, message, CHANNEL_CONTROL_BYTES, sequence, NULL)) {
+                printf("  ERROR: Control channel full (guest is not echoing)\n");
+                failed = true;
+                break;
+            }
+            
+            uint32_t echo_size = 0, echo_sequence = 0;
+            struct wait_state ws;
+            wait_begin(&ws);
+            while (!ring_try_pop(&reply_ring, echo, sizeof(echo), &echo_size, &echo_sequence, NULL)) {
+                if (get_time_ns() - t0 > 5000000000ULL) {
+                    printf("  TIMEOUT waiting for control reply %u\n", sequence);
+                    failed = true;
+                    break;
+                }
+                wait_step(&host_wait, &ws);
+            }
+            if (failed) break;
+            rtt[count++] = get_time_ns() - t0;
+            
+            if (echo_sequence != sequence) {
+                printf("  ERROR: Control reply %u for request %u\n", echo_sequence, sequence);
+                shm->error_code = 4;
+            }
+            sequence++;
+        }
+        
+        uint64_t elapsed = get_time_ns() - phase_start;
+        __atomic_store_n(&phase_stop, 1, __ATOMIC_RELEASE);
+        if (video_running) pthread_join(video_thread, NULL);
+        if (audio_running) pthread_join(audio_thread, NULL);
+        
+        if (count == 0) break;
+        
+        qsort(rtt, count, sizeof(uint64_t), compare_u64);
+        p50[phase] = rtt[count / 2];
+        p99[phase] = rtt[(count * 99) / 100];
+        uint64_t p999 = rtt[(count * 999) / 1000], rtt_max = rtt[count - 1];
+        double video_mbps = video_w.bytes / (1024.0 * 1024.0) / (elapsed / 1e9);
+        uint64_t telemetry_msgs = __atomic_load_n(&telemetry_w.messages, __ATOMIC_RELAXED) - telemetry_before;
+        bool success = !failed && shm->error_code == 0;
+        
+        printf("  %12s | %9lu | %7.1f µs | %7.1f µs | %7.1f µs | %7.0f µs | %10.0f | %10lu | %9lu\n",
+               phase_names[phase], (unsigned long)count, p50[phase] / 1000.0, p99[phase] / 1000.0,
+               p999 / 1000.0, rtt_max / 1000.0, video_mbps, (unsigned long)audio_w.messages,
+               (unsigned long)telemetry_msgs);
+        fflush(stdout);
+        
+        if (csv && csv->file) {
+            const char *wait_host = wait_policy_name(host_wait.kind), *wait_guest = guest_wait_name(shm);
+            fprintf(csv->file, "%s,control,control,host->guest,%u,%lu,%.3f,%lu,%lu,%lu,%lu,%d,%s,%s\n",
+                    phase_names[phase], CHANNEL_CONTROL_BYTES, (unsigned long)count,
+                    count * CHANNEL_CONTROL_BYTES / (1024.0 * 1024.0) / (elapsed / 1e9),
+                    p50[phase], p99[phase], p999, rtt_max, success, wait_host, wait_guest);
+            fprintf(csv->file, "%s,video,video,host->guest,%u,%lu,%.1f,0,0,0,0,%d,%s,%s\n",
+                    phase_names[phase], video_size, (unsigned long)video_w.messages, video_mbps, success,
+                    wait_host, wait_guest);
+            fprintf(csv->file, "%s,audio,audio,host->guest,%u,%lu,%.3f,0,0,0,0,%d,%s,%s\n",
+                    phase_names[phase], CHANNEL_AUDIO_BYTES, (unsigned long)audio_w.messages,
+                    audio_w.bytes / (1024.0 * 1024.0) / (elapsed / 1e9), success, wait_host, wait_guest);
+            fprintf(csv->file, "%s,telemetry,telemetry,guest->host,%u,%lu,%.3f,0,0,0,0,%d,%s,%s\n",
+                    phase_names[phase], CHANNEL_TELEMETRY_BYTES, (unsigned long)telemetry_msgs,
+                    telemetry_msgs * CHANNEL_TELEMETRY_BYTES / (1024.0 * 1024.0) / (elapsed / 1e9), success,
+                    wait_host, wait_guest);
+        }
+    }
+    
+    // End of traffic on every channel; the guest's workers drain and exit
+    chandir_close(dir);
+    if (telemetry_running) pthread_join(telemetry_thread, NULL);
+    
+    bool guest_done = wait_for_guest_state(shm, GUEST_STATE_ACKNOWLEDGED, 10000000000ULL, "guest closed channels");
+    
+    if (p50[0] > 0 && p50[1] > 0) {
+        printf("\nControl RTT with bulk traffic vs. alone: p50 %.2fx, p99 %.2fx\n",
+               (double)p50[1] / p50[0], (double)p99[1] / p99[0]);
+    }
+    printf("RTT: control request pushed -> guest echo popped from control-reply (host clock).\n");
+    if (!guest_done) {
+        printf("WARNING: Guest did not acknowledge the end of the stream\n");
+    }
+    
+    // STATE: HOST_STATE_SENDING -> HOST_STATE_READY
+    set_host_state(shm, HOST_STATE_READY);
+    
+    if (!wait_for_guest_state(shm, GUEST_STATE_READY, 1000000000ULL, "guest ready")) {
+        printf("WARNING: Guest didn't return to ready state\n");
+    }
+    
+    page_free(video_frame, video_size, host_pages);
+    free(audio_buf);
+    free(telemetry_buf);
+    free(rtt);
+    csv_close(csv);
+}
+
+// Message mix for the allocator test: per 1000 messages, 15 video frames
+// (720p or 1080p), 285 audio buffers (10 or 20 ms) and 700 metadata records
+#define ALLOC_KIND_FRAME 0
+#define ALLOC_KIND_AUDIO 1
+#define ALLOC_KIND_META 2
+#define ALLOC_MAX_MESSAGE (1920 * 1080 * 3)
+
+static uint32_t alloc_mix_next(uint64_t *state, uint16_t *kind)
+{
+    // xorshift64: deterministic so both phases see the same sequence
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    
+    uint32_t r = (uint32_t)(x % 1000);
+    if (r < 15) {
+        *kind = ALLOC_KIND_FRAME;
+        return (x >> 32) & 1 ? 1920 * 1080 * 3 : 1280 * 720 * 3;
+    }
+    if (r < 300) {
+        *kind = ALLOC_KIND_AUDIO;
+        return (x >> 32) & 1 ? 3840 : 1920;
+    }
+    *kind = ALLOC_KIND_META;
+    return 32 + (uint32_t)((x >> 32) % 993);
+}
+
+// Region allocator: a realistic mix of frames, audio and metadata streamed
+// through blocks allocated from the data area and freed by the guest. Runs
+// once with the arena alone and once with size-class slabs in front of it,
+// reporting throughput and how fragmented the region gets.
+void test_alloc(volatile struct shared_data *shm, int seconds)
+{
+    static const char *phase_names[RALLOC_PHASES] = { "arena-only", "slab+arena" };
+    
+    printf("\n=== Region Allocator Test - Mixed Message Sizes ===\n");
+    printf("Mix per 1000 messages: 15 frames (720p/1080p), 285 audio (1920/3840 B), 700 metadata (32-1024 B)\n");
+    printf("Host: allocate, write, submit offset | Guest: read in place, free through the return queue\n");
+    printf("Phases: arena only, then slabs (");
+    for (int c = 0; c < RALLOC_DEFAULT_CLASS_COUNT; c++) {
+        printf("%s%u", c > 0 ? "/" : "", ralloc_default_classes[c]);
+    }
+    printf(" B) in front of the arena (%d s each)\n\n", seconds);
+    
+    size_t avail = SHMEM_SIZE - offsetof(struct shared_data, buffer);
+    uint8_t *source = page_alloc(ALLOC_MAX_MESSAGE, &host_pages);
+    if (!source) {
+        printf("ERROR: Failed to allocate source buffer\n");
+        return;
+    }
+    generate_random_frame(source, 1920, 1080);
+    
+    csv_logger_t *csv = csv_create("alloc_results.csv",
+        "phase,messages,frames,audio,metadata,mb_per_s,msgs_per_s,alloc_avg_ns,alloc_max_ns,alloc_stalls,stall_ms,peak_in_use_mb,internal_frag_pct,external_frag_avg_pct,external_frag_max_pct,max_extents,slab_allocs,arena_allocs,success,host_wait_policy,guest_wait_policy");
+    
+    printf("       Phase |  Messages |   MB/s |   Msgs/s | Alloc avg | Stalls | Peak MB | Int frag | Ext frag avg/max | Extents\n");
+    printf("  -----------+-----------+--------+----------+-----------+--------+---------+----------+------------------+--------\n");
+    
+    for (int phase = 0; phase < RALLOC_PHASES; phase++) {
+        struct ralloc alloc;
+        uint32_t class_count = phase == 0 ? 0 : RALLOC_DEFAULT_CLASS_COUNT;
+        
+        memset((void *)&shm->timing, 0, sizeof(struct timing_data));
+        shm->error_code = 0;
+        
+        if (!ralloc_init(&alloc, (void *)&shm->buffer[0], avail, ralloc_default_classes, class_count)) {
+            printf("ERROR: Failed to format the allocator over %zu bytes\n", avail);
+            break;
+        }
+        __sync_synchronize();
+        
+        // STATE: HOST_STATE_READY -> HOST_STATE_SENDING (allocator is formatted)
+        set_host_state(shm, HOST_STATE_SENDING);
+        
+        if (!wait_for_guest_state(shm, GUEST_STATE_PROCESSING, 10000000000ULL, "guest attached")) {
+            printf("ERROR: Guest did not attach (is it running with -A?)\n");
+            set_host_state(shm, HOST_STATE_READY);
+            ralloc_destroy(&alloc);
+            break;
+        }
+        
+        uint64_t rng = 0x9E3779B97F4A7C15ULL;
+        uint64_t messages = 0, bytes = 0, kinds[3] = {0};
+        uint64_t alloc_ns = 0, alloc_max = 0, stalls = 0, stall_ns = 0;
+        uint64_t samples = 0, max_extents = 0;
+        double ext_sum = 0.0, ext_max = 0.0, int_sum = 0.0;
+        bool failed = false;
+        struct wait_state ws;
+        
+        uint64_t start = get_time_ns();
+        uint64_t end = start + (uint64_t)seconds * 1000000000ULL;
+        
+        while (!failed && get_time_ns() < end) {
+            struct ralloc_desc d;
+            uint32_t size = alloc_mix_next(&rng, &d.kind);
+            
+            uint64_t t0 = get_time_ns();
+            bool ok = ralloc_alloc(&alloc, size, &d);
+            uint64_t t1 = get_time_ns();
+            if (!ok) {
+                // Region full: wait for the guest to free something
+                stalls++;
+                wait_begin(&ws);
+                while (!(ok = ralloc_alloc(&alloc, size, &d))) {
+                    if (get_time_ns() - t1 > 5000000000ULL) {
+                        printf("  TIMEOUT: no space for a %u B message after 5 s\n", size);
+                        failed = true;
+                        break;
+                    }
+                    wait_step(&host_wait, &ws);
+                }
+                if (failed) break;
+                uint64_t t2 = get_time_ns();
+                stall_ns += t2 - t1;
+                t0 = t2;
+                t1 = t2;
+            }
+            alloc_ns += t1 - t0;
+            if (t1 - t0 > alloc_max) alloc_max = t1 - t0;
+            
+            uint8_t *block = ralloc_ptr(alloc.base, d.offset);
+            memcpy(block, source, size);
+            d.sequence = (uint32_t)messages;
+            memcpy(block, &d.sequence, sizeof(d.sequence));
+            
+            wait_begin(&ws);
+            while (!ralloc_submit(&alloc, &d)) {
+                ralloc_reclaim(&alloc, NULL);
+                wait_step(&host_wait, &ws);
+            }
+            
+            messages++;
+            bytes += size;
+            kinds[d.kind]++;
+            
+            if ((messages & 255) == 0) {
+                double ext = ralloc_external_frag(&alloc);
+                ext_sum += ext;
+                if (ext > ext_max) ext_max = ext;
+                if (alloc.in_use > 0) int_sum += 1.0 - (double)alloc.requested / alloc.in_use;
+                if (alloc.extent_count > max_extents) max_extents = alloc.extent_count;
+                samples++;
+            }
+        }
+        uint64_t elapsed = get_time_ns() - start;
+        
+        // Every block must come back once the guest has drained the stream
+        ralloc_close(&alloc);
+        uint64_t drain_start = get_time_ns();
+        wait_begin(&ws);
+        while (!ralloc_idle(&alloc) && get_time_ns() - drain_start < 10000000000ULL) {
+            wait_step(&host_wait, &ws);
+        }
+        bool leaked = alloc.in_use != 0;
+        if (leaked) {
+            printf("  ERROR: %lu bytes still allocated after the guest finished\n", (unsigned long)alloc.in_use);
+        }
+        if (alloc.rejected > 0) {
+            printf("  ERROR: %lu freed descriptors matched no outstanding block\n", (unsigned long)alloc.rejected);
+        }
+        
+        bool guest_done = wait_for_guest_state(shm, GUEST_STATE_ACKNOWLEDGED, 10000000000ULL, "guest drained");
+        bool success = guest_done && !failed && !leaked && alloc.rejected == 0 && shm->error_code == 0;
+        
+        double mbps = bytes / (1024.0 * 1024.0) / (elapsed / 1e9);
+        double rate = messages / (elapsed / 1e9);
+        double alloc_avg = messages > 0 ? (double)alloc_ns / messages : 0.0;
+        double int_frag = samples > 0 ? 100.0 * int_sum / samples : 0.0;
+        double ext_avg = samples > 0 ? 100.0 * ext_sum / samples : 0.0;
+        
+        printf("  %10s | %9lu | %6.0f | %8.0f | %6.0f ns | %6lu | %7.1f | %7.1f%% | %6.1f%% / %5.1f%% | %7lu\n",
+               phase_names[phase], (unsigned long)messages, mbps, rate, alloc_avg, (unsigned long)stalls,
+               alloc.peak_in_use / (1024.0 * 1024.0), int_frag, ext_avg, 100.0 * ext_max, (unsigned long)max_extents);
+        if (!success) {
+            printf("  ✗ Phase failed (guest error %u)\n", shm->error_code);
+        }
+        fflush(stdout);
+        
+        if (csv && csv->file) {
+            fprintf(csv->file, "%s,%lu,%lu,%lu,%lu,%.1f,%.0f,%.1f,%lu,%lu,%.3f,%.2f,%.2f,%.2f,%.2f,%lu,%lu,%lu,%d,%s,%s\n",
+                    phase_names[phase], (unsigned long)messages, (unsigned long)kinds[ALLOC_KIND_FRAME],
+                    (unsigned long)kinds[ALLOC_KIND_AUDIO], (unsigned long)kinds[ALLOC_KIND_META], mbps, rate,
+                    alloc_avg, (unsigned long)alloc_max, (unsigned long)stalls, stall_ns / 1e6,
+                    alloc.peak_in_use / (1024.0 * 1024.0), int_frag, ext_avg, 100.0 * ext_max,
+                    (unsigned long)max_extents, (unsigned long)alloc.slab_allocs, (unsigned long)alloc.arena_allocs,
+                    success, wait_policy_name(host_wait.kind), guest_wait_name(shm));
+        }
+        ralloc_destroy(&alloc);
+        
+        // STATE: HOST_STATE_SENDING -> HOST_STATE_READY
+        set_host_state(shm, HOST_STATE_READY);
+        
+        if (!wait_for_guest_state(shm, GUEST_STATE_READY, 1000000000ULL, "guest ready")) {
+            printf("WARNING: Guest didn't return to ready state\n");
+        }
+        if (!guest_done) {
+            break;
+        }
+    }
+    
+    printf("\nInt frag: bytes reserved but not requested (slab/page rounding), sampled every 256 messages.\n");
+    printf("Ext frag: 1 - largest free arena extent / free arena bytes.\n");
+    
+    page_free(source, ALLOC_MAX_MESSAGE, host_pages);
+    csv_close(csv);
+}
+
+// Zero-copy consume: the guest runs a real kernel on every frame of a ring
+// stream, once after copying the slot out and once in place through
+// ring_lease(). Six phases of `frames` each (3 kernels x 2 modes); the guest's
+// kernel output is checked against the host's own run on the same frame.
+void test_zerocopy(volatile struct shared_data *shm, int frames, const char *frame_name)
+{
+    printf("\n=== Zero-Copy Consume Test - In-Place Kernels vs. Copy-Then-Process ===\n");
+    printf("Guest per frame: copy mode = memcpy slot -> local, kernel on local | in-place = lease slot, kernel on slot\n");
+    
+    int frame_idx = 0;
+    while (test_frames[frame_idx].name != NULL && strcmp(test_frames[frame_idx].name, frame_name) != 0) {
+        frame_idx++;
+    }
+    if (test_frames[frame_idx].name == NULL) {
+        printf("ERROR: Unknown frame type '%s' (use 1080p, 1440p or 4K)\n", frame_name);
+        return;
+    }
+    
+    uint32_t width = test_frames[frame_idx].width;
+    uint32_t height = test_frames[frame_idx].height;
+    uint32_t frame_size = width * height * test_frames[frame_idx].bpp;
+    if (test_frames[frame_idx].bpp != 3) {
+        printf("ERROR: Kernels expect RGB24 frames\n");
+        return;
+    }
+    
+    size_t avail = SHMEM_SIZE - offsetof(struct shared_data, buffer);
+    uint32_t slots = ring_max_slots(avail - KBENCH_HEADER_SIZE, frame_size);
+    if (slots > RING_DEFAULT_MAX_SLOTS) slots = RING_DEFAULT_MAX_SLOTS;
+    if (slots < 2) {
+        printf("ERROR: A ring of 2 x %s (%.2f MB) doesn't fit in %zu bytes\n",
+               frame_name, frame_size / (1024.0 * 1024.0), avail);
+        return;
+    }
+    printf("Frame: %s (%.2f MB) | %u slots | %d frames per phase\n\n",
+           frame_name, frame_size / (1024.0 * 1024.0), slots, frames);
+    
+    uint8_t *frame = page_alloc(frame_size, &host_pages);
+    void *scratch = malloc(frame_kernel_scratch_size(width, height));
+    if (!frame || !scratch) {
+        printf("ERROR: Failed to allocate frame buffers\n");
+        if (frame) page_free(frame, frame_size, host_pages);
+        free(scratch);
+        return;
+    }
+    generate_random_frame(frame, width, height);
+    
+    csv_logger_t *csv = csv_create("zerocopy_results.csv",
+        "kernel,mode,frame_type,size_bytes,frames,guest_copy_us,guest_kernel_us,guest_hold_us,frames_per_s,mismatches,success,host_wait_policy,guest_wait_policy");
+    
+    volatile struct kbench_header *hdr = (volatile struct kbench_header *)&shm->buffer[0];
+    double cost_us[KERNEL_COUNT][KBENCH_MODE_COUNT] = {{0}};
+    bool stopped = false;
+    
+    printf("     Kernel |     Mode | Frames | Copy µs/frame | Kernel µs/frame | Slot held µs | Frames/s | Check\n");
+    printf("  ----------+----------+--------+---------------+-----------------+--------------+----------+------\n");
+    
+    for (uint32_t kernel = 0; kernel < KERNEL_COUNT && !stopped; kernel++) {
+        uint64_t expected = frame_kernel_run(kernel, frame, width, height, scratch);
+        
+        for (uint32_t mode = 0; mode < KBENCH_MODE_COUNT; mode++) {
+            memset((void *)&shm->timing, 0, sizeof(struct timing_data));
+            shm->error_code = 0;
+            
+            hdr->magic = 0;
+            __sync_synchronize();
+            memset((void *)hdr, 0, sizeof(struct kbench_header));
+            hdr->kernel = kernel;
+            hdr->mode = mode;
+            hdr->width = width;
+            hdr->height = height;
+            hdr->ring_offset = KBENCH_HEADER_SIZE;
+            hdr->expected = expected;
+            
+            struct ring ring;
+            if (!ring_init(&ring, (uint8_t *)hdr + KBENCH_HEADER_SIZE, avail - KBENCH_HEADER_SIZE, slots, frame_size)) {
+                printf("ERROR: Failed to initialize the ring\n");
+                stopped = true;
+                break;
+            }
+            __atomic_store_n(&hdr->magic, KBENCH_MAGIC, __ATOMIC_RELEASE);
+            
+            // STATE: HOST_STATE_READY -> HOST_STATE_SENDING (phase and ring formatted)
+            set_host_state(shm, HOST_STATE_SENDING);
+            
+            if (!wait_for_guest_state(shm, GUEST_STATE_PROCESSING, 10000000000ULL, "guest attached")) {
+                printf("ERROR: Guest did not attach (is it running with -Z?)\n");
+                set_host_state(shm, HOST_STATE_READY);
+                stopped = true;
+                break;
+            }
+            
+            uint64_t start = get_time_ns();
+            int sent = 0;
+            bool timed_out = false;
+            struct wait_state ws;
+            while (sent < frames) {
+                wait_begin(&ws);
+                uint64_t wait_start = get_time_ns();
+                while (!ring_has_space(&ring)) {
+                    if (get_time_ns() - wait_start > 10000000000ULL) {
+                        printf("  TIMEOUT waiting for the guest to release a slot\n");
+                        timed_out = true;
+                        break;
+                    }
+                    wait_step(&host_wait, &ws);
+                }
+                if (timed_out) break;
+                ring_try_push(&ring, frame, frame_size, (uint32_t)sent, NULL);
+                sent++;
+            }
+            __atomic_store_n(&hdr->closed, 1, __ATOMIC_RELEASE);
+            
+            bool guest_done = wait_for_guest_state(shm, GUEST_STATE_ACKNOWLEDGED, 30000000000ULL, "guest drained");
+            uint64_t elapsed = get_time_ns() - start;
+            
+            uint64_t done = hdr->frames;
+            double copy_us = done > 0 ? hdr->copy_ns / 1000.0 / done : 0.0;
+            double kernel_us = done > 0 ? hdr->process_ns / 1000.0 / done : 0.0;
+            double hold_us = done > 0 ? hdr->hold_ns / 1000.0 / done : 0.0;
+            cost_us[kernel][mode] = copy_us + kernel_us;
+            double fps = done / (elapsed / 1e9);
+            bool success = guest_done && !timed_out && done == (uint64_t)sent && hdr->mismatches == 0 &&
+                           shm->error_code == 0;
+            
+            printf("  %9s | %8s | %6lu | %13.1f | %15.1f | %12.1f | %8.1f | %s\n",
+                   frame_kernel_name(kernel), kbench_mode_name(mode), (unsigned long)done, copy_us, kernel_us,
+                   hold_us, fps, success ? "✓" : "✗");
+            if (hdr->mismatches > 0) {
+                printf("  ERROR: %u frames gave a different %s result on the guest\n", hdr->mismatches,
+                       frame_kernel_name(kernel));
+            }
+            fflush(stdout);
+            
+            if (csv && csv->file) {
+                fprintf(csv->file, "%s,%s,%s,%u,%lu,%.2f,%.2f,%.2f,%.1f,%u,%d,%s,%s\n",
+                        frame_kernel_name(kernel), kbench_mode_name(mode), frame_name, frame_size,
+                        (unsigned long)done, copy_us, kernel_us, hold_us, fps, hdr->mismatches,
+                        success, wait_policy_name(host_wait.kind), guest_wait_name(shm));
+            }
+            
+            // STATE: HOST_STATE_SENDING -> HOST_STATE_READY
+            set_host_state(shm, HOST_STATE_READY);
+            
+            if (!wait_for_guest_state(shm, GUEST_STATE_READY, 1000000000ULL, "guest ready")) {
+                printf("WARNING: Guest didn't return to ready state\n");
+            }
+            if (!guest_done) {
+                stopped = true;
+                break;
+            }
+        }
+    }
+    
+    if (!stopped) {
+        printf("\nGuest time per frame (copy + kernel), copy-then-process vs. in-place:\n");
+        for (uint32_t kernel = 0; kernel < KERNEL_COUNT; kernel++) {
+            double copy = cost_us[kernel][KBENCH_COPY], in_place = cost_us[kernel][KBENCH_IN_PLACE];
+            printf("  %-9s  %8.1f µs -> %8.1f µs (%.2fx)\n", frame_kernel_name(kernel), copy, in_place,
+                   in_place > 0 ? copy / in_place : 0.0);
+        }
+        printf("Copy mode releases the slot after the memcpy; in-place holds it until the kernel finishes,\n");
+        printf("so in-place saves a pass over the frame but keeps the producer off the slot for longer.\n");
+    }
+    
+    page_free(frame, frame_size, host_pages);
+    free(scratch);
+    csv_close(csv);
+}
+
+// Striped transfer: the frame is published stripe by stripe so the guest can
+// copy stripe i out while the host writes stripe i+1. One phase per stripe
+// count in stripe_sweep (1 = monolithic), `frames` frames each, one frame in
+// flight. Time to first stripe and completion are both read on the host clock:
+// t0 is the start of the host's write, and the guest's `consumed` counter is
+// sampled between stripes and while waiting for the frame to drain.
+void test_stripes(volatile struct shared_data *shm, int frames, const char *frame_name)
+{
+    printf("\n=== Striped Transfer Test - Partial-Frame Availability vs. Monolithic ===\n");
+    printf("Host per stripe: copy -> stamp -> publish ready flag | Guest: copy each stripe out as soon as it's ready\n");
+    
+    int frame_idx = 0;
+    while (test_frames[frame_idx].name != NULL && strcmp(test_frames[frame_idx].name, frame_name) != 0) {
+        frame_idx++;
+    }
+    if (test_frames[frame_idx].name == NULL) {
+        printf("ERROR: Unknown frame type '%s' (use 1080p, 1440p or 4K)\n", frame_name);
+        return;
+    }
+    
+    uint32_t frame_size = test_frames[frame_idx].width * test_frames[frame_idx].height * test_frames[frame_idx].bpp;
+    size_t avail = SHMEM_SIZE - offsetof(struct shared_data, buffer);
+    if (stripe_data_offset() + (size_t)frame_size > avail) {
+        printf("ERROR: A %s frame (%.2f MB) doesn't fit in %zu bytes\n",
+               frame_name, frame_size / (1024.0 * 1024.0), avail);
+        return;
+    }
+    printf("Frame: %s (%.2f MB) | %d frames per stripe count\n\n", frame_name, frame_size / (1024.0 * 1024.0), frames);
+    
+    uint8_t *frame = page_alloc(frame_size, &host_pages);
+    uint64_t *first_ns = malloc(frames * sizeof(uint64_t));
+    uint64_t *write_ns = malloc(frames * sizeof(uint64_t));
+    uint64_t *done_ns = malloc(frames * sizeof(uint64_t));
+    if (!frame || !first_ns || !write_ns || !done_ns) {
+        printf("ERROR: Failed to allocate frame buffers\n");
+        if (frame) page_free(frame, frame_size, host_pages);
+        free(first_ns);
+        free(write_ns);
+        free(done_ns);
+        return;
+    }
+    generate_random_frame(frame, test_frames[frame_idx].width, test_frames[frame_idx].height);
+    
+    csv_logger_t *csv = csv_create("stripe_results.csv",
+        "stripes,stripe_bytes,frame_type,size_bytes,frames,first_stripe_p50_us,first_stripe_p99_us,host_write_p50_us,complete_p50_us,complete_p99_us,speedup_vs_monolithic,stamp_errors,success,host_wait_policy,guest_wait_policy");
+    
+    volatile struct stripe_header *hdr = (volatile struct stripe_header *)&shm->buffer[0];
+    double monolithic_us = 0.0;
+    
+    printf("  Stripes | Stripe KB | Frames | First stripe p50/p99 µs | Host write p50 µs | Complete p50/p99 µs | vs. 1 | Check\n");
+    printf("  --------+-----------+--------+-------------------------+-------------------+---------------------+-------+------\n");
+    
+    for (int phase = 0; phase < STRIPE_SWEEP_COUNT; phase++) {
+        memset((void *)&shm->timing, 0, sizeof(struct timing_data));
+        shm->error_code = 0;
+        
+        if (!stripe_init(hdr, avail, frame_size, stripe_sweep[phase])) {
+            printf("ERROR: Failed to format %u stripes\n", stripe_sweep[phase]);
+            break;
+        }
+        uint32_t stripes = hdr->stripe_count;
+        uint32_t stripe_size = hdr->stripe_size;
+        
+        // STATE: HOST_STATE_READY -> HOST_STATE_SENDING (stripe header formatted)
+        set_host_state(shm, HOST_STATE_SENDING);
+        
+        if (!wait_for_guest_state(shm, GUEST_STATE_PROCESSING, 10000000000ULL, "guest attached")) {
+            printf("ERROR: Guest did not attach (is it running with -S?)\n");
+            set_host_state(shm, HOST_STATE_READY);
+            break;
+        }
+        
+        uint64_t base = 0;
+        int sent = 0;
+        bool timed_out = false;
+        struct wait_state ws;
+        for (; sent < frames && !timed_out; sent++) {
+            uint32_t number = (uint32_t)sent + 1;
+            uint64_t first = 0;
+            uint64_t t0 = get_time_ns();
+            
+            for (uint32_t i = 0; i < stripes; i++) {
+                uint8_t *dst = stripe_data(hdr, i);
+                copy_pool_run(&host_pool, dst, frame + (size_t)i * stripe_size, stripe_length(hdr, i));
+                memcpy(dst, &number, sizeof(number));
+                stripe_publish(hdr, i, number);
+                if (first == 0 && stripe_progress(hdr) > base) {
+                    first = get_time_ns();
+                }
+            }
+            uint64_t written = get_time_ns();
+            
+            // One frame in flight: wait until the guest has every stripe before reusing them
+            wait_begin(&ws);
+            uint64_t progress;
+            while ((progress = stripe_progress(hdr)) < base + stripes) {
+                if (first == 0 && progress > base) {
+                    first = get_time_ns();
+                }
+                if (get_time_ns() - written > 10000000000ULL) {
+                    printf("  TIMEOUT waiting for the guest to consume frame %u\n", number);
+                    timed_out = true;
+                    break;
+                }
+                wait_step(&host_wait, &ws);
+            }
+            if (timed_out) break;
+            uint64_t done = get_time_ns();
+            
+            first_ns[sent] = (first ? first : done) - t0;
+            write_ns[sent] = written - t0;
+            done_ns[sent] = done - t0;
+            base += stripes;
+        }
+        stripe_close(hdr);
+        
+        bool guest_done = wait_for_guest_state(shm, GUEST_STATE_ACKNOWLEDGED, 30000000000ULL, "guest drained");
+        
+        double first_p50 = 0, first_p99 = 0, write_p50 = 0, done_p50 = 0, done_p99 = 0;
+        if (sent > 0) {
+            qsort(first_ns, sent, sizeof(uint64_t), compare_u64);
+            qsort(write_ns, sent, sizeof(uint64_t), compare_u64);
+            qsort(done_ns, sent, sizeof(uint64_t), compare_u64);
+            first_p50 = first_ns[sent / 2] / 1000.0;
+            first_p99 = first_ns[(sent * 99) / 100] / 1000.0;
+            write_p50 = write_ns[sent / 2] / 1000.0;
+            done_p50 = done_ns[sent / 2] / 1000.0;
+            done_p99 = done_ns[(sent * 99) / 100] / 1000.0;
+        }
+        if (phase == 0) {
+            monolithic_us = done_p50;
+        }
+        double speedup = done_p50 > 0 ? monolithic_us / done_p50 : 0.0;
+        bool success = guest_done && !timed_out && sent == frames && hdr->errors == 0 && shm->error_code == 0;
+        
+        printf("  %7u | %9u | %6d | %11.1f / %9.1f | %17.1f | %9.1f / %7.1f | %4.2fx | %s\n",
+               stripes, stripe_size / 1024, sent, first_p50, first_p99, write_p50, done_p50, done_p99, speedup,
+               success ? "✓" : "✗");
+        if (hdr->errors > 0) {
+            printf("  ERROR: %u stripes carried the wrong frame stamp on the guest\n", hdr->errors);
+        }
+        fflush(stdout);
+        
+        if (csv && csv->file) {
+            fprintf(csv->file, "%u,%u,%s,%u,%d,%.2f,%.2f,%.2f,%.2f,%.2f,%.3f,%u,%d,%s,%s\n",
+                    stripes, stripe_size, frame_name, frame_size, sent, first_p50, first_p99, write_p50,
+                    done_p50, done_p99, speedup, hdr->errors, success,
+                    wait_policy_name(host_wait.kind), guest_wait_name(shm));
+        }
+        
+        // STATE: HOST_STATE_SENDING -> HOST_STATE_READY
+        set_host_state(shm, HOST_STATE_READY);
+        
+        if (!wait_for_guest_state(shm, GUEST_STATE_READY, 1000000000ULL, "guest ready")) {
+            printf("WARNING: Guest didn't return to ready state\n");
+        }
+        if (!guest_done) {
+            break;
+        }
+    }
+    
+    printf("\nFirst stripe: host write start -> guest has copied stripe 0 out (sampled between stripe writes).\n");
+    printf("Complete: host write start -> guest has copied the whole frame out. 1 stripe is the monolithic transfer;\n");
+    printf("with K stripes the guest's copy overlaps the host's, so completion approaches write + one stripe.\n");
+    
+    page_free(frame, frame_size, host_pages);
+    free(first_ns);
+    free(write_ns);
+    free(done_ns);
+    csv_close(csv);
+}
+
+// Wake-up latency and idle CPU cost of each wait policy. One phase per policy,
+// `rounds` rounds each, one round every WAKEUP_INTERVAL_US: the host bumps
+// `ping` and waits for the guest's `pong` with the same policy the guest is
+// waiting with. The futex phase runs when the guest maps the host-local
+// region, the doorbell phase when both sides have a doorbell.
+void test_wakeup(volatile struct shared_data *shm, int rounds)
+{
+    static const wait_policy_kind_t policies[] = {
+        WAIT_POLICY_SPIN, WAIT_POLICY_YIELD, WAIT_POLICY_BACKOFF, WAIT_POLICY_USLEEP, WAIT_POLICY_FUTEX,
+        WAIT_POLICY_DOORBELL
+    };
+    int phases = (int)(sizeof(policies) / sizeof(policies[0]));
+    
+    printf("\n=== Wake-up Test - Notification Latency vs. CPU Cost per Wait Policy ===\n");
+    printf("Per round: host sleeps %d µs, bumps ping (futex: wakes, doorbell: rings the guest), waits for pong\n",
+           WAKEUP_INTERVAL_US);
+    
+    bool futex = shm->guest_futex != 0;
+    printf("Futex: %s\n", futex ? "on (guest maps the host-local region)" : "off (guest is not on a host-local region)");
+    
+    bool doorbell = host_doorbell.kind != DOORBELL_NONE && shm->guest_doorbell_peer != DOORBELL_NO_PEER;
+    if (doorbell) {
+        printf("Doorbell: host peer %u, guest peer %u (%s)\n", shm->host_doorbell_peer, shm->guest_doorbell_peer,
+               doorbell_kind_name(host_doorbell.kind));
+    } else {
+        printf("Doorbell: off (start both sides with --doorbell to include it)\n");
+    }
+    printf("Rounds per policy: %d | Spin limit: %u\n\n", rounds, host_wait.spin_limit);
+    
+    uint64_t *rtt_ns = malloc(rounds * sizeof(uint64_t));
+    if (!rtt_ns) {
+        printf("ERROR: Failed to allocate round buffer\n");
+        return;
+    }
+    
+    csv_logger_t *csv = csv_create("wakeup_results.csv",
+        "policy,rounds,interval_us,spin_limit,rtt_p50_us,rtt_p99_us,rtt_max_us,wake_p50_us,guest_cpu_pct,host_cpu_pct,guest_doorbell_wakeups,doorbell,success");
+    
+    volatile struct wakeup_block *blk = (volatile struct wakeup_block *)&shm->buffer[0];
+    double wake_us[WAKEUP_PHASES] = {0}, guest_cpu_pct[WAKEUP_PHASES] = {0};
+    bool measured[WAKEUP_PHASES] = {false};
+    
+    printf("    Policy | Rounds | RTT p50 µs | RTT p99 µs | RTT max µs | Wake-up µs | Guest CPU | Host CPU | Check\n");
+    printf("  ---------+--------+------------+------------+------------+------------+-----------+----------+------\n");
+    
+    for (int phase = 0; phase < phases; phase++) {
+        if (policies[phase] == WAIT_POLICY_DOORBELL && !doorbell) {
+            printf("  %8s |      - | skipped: no doorbell on %s\n", wait_policy_name(policies[phase]),
+                   host_doorbell.kind == DOORBELL_NONE ? "the host" : "the guest");
+            continue;
+        }
+        if (policies[phase] == WAIT_POLICY_FUTEX && !futex) {
+            printf("  %8s |      - | skipped: guest isn't on a host-local region\n", wait_policy_name(policies[phase]));
+            continue;
+        }
+        
+        memset((void *)&shm->timing, 0, sizeof(struct timing_data));
+        shm->error_code = 0;
+        
+        struct wait_policy policy = host_wait;
+        policy.kind = policies[phase];
+        policy.doorbell = doorbell ? &host_doorbell : NULL;
+        wait_policy_apply(&policy);
+        
+        blk->magic = 0;
+        __sync_synchronize();
+        memset((void *)blk, 0, sizeof(struct wakeup_block));
+        blk->policy = policy.kind;
+        blk->spin_limit = policy.spin_limit;
+        __atomic_store_n(&blk->magic, WAKEUP_MAGIC, __ATOMIC_RELEASE);
+        
+        // STATE: HOST_STATE_READY -> HOST_STATE_SENDING (phase set up)
+        set_host_state(shm, HOST_STATE_SENDING);
+        
+        if (!wait_for_guest_state(shm, GUEST_STATE_PROCESSING, 10000000000ULL, "guest attached")) {
+            printf("ERROR: Guest did not attach (is it running with -W?)\n");
+            set_host_state(shm, HOST_STATE_READY);
+            break;
+        }
+        
+        struct timespec cpu_start, cpu_end, next;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+        clock_gettime(CLOCK_MONOTONIC, &next);
+        uint64_t wall_start = get_time_ns();
+        
+        int done = 0;
+        bool timed_out = false;
+        struct wait_state ws;
+        for (; done < rounds; done++) {
+            uint64_t ns = next.tv_nsec + WAKEUP_INTERVAL_US * 1000ULL;
+            next.tv_sec += ns / 1000000000ULL;
+            next.tv_nsec = ns % 1000000000ULL;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+            
+            uint32_t round = (uint32_t)done + 1;
+            uint64_t t0 = get_time_ns();
+            __atomic_store_n(&blk->ping, round, __ATOMIC_RELEASE);
+            if (policy.kind == WAIT_POLICY_FUTEX) {
+                wait_notify(&shm->host_wake);
+            } else if (policy.kind == WAIT_POLICY_DOORBELL) {
+                doorbell_ring(&host_doorbell, shm->guest_doorbell_peer, 0);
+            }
+            
+            wait_begin(&ws);
+            while (__atomic_load_n(&blk->pong, __ATOMIC_ACQUIRE) != round) {
+                if (get_time_ns() - t0 > 1000000000ULL) {
+                    printf("  TIMEOUT waiting for pong %u\n", round);
+                    timed_out = true;
+                    break;
+                }
+                wait_step(&policy, &ws);
+            }
+            if (timed_out) break;
+            rtt_ns[done] = get_time_ns() - t0;
+        }
+        
+        uint64_t wall_ns = get_time_ns() - wall_start;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+        uint64_t host_cpu_ns = (uint64_t)(cpu_end.tv_sec - cpu_start.tv_sec) * 1000000000ULL +
+                               cpu_end.tv_nsec - cpu_start.tv_nsec;
+        __atomic_store_n(&blk->closed, 1, __ATOMIC_RELEASE);
+        if (policy.kind == WAIT_POLICY_FUTEX) {
+            wait_notify(&shm->host_wake);
+        } else if (policy.kind == WAIT_POLICY_DOORBELL) {
+            doorbell_ring(&host_doorbell, shm->guest_doorbell_peer, 0);
+        }
+        
+        bool guest_done = wait_for_guest_state(shm, GUEST_STATE_ACKNOWLEDGED, 10000000000ULL, "guest results");
+        
+        double p50 = 0, p99 = 0, max = 0;
+        if (done > 0) {
+            qsort(rtt_ns, done, sizeof(uint64_t), compare_u64);
+            p50 = rtt_ns[done / 2] / 1000.0;
+            p99 = rtt_ns[(done * 99) / 100] / 1000.0;
+            max = rtt_ns[done - 1] / 1000.0;
+        }
+        double guest_cpu = blk->wall_ns > 0 ? 100.0 * blk->cpu_ns / blk->wall_ns : 0.0;
+        double host_cpu = wall_ns > 0 ? 100.0 * host_cpu_ns / wall_ns : 0.0;
+        bool success = guest_done && !timed_out && done == rounds && shm->error_code == 0;
+        wake_us[phase] = p50 / 2;
+        guest_cpu_pct[phase] = guest_cpu;
+        measured[phase] = success;
+        
+        printf("  %8s | %6d | %10.2f | %10.2f | %10.2f | %10.2f | %8.1f%% | %7.1f%% | %s\n",
+               wait_policy_name(policy.kind), done, p50, p99, max, p50 / 2, guest_cpu, host_cpu,
+               success ? "✓" : "✗");
+        fflush(stdout);
+        
+        if (csv && csv->file) {
+            fprintf(csv->file, "%s,%d,%d,%u,%.3f,%.3f,%.3f,%.3f,%.2f,%.2f,%lu,%s,%d\n",
+                    wait_policy_name(policy.kind), done, WAKEUP_INTERVAL_US, policy.spin_limit, p50, p99, max,
+                    p50 / 2, guest_cpu, host_cpu, (unsigned long)blk->wakeups,
+                    doorbell ? doorbell_kind_name(host_doorbell.kind) : "none", success);
+        }
+        
+        // STATE: HOST_STATE_SENDING -> HOST_STATE_READY
+        set_host_state(shm, HOST_STATE_READY);
+        
+        if (!wait_for_guest_state(shm, GUEST_STATE_READY, 1000000000ULL, "guest ready")) {
+            printf("WARNING: Guest didn't return to ready state\n");
+        }
+        if (!guest_done) {
+            break;
+        }
+    }
+    
+    // Blocking policies (futex, doorbell) against the legacy usleep(10) poll, phase 3
+    for (int phase = 4; phase < phases; phase++) {
+        if (measured[3] && measured[phase]) {
+            printf("\n%s vs. usleep(10): wake-up %.2f µs vs. %.2f µs, guest CPU %.1f%% vs. %.1f%%",
+                   wait_policy_name(policies[phase]), wake_us[phase], wake_us[3], guest_cpu_pct[phase],
+                   guest_cpu_pct[3]);
+        }
+    }
+    printf("\nWake-up: half the round trip, since both directions use the same policy.\n");
+    printf("CPU: thread CPU time / wall time over the phase, %d µs idle between rounds; 100%% = a core spinning.\n",
+           WAKEUP_INTERVAL_US);
+    
+    wait_policy_apply(&host_wait);
+    free(rtt_ns);
+    csv_close(csv);
+}
+
+// Package energy counter (RAPL through powercap). Usually root-only; the test
+// prints n/a for power when it can't be read.
+#define RAPL_ENERGY_PATH "/sys/class/powercap/intel-rapl:0/energy_uj"
+#define RAPL_RANGE_PATH "/sys/class/powercap/intel-rapl:0/max_energy_range_uj"
+
+static bool rapl_read(const char *path, uint64_t *value)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) return false;
+    unsigned long long v;
+    bool ok = fscanf(f, "%llu", &v) == 1;
+    fclose(f);
+    *value = v;
+    return ok;
+}
+
+// Energy in µJ between two readings, allowing for one counter wrap
+static uint64_t rapl_delta(uint64_t start, uint64_t end, uint64_t range)
+{
+    return end >= start ? end - start : range - start + end;
+}
+
+#define WAIT_POWER_INTERVAL_US 1000    // One wake-up per millisecond
+
+// Wait-power block, at the start of shared_data.buffer. The waker writes the
+// first line (the one umwait monitors), the waiter the second.
+struct wait_power_block {
+    uint32_t ping;                 // Round number, bumped once per interval
+    uint32_t wake;                 // Futex word for the futex phase
+    uint32_t closed;
+    uint64_t wake_ns;              // get_time_ns() just before ping was bumped
+    uint32_t seen __attribute__((aligned(128)));  // Last round the waiter saw
+};
+
+struct wait_power_waiter {
+    volatile struct wait_power_block *blk;
+    struct wait_policy policy;
+    int cpu;
+    uint64_t *samples;
+    int capacity;
+    int count;
+    uint64_t cpu_ns;               // Thread CPU time over wall_ns, the waiter's whole life
+    uint64_t wall_ns;
+};
+
+struct wait_power_sibling {
+    int cpu;
+    volatile uint64_t iterations;
+    volatile bool stop;
+};
+
+// The dedicated waiter: block on `ping` with the phase's policy, time each wake-up
+static void *wait_power_waiter_thread(void *arg)
+{
+    struct wait_power_waiter *w = (struct wait_power_waiter *)arg;
+    volatile struct wait_power_block *blk = w->blk;
+    if (w->cpu >= 0) numa_pin_cpu(w->cpu);
+    
+    struct timespec cpu_start, cpu_end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+    uint64_t wall_start = get_time_ns();
+    
+    uint32_t last = 0;
+    struct wait_state ws;
+    for (;;) {
+        uint32_t ping;
+        wait_begin(&ws);
+        while ((ping = __atomic_load_n(&blk->ping, __ATOMIC_ACQUIRE)) == last &&
+               !__atomic_load_n(&blk->closed, __ATOMIC_ACQUIRE)) {
+            wait_step(&w->policy, &ws);
+        }
+        if (ping == last) break;
+        uint64_t now = get_time_ns();
+        if (w->count < w->capacity) {
+            w->samples[w->count++] = now - blk->wake_ns;
+        }
+        last = ping;
+        __atomic_store_n(&blk->seen, ping, __ATOMIC_RELEASE);
+    }
+    
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    w->wall_ns = get_time_ns() - wall_start;
+    w->cpu_ns = (uint64_t)(cpu_end.tv_sec - cpu_start.tv_sec) * 1000000000ULL + cpu_end.tv_nsec - cpu_start.tv_nsec;
+    return NULL;
+}
+
+// Integer work on the waiter's hyperthread sibling; its rate shows what the waiter leaves over
+static void *wait_power_sibling_thread(void *arg)
+{
+    struct wait_power_sibling *s = (struct wait_power_sibling *)arg;
+    if (s->cpu >= 0) numa_pin_cpu(s->cpu);
+    
+    uint64_t x = 1, n = 0;
+    while (!s->stop) {
+        for (int i = 0; i < 1024; i++) {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        }
+        n += 1024;
+        s->iterations = n;
+    }
+    __asm__ __volatile__("" :: "r"(x));
+    return NULL;
+}
+
+// What a core dedicated to waiting costs: one waiter thread per backend
+// blocks on a shared word that a waker on another core bumps every
+// WAIT_POWER_INTERVAL_US, while integer work runs on the waiter's SMT
+// sibling. Reports wake-up latency, the sibling's throughput against a phase
+// with no waiter, and package power from RAPL. Threads only; no guest needed.
+void test_wait_power(volatile struct shared_data *shm, int rounds, int waiter_cpu)
+{
+    static const wait_policy_kind_t backends[] = {
+        WAIT_POLICY_SPIN, WAIT_POLICY_PAUSE, WAIT_POLICY_UMWAIT, WAIT_POLICY_BACKOFF, WAIT_POLICY_FUTEX
+    };
+    int phases = (int)(sizeof(backends) / sizeof(backends[0]));
+    
+    printf("\n=== Wait Power - Waiter Cost to its Hyperthread Sibling and the Package ===\n");
+    printf("Per round: the waker sleeps %d µs, stamps the time and bumps ping; the waiter times its wake-up\n",
+           WAIT_POWER_INTERVAL_US);
+    
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (waiter_cpu < 0) {
+        waiter_cpu = 0;
+        for (int c = 0; c < cpus && c < NUMA_MAX_CPUS; c++) {
+            if (numa_cpu_sibling(c) >= 0) {
+                waiter_cpu = c;
+                break;
+            }
+        }
+    }
+    int sibling_cpu = numa_cpu_sibling(waiter_cpu);
+    int waker_cpu = -1;
+    for (int c = 0; c < cpus && c < NUMA_MAX_CPUS; c++) {
+        if (c != waiter_cpu && c != sibling_cpu) {
+            waker_cpu = c;
+            break;
+        }
+    }
+    
+    printf("Waiter on CPU %d, ", waiter_cpu);
+    if (sibling_cpu >= 0) {
+        printf("sibling work on CPU %d, ", sibling_cpu);
+    } else {
+        printf("no SMT sibling (sibling throughput n/a), ");
+    }
+    if (waker_cpu >= 0) {
+        printf("waker on CPU %d\n", waker_cpu);
+        if (!numa_pin_cpu(waker_cpu)) {
+            printf("ERROR: Cannot pin the waker to CPU %d: %s\n", waker_cpu, strerror(errno));
+            return;
+        }
+    } else {
+        printf("waker shares the waiter's CPU\n");
+        printf("WARNING: too few CPUs - spinning waiters delay the waker, so this measures the scheduler\n");
+    }
+    
+    bool umwait = wait_umwait_supported();
+    uint64_t energy_range = 0, energy;
+    bool rapl = rapl_read(RAPL_ENERGY_PATH, &energy) && rapl_read(RAPL_RANGE_PATH, &energy_range);
+    printf("WAITPKG (umwait): %s | RAPL package energy: %s\n", umwait ? "yes" : "no",
+           rapl ? "yes" : "n/a (no " RAPL_ENERGY_PATH " or not readable)");
+    printf("Rounds per backend: %d | Pause count: %u | Spin limit: %u\n\n", rounds, host_wait.pause_count,
+           host_wait.spin_limit);
+    
+    struct wait_power_waiter waiter = {0};
+    waiter.samples = malloc((size_t)rounds * sizeof(uint64_t));
+    if (!waiter.samples) {
+        printf("ERROR: Failed to allocate %d samples\n", rounds);
+        return;
+    }
+    waiter.capacity = rounds;
+    waiter.cpu = waiter_cpu;
+    waiter.blk = (volatile struct wait_power_block *)&shm->buffer[0];
+    
+    csv_logger_t *csv = csv_create("wait_power.csv",
+        "backend,rounds,woken,pause_count,wake_p50_ns,wake_p99_ns,wake_max_ns,waiter_cpu_pct,sibling_mops,sibling_pct,package_w,waiter_cpu,sibling_cpu,waker_cpu");
+    
+    volatile struct wait_power_block *blk = waiter.blk;
+    double base_mops = 0;
+    
+    printf("   Backend | Woken |   p50 (ns) |   p99 (ns) |   Max (ns) | Waiter CPU | Sibling Mop/s | vs. idle | Package W\n");
+    printf("  ---------+-------+------------+------------+------------+------------+---------------+----------+----------\n");
+    
+    // Phase -1 is the baseline: sibling work alone, the waiter core idle
+    for (int phase = -1; phase < phases; phase++) {
+        bool idle = phase < 0;
+        const char *name = idle ? "idle" : wait_policy_name(backends[phase]);
+        if (!idle && backends[phase] == WAIT_POLICY_UMWAIT && !umwait) {
+            printf("  %8s |     - | skipped: no WAITPKG on this CPU (umwait would fall back to pause)\n", name);
+            continue;
+        }
+        
+        memset((void *)blk, 0, sizeof(struct wait_power_block));
+        __sync_synchronize();
+        
+        waiter.policy = host_wait;
+        waiter.count = 0;
+        waiter.cpu_ns = 0;
+        waiter.wall_ns = 0;
+        if (!idle) {
+            waiter.policy.kind = backends[phase];
+            waiter.policy.monitor_word = &blk->ping;
+            waiter.policy.futex_word = &blk->wake;
+            wait_policy_apply(&waiter.policy);
+        }
+        
+        struct wait_power_sibling sibling = { sibling_cpu, 0, false };
+        pthread_t waiter_thread, sibling_thread;
+        if (sibling_cpu >= 0 && pthread_create(&sibling_thread, NULL, wait_power_sibling_thread, &sibling) != 0) {
+            printf("ERROR: Failed to start the sibling thread\n");
+            break;
+        }
+        if (!idle && pthread_create(&waiter_thread, NULL, wait_power_waiter_thread, &waiter) != 0) {
+            printf("ERROR: Failed to start the waiter thread\n");
+            sibling.stop = true;
+            if (sibling_cpu >= 0) pthread_join(sibling_thread, NULL);
+            break;
+        }
+        usleep(50000);  // Let both threads settle on their CPUs
+        
+        uint64_t energy_start = 0, energy_end = 0;
+        if (rapl) rapl_read(RAPL_ENERGY_PATH, &energy_start);
+        uint64_t iter_start = sibling.iterations;
+        uint64_t wall_start = get_time_ns();
+        
+        struct timespec next;
+        clock_gettime(CLOCK_MONOTONIC, &next);
+        for (int r = 1; r <= rounds; r++) {
+            uint64_t ns = next.tv_nsec + WAIT_POWER_INTERVAL_US * 1000ULL;
+            next.tv_sec += ns / 1000000000ULL;
+            next.tv_nsec = ns % 1000000000ULL;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+            
+            blk->wake_ns = get_time_ns();
+            __atomic_store_n(&blk->ping, (uint32_t)r, __ATOMIC_RELEASE);
+            if (!idle && waiter.policy.kind == WAIT_POLICY_FUTEX) {
+                wait_notify(&blk->wake);
+            }
+        }
+        
+        uint64_t wall_ns = get_time_ns() - wall_start;
+        uint64_t iters = sibling.iterations - iter_start;
+        if (rapl && !rapl_read(RAPL_ENERGY_PATH, &energy_end)) rapl = false;
+        
+        // Give the last wake-up its interval, then release the threads
+        usleep(WAIT_POWER_INTERVAL_US);
+        __atomic_store_n(&blk->closed, 1, __ATOMIC_RELEASE);
+        if (!idle) {
+            wait_notify(&blk->wake);
+            pthread_join(waiter_thread, NULL);
+        }
+        sibling.stop = true;
+        if (sibling_cpu >= 0) pthread_join(sibling_thread, NULL);
+        
+        int woken = waiter.count;
+        uint64_t p50 = 0, p99 = 0, max = 0;
+        if (woken > 0) {
+            qsort(waiter.samples, woken, sizeof(uint64_t), compare_u64);
+            p50 = waiter.samples[woken / 2];
+            p99 = waiter.samples[((size_t)woken * 99) / 100];
+            max = waiter.samples[woken - 1];
+        }
+        double waiter_pct = waiter.wall_ns > 0 ? 100.0 * waiter.cpu_ns / waiter.wall_ns : 0.0;
+        double mops = wall_ns > 0 ? iters * 1000.0 / wall_ns : 0.0;
+        if (idle) base_mops = mops;
+        double sibling_pct = base_mops > 0 ? 100.0 * mops / base_mops : 0.0;
+        double watts = rapl && wall_ns > 0 ? rapl_delta(energy_start, energy_end, energy_range) * 1000.0 / wall_ns : 0.0;
+        
+        char woken_col[16], p50_col[16], p99_col[16], max_col[16], cpu_col[16], mops_col[16], pct_col[16], watts_col[16];
+        snprintf(woken_col, sizeof(woken_col), idle ? "-" : "%d", woken);
+        snprintf(p50_col, sizeof(p50_col), idle ? "-" : "%lu", p50);
+        snprintf(p99_col, sizeof(p99_col), idle ? "-" : "%lu", p99);
+        snprintf(max_col, sizeof(max_col), idle ? "-" : "%lu", max);
+        snprintf(cpu_col, sizeof(cpu_col), idle ? "-" : "%.1f%%", waiter_pct);
+        snprintf(mops_col, sizeof(mops_col), sibling_cpu >= 0 ? "%.1f" : "n/a", mops);
+        snprintf(pct_col, sizeof(pct_col), sibling_cpu >= 0 ? "%.1f%%" : "n/a", sibling_pct);
+        snprintf(watts_col, sizeof(watts_col), rapl ? "%.2f" : "n/a", watts);
+        printf("  %8s | %5s | %10s | %10s | %10s | %10s | %13s | %8s | %9s\n", name, woken_col, p50_col, p99_col,
+               max_col, cpu_col, mops_col, pct_col, watts_col);
+        fflush(stdout);
+        
+        if (csv && csv->file) {
+            fprintf(csv->file, "%s,%d,%d,%u,%lu,%lu,%lu,%.2f,%.2f,%.2f,%.3f,%d,%d,%d\n", name, rounds,
+                    idle ? 0 : woken, host_wait.pause_count, p50, p99, max, idle ? 0.0 : waiter_pct,
+                    sibling_cpu >= 0 ? mops : 0.0, sibling_cpu >= 0 ? sibling_pct : 0.0, rapl ? watts : 0.0,
+                    waiter_cpu, sibling_cpu, waker_cpu);
+        }
+    }
+    
+    printf("\nWake-up: waker's timestamp -> waiter sees the new ping. Woken < rounds means wake-ups were coalesced.\n");
+    printf("Sibling: integer work on the waiter's hyperthread, relative to the idle phase; package power from RAPL.\n");
+    printf("Pause: %u pause hints per re-check (--pause-count); umwait monitors the ping line in C0.2.\n",
+           host_wait.pause_count);
+    
+    wait_policy_apply(&host_wait);
+    free(waiter.samples);
+    csv_close(csv);
+}
+
+#define CLOCK_SYNC_PERIOD_MS 1000   // One probe burst per second in the clock sync test
+
+// Host/guest clock offset over time: one burst of CLOCK_SYNC_PROBES probes
+// per second against the guest's responder thread (-T). Before each burst the
+// current estimate predicts the offset, so the prediction error shows how
+// well the drift fit carries the estimate between re-estimations.
+void test_clock_sync(volatile struct shared_data *shm, int seconds)
+{
+    printf("\n=== Clock Sync - Host/Guest Offset and Drift ===\n");
+    printf("Per second: %d probes t1 -> (t2, t3) -> t4, the min-RTT probe joins a %d-burst drift fit\n",
+           CLOCK_SYNC_PROBES, CLOCK_SYNC_WINDOW);
+    printf("Host timer: %s | Guest timer: %s (%u ns overhead)\n", timing_source(),
+           shm->guest_tsc_khz ? "tsc" : "clock_gettime", shm->guest_timer_overhead_ns);
+    
+    if (!shm->guest_clock_sync) {
+        printf("ERROR: The guest doesn't answer clock sync probes (is it running with -T?)\n");
+        return;
+    }
+    printf("Duration: %d s | Wait policy: %s\n\n", seconds, wait_policy_name(host_wait.kind));
+    
+    struct clock_sync sync;
+    clock_sync_init(&sync, &shm->sync_seq, &shm->sync_t1, &shm->sync_echo, &shm->sync_t2, &shm->sync_t3);
+    
+    csv_logger_t *csv = csv_create("clock_sync.csv",
+        "elapsed_s,probes,lost,best_rtt_ns,measured_offset_ns,predicted_offset_ns,prediction_error_ns,offset_ns,offset_err_ns,drift_ppm");
+    
+    printf("   Time | Best RTT ns |    Offset ns | Predicted ns | Pred. err ns |  Fit offset ns |  ± Bound ns | Drift ppm\n");
+    printf("  ------+-------------+--------------+--------------+--------------+----------------+-------------+----------\n");
+    
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    uint64_t start = get_time_ns();
+    
+    for (int s = 0; s <= seconds; s++) {
+        if (s > 0) {
+            uint64_t ns = next.tv_nsec + CLOCK_SYNC_PERIOD_MS * 1000000ULL;
+            next.tv_sec += ns / 1000000000ULL;
+            next.tv_nsec = ns % 1000000000ULL;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+        
+        struct clock_sync previous = sync;
+        bool predicted = clock_sync_valid(&previous);
+        uint64_t lost_before = sync.lost;
+        
+        struct clock_sync_sample best;
+        if (!clock_sync_burst(&sync, &host_wait, CLOCK_SYNC_PROBES, &best)) {
+            printf("  %4d s | no probe answered (%lu lost) - is the guest still running?\n", s,
+                   (unsigned long)(sync.lost - lost_before));
+            break;
+        }
+        
+        // The previous estimate carried forward to this burst, against what the burst measured
+        int64_t prediction = predicted ? clock_sync_offset_at(&previous, best.host_ns) : 0;
+        int64_t pred_err = predicted ? best.offset_ns - prediction : 0;
+        
+        char pred_col[24] = "-", err_col[24] = "-";
+        if (predicted) {
+            snprintf(pred_col, sizeof(pred_col), "%+ld", (long)prediction);
+            snprintf(err_col, sizeof(err_col), "%+ld", (long)pred_err);
+        }
+        printf("  %4d s | %11lu | %+12ld | %12s | %12s | %+14ld | %11lu | %+9.3f\n", s, (unsigned long)best.rtt_ns,
+               (long)best.offset_ns, pred_col, err_col, (long)sync.anchor_offset_ns, (unsigned long)sync.err_ns,
+               clock_sync_drift_ppm(&sync));
+        fflush(stdout);
+        
+        if (csv && csv->file) {
+            fprintf(csv->file, "%.3f,%d,%lu,%lu,%ld,%ld,%ld,%ld,%lu,%.3f\n", (get_time_ns() - start) / 1e9,
+                    CLOCK_SYNC_PROBES, (unsigned long)(sync.lost - lost_before), (unsigned long)best.rtt_ns,
+                    (long)best.offset_ns, (long)prediction, (long)pred_err, (long)sync.anchor_offset_ns,
+                    (unsigned long)sync.err_ns, clock_sync_drift_ppm(&sync));
+        }
+    }
+    
+    if (clock_sync_valid(&sync)) {
+        printf("\nGuest - host: %+ld ns ± %lu ns, drift %+.3f ppm (%lu probes, %lu lost)\n",
+               (long)sync.anchor_offset_ns, (unsigned long)sync.err_ns, clock_sync_drift_ppm(&sync),
+               (unsigned long)sync.probes, (unsigned long)sync.lost);
+    }
+    printf("Offset: ((t2 - t1) + (t3 - t4)) / 2 of the min-RTT probe; the true offset is within ± RTT / 2.\n");
+    printf("Bound: that half round trip plus the largest distance of a window sample from the drift fit.\n");
+    printf("Predicted: the previous estimate carried forward by the drift; its error is what a 1 s gap costs.\n");
+    
+    csv_close(csv);
+}
+
+void print_usage(const char *prog_name) {
+    printf("Usage: %s [OPTIONS]\n", prog_name);
+    printf("Options:\n");
+    printf("  -l, --latency [COUNT]     Run latency test (default: 100 messages)\n");
+    printf("  -b, --bandwidth [COUNT]   Run bandwidth test (default: 10 iterations)\n");
+    printf("  -r, --ring [COUNT]        Run ring buffer streaming test (default: 100 frames)\n");
+    printf("  -F, --fanout [COUNT]      Run fan-out test: broadcast COUNT frames to every registered guest (default: 100)\n");
+    printf("      --readers N           Fan-out: guests to wait for before streaming, 1-%d (default: 1)\n", BCAST_MAX_READERS);
+    printf("  -p, --pipeline [SECONDS]  Run sustained double/triple-buffered frame stream (default: 10 s)\n");
+    printf("  -m, --message-rate [N]    Run small-message sweep, 0 B and 64 B..64 KB, N messages per size (default: 10000)\n");
+    printf("  -B, --batch [N]           Run batched submission sweep, batch size 1..%d, ~N messages each (default: 100000)\n", BATCH_SWEEP_MAX);
+    printf("      --msg-size BYTES      Batched message payload, 0-%d (default: %d)\n", MSGQ_MAX_MESSAGE, MSG_RATE_MIN_SIZE);
+    printf("  -D, --duplex [SECONDS]    Run full duplex test: each direction alone, then both (default: 5 s per phase)\n");
+    printf("  -C, --channels [SECONDS]  Run channel directory test: control latency alone, then with video and audio\n");
+    printf("                            (default: 5 s per phase)\n");
+    printf("  -A, --alloc [SECONDS]     Run region allocator test: mixed frame/audio/metadata sizes, arena vs. slabs\n");
+    printf("                            (default: 5 s per phase)\n");
+    printf("  -Z, --zero-copy [FRAMES]  Run zero-copy test: guest kernels in place vs. after a copy (default: 200)\n");
+    printf("  -S, --stripes [FRAMES]    Run striped transfer test: 1 (monolithic) to %d stripes per frame\n", STRIPE_MAX_STRIPES);
+    printf("                            (default: 50 frames per stripe count, 4K frames)\n");
+    printf("  -M, --mailbox [SECONDS]   Run latest-frame-wins triple-buffer stream (default: 10 s)\n");
+    printf("      --fps N               Mailbox publish rate, 0 = as fast as possible (default: 60)\n");
+    printf("      --slots N             Ring/fan-out slot count (default: as many as fit, max %d); pipeline: 2 or 3\n", RING_DEFAULT_MAX_SLOTS);
+    printf("      --frame TYPE          Ring/fan-out/pipeline/duplex/mailbox/zero-copy/stripe frame type: 1080p, 1440p, 4K\n");
+    printf("                            (default: 1080p ring, fan-out, duplex, mailbox and zero-copy, 4K pipeline)\n");
+    printf("  -w, --wait POLICY         Polling strategy: spin, yield, backoff, usleep, doorbell, futex,\n"
+           "                            pause, umwait (default: backoff)\n");
+    printf("      --wait-spins N        Pause iterations before yield/backoff/doorbell/futex kicks in (default: %d)\n", WAIT_DEFAULT_SPIN_LIMIT);
+    printf("      --pause-count N       Pause hints per re-check for pause/umwait (default: %d)\n", WAIT_DEFAULT_PAUSE_COUNT);
+    printf("      --doorbell SOCKET     Connect to an ivshmem-server and ring the guest on every state change\n");
+    printf("      --doorbell-server SOCKET  Run a stand-in ivshmem-server on SOCKET (loopback) and connect to it\n");
+    printf("  -W, --wakeup [ROUNDS]     Run wake-up test: latency and idle CPU of each wait policy (default: 2000)\n");
+    printf("  -T, --clock-sync [SECONDS] Estimate guest/host clock offset and drift once a second (default: 10);\n");
+    printf("                            the guest needs -T, which also gives -m a synced one-way latency\n");
+    printf("      --copy-kernel NAME    Frame write kernel: auto, memcpy, rep_movsb, sse2_nt, avx2_nt, avx512_nt\n");
+    printf("                            (default: auto = avx2_nt, else sse2_nt, else memcpy)\n");
+    printf("      --produce MODE        Bandwidth test producer: copy (pre-rendered frame copied in) or direct\n");
+    printf("                            (render straight into the reserved shared buffer) (default: copy)\n");
+    printf("      --copy-threads N      Threads striping each frame write (default: 1)\n");
+    printf("      --verify ALGO         Frame digest: sha256, crc32c, xxh3, none (default: sha256)\n");
+    printf("  -s, --copy-scaling [ITER] Sweep copy threads 1..N over the region, no guest needed (default: 20)\n");
+    printf("      --pages KIND          Local frame buffer pages: 4k, thp, hugetlb (default: 4k)\n");
+    printf("      --shm PATH            Shared memory file (default: %s; hugetlbfs: /dev/hugepages/ivshmem)\n", SHMEM_PATH);
+    printf("      --numa-node N         Bind the shared region to node N, first-touch buffers there, run on its CPUs\n");
+    printf("      --cpu N               Pin the writer thread to CPU N\n");
+    printf("  -P, --state-pingpong [N]  State-transition round trip, layout v1 vs v2, no guest needed (default: 100000)\n");
+    printf("  -E, --wait-power [ROUNDS] Wake-up latency, SMT sibling throughput and package power per wait backend,\n");
+    printf("                            no guest needed (default: 2000 rounds of 1 ms; --cpu picks the waiter CPU)\n");
+    printf("  -n, --numa-matrix [COUNT] Bandwidth test for every writer/region node pair (default: 10 iterations)\n");
+    printf("  -c, --count COUNT         Number of messages/iterations (count-based modes only)\n");
+    printf("  -h, --help               Show this help\n");
+    printf("\nExamples:\n");
+    printf("  %s -l 1                  Send single latency message\n", prog_name);
+    printf("  %s -l 100                Send 100 latency messages\n", prog_name);
+    printf("  %s -b 5                  Run 5 bandwidth iterations\n", prog_name);
+    printf("  %s -l -b                 Run both tests with defaults\n", prog_name);
+    printf("  %s -r 600 --slots 4      Stream 600 1080p frames through a 4-slot ring\n", prog_name);
+    printf("  %s -F 600 --readers 4    Broadcast 600 1080p frames to four guests\n", prog_name);
+    printf("  %s -p 30                 Stream 4K frames for 30 s through as many slots as fit (2)\n", prog_name);
+    printf("  %s -p --slots 3 --frame 1440p  Triple-buffered 1440p stream for 10 s\n", prog_name);
+    printf("  %s -m 1000               Message rate and latency, 1000 messages per size\n", prog_name);
+    printf("  %s -B 50000 --msg-size 256  Batch size sweep with 256 B messages, ~50000 per batch size\n", prog_name);
+    printf("  %s -D 10 --frame 1440p   Full duplex 1440p frames, 10 s per phase\n", prog_name);
+    printf("  %s -C 10                 Control channel latency with and without bulk video, 10 s per phase\n", prog_name);
+    printf("  %s -A 10                 Allocator throughput and fragmentation, 10 s per phase\n", prog_name);
+    printf("  %s -Z 500 --frame 4K     Histogram/downscale on 4K frames, leased vs. copied\n", prog_name);
+    printf("  %s -S 100                4K frames in 1..%d stripes, time to first stripe and to completion\n", prog_name, STRIPE_MAX_STRIPES);
+    printf("  %s -M 30 --fps 120       Publish 1080p frames at 120 frames/s to the mailbox for 30 s\n", prog_name);
+    printf("  %s -l 1000 -w spin       Latency test with busy-wait polling\n", prog_name);
+    printf("  %s -W --doorbell-server /tmp/ivshmem_socket  Polling vs. eventfd doorbells, loopback guest\n", prog_name);
+    printf("  %s -T 60                 Guest/host clock offset and drift for a minute (guest: -T)\n", prog_name);
+    printf("  %s -b 10 --copy-kernel memcpy  Bandwidth test with plain memcpy writes\n", prog_name);
+    printf("  %s -b 10 --produce direct  Bandwidth test rendering frames in place (vs. render + copy)\n", prog_name);
+    printf("  %s -s --copy-threads 8   Copy throughput for 1, 2, 4 and 8 threads\n", prog_name);
+    printf("  %s -b 10 --verify xxh3   Bandwidth test with XXH3 frame checks\n", prog_name);
+    printf("  %s -b 10 --pages hugetlb --shm /dev/hugepages/ivshmem  Bandwidth test on 2 MB pages\n", prog_name);
+    printf("  %s -b 10 --numa-node 1 --cpu 8  Bandwidth test with region and writer on node 1\n", prog_name);
+    printf("  %s -P --cpu 2 -w spin    Control block ping-pong between CPU 2 and CPU 3\n", prog_name);
+    printf("  %s -E --pause-count 64  Waiter cost per backend: wake-up, sibling throughput, package power\n", prog_name);
+    printf("  %s -n 5                  Local vs. remote node bandwidth matrix\n", prog_name);
+}
+
+// Join the ivshmem-server at `path` (starting the stand-in there first if `serve`),
+// check it shares the region we mapped and let the wait policy block on it
+static bool host_doorbell_open(const char *path, bool serve, int shm_fd)
+{
+    if (serve) {
+        if (!doorbell_server_start(&host_doorbell_server, path, shm_fd, 1)) {
+            printf("ERROR: Cannot start the stand-in ivshmem-server on %s: %s\n", path, strerror(errno));
+            return false;
+        }
+        host_doorbell_serving = true;
+        printf("Doorbell: stand-in ivshmem-server listening on %s\n", path);
+    }
+    
+    if (!doorbell_connect(&host_doorbell, path)) {
+        printf("ERROR: Cannot join the ivshmem-server on %s: %s\n", path, strerror(errno));
+        if (host_doorbell_serving) doorbell_server_stop(&host_doorbell_server);
+        host_doorbell_serving = false;
+        return false;
+    }
+    
+    struct stat ours, theirs;
+    if (host_doorbell.shm_fd >= 0 && fstat(shm_fd, &ours) == 0 && fstat(host_doorbell.shm_fd, &theirs) == 0 &&
+        (ours.st_dev != theirs.st_dev || ours.st_ino != theirs.st_ino)) {
+        printf("WARNING: The ivshmem-server shares a different region than --shm; point --shm at its file\n");
+    }
+    host_wait.doorbell = &host_doorbell;
+    printf("Doorbell: peer %ld, %u vector%s, %u other peer%s\n", (long)host_doorbell.id, host_doorbell.vectors,
+           host_doorbell.vectors == 1 ? "" : "s", host_doorbell.peer_count, host_doorbell.peer_count == 1 ? "" : "s");
+    return true;
+}
+
+static void host_doorbell_close(void)
+{
+    if (host_doorbell.kind != DOORBELL_NONE) {
+        printf("Doorbell: %lu rings sent, %lu waits woken by the guest\n", (unsigned long)host_doorbell.rings,
+               (unsigned long)host_doorbell.wakeups);
+        doorbell_close(&host_doorbell);
+    }
+    if (host_doorbell_serving) {
+        doorbell_server_stop(&host_doorbell_server);
+        host_doorbell_serving = false;
+    }
+}
+
+// Returns false if the guest was built for a different shared memory layout
+bool init_shared_memory(volatile struct shared_data *shm) {
+    printf("HOST: Starting initialization...\n");
+    
+    guest_state_t guest_state = get_guest_state(shm);
+    if (guest_state != GUEST_STATE_UNINITIALIZED) {
+        printf("HOST: Detected guest started first (state: %s), clearing...\n", 
+               guest_state_name(guest_state));
+    }
+    
+    // A v1 guest started first is waiting with its state at the v1 offset
+    uint32_t v1_guest_state = shm->v1_guest_state;
+    
+    shm->magic = 0;
+    set_host_state(shm, HOST_STATE_INITIALIZING);
+    __sync_synchronize();
+    
+    shm->sequence = 0;
+    shm->data_size = 0;
+    shm->error_code = 0;
+    shm->test_complete = 0;
+    shm->digest_algo = DIGEST_SHA256;
+    memset((void*)shm->data_digest, 0, DIGEST_MAX_SIZE);
+    memset((void*)&shm->timing, 0, sizeof(struct timing_data));
+    shm->v1_host_state = 0;
+    shm->v1_guest_state = 0;
+    shm->layout_version = SHM_LAYOUT_VERSION;
+    shm->sync_seq = 0;
+    shm->sync_t1 = 0;
+    shm->host_doorbell_peer = host_doorbell.kind != DOORBELL_NONE ? (uint32_t)host_doorbell.id : DOORBELL_NO_PEER;
+    __sync_synchronize();
+    
+    shm->magic = MAGIC;
+    set_host_state(shm, HOST_STATE_READY);
+    __sync_synchronize();
+    
+    printf("HOST: Initialization complete - waiting for guest...\n");
+    
+    if (!wait_for_guest_state(shm, GUEST_STATE_READY, 10000000000ULL, "guest ready")) {
+        if (v1_guest_state == GUEST_STATE_WAITING_HOST_INIT || shm->v1_guest_state != 0) {
+            printf("HOST: ERROR - A layout v1 guest_reader wrote its state at the v1 offset;\n");
+            printf("HOST: rebuild it for layout v%d\n", SHM_LAYOUT_VERSION);
+            return false;
+        }
+        printf("HOST: WARNING - Guest not ready within 10 seconds\n");
+        printf("HOST: Current guest state: %s\n", guest_state_name(get_guest_state(shm)));
+        printf("HOST: Proceeding anyway...\n");
+    } else if (shm->guest_layout_version != SHM_LAYOUT_VERSION) {
+        printf("HOST: ERROR - Guest uses shared memory layout v%u, this host needs v%d\n",
+               shm->guest_layout_version, SHM_LAYOUT_VERSION);
+        return false;
+    } else {
+        printf("HOST: ✓ Guest ready - synchronization complete (layout v%d)\n", SHM_LAYOUT_VERSION);
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    bool run_latency = false;
+    bool run_bandwidth = false;
+    bool run_ring = false;
+    bool run_pipeline = false;
+    bool run_mailbox = false;
+    bool run_message_rate = false;
+    int message_count = 10000;
+    bool run_batch = false;
+    bool run_fanout = false;
+    bool run_duplex = false;
+    int duplex_seconds = 5;
+    bool run_channels = false;
+    int channel_seconds = 5;
+    bool run_alloc = false;
+    int alloc_seconds = 5;
+    bool run_zerocopy = false;
+    int zerocopy_frames = 200;
+    bool run_stripes = false;
+    int stripe_frames = 50;
+    bool run_wakeup = false;
+    bool run_clock_sync = false;
+    int clock_sync_seconds = 10;
+    int wakeup_rounds = 2000;
+    const char *doorbell_path = NULL;
+    bool doorbell_serve = false;
+    int fanout_readers = 1;
+    int batch_count = 100000;
+    int batch_msg_size = MSG_RATE_MIN_SIZE;
+    bool run_scaling = false;
+    bool run_numa_matrix = false;
+    bool run_pingpong = false;
+    int pingpong_rounds = 100000;
+    bool run_wait_power = false;
+    int wait_power_rounds = 2000;
+    int latency_count = 100;
+    int bandwidth_count = 10;
+    int ring_count = 100;
+    int ring_slots = 0;
+    int pipeline_seconds = 10;
+    int mailbox_seconds = 10;
+    int mailbox_fps = 60;
+    const char *frame_name = NULL;
+    int scaling_count = 20;
+    bool count_given = false;
+    int copy_threads = 1;
+    const char *shm_path = SHMEM_PATH;
+    int numa_node = -1;
+    int host_cpu = -1;
+    
+    wait_policy_defaults(&host_wait, WAIT_POLICY_BACKOFF);
+    copy_kernel_kind_t copy_kind = COPY_KERNEL_AUTO;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "--latency") == 0) {
+            run_latency = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                latency_count = atoi(argv[++i]);
+                if (latency_count <= 0) latency_count = 1;
+            }
+        } else if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--bandwidth") == 0) {
+            run_bandwidth = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                bandwidth_count = atoi(argv[++i]);
+                if (bandwidth_count <= 0) bandwidth_count = 1;
+            }
+        } else if (strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--ring") == 0) {
+            run_ring = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                ring_count = atoi(argv[++i]);
+                if (ring_count <= 0) ring_count = 1;
+            }
+        } else if (strcmp(argv[i], "-F") == 0 || strcmp(argv[i], "--fanout") == 0) {
+            run_fanout = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                ring_count = atoi(argv[++i]);
+                if (ring_count <= 0) ring_count = 1;
+            }
+        } else if (strcmp(argv[i], "--readers") == 0) {
+            if (i + 1 < argc) {
+                fanout_readers = atoi(argv[++i]);
+            }
+            if (fanout_readers < 1 || fanout_readers > BCAST_MAX_READERS) {
+                printf("Invalid reader count (1-%d)\n", BCAST_MAX_READERS);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--pipeline") == 0) {
+            run_pipeline = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                pipeline_seconds = atoi(argv[++i]);
+                if (pipeline_seconds <= 0) pipeline_seconds = 1;
+            }
+        } else if (strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "--message-rate") == 0) {
+            run_message_rate = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                message_count = atoi(argv[++i]);
+                if (message_count <= 0) message_count = 1;
+            }
+        } else if (strcmp(argv[i], "-B") == 0 || strcmp(argv[i], "--batch") == 0) {
+            run_batch = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                batch_count = atoi(argv[++i]);
+                if (batch_count <= 0) batch_count = 1;
+            }
+        } else if (strcmp(argv[i], "--msg-size") == 0) {
+            if (i + 1 < argc) {
+                batch_msg_size = atoi(argv[++i]);
+            }
+            if (batch_msg_size < 0 || batch_msg_size > MSGQ_MAX_MESSAGE) {
+                printf("Invalid message size (0-%d bytes)\n", MSGQ_MAX_MESSAGE);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-D") == 0 || strcmp(argv[i], "--duplex") == 0) {
+            run_duplex = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                duplex_seconds = atoi(argv[++i]);
+                if (duplex_seconds <= 0) duplex_seconds = 1;
+            }
+        } else if (strcmp(argv[i], "-C") == 0 || strcmp(argv[i], "--channels") == 0) {
+            run_channels = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                channel_seconds = atoi(argv[++i]);
+                if (channel_seconds <= 0) channel_seconds = 1;
+            }
+        } else if (strcmp(argv[i], "-A") == 0 || strcmp(argv[i], "--alloc") == 0) {
+            run_alloc = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                alloc_seconds = atoi(argv[++i]);
+                if (alloc_seconds <= 0) alloc_seconds = 1;
+            }
+        } else if (strcmp(argv[i], "-Z") == 0 || strcmp(argv[i], "--zero-copy") == 0) {
+            run_zerocopy = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                zerocopy_frames = atoi(argv[++i]);
+                if (zerocopy_frames <= 0) zerocopy_frames = 1;
+            }
+        } else if (strcmp(argv[i], "-S") == 0 || strcmp(argv[i], "--stripes") == 0) {
+            run_stripes = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                stripe_frames = atoi(argv[++i]);
+                if (stripe_frames <= 0) stripe_frames = 1;
+            }
+        } else if (strcmp(argv[i], "-T") == 0 || strcmp(argv[i], "--clock-sync") == 0) {
+            run_clock_sync = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                clock_sync_seconds = atoi(argv[++i]);
+                if (clock_sync_seconds <= 0) clock_sync_seconds = 1;
+            }
+        } else if (strcmp(argv[i], "-W") == 0 || strcmp(argv[i], "--wakeup") == 0) {
+            run_wakeup = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                wakeup_rounds = atoi(argv[++i]);
+                if (wakeup_rounds <= 0) wakeup_rounds = 1;
+            }
+        } else if (strcmp(argv[i], "--doorbell") == 0 || strcmp(argv[i], "--doorbell-server") == 0) {
+            doorbell_serve = strcmp(argv[i], "--doorbell-server") == 0;
+            if (i + 1 >= argc) {
+                printf("%s needs a socket path\n", argv[i]);
+                return 1;
+            }
+            doorbell_path = argv[++i];
+        } else if (strcmp(argv[i], "-M") == 0 || strcmp(argv[i], "--mailbox") == 0) {
+            run_mailbox = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                mailbox_seconds = atoi(argv[++i]);
+                if (mailbox_seconds <= 0) mailbox_seconds = 1;
+            }
+        } else if (strcmp(argv[i], "--fps") == 0) {
+            if (i + 1 < argc) {
+                mailbox_fps = atoi(argv[++i]);
+            }
+            if (mailbox_fps < 0) {
+                printf("Invalid frame rate (0 = as fast as possible)\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--slots") == 0) {
+            if (i + 1 < argc) {
+                ring_slots = atoi(argv[++i]);
+            }
+            if (ring_slots < 2) {
+                printf("Invalid slot count (at least 2)\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--frame") == 0) {
+            if (i + 1 < argc) {
+                frame_name = argv[++i];
+            }
+        } else if (strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "--wait") == 0) {
+            if (i + 1 >= argc || !wait_policy_parse(argv[++i], &host_wait)) {
+                printf("Invalid wait policy (use spin, yield, backoff, usleep, doorbell, futex, pause or umwait)\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--copy-kernel") == 0) {
+            if (i + 1 >= argc || !copy_kernel_parse(argv[++i], &copy_kind)) {
+                printf("Invalid copy kernel (use auto, memcpy, rep_movsb, sse2_nt, avx2_nt or avx512_nt)\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--produce") == 0) {
+            if (i + 1 < argc && strcmp(argv[i + 1], "copy") == 0) {
+                host_direct_write = false;
+            } else if (i + 1 < argc && strcmp(argv[i + 1], "direct") == 0) {
+                host_direct_write = true;
+            } else {
+                printf("Invalid producer mode (use copy or direct)\n");
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--verify") == 0) {
+            if (i + 1 >= argc || !digest_parse(argv[++i], &host_verify)) {
+                printf("Invalid digest (use sha256, crc32c, xxh3 or none)\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--copy-threads") == 0) {
+            if (i + 1 < argc) {
+                copy_threads = atoi(argv[++i]);
+            }
+            if (copy_threads < 1 || copy_threads > COPY_POOL_MAX_THREADS) {
+                printf("Invalid copy thread count (1-%d)\n", COPY_POOL_MAX_THREADS);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--copy-scaling") == 0) {
+            run_scaling = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                scaling_count = atoi(argv[++i]);
+                if (scaling_count <= 0) scaling_count = 1;
+            }
+        } else if (strcmp(argv[i], "--pages") == 0) {
+            if (i + 1 >= argc || !page_kind_parse(argv[++i], &host_pages)) {
+                printf("Invalid page kind (use 4k, thp or hugetlb)\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--shm") == 0) {
+            if (i + 1 < argc) {
+                shm_path = argv[++i];
+            }
+        } else if (strcmp(argv[i], "--numa-node") == 0) {
+            if (i + 1 < argc) {
+                numa_node = atoi(argv[++i]);
+            }
+            if (numa_node < 0 || numa_node >= numa_node_count() || !numa_node_has_memory(numa_node)) {
+                printf("Invalid NUMA node (0-%d, must have memory)\n", numa_node_count() - 1);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cpu") == 0) {
+            if (i + 1 < argc) {
+                host_cpu = atoi(argv[++i]);
+            }
+            if (numa_cpu_node(host_cpu) < 0) {
+                printf("Invalid CPU (not online)\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--numa-matrix") == 0) {
+            run_numa_matrix = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                bandwidth_count = atoi(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "-P") == 0 || strcmp(argv[i], "--state-pingpong") == 0) {
+            run_pingpong = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                pingpong_rounds = atoi(argv[++i]);
+                if (pingpong_rounds <= 0) pingpong_rounds = 1;
+            }
+        } else if (strcmp(argv[i], "-E") == 0 || strcmp(argv[i], "--wait-power") == 0) {
+            run_wait_power = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                wait_power_rounds = atoi(argv[++i]);
+                if (wait_power_rounds <= 0) wait_power_rounds = 1;
+            }
+        } else if (strcmp(argv[i], "--wait-spins") == 0) {
+            if (i + 1 < argc) {
+                host_wait.spin_limit = (uint32_t)atoi(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--pause-count") == 0) {
+            if (i + 1 < argc) {
+                host_wait.pause_count = (uint32_t)atoi(argv[++i]);
+                if (host_wait.pause_count == 0) host_wait.pause_count = 1;
+            }
+        } else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--count") == 0) {
+            if (i + 1 < argc) {
+                int count = atoi(argv[++i]);
+                if (count > 0) {
+                    latency_count = count;
+                    bandwidth_count = count;
+                    ring_count = count;
+                    message_count = count;
+                    batch_count = count;
+                    scaling_count = count;
+                    pingpong_rounds = count;
+                    zerocopy_frames = count;
+                    stripe_frames = count;
+                    wakeup_rounds = count;
+                    wait_power_rounds = count;
+                    count_given = true;
+                }
+            }
+        } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    // Every mode except -l and -b drives its own guest loop (or none), so only those two combine
+    int exclusive_modes = run_ring + run_fanout + run_pipeline + run_mailbox + run_message_rate + run_batch +
+                          run_duplex + run_channels + run_alloc + run_zerocopy + run_stripes + run_wakeup +
+                          run_clock_sync + run_wait_power + run_scaling + run_pingpong + run_numa_matrix;
+    if (exclusive_modes > 1 || (exclusive_modes == 1 && (run_latency || run_bandwidth))) {
+        printf("Run one test mode at a time (only -l and -b combine)\n");
+        return 1;
+    }
+    
+    if (count_given && (run_pipeline || run_mailbox || run_duplex || run_channels || run_alloc ||
+                        run_clock_sync)) {
+        printf("-c sets a message count; this test runs for a duration (give it SECONDS instead)\n");
+        return 1;
+    }
+    
+    if (run_clock_sync && (run_latency || run_bandwidth || run_ring || run_fanout || run_pipeline || run_mailbox ||
+                           run_message_rate || run_batch || run_duplex || run_channels || run_alloc || run_zerocopy ||
+                           run_stripes || run_wakeup)) {
+        printf("The clock sync test runs on its own (the message-rate test syncs by itself when the guest has -T)\n");
+        return 1;
+    }
+    
+    if (host_wait.kind == WAIT_POLICY_DOORBELL && !doorbell_path) {
+        printf("The doorbell wait policy needs --doorbell or --doorbell-server\n");
+        return 1;
+    }
+    
+    if (exclusive_modes == 0 && !run_latency && !run_bandwidth) {
+        run_latency = true;
+        run_bandwidth = true;
+    }
+    
+    printf("Host Writer - ivshmem Performance Test with Overhead Analysis\n");
+    printf("=============================================================\n\n");
+    
+    timing_init();
+    if (timing.tsc) {
+        printf("Timer: TSC %.3f MHz, overhead %u ns, resolution %.2f ns (clock_gettime: %u ns)\n",
+               timing.tsc_hz / 1e6, timing.overhead_ns, timing.resolution_ns, timing.clock_overhead_ns);
+    } else {
+        printf("Timer: clock_gettime, overhead %u ns, resolution %.0f ns (no invariant TSC)\n",
+               timing.overhead_ns, timing.resolution_ns);
+    }
+    
+    wait_policy_apply(&host_wait);
+    printf("Wait policy: %s (spin limit %u)\n", wait_policy_name(host_wait.kind), host_wait.spin_limit);
+    if (host_wait.kind == WAIT_POLICY_UMWAIT && !wait_umwait_supported()) {
+        printf("Note: no WAITPKG on this CPU, umwait falls back to pause (%u per re-check)\n", host_wait.pause_count);
+    }
+    
+    host_copy = copy_kernel_select(copy_kind);
+    if (!host_copy) {
+        printf("ERROR: Copy kernel %s is not supported on this CPU\n", copy_kernels[copy_kind].name);
+        return 1;
+    }
+    printf("Copy kernel: %s\n", host_copy->name);
+    printf("Frame digest: %s\n", digest_name(host_verify));
+    
+    // Node placement first, so copy workers inherit the node's CPU mask and memory policy
+    if (numa_node >= 0 && !run_numa_matrix) {
+        if (!numa_pin_node(numa_node) || !numa_prefer_node(numa_node)) {
+            printf("ERROR: Cannot place the writer on node %d: %s\n", numa_node, strerror(errno));
+            return 1;
+        }
+        host_node = numa_node;
+    }
+    
+    if (!run_scaling && !run_pingpong && !run_wait_power) {
+        if (!copy_pool_init(&host_pool, copy_threads, host_copy->copy)) {
+            printf("ERROR: Failed to start %d copy threads\n", copy_threads);
+            return 1;
+        }
+        printf("Copy threads: %d\n", copy_threads);
+    }
+    
+    if (host_cpu >= 0 && !run_numa_matrix) {
+        if (!numa_pin_cpu(host_cpu)) {
+            printf("ERROR: Cannot pin the writer to CPU %d: %s\n", host_cpu, strerror(errno));
+            return 1;
+        }
+        host_node = numa_cpu_node(host_cpu);
+    }
+    if (host_node < 0) {
+        host_node = numa_current_node();
+    }
+    
+    int fd = open(shm_path, O_RDWR);
+    if (fd < 0) {
+        perror("Failed to open shared memory");
+        printf("Make sure the VM setup script has been run.\n");
+        return 1;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("fstat");
+        close(fd);
+        return 1;
+    }
+    
+    host_shm_page_kb = shm_page_kb(fd);
+    printf("Shared memory: %s (%ld bytes, %u KB pages)\n", shm_path, st.st_size, host_shm_page_kb);
+    printf("Local buffers: %s pages\n", page_kind_name(host_pages));
+    
+    void *ptr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        return 1;
+    }
+    
+    volatile struct shared_data *shm = (volatile struct shared_data *)ptr;
+    host_wait.futex_word = &shm->guest_wake;
+    host_wait.monitor_word = &shm->guest_state;
+    
+    printf("Mapped at address: %p\n", ptr);
+    printf("Data buffer size: %zu bytes\n", 
+           st.st_size - offsetof(struct shared_data, buffer));
+    
+    if (numa_node >= 0 && !run_numa_matrix) {
+        bind_region(shm, st.st_size, numa_node);
+    } else {
+        shm_node = numa_page_node((const void *)&shm->buffer[0]);
+    }
+    printf("NUMA: writer on node %d%s, shared region on node %d (%d node%s)\n",
+           host_node, host_cpu >= 0 && !run_numa_matrix ? " (pinned CPU)" : "", shm_node,
+           numa_node_count(), numa_node_count() == 1 ? "" : "s");
+    
+    if (run_scaling) {
+        int max_threads = copy_threads;
+        if (max_threads == 1) {
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            max_threads = cpus < 1 ? 1 : cpus > COPY_POOL_MAX_THREADS ? COPY_POOL_MAX_THREADS : (int)cpus;
+        }
+        test_copy_scaling(shm, st.st_size, scaling_count, max_threads);
+        munmap(ptr, st.st_size);
+        close(fd);
+        printf("\nTests completed.\n");
+        return 0;
+    }
+    
+    if (run_pingpong) {
+        test_state_pingpong(shm, pingpong_rounds, host_cpu);
+        munmap(ptr, st.st_size);
+        close(fd);
+        printf("\nTests completed.\n");
+        return 0;
+    }
+    
+    if (run_wait_power) {
+        test_wait_power(shm, wait_power_rounds, host_cpu);
+        munmap(ptr, st.st_size);
+        close(fd);
+        printf("\nTests completed.\n");
+        return 0;
+    }
+    
+    if (doorbell_path && !host_doorbell_open(doorbell_path, doorbell_serve, fd)) {
+        copy_pool_destroy(&host_pool);
+        munmap(ptr, st.st_size);
+        close(fd);
+        return 1;
+    }
+    
+    printf("\nInitializing shared memory protocol...\n");
+    if (!init_shared_memory(shm)) {
+        set_host_state(shm, HOST_STATE_COMPLETED);
+        shm->test_complete = 1;
+        __sync_synchronize();
+        host_doorbell_close();
+        copy_pool_destroy(&host_pool);
+        munmap(ptr, st.st_size);
+        close(fd);
+        return 1;
+    }
+    
+    printf("\nMake sure the guest program is running!\n");
+    if (run_numa_matrix) {
+        int cpu_nodes[NUMA_MAX_NODES], mem_nodes[NUMA_MAX_NODES];
+        int cpu_count, mem_count;
+        numa_matrix_nodes(cpu_nodes, &cpu_count, mem_nodes, &mem_count);
+        printf("NUMA matrix: guest must expect %d messages (guest_reader -c %d)\n",
+               cpu_count * mem_count * 3 * bandwidth_count, cpu_count * mem_count * 3 * bandwidth_count);
+    }
+    printf("Press Enter to start tests...\n");
+    getchar();
+    
+    if (run_latency) {
+        test_latency(shm, latency_count);
+    }
+    
+    if (run_bandwidth) {
+        if (run_latency) {
+            printf("\nPress Enter to run bandwidth test...\n");
+            getchar();
+        }
+        test_bandwidth(shm, bandwidth_count, NULL);
+    }
+    
+    if (run_ring) {
+        test_ring(shm, ring_count, ring_slots, frame_name ? frame_name : "1080p");
+    }
+    
+    if (run_fanout) {
+        test_fanout(shm, ring_count, ring_slots, frame_name ? frame_name : "1080p", fanout_readers);
+    }
+    
+    if (run_pipeline) {
+        test_pipeline(shm, pipeline_seconds, ring_slots, frame_name ? frame_name : "4K");
+    }
+    
+    if (run_message_rate) {
+        test_message_rate(shm, message_count);
+    }
+    
+    if (run_batch) {
+        test_batch(shm, batch_count, (uint32_t)batch_msg_size);
+    }
+    
+    if (run_duplex) {
+        test_duplex(shm, duplex_seconds, frame_name ? frame_name : "1080p");
+    }
+    
+    if (run_channels) {
+        test_channels(shm, channel_seconds);
+    }
+    
+    if (run_alloc) {
+        test_alloc(shm, alloc_seconds);
+    }
+    
+    if (run_zerocopy) {
+        test_zerocopy(shm, zerocopy_frames, frame_name ? frame_name : "1080p");
+    }
+    
+    if (run_stripes) {
+        test_stripes(shm, stripe_frames, frame_name ? frame_name : "4K");
+    }
+    
+    if (run_wakeup) {
+        test_wakeup(shm, wakeup_rounds);
+    }
+    
+    if (run_clock_sync) {
+        test_clock_sync(shm, clock_sync_seconds);
+    }
+    
+    if (run_mailbox) {
+        test_mailbox(shm, mailbox_seconds, mailbox_fps, frame_name ? frame_name : "1080p");
+    }
+    
+    if (run_numa_matrix) {
+        test_numa_matrix(shm, st.st_size, bandwidth_count, copy_threads);
+    }
+    
+    shm->test_complete = 1;
+    __sync_synchronize();
+    set_host_state(shm, HOST_STATE_COMPLETED);
     
+    host_doorbell_close();
+    copy_pool_destroy(&host_pool);
     munmap(ptr, st.st_size);
     close(fd);
     
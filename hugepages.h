@@ -0,0 +1,172 @@
+/*
+ * hugepages.h - Page size control for the shared region and local buffers
+ *
+ * A 4K frame spans ~6000 4 KB pages. Streaming it through memcpy touches a
+ * new page every 64 cache lines, so the dTLB (and, inside the VM, the EPT
+ * walk behind it) misses on every page. 2 MB pages cut that to a dozen
+ * entries per frame.
+ *
+ *   4k      - anonymous mmap with MADV_NOHUGEPAGE (baseline, no THP surprises)
+ *   thp     - 2 MB aligned anonymous mmap with MADV_HUGEPAGE (transparent)
+ *   hugetlb - MAP_HUGETLB | MAP_HUGE_2MB from the reserved pool
+ *             (vm.nr_hugepages); falls back to thp when the pool is empty
+ *
+ * The shared region's page size is a property of its backing file: a file on
+ * hugetlbfs (setup.sh with HUGEPAGES=1) is mapped with huge pages by every
+ * process and by QEMU; a file on tmpfs uses 4 KB pages unless
+ * shmem_enabled allows THP and the mapping is advised.
+ *
+ * Usage:
+ *   page_kind_t pages = PAGES_HUGETLB;
+ *   uint8_t *buf = page_alloc(size, &pages);   // pages now holds what was used
+ *   page_free(buf, size, pages);
+ */
+
+#ifndef HUGEPAGES_H
+#define HUGEPAGES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/vfs.h>
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MADV_HUGEPAGE
+#define MADV_HUGEPAGE 14
+#endif
+#ifndef MADV_NOHUGEPAGE
+#define MADV_NOHUGEPAGE 15
+#endif
+#ifndef HUGETLBFS_MAGIC
+#define HUGETLBFS_MAGIC 0x958458f6
+#endif
+
+#define HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+
+typedef enum {
+    PAGES_4K = 0,
+    PAGES_THP = 1,
+    PAGES_HUGETLB = 2,
+    PAGES_COUNT
+} page_kind_t;
+
+static inline const char *page_kind_name(page_kind_t kind)
+{
+    switch (kind) {
+        case PAGES_4K: return "4k";
+        case PAGES_THP: return "thp";
+        case PAGES_HUGETLB: return "hugetlb";
+        default: return "unknown";
+    }
+}
+
+// Parse a page kind from the command line. Returns false if unknown.
+static inline bool page_kind_parse(const char *name, page_kind_t *kind)
+{
+    for (int k = 0; k < PAGES_COUNT; k++) {
+        if (strcasecmp(name, page_kind_name((page_kind_t)k)) == 0) {
+            *kind = (page_kind_t)k;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Page size (KB) backing a buffer of the given kind (thp is best effort)
+static inline uint32_t page_kind_kb(page_kind_t kind)
+{
+    return kind == PAGES_4K ? (uint32_t)(sysconf(_SC_PAGESIZE) / 1024) : (uint32_t)(HUGE_PAGE_SIZE / 1024);
+}
+
+static inline size_t page_round(size_t size, page_kind_t kind)
+{
+    size_t page = kind == PAGES_4K ? (size_t)sysconf(_SC_PAGESIZE) : HUGE_PAGE_SIZE;
+    return (size + page - 1) & ~(page - 1);
+}
+
+// 2 MB aligned anonymous mapping, so every huge page the kernel hands out is fully used
+static inline void *page_map_aligned(size_t length)
+{
+    size_t span = length + HUGE_PAGE_SIZE;
+    uint8_t *raw = mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return NULL;
+    }
+
+    uint8_t *aligned = (uint8_t *)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+    size_t head = aligned - raw;
+    if (head > 0) munmap(raw, head);
+    if (span - head > length) munmap(aligned + length, span - head - length);
+    return aligned;
+}
+
+// Allocate a prefaulted local buffer. *kind is the requested page kind on
+// entry and the kind actually used on return; an empty hugetlb pool downgrades
+// to thp (with one warning) so callers can keep passing the same variable.
+static inline void *page_alloc(size_t size, page_kind_t *kind)
+{
+    size_t length = 0;
+    void *ptr = NULL;
+
+    if (*kind == PAGES_HUGETLB) {
+        length = page_round(size, PAGES_HUGETLB);
+        ptr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+        if (ptr == MAP_FAILED) {
+            fprintf(stderr, "WARNING: no free 2 MB hugetlb pages (vm.nr_hugepages), using thp\n");
+            *kind = PAGES_THP;
+            ptr = NULL;
+        }
+    }
+
+    if (*kind == PAGES_THP) {
+        length = page_round(size, PAGES_THP);
+        ptr = page_map_aligned(length);
+        if (ptr) madvise(ptr, length, MADV_HUGEPAGE);
+    } else if (*kind == PAGES_4K) {
+        length = page_round(size, PAGES_4K);
+        ptr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            ptr = NULL;
+        } else {
+            madvise(ptr, length, MADV_NOHUGEPAGE);
+        }
+    }
+
+    // Fault every page in now so no page fault lands inside a timed copy
+    if (ptr) memset(ptr, 0, length);
+    return ptr;
+}
+
+static inline void page_free(void *ptr, size_t size, page_kind_t kind)
+{
+    if (ptr) {
+        munmap(ptr, page_round(size, kind));
+    }
+}
+
+// Page size (KB) of the file backing a shared mapping: hugetlbfs reports its
+// huge page size, anything else is mapped with base pages
+static inline uint32_t shm_page_kb(int fd)
+{
+    struct statfs sfs;
+    if (fstatfs(fd, &sfs) == 0 && (unsigned long)sfs.f_type == HUGETLBFS_MAGIC) {
+        return (uint32_t)(sfs.f_bsize / 1024);
+    }
+    return (uint32_t)(sysconf(_SC_PAGESIZE) / 1024);
+}
+
+#endif // HUGEPAGES_H
@@ -0,0 +1,639 @@
+/*
+ * integrity.h - Selectable frame digests for data integrity checks
+ *
+ * SHA256 is a cryptographic hash: on a 4K frame it costs tens of milliseconds,
+ * far more than the copy being measured. Detecting a torn or stale frame in
+ * shared memory only needs a good checksum, so the digest is a tier:
+ *
+ *   sha256 - OpenSSL SHA256 (32 bytes), the original check
+ *   crc32c - Castagnoli CRC (4 bytes), SSE4.2 crc32 instruction on three
+ *            interleaved streams, table fallback elsewhere
+ *   xxh3   - XXH3 64-bit, seed 0 (8 bytes), AVX2 accumulate loop with a
+ *            scalar fallback; matches the reference xxHash 0.8 output
+ *   none   - no digest (verification always passes)
+ *
+ * Digests are stored zero-padded in a DIGEST_MAX_SIZE byte field alongside an
+ * algorithm tag, so the reader always knows which check the writer used.
+ *
+ * digest_copy() is the fused receive kernel: it copies src to dst and
+ * computes the digest over the words it has just loaded, so the source (the
+ * BAR on the guest) is read exactly once. The inner loops take an optional
+ * destination; the plain digest path passes NULL and the store drops out
+ * when the call is inlined.
+ */
+
+#ifndef INTEGRITY_H
+#define INTEGRITY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <openssl/sha.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define DIGEST_MAX_SIZE 32
+
+typedef enum {
+    DIGEST_SHA256 = 0,   // Zero so a cleared header means the legacy SHA256 check
+    DIGEST_CRC32C = 1,
+    DIGEST_XXH3 = 2,
+    DIGEST_NONE = 3,
+    DIGEST_COUNT
+} digest_algo_t;
+
+static inline const char *digest_name(digest_algo_t algo)
+{
+    switch (algo) {
+        case DIGEST_SHA256: return "sha256";
+        case DIGEST_CRC32C: return "crc32c";
+        case DIGEST_XXH3: return "xxh3";
+        case DIGEST_NONE: return "none";
+        default: return "unknown";
+    }
+}
+
+static inline size_t digest_size(digest_algo_t algo)
+{
+    switch (algo) {
+        case DIGEST_SHA256: return 32;
+        case DIGEST_CRC32C: return 4;
+        case DIGEST_XXH3: return 8;
+        default: return 0;
+    }
+}
+
+// Parse an algorithm name from the command line. Returns false if unknown.
+static inline bool digest_parse(const char *name, digest_algo_t *algo)
+{
+    for (int a = 0; a < DIGEST_COUNT; a++) {
+        if (strcasecmp(name, digest_name((digest_algo_t)a)) == 0) {
+            *algo = (digest_algo_t)a;
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline uint64_t digest_read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t digest_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/* ---------------------------------------------------------------- CRC32C */
+
+#define CRC32C_POLY 0x82F63B78u   // Reflected Castagnoli polynomial
+
+static uint32_t crc32c_table[8][256];
+static bool crc32c_table_ready = false;
+
+static inline void crc32c_init_table(void)
+{
+    if (crc32c_table_ready) return;
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+        }
+        crc32c_table[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+        for (int t = 1; t < 8; t++) {
+            crc32c_table[t][n] = (crc32c_table[t - 1][n] >> 8) ^ crc32c_table[0][crc32c_table[t - 1][n] & 0xFF];
+        }
+    }
+    crc32c_table_ready = true;
+}
+
+static inline void digest_write64(uint8_t *p, uint64_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+// Raw CRC register update (no pre/post inversion), slicing-by-8.
+// If `dst` is not NULL the input is copied there in the same pass.
+static inline uint32_t crc32c_update_table(uint32_t crc, uint8_t *dst, const uint8_t *p, size_t len)
+{
+    crc32c_init_table();
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t w = digest_read64(p);
+        if (dst) {
+            digest_write64(dst, w);
+            dst += 8;
+        }
+        uint64_t v = w ^ crc;
+        crc = crc32c_table[7][v & 0xFF] ^ crc32c_table[6][(v >> 8) & 0xFF] ^
+              crc32c_table[5][(v >> 16) & 0xFF] ^ crc32c_table[4][(v >> 24) & 0xFF] ^
+              crc32c_table[3][(v >> 32) & 0xFF] ^ crc32c_table[2][(v >> 40) & 0xFF] ^
+              crc32c_table[1][(v >> 48) & 0xFF] ^ crc32c_table[0][v >> 56];
+    }
+    while (len--) {
+        if (dst) *dst++ = *p;
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xFF];
+    }
+    return crc;
+}
+
+// GF(2) 32x32 matrix helpers for advancing a CRC register over zero bytes
+static inline uint32_t crc32c_gf2_times(const uint32_t *mat, uint32_t vec)
+{
+    uint32_t sum = 0;
+    for (int i = 0; vec; i++, vec >>= 1) {
+        if (vec & 1) sum ^= mat[i];
+    }
+    return sum;
+}
+
+static inline void crc32c_gf2_square(uint32_t *square, const uint32_t *mat)
+{
+    for (int n = 0; n < 32; n++) {
+        square[n] = crc32c_gf2_times(mat, mat[n]);
+    }
+}
+
+// Register value after feeding `len` zero bytes into `crc` (zlib's crc32_combine method)
+static inline uint32_t crc32c_shift(uint32_t crc, size_t len)
+{
+    uint32_t even[32], odd[32];
+
+    // Operator for one zero bit
+    odd[0] = CRC32C_POLY;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = 1u << (n - 1);
+    }
+    crc32c_gf2_square(even, odd);   // two zero bits
+    crc32c_gf2_square(odd, even);   // four zero bits
+
+    // Each squaring doubles the shift: first application is one zero byte
+    do {
+        crc32c_gf2_square(even, odd);
+        if (len & 1) crc = crc32c_gf2_times(even, crc);
+        len >>= 1;
+        if (!len) break;
+        crc32c_gf2_square(odd, even);
+        if (len & 1) crc = crc32c_gf2_times(odd, crc);
+        len >>= 1;
+    } while (len);
+
+    return crc;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse4.2")))
+static inline uint32_t crc32c_update_sse42_serial(uint32_t crc, uint8_t *dst, const uint8_t *p, size_t len)
+{
+    uint64_t c = crc;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t w = digest_read64(p);
+        if (dst) {
+            digest_write64(dst, w);
+            dst += 8;
+        }
+        c = _mm_crc32_u64(c, w);
+    }
+    crc = (uint32_t)c;
+    while (len--) {
+        if (dst) *dst++ = *p;
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+
+// The crc32 instruction has 3-cycle latency and 1-cycle throughput: run three
+// independent streams over thirds of the buffer and stitch them together.
+__attribute__((target("sse4.2")))
+static inline uint32_t crc32c_update_sse42(uint32_t crc, uint8_t *dst, const uint8_t *p, size_t len)
+{
+    if (len < 3 * 4096) {
+        return crc32c_update_sse42_serial(crc, dst, p, len);
+    }
+
+    size_t third = (len / 3) & ~(size_t)7;
+    const uint8_t *a = p, *b = p + third, *c = p + 2 * third;
+    uint64_t ca = crc, cb = 0, cc = 0;
+
+    for (size_t i = 0; i < third; i += 8) {
+        uint64_t wa = digest_read64(a + i);
+        uint64_t wb = digest_read64(b + i);
+        uint64_t wc = digest_read64(c + i);
+        if (dst) {
+            digest_write64(dst + i, wa);
+            digest_write64(dst + third + i, wb);
+            digest_write64(dst + 2 * third + i, wc);
+        }
+        ca = _mm_crc32_u64(ca, wa);
+        cb = _mm_crc32_u64(cb, wb);
+        cc = _mm_crc32_u64(cc, wc);
+    }
+
+    uint32_t merged = crc32c_shift((uint32_t)ca, third) ^ (uint32_t)cb;
+    merged = crc32c_shift(merged, third) ^ (uint32_t)cc;
+    return crc32c_update_sse42_serial(merged, dst ? dst + 3 * third : NULL,
+                                      p + 3 * third, len - 3 * third);
+}
+
+#endif // __x86_64__
+
+// CRC32C of `data`; if `dst` is not NULL the data is copied there in the same pass
+static inline uint32_t crc32c_copy(void *dst, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        return ~crc32c_update_sse42(~0u, (uint8_t *)dst, p, len);
+    }
+#endif
+    return ~crc32c_update_table(~0u, (uint8_t *)dst, p, len);
+}
+
+static inline uint32_t crc32c(const void *data, size_t len)
+{
+    return crc32c_copy(NULL, data, len);
+}
+
+/* ------------------------------------------------------------------ XXH3 */
+
+#define XXH_PRIME32_1 0x9E3779B1u
+#define XXH_PRIME32_2 0x85EBCA77u
+#define XXH_PRIME32_3 0xC2B2AE3Du
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+#define XXH_PRIME_MX1 0x165667919E3779F9ULL
+#define XXH_PRIME_MX2 0x9FB21C651E98DF25ULL
+
+#define XXH3_SECRET_SIZE 192
+#define XXH3_STRIPE_LEN 64
+#define XXH3_SECRET_CONSUME_RATE 8
+#define XXH3_ACC_NB 8
+
+static const uint8_t xxh3_secret[XXH3_SECRET_SIZE] __attribute__((aligned(64))) = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+static inline uint64_t xxh_rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_mul128_fold64(uint64_t lhs, uint64_t rhs)
+{
+    __uint128_t product = (__uint128_t)lhs * rhs;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+static inline uint64_t xxh64_avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline uint64_t xxh3_avalanche(uint64_t h)
+{
+    h ^= h >> 37;
+    h *= XXH_PRIME_MX1;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline uint64_t xxh3_rrmxmx(uint64_t h, uint64_t len)
+{
+    h ^= xxh_rotl64(h, 49) ^ xxh_rotl64(h, 24);
+    h *= XXH_PRIME_MX2;
+    h ^= (h >> 35) + len;
+    h *= XXH_PRIME_MX2;
+    h ^= h >> 28;
+    return h;
+}
+
+static inline uint64_t xxh3_mix16(const uint8_t *p, const uint8_t *secret)
+{
+    return xxh_mul128_fold64(digest_read64(p) ^ digest_read64(secret),
+                             digest_read64(p + 8) ^ digest_read64(secret + 8));
+}
+
+static inline uint64_t xxh3_len_0to16(const uint8_t *p, size_t len)
+{
+    const uint8_t *s = xxh3_secret;
+
+    if (len > 8) {
+        uint64_t lo = digest_read64(p) ^ (digest_read64(s + 24) ^ digest_read64(s + 32));
+        uint64_t hi = digest_read64(p + len - 8) ^ (digest_read64(s + 40) ^ digest_read64(s + 48));
+        uint64_t acc = len + __builtin_bswap64(lo) + hi + xxh_mul128_fold64(lo, hi);
+        return xxh3_avalanche(acc);
+    }
+    if (len >= 4) {
+        uint64_t in64 = digest_read32(p + len - 4) + ((uint64_t)digest_read32(p) << 32);
+        uint64_t keyed = in64 ^ (digest_read64(s + 8) ^ digest_read64(s + 16));
+        return xxh3_rrmxmx(keyed, len);
+    }
+    if (len > 0) {
+        uint32_t combined = ((uint32_t)p[0] << 16) | ((uint32_t)p[len >> 1] << 24) |
+                            (uint32_t)p[len - 1] | ((uint32_t)len << 8);
+        uint64_t bitflip = digest_read32(s) ^ digest_read32(s + 4);
+        return xxh64_avalanche((uint64_t)combined ^ bitflip);
+    }
+    return xxh64_avalanche(digest_read64(s + 56) ^ digest_read64(s + 64));
+}
+
+static inline uint64_t xxh3_len_17to128(const uint8_t *p, size_t len)
+{
+    const uint8_t *s = xxh3_secret;
+    uint64_t acc = len * XXH_PRIME64_1;
+
+    if (len > 32) {
+        if (len > 64) {
+            if (len > 96) {
+                acc += xxh3_mix16(p + 48, s + 96);
+                acc += xxh3_mix16(p + len - 64, s + 112);
+            }
+            acc += xxh3_mix16(p + 32, s + 64);
+            acc += xxh3_mix16(p + len - 48, s + 80);
+        }
+        acc += xxh3_mix16(p + 16, s + 32);
+        acc += xxh3_mix16(p + len - 32, s + 48);
+    }
+    acc += xxh3_mix16(p, s);
+    acc += xxh3_mix16(p + len - 16, s + 16);
+    return xxh3_avalanche(acc);
+}
+
+static inline uint64_t xxh3_len_129to240(const uint8_t *p, size_t len)
+{
+    const uint8_t *s = xxh3_secret;
+    uint64_t acc = len * XXH_PRIME64_1;
+    int rounds = (int)len / 16;
+
+    for (int i = 0; i < 8; i++) {
+        acc += xxh3_mix16(p + 16 * i, s + 16 * i);
+    }
+    acc = xxh3_avalanche(acc);
+    for (int i = 8; i < rounds; i++) {
+        acc += xxh3_mix16(p + 16 * i, s + 16 * (i - 8) + 3);
+    }
+    acc += xxh3_mix16(p + len - 16, s + 136 - 17);
+    return xxh3_avalanche(acc);
+}
+
+static inline void xxh3_accumulate_512_scalar(uint64_t *acc, const uint8_t *p, const uint8_t *secret, uint8_t *dst)
+{
+    for (int i = 0; i < XXH3_ACC_NB; i++) {
+        uint64_t data = digest_read64(p + 8 * i);
+        if (dst) digest_write64(dst + 8 * i, data);
+        uint64_t key = data ^ digest_read64(secret + 8 * i);
+        acc[i ^ 1] += data;
+        acc[i] += (uint32_t)key * (key >> 32);
+    }
+}
+
+static inline void xxh3_scramble_scalar(uint64_t *acc, const uint8_t *secret)
+{
+    for (int i = 0; i < XXH3_ACC_NB; i++) {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= digest_read64(secret + 8 * i);
+        a *= XXH_PRIME32_1;
+        acc[i] = a;
+    }
+}
+
+// Stripe loop for inputs > 240 bytes; `accumulate`/`scramble` pick the ISA.
+// The stripes cover every input byte (the last one overlaps), so passing a
+// destination also produces a complete copy.
+#define XXH3_DST(dst, offset) ((dst) ? (dst) + (offset) : NULL)
+#define XXH3_HASH_LONG_LOOP(acc, p, dst, len, accumulate, scramble)                                \
+    do {                                                                                           \
+        const size_t stripes_per_block = (XXH3_SECRET_SIZE - XXH3_STRIPE_LEN) / XXH3_SECRET_CONSUME_RATE; \
+        const size_t block_len = XXH3_STRIPE_LEN * stripes_per_block;                               \
+        const size_t blocks = ((len) - 1) / block_len;                                              \
+        for (size_t n = 0; n < blocks; n++) {                                                       \
+            for (size_t st = 0; st < stripes_per_block; st++) {                                     \
+                accumulate(acc, (p) + n * block_len + st * XXH3_STRIPE_LEN,                         \
+                           xxh3_secret + st * XXH3_SECRET_CONSUME_RATE,                             \
+                           XXH3_DST(dst, n * block_len + st * XXH3_STRIPE_LEN));                    \
+            }                                                                                       \
+            scramble(acc, xxh3_secret + XXH3_SECRET_SIZE - XXH3_STRIPE_LEN);                        \
+        }                                                                                           \
+        const size_t stripes = (((len) - 1) - block_len * blocks) / XXH3_STRIPE_LEN;                \
+        for (size_t st = 0; st < stripes; st++) {                                                   \
+            accumulate(acc, (p) + blocks * block_len + st * XXH3_STRIPE_LEN,                        \
+                       xxh3_secret + st * XXH3_SECRET_CONSUME_RATE,                                 \
+                       XXH3_DST(dst, blocks * block_len + st * XXH3_STRIPE_LEN));                   \
+        }                                                                                           \
+        accumulate(acc, (p) + (len) - XXH3_STRIPE_LEN,                                              \
+                   xxh3_secret + XXH3_SECRET_SIZE - XXH3_STRIPE_LEN - 7,                            \
+                   XXH3_DST(dst, (len) - XXH3_STRIPE_LEN));                                         \
+    } while (0)
+
+static inline uint64_t xxh3_merge_accs(const uint64_t *acc, size_t len)
+{
+    const uint8_t *s = xxh3_secret + 11;
+    uint64_t result = len * XXH_PRIME64_1;
+    for (int i = 0; i < 4; i++) {
+        result += xxh_mul128_fold64(acc[2 * i] ^ digest_read64(s + 16 * i),
+                                    acc[2 * i + 1] ^ digest_read64(s + 16 * i + 8));
+    }
+    return xxh3_avalanche(result);
+}
+
+#define XXH3_INIT_ACC { XXH_PRIME32_3, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3, \
+                        XXH_PRIME64_4, XXH_PRIME32_2, XXH_PRIME64_5, XXH_PRIME32_1 }
+
+static inline uint64_t xxh3_hash_long_scalar(const uint8_t *p, uint8_t *dst, size_t len)
+{
+    uint64_t acc[XXH3_ACC_NB] = XXH3_INIT_ACC;
+    XXH3_HASH_LONG_LOOP(acc, p, dst, len, xxh3_accumulate_512_scalar, xxh3_scramble_scalar);
+    return xxh3_merge_accs(acc, len);
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2")))
+static inline void xxh3_accumulate_512_avx2(__m256i *acc, const uint8_t *p, const uint8_t *secret, uint8_t *dst)
+{
+    for (int i = 0; i < 2; i++) {
+        __m256i data = _mm256_loadu_si256((const __m256i *)(p + 32 * i));
+        if (dst) _mm256_storeu_si256((__m256i *)(dst + 32 * i), data);
+        __m256i key = _mm256_xor_si256(data, _mm256_loadu_si256((const __m256i *)(secret + 32 * i)));
+        __m256i key_hi = _mm256_srli_epi64(key, 32);
+        __m256i product = _mm256_mul_epu32(key, key_hi);
+        __m256i swapped = _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+        acc[i] = _mm256_add_epi64(product, _mm256_add_epi64(acc[i], swapped));
+    }
+}
+
+__attribute__((target("avx2")))
+static inline void xxh3_scramble_avx2(__m256i *acc, const uint8_t *secret)
+{
+    const __m256i prime = _mm256_set1_epi32((int)XXH_PRIME32_1);
+    for (int i = 0; i < 2; i++) {
+        __m256i a = _mm256_xor_si256(acc[i], _mm256_srli_epi64(acc[i], 47));
+        __m256i key = _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i *)(secret + 32 * i)));
+        __m256i key_hi = _mm256_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1));
+        __m256i lo = _mm256_mul_epu32(key, prime);
+        __m256i hi = _mm256_mul_epu32(key_hi, prime);
+        acc[i] = _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+    }
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t xxh3_hash_long_avx2(const uint8_t *p, uint8_t *dst, size_t len)
+{
+    uint64_t init[XXH3_ACC_NB] __attribute__((aligned(32))) = XXH3_INIT_ACC;
+    __m256i acc[2] = {
+        _mm256_load_si256((const __m256i *)&init[0]),
+        _mm256_load_si256((const __m256i *)&init[4]),
+    };
+    XXH3_HASH_LONG_LOOP(acc, p, dst, len, xxh3_accumulate_512_avx2, xxh3_scramble_avx2);
+    _mm256_store_si256((__m256i *)&init[0], acc[0]);
+    _mm256_store_si256((__m256i *)&init[4], acc[1]);
+    return xxh3_merge_accs(init, len);
+}
+
+#endif // __x86_64__
+
+// XXH3-64 of `data`; if `dst` is not NULL the data is copied there in the same pass
+static inline uint64_t xxh3_64_copy(void *dst, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+
+    if (len <= 240) {
+        // Short inputs: copy first, then hash the (now cached) copy
+        if (dst) {
+            memcpy(dst, data, len);
+            p = (const uint8_t *)dst;
+        }
+        if (len <= 16) return xxh3_len_0to16(p, len);
+        if (len <= 128) return xxh3_len_17to128(p, len);
+        return xxh3_len_129to240(p, len);
+    }
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return xxh3_hash_long_avx2(p, (uint8_t *)dst, len);
+    }
+#endif
+    return xxh3_hash_long_scalar(p, (uint8_t *)dst, len);
+}
+
+static inline uint64_t xxh3_64(const void *data, size_t len)
+{
+    return xxh3_64_copy(NULL, data, len);
+}
+
+/* ---------------------------------------------------------------- Digest */
+
+// Compute the digest of `data` into `out` (always DIGEST_MAX_SIZE bytes, zero padded)
+static inline void digest_compute(digest_algo_t algo, const void *data, size_t len, uint8_t *out)
+{
+    memset(out, 0, DIGEST_MAX_SIZE);
+    switch (algo) {
+        case DIGEST_SHA256:
+            SHA256((const unsigned char *)data, len, out);
+            break;
+        case DIGEST_CRC32C: {
+            uint32_t crc = crc32c(data, len);
+            memcpy(out, &crc, sizeof(crc));
+            break;
+        }
+        case DIGEST_XXH3: {
+            uint64_t hash = xxh3_64(data, len);
+            memcpy(out, &hash, sizeof(hash));
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Fused receive: copy `len` bytes to `dst` and digest them, reading `src` once.
+// CRC32C and XXH3 digest the words as they are copied; SHA256 has no fused
+// kernel, so it hashes the (cache-hot) destination after the copy.
+static inline void digest_copy(digest_algo_t algo, void *dst, const void *src, size_t len, uint8_t *out)
+{
+    memset(out, 0, DIGEST_MAX_SIZE);
+    switch (algo) {
+        case DIGEST_CRC32C: {
+            uint32_t crc = crc32c_copy(dst, src, len);
+            memcpy(out, &crc, sizeof(crc));
+            break;
+        }
+        case DIGEST_XXH3: {
+            uint64_t hash = xxh3_64_copy(dst, src, len);
+            memcpy(out, &hash, sizeof(hash));
+            break;
+        }
+        case DIGEST_SHA256:
+            memcpy(dst, src, len);
+            SHA256((const unsigned char *)dst, len, out);
+            break;
+        default:
+            memcpy(dst, src, len);
+            break;
+    }
+}
+
+// Fused receive + verify: true if the copied data matches `expected`. The data
+// is still copied for an unknown algorithm tag, but it never verifies.
+static inline bool digest_copy_verify(digest_algo_t algo, void *dst, const void *src, size_t len,
+                                      const uint8_t *expected)
+{
+    uint8_t calculated[DIGEST_MAX_SIZE];
+    digest_copy(algo, dst, src, len, calculated);
+    if (algo == DIGEST_NONE) {
+        return true;
+    }
+    if ((unsigned)algo >= DIGEST_COUNT) {
+        return false;
+    }
+    return memcmp(calculated, expected, digest_size(algo)) == 0;
+}
+
+// True if `data` matches the `expected` digest (always true for DIGEST_NONE,
+// always false for an algorithm tag this build doesn't know)
+static inline bool digest_verify(digest_algo_t algo, const void *data, size_t len, const uint8_t *expected)
+{
+    if (algo == DIGEST_NONE) {
+        return true;
+    }
+    if ((unsigned)algo >= DIGEST_COUNT) {
+        return false;
+    }
+    uint8_t calculated[DIGEST_MAX_SIZE];
+    digest_compute(algo, data, len, calculated);
+    return memcmp(calculated, expected, digest_size(algo)) == 0;
+}
+
+#endif // INTEGRITY_H
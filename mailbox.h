@@ -0,0 +1,213 @@
+/*
+ * mailbox.h - Latest-frame-wins triple buffer
+ *
+ * For remote display the guest only ever wants the newest frame; queueing
+ * stale frames (ring_buffer.h, frame_pipeline.h) adds latency instead of
+ * hiding it. The mailbox keeps three slots and one shared `latest` word:
+ *
+ *   back   - slot the host is filling (host-private)
+ *   latest - slot holding the newest complete frame, plus a FRESH bit
+ *   front  - slot the guest is reading (guest-private)
+ *
+ * The host publishes by exchanging its back slot with `latest`; whatever
+ * comes back becomes its new back slot. If that slot was still FRESH the
+ * guest never saw it, and the frame is dropped. The guest takes a frame by
+ * exchanging its front slot with `latest` when FRESH is set. Neither side
+ * ever waits for the other: the host always has a free slot, and the guest
+ * always gets the newest complete frame.
+ *
+ * Each slot carries the host's publish timestamp so the guest can report the
+ * frame's age when it has finished copying it out. The ages only mean
+ * something when both sides read the same clock (host loopback, or a guest
+ * clock kept in step with the host's).
+ */
+
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#define MAILBOX_MAGIC 0x4D424F58   // "MBOX"
+#define MAILBOX_SLOTS 3
+#define MAILBOX_CACHE_LINE 64
+#define MAILBOX_SLOT_ALIGN 4096    // Slot payloads are page aligned
+#define MAILBOX_FRESH 0x80000000u  // Set in `latest` until the guest takes the frame
+
+// Per-slot metadata (one cache line each) - written by the host while it owns the slot
+struct mailbox_slot_desc {
+    uint32_t sequence;             // Frame number
+    uint32_t data_size;            // Valid bytes in the payload
+    uint64_t publish_ns;           // Host timing_shared_ns() (CLOCK_MONOTONIC) when the frame was complete
+    uint8_t  _pad[MAILBOX_CACHE_LINE - 16];
+} __attribute__((aligned(MAILBOX_CACHE_LINE)));
+
+// Guest-side counters, updated as frames are consumed so the host can sample them
+struct mailbox_guest_stats {
+    uint64_t consumed;             // Frames taken and copied out
+    uint64_t dropped;              // Frames the guest never saw (sequence gaps)
+    uint64_t age_sum_ns;           // Sum of frame ages at consume time
+    uint64_t age_max_ns;
+    uint64_t age_last_ns;
+    uint64_t age_p50_ns;           // Written once at the end of the stream
+    uint64_t age_p99_ns;
+    uint64_t lag_max;              // Most frames published behind the one being consumed
+};
+
+// Mailbox control block, placed at the start of shared_data.buffer
+struct mailbox_header {
+    // Geometry - written once by the host in mailbox_init()
+    uint32_t magic;                // MAILBOX_MAGIC once geometry is valid
+    uint32_t slot_size;            // Payload capacity per slot (bytes)
+    uint32_t data_offset;          // Offset of first payload from the mailbox header
+
+    // Newest complete frame: slot index | MAILBOX_FRESH - exchanged by both sides
+    uint32_t latest __attribute__((aligned(MAILBOX_CACHE_LINE)));
+
+    // Host counters - host writes, guest reads
+    uint64_t published __attribute__((aligned(MAILBOX_CACHE_LINE)));
+    uint64_t overwritten;          // Fresh frames replaced before the guest took them
+    uint32_t closed;               // Set after the last publish
+
+    // Guest counters - guest writes, host reads
+    struct mailbox_guest_stats guest __attribute__((aligned(MAILBOX_CACHE_LINE)));
+
+    struct mailbox_slot_desc slots[MAILBOX_SLOTS] __attribute__((aligned(MAILBOX_CACHE_LINE)));
+};
+
+// Process-local view of a mailbox (never placed in shared memory)
+struct mailbox {
+    volatile struct mailbox_header *hdr;
+    uint8_t *data;                 // Base of the slot payload area
+    uint32_t slot_size;
+    size_t   slot_stride;          // Distance between payloads (page aligned)
+    uint32_t slot;                 // Our private slot: back (host) or front (guest)
+};
+
+static inline size_t mailbox_align_up(size_t value, size_t align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+
+// Bytes needed for a mailbox with the given slot size
+static inline size_t mailbox_required_size(uint32_t slot_size)
+{
+    return mailbox_align_up(sizeof(struct mailbox_header), MAILBOX_SLOT_ALIGN) +
+           MAILBOX_SLOTS * mailbox_align_up(slot_size, MAILBOX_SLOT_ALIGN);
+}
+
+static inline void mailbox_setup_view(struct mailbox *m, void *base)
+{
+    m->hdr = (volatile struct mailbox_header *)base;
+    m->slot_size = m->hdr->slot_size;
+    m->slot_stride = mailbox_align_up(m->slot_size, MAILBOX_SLOT_ALIGN);
+    m->data = (uint8_t *)base + m->hdr->data_offset;
+}
+
+// Host: format a mailbox in [base, base + avail). The host starts with slot 0,
+// `latest` holds slot 1 (not fresh) and the guest starts with slot 2.
+static inline bool mailbox_init(struct mailbox *m, void *base, size_t avail, uint32_t slot_size)
+{
+    if (slot_size == 0 || mailbox_required_size(slot_size) > avail) {
+        return false;
+    }
+
+    volatile struct mailbox_header *hdr = (volatile struct mailbox_header *)base;
+    hdr->magic = 0;
+    __sync_synchronize();
+
+    memset((void *)hdr, 0, sizeof(struct mailbox_header));
+    hdr->slot_size = slot_size;
+    hdr->data_offset = (uint32_t)mailbox_align_up(sizeof(struct mailbox_header), MAILBOX_SLOT_ALIGN);
+    hdr->latest = 1;
+
+    // Publish geometry last so the guest never attaches to a half-built mailbox
+    __atomic_store_n(&hdr->magic, MAILBOX_MAGIC, __ATOMIC_RELEASE);
+
+    mailbox_setup_view(m, base);
+    m->slot = 0;
+    return true;
+}
+
+// Guest: attach to a mailbox formatted by the host. Returns false if absent or invalid.
+static inline bool mailbox_attach(struct mailbox *m, void *base, size_t avail)
+{
+    volatile struct mailbox_header *hdr = (volatile struct mailbox_header *)base;
+
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != MAILBOX_MAGIC) {
+        return false;
+    }
+    if (mailbox_required_size(hdr->slot_size) > avail) {
+        return false;
+    }
+
+    mailbox_setup_view(m, base);
+    m->slot = 2;
+    return true;
+}
+
+// Payload of our private slot
+static inline uint8_t *mailbox_data(const struct mailbox *m)
+{
+    return m->data + m->slot * m->slot_stride;
+}
+
+static inline volatile struct mailbox_slot_desc *mailbox_desc(const struct mailbox *m)
+{
+    return &m->hdr->slots[m->slot];
+}
+
+// Host: publish the back slot as the newest frame and take the old `latest`
+// as the new back slot. Returns true if that frame was never taken (dropped).
+static inline bool mailbox_publish(struct mailbox *m, uint32_t sequence, uint32_t size, uint64_t publish_ns)
+{
+    volatile struct mailbox_slot_desc *desc = mailbox_desc(m);
+    desc->sequence = sequence;
+    desc->data_size = size;
+    desc->publish_ns = publish_ns;
+
+    // Release: payload and metadata are visible before the slot becomes `latest`;
+    // acquire: the guest's reads of the slot we get back are complete
+    uint32_t old = __atomic_exchange_n(&m->hdr->latest, m->slot | MAILBOX_FRESH, __ATOMIC_ACQ_REL);
+    m->slot = old & ~MAILBOX_FRESH;
+
+    m->hdr->published = (uint64_t)sequence + 1;
+    if (old & MAILBOX_FRESH) {
+        m->hdr->overwritten++;
+        return true;
+    }
+    return false;
+}
+
+// Guest: true if a frame newer than the one we hold is waiting
+static inline bool mailbox_has_fresh(const struct mailbox *m)
+{
+    return (__atomic_load_n(&m->hdr->latest, __ATOMIC_ACQUIRE) & MAILBOX_FRESH) != 0;
+}
+
+// Guest: swap our front slot for the newest frame. Returns false if nothing new.
+// Only the guest clears FRESH, so a frame seen as fresh is still there to take.
+static inline bool mailbox_take(struct mailbox *m)
+{
+    if (!mailbox_has_fresh(m)) {
+        return false;
+    }
+    uint32_t old = __atomic_exchange_n(&m->hdr->latest, m->slot, __ATOMIC_ACQ_REL);
+    m->slot = old & ~MAILBOX_FRESH;
+    return true;
+}
+
+// Host: mark the end of the stream after the last mailbox_publish()
+static inline void mailbox_close(struct mailbox *m)
+{
+    __atomic_store_n(&m->hdr->closed, 1, __ATOMIC_RELEASE);
+}
+
+static inline bool mailbox_closed(const struct mailbox *m)
+{
+    return __atomic_load_n(&m->hdr->closed, __ATOMIC_ACQUIRE) != 0;
+}
+
+#endif // MAILBOX_H
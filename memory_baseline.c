@@ -5,7 +5,8 @@
  * Run this on the HOST to compare against VM performance
  * 
  * Compile: gcc -O2 -o memory_baseline memory_baseline.c
- * Run: ./memory_baseline
+ * Run: ./memory_baseline [SIZE_MB] [ITERATIONS] [NUMA_NODE]
+ *   NUMA_NODE runs the test on that node's CPUs with every buffer on that node
  */
 
 #define _POSIX_C_SOURCE 200809L
@@ -21,16 +22,12 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 
+#include "numa.h"
+#include "timing.h"
+
 // Test size - 24MB (same as 4K frame test)
 #define TEST_SIZE (3840 * 2160 * 3)
 
-static inline uint64_t get_time_ns(void)
-{
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
-}
-
 // Cache flush function
 static void flush_cache_range(void *addr, size_t len) {
     #if defined(__x86_64__) || defined(__i386__)
@@ -176,11 +173,24 @@ int main(int argc, char *argv[])
     if (argc > 2) {
         iterations = atoi(argv[2]);
     }
+    int numa_node = -1;
+    if (argc > 3) {
+        numa_node = atoi(argv[3]);
+        if (!numa_node_has_memory(numa_node) || !numa_pin_node(numa_node) || !numa_prefer_node(numa_node)) {
+            fprintf(stderr, "Cannot place the test on NUMA node %d\n", numa_node);
+            return 1;
+        }
+    }
     
     printf("Memory Baseline Performance Test\n");
     printf("=================================\n");
     printf("Test size: %.2f MB (%zu bytes)\n", test_size / (1024.0 * 1024.0), test_size);
-    printf("Iterations: %d\n\n", iterations);
+    printf("Iterations: %d\n", iterations);
+    timing_init();
+    printf("Timer: %s, overhead %u ns, resolution %.2f ns\n", timing.tsc ? "TSC" : "clock_gettime",
+           timing.overhead_ns, timing.resolution_ns);
+    printf("NUMA node: %d of %d%s\n\n", numa_node >= 0 ? numa_node : numa_current_node(), numa_node_count(),
+           numa_node >= 0 ? " (pinned, buffers first-touched there)" : "");
     
     // Allocate test buffers (heap memory)
     printf("Allocating test buffers in heap (malloc)...\n");
@@ -0,0 +1,232 @@
+/*
+ * message_queue.h - Batched SPSC queue of variable-length messages
+ *
+ * The state machine in common.h costs a full handshake per message, which for
+ * small control messages is the whole cost. This queue separates enqueueing
+ * from notification: the host appends any number of records and makes them
+ * visible with a single release store of `head`; the guest drains everything
+ * up to the `head` it observed and acknowledges with a single release store of
+ * `tail`. A batch of K messages therefore costs one notification and one
+ * acknowledgement instead of K of each.
+ *
+ * Records are an 8-byte header followed by the payload, padded to
+ * MSGQ_ALIGN. A record never wraps: when it doesn't fit before the end of the
+ * buffer the producer writes a pad record and starts again at offset 0.
+ * `head` and `tail` are free-running byte counters on their own cache lines.
+ *
+ * Usage (host):                         Usage (guest):
+ *   msgq_enqueue(&q, msg, len, seq);      while ((rec = msgq_peek(&q))) {
+ *   ...                                       use(msgq_payload(rec), rec->size);
+ *   msgq_publish(&q);                         msgq_consume(&q, rec);
+ *                                         }
+ *                                         msgq_ack(&q);
+ */
+
+#ifndef MESSAGE_QUEUE_H
+#define MESSAGE_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#define MSGQ_MAGIC 0x4D534751      // "MSGQ"
+#define MSGQ_CACHE_LINE 64
+#define MSGQ_ALIGN 8               // Record alignment
+#define MSGQ_PAD 0xFFFFFFFFu       // Record size marking the unused tail of the buffer
+#define MSGQ_MAX_MESSAGE 65536     // Largest payload; consumers size their copy buffer from it
+
+struct msgq_record {
+    uint32_t size;                 // Payload bytes, or MSGQ_PAD
+    uint32_t sequence;             // Message number
+    // Payload follows
+};
+
+// Queue control block, placed at the start of shared_data.buffer
+struct msgq_header {
+    // Geometry - written once by the producer in msgq_init()
+    uint32_t magic;                // MSGQ_MAGIC once geometry is valid
+    uint32_t data_offset;          // Offset of the record buffer from the queue header
+    uint64_t capacity;             // Record buffer bytes (power of two)
+
+    // Producer index and end of stream - host writes, guest reads
+    uint64_t head __attribute__((aligned(MSGQ_CACHE_LINE)));
+    uint32_t closed;               // Set after the last publish
+
+    // Consumer index - guest writes, host reads
+    uint64_t tail __attribute__((aligned(MSGQ_CACHE_LINE)));
+    uint64_t acks;                 // Acknowledgements issued (one per drain)
+};
+
+// Process-local view of a queue (never placed in shared memory)
+struct msgq {
+    volatile struct msgq_header *hdr;
+    uint8_t *data;
+    uint64_t capacity;
+    uint64_t local_index;          // Unpublished head (producer) or unacknowledged tail (consumer)
+    uint64_t peer_index;           // Last observed peer index, refreshed only when needed
+};
+
+static inline uint64_t msgq_record_bytes(uint32_t size)
+{
+    return (sizeof(struct msgq_record) + size + MSGQ_ALIGN - 1) & ~(uint64_t)(MSGQ_ALIGN - 1);
+}
+
+// Largest power-of-two record buffer that fits in `avail` bytes with the header
+static inline uint64_t msgq_max_capacity(size_t avail)
+{
+    uint64_t control = (sizeof(struct msgq_header) + MSGQ_CACHE_LINE - 1) & ~(uint64_t)(MSGQ_CACHE_LINE - 1);
+    uint64_t capacity = 1;
+    if (avail <= control) return 0;
+    while (capacity * 2 <= avail - control) capacity *= 2;
+    return capacity;
+}
+
+static inline void msgq_setup_view(struct msgq *q, void *base)
+{
+    q->hdr = (volatile struct msgq_header *)base;
+    q->capacity = q->hdr->capacity;
+    q->data = (uint8_t *)base + q->hdr->data_offset;
+}
+
+// Producer: format a queue with `capacity` bytes of records (power of two)
+static inline bool msgq_init(struct msgq *q, void *base, size_t avail, uint64_t capacity)
+{
+    if (capacity < MSGQ_CACHE_LINE || (capacity & (capacity - 1)) != 0 || capacity > msgq_max_capacity(avail)) {
+        return false;
+    }
+
+    volatile struct msgq_header *hdr = (volatile struct msgq_header *)base;
+    hdr->magic = 0;
+    __sync_synchronize();
+
+    memset((void *)hdr, 0, sizeof(struct msgq_header));
+    hdr->data_offset = (uint32_t)((sizeof(struct msgq_header) + MSGQ_CACHE_LINE - 1) & ~(size_t)(MSGQ_CACHE_LINE - 1));
+    hdr->capacity = capacity;
+
+    // Publish geometry last so a consumer never attaches to a half-built queue
+    __atomic_store_n(&hdr->magic, MSGQ_MAGIC, __ATOMIC_RELEASE);
+
+    msgq_setup_view(q, base);
+    q->local_index = 0;
+    q->peer_index = 0;
+    return true;
+}
+
+// Consumer: attach to a queue formatted by the producer
+static inline bool msgq_attach(struct msgq *q, void *base, size_t avail)
+{
+    volatile struct msgq_header *hdr = (volatile struct msgq_header *)base;
+
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != MSGQ_MAGIC) {
+        return false;
+    }
+    if (hdr->capacity == 0 || hdr->capacity > msgq_max_capacity(avail)) {
+        return false;
+    }
+
+    msgq_setup_view(q, base);
+    q->local_index = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+    q->peer_index = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+    return true;
+}
+
+static inline struct msgq_record *msgq_at(const struct msgq *q, uint64_t index)
+{
+    return (struct msgq_record *)(q->data + (index & (q->capacity - 1)));
+}
+
+static inline const uint8_t *msgq_payload(const struct msgq_record *rec)
+{
+    return (const uint8_t *)(rec + 1);
+}
+
+// Producer: append a message without making it visible. Returns false if the
+// queue lacks space (publish and wait for the consumer) or the message can never fit.
+static inline bool msgq_enqueue(struct msgq *q, const void *src, uint32_t size, uint32_t sequence)
+{
+    uint64_t need = msgq_record_bytes(size);
+    uint64_t offset = q->local_index & (q->capacity - 1);
+    uint64_t pad = offset + need > q->capacity ? q->capacity - offset : 0;
+
+    if (size > MSGQ_MAX_MESSAGE || need > q->capacity) {
+        return false;
+    }
+    if (q->local_index + pad + need - q->peer_index > q->capacity) {
+        q->peer_index = __atomic_load_n(&q->hdr->tail, __ATOMIC_ACQUIRE);
+        if (q->local_index + pad + need - q->peer_index > q->capacity) {
+            return false;
+        }
+    }
+
+    if (pad > 0) {
+        msgq_at(q, q->local_index)->size = MSGQ_PAD;
+        q->local_index += pad;
+    }
+
+    struct msgq_record *rec = msgq_at(q, q->local_index);
+    rec->size = size;
+    rec->sequence = sequence;
+    if (size > 0) {
+        memcpy(rec + 1, src, size);
+    }
+    q->local_index += need;
+    return true;
+}
+
+// Producer: make every enqueued message visible with one release store
+static inline void msgq_publish(struct msgq *q)
+{
+    __atomic_store_n(&q->hdr->head, q->local_index, __ATOMIC_RELEASE);
+}
+
+// Producer: true once the consumer has acknowledged everything published
+static inline bool msgq_acked(struct msgq *q)
+{
+    q->peer_index = __atomic_load_n(&q->hdr->tail, __ATOMIC_ACQUIRE);
+    return q->peer_index == q->local_index;
+}
+
+// Producer: mark the end of the stream after the last publish
+static inline void msgq_close(struct msgq *q)
+{
+    __atomic_store_n(&q->hdr->closed, 1, __ATOMIC_RELEASE);
+}
+
+static inline bool msgq_closed(const struct msgq *q)
+{
+    return __atomic_load_n(&q->hdr->closed, __ATOMIC_ACQUIRE) != 0;
+}
+
+// Consumer: next published record, or NULL if none. Only touches the
+// producer's cache line once everything seen so far has been consumed.
+static inline const struct msgq_record *msgq_peek(struct msgq *q)
+{
+    for (;;) {
+        if (q->local_index == q->peer_index) {
+            q->peer_index = __atomic_load_n(&q->hdr->head, __ATOMIC_ACQUIRE);
+            if (q->local_index == q->peer_index) {
+                return NULL;
+            }
+        }
+        const struct msgq_record *rec = msgq_at(q, q->local_index);
+        if (rec->size != MSGQ_PAD) {
+            return rec;
+        }
+        q->local_index += q->capacity - (q->local_index & (q->capacity - 1));
+    }
+}
+
+static inline void msgq_consume(struct msgq *q, const struct msgq_record *rec)
+{
+    q->local_index += msgq_record_bytes(rec->size);
+}
+
+// Consumer: release every consumed record with one release store
+static inline void msgq_ack(struct msgq *q)
+{
+    q->hdr->acks++;
+    __atomic_store_n(&q->hdr->tail, q->local_index, __ATOMIC_RELEASE);
+}
+
+#endif // MESSAGE_QUEUE_H
@@ -0,0 +1,210 @@
+/*
+ * numa.h - NUMA placement for the shared region, local buffers and threads
+ *
+ * On a multi-socket host the tmpfs pages behind /dev/shm/ivshmem live on
+ * whichever node first touched them, and the writer thread runs wherever the
+ * scheduler puts it. When the two disagree every copy crosses the socket
+ * interconnect. These helpers make the placement explicit:
+ *
+ *   numa_bind_memory()  - mbind a mapping to one node and migrate its pages
+ *   numa_prefer_node()  - first-touch policy for the calling thread, so
+ *                         buffers faulted in later land on the node
+ *   numa_pin_node()     - restrict the calling thread to a node's CPUs
+ *   numa_pin_cpu()      - pin the calling thread to one CPU
+ *   numa_cpu_sibling()  - another hardware thread on the same core
+ *   numa_page_node()    - node a page currently lives on
+ *
+ * Raw syscalls keep libnuma out of the build (the guest is compiled inside
+ * the VM). Topology comes from /sys/devices/system/node. Affinity is per
+ * thread, and threads inherit it at creation, so pin before starting worker
+ * pools that should follow.
+ */
+
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define NUMA_MAX_NODES 64
+#define NUMA_MAX_CPUS 1024
+
+// <linux/mempolicy.h> values (not exported by glibc)
+#define NUMA_MPOL_PREFERRED 1
+#define NUMA_MPOL_BIND 2
+#define NUMA_MPOL_F_NODE (1 << 0)
+#define NUMA_MPOL_F_ADDR (1 << 1)
+#define NUMA_MPOL_MF_MOVE (1 << 1)
+#define NUMA_MPOL_MF_MOVE_ALL (1 << 2)
+
+typedef struct {
+    unsigned long bits[NUMA_MAX_CPUS / (8 * sizeof(unsigned long))];
+} numa_cpumask_t;
+
+// Parse a sysfs list such as "0-3,8,10-11" into a bitmask. Returns the number of bits set.
+static inline int numa_parse_list(const char *path, unsigned long *bits, int max_bits)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+
+    char line[4096];
+    int count = 0;
+    if (fgets(line, sizeof(line), f)) {
+        char *p = line;
+        while (*p && *p != '\n') {
+            char *end;
+            long lo = strtol(p, &end, 10);
+            if (end == p) break;
+            long hi = lo;
+            if (*end == '-') {
+                p = end + 1;
+                hi = strtol(p, &end, 10);
+            }
+            for (long i = lo; i <= hi && i < max_bits; i++) {
+                bits[i / (8 * sizeof(unsigned long))] |= 1UL << (i % (8 * sizeof(unsigned long)));
+                count++;
+            }
+            p = (*end == ',') ? end + 1 : end;
+        }
+    }
+    fclose(f);
+    return count;
+}
+
+static inline bool numa_mask_test(const unsigned long *bits, int bit)
+{
+    return (bits[bit / (8 * sizeof(unsigned long))] >> (bit % (8 * sizeof(unsigned long)))) & 1UL;
+}
+
+// Number of NUMA nodes (highest online node + 1); 1 when the kernel has no NUMA support
+static inline int numa_node_count(void)
+{
+    unsigned long online[NUMA_MAX_NODES / (8 * sizeof(unsigned long)) + 1] = {0};
+    if (numa_parse_list("/sys/devices/system/node/online", online, NUMA_MAX_NODES) == 0) {
+        return 1;
+    }
+    int highest = 0;
+    for (int n = 0; n < NUMA_MAX_NODES; n++) {
+        if (numa_mask_test(online, n)) highest = n;
+    }
+    return highest + 1;
+}
+
+// True if the node has memory of its own (CPU-only nodes can't hold the region)
+static inline bool numa_node_has_memory(int node)
+{
+    unsigned long bits[NUMA_MAX_NODES / (8 * sizeof(unsigned long)) + 1] = {0};
+    if (numa_parse_list("/sys/devices/system/node/has_memory", bits, NUMA_MAX_NODES) == 0) {
+        return node == 0;
+    }
+    return node >= 0 && node < NUMA_MAX_NODES && numa_mask_test(bits, node);
+}
+
+// CPUs of a node. Returns false if the node doesn't exist or has no CPUs.
+static inline bool numa_node_cpus(int node, numa_cpumask_t *mask)
+{
+    char path[64];
+    memset(mask, 0, sizeof(*mask));
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    return numa_parse_list(path, mask->bits, NUMA_MAX_CPUS) > 0;
+}
+
+// Node a CPU belongs to (-1 if unknown)
+static inline int numa_cpu_node(int cpu)
+{
+    numa_cpumask_t mask;
+    for (int n = 0; n < numa_node_count(); n++) {
+        if (numa_node_cpus(n, &mask) && cpu < NUMA_MAX_CPUS && numa_mask_test(mask.bits, cpu)) {
+            return n;
+        }
+    }
+    return -1;
+}
+
+static inline bool numa_pin_mask(const numa_cpumask_t *mask)
+{
+    return syscall(SYS_sched_setaffinity, 0, sizeof(mask->bits), mask->bits) == 0;
+}
+
+// Restrict the calling thread to the CPUs of `node`
+static inline bool numa_pin_node(int node)
+{
+    numa_cpumask_t mask;
+    return numa_node_cpus(node, &mask) && numa_pin_mask(&mask);
+}
+
+// Pin the calling thread to a single CPU
+static inline bool numa_pin_cpu(int cpu)
+{
+    if (cpu < 0 || cpu >= NUMA_MAX_CPUS) return false;
+    numa_cpumask_t mask;
+    memset(&mask, 0, sizeof(mask));
+    mask.bits[cpu / (8 * sizeof(unsigned long))] = 1UL << (cpu % (8 * sizeof(unsigned long)));
+    return numa_pin_mask(&mask);
+}
+
+// First other hardware thread on `cpu`'s core (-1 without SMT)
+static inline int numa_cpu_sibling(int cpu)
+{
+    char path[96];
+    numa_cpumask_t mask;
+    memset(&mask, 0, sizeof(mask));
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+    if (numa_parse_list(path, mask.bits, NUMA_MAX_CPUS) < 2) return -1;
+    for (int c = 0; c < NUMA_MAX_CPUS; c++) {
+        if (c != cpu && numa_mask_test(mask.bits, c)) return c;
+    }
+    return -1;
+}
+
+// New pages the calling thread faults in come from `node` (falls back to others when full)
+static inline bool numa_prefer_node(int node)
+{
+    unsigned long nodemask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+    nodemask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+    return syscall(SYS_set_mempolicy, NUMA_MPOL_PREFERRED, nodemask, NUMA_MAX_NODES + 1) == 0;
+}
+
+// Bind a page-aligned mapping to `node` and migrate pages already resident.
+// Moving pages that other processes (QEMU) also map needs CAP_SYS_NICE;
+// without it only our exclusive pages move and the rest stay put.
+static inline bool numa_bind_memory(void *addr, size_t len, int node)
+{
+    unsigned long nodemask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+    nodemask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+
+    if (syscall(SYS_mbind, addr, len, NUMA_MPOL_BIND, nodemask, NUMA_MAX_NODES + 1,
+                NUMA_MPOL_MF_MOVE_ALL) == 0) {
+        return true;
+    }
+    if (errno != EPERM) return false;
+    return syscall(SYS_mbind, addr, len, NUMA_MPOL_BIND, nodemask, NUMA_MAX_NODES + 1,
+                   NUMA_MPOL_MF_MOVE) == 0;
+}
+
+// Node the page holding `addr` lives on (-1 if unknown or not resident)
+static inline int numa_page_node(const void *addr)
+{
+    int node = -1;
+    if (syscall(SYS_get_mempolicy, &node, NULL, 0, addr, NUMA_MPOL_F_NODE | NUMA_MPOL_F_ADDR) != 0) {
+        return -1;
+    }
+    return node;
+}
+
+// Node the calling thread is running on right now (-1 if unknown)
+static inline int numa_current_node(void)
+{
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) return -1;
+    return (int)node;
+}
+
+#endif // NUMA_H
@@ -0,0 +1,187 @@
+/*
+ * parallel_copy.h - Persistent worker pool for striped frame copies
+ *
+ * A single core can't keep enough misses in flight to saturate a multi-channel
+ * memory controller, so a 6-25 MB frame copy is latency bound on one thread.
+ * The pool splits each copy into one contiguous stripe per thread, with stripe
+ * boundaries on destination cache-line boundaries so no two threads ever
+ * write the same line. The calling thread copies stripe 0 itself.
+ *
+ * Workers are created once and sleep on a condition variable between copies;
+ * completion is signalled with a release decrement of `pending`, so stores
+ * made by every worker (including NT stores drained by the kernel's sfence)
+ * are visible to the caller when copy_pool_run() returns.
+ *
+ * Usage:
+ *   struct copy_pool pool;
+ *   copy_pool_init(&pool, 4, memcpy_like_fn);
+ *   copy_pool_run(&pool, dst, src, size);
+ *   copy_pool_destroy(&pool);
+ */
+
+#ifndef PARALLEL_COPY_H
+#define PARALLEL_COPY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define COPY_POOL_MAX_THREADS 64
+#define COPY_STRIPE_ALIGN 64             // Stripe boundaries fall on destination cache lines
+#define COPY_POOL_MIN_STRIPE (64 * 1024) // Below this per thread, copy inline
+
+typedef void (*parallel_copy_fn_t)(void *dst, const void *src, size_t size);
+
+struct copy_pool;
+
+struct copy_worker {
+    struct copy_pool *pool;
+    int index;                           // Stripe index (1..threads-1)
+    pthread_t thread;
+};
+
+struct copy_pool {
+    int threads;                         // Total copiers, including the caller
+    parallel_copy_fn_t copy;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    uint64_t generation;                 // Bumped (under lock) for every job
+    bool shutdown;
+
+    // Current job - written under lock before the generation bump
+    uint8_t *dst;
+    const uint8_t *src;
+    size_t size;
+    int active;                          // Threads taking part in this job
+
+    int pending;                         // Workers still copying (atomic)
+
+    struct copy_worker workers[COPY_POOL_MAX_THREADS];
+};
+
+// Offset of stripe `index` in a copy of `size` bytes to `dst` split `parts` ways
+static inline size_t copy_stripe_offset(const uint8_t *dst, size_t size, int parts, int index)
+{
+    if (index <= 0) return 0;
+    if (index >= parts) return size;
+
+    uintptr_t base = (uintptr_t)dst;
+    uintptr_t split = base + (size / parts) * index;
+    uintptr_t aligned = (split + COPY_STRIPE_ALIGN - 1) & ~(uintptr_t)(COPY_STRIPE_ALIGN - 1);
+    size_t offset = aligned - base;
+    return offset < size ? offset : size;
+}
+
+static inline void copy_pool_stripe(struct copy_pool *pool, int index)
+{
+    size_t begin = copy_stripe_offset(pool->dst, pool->size, pool->active, index);
+    size_t end = copy_stripe_offset(pool->dst, pool->size, pool->active, index + 1);
+
+    if (end > begin) {
+        pool->copy(pool->dst + begin, pool->src + begin, end - begin);
+    }
+}
+
+static inline void *copy_pool_worker(void *arg)
+{
+    struct copy_worker *worker = (struct copy_worker *)arg;
+    struct copy_pool *pool = worker->pool;
+    uint64_t seen = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seen && !pool->shutdown) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        seen = pool->generation;
+        bool participate = worker->index < pool->active;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (participate) {
+            copy_pool_stripe(pool, worker->index);
+            __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_RELEASE);
+        }
+    }
+    return NULL;
+}
+
+// Start `threads - 1` workers (threads == 1 means copies run inline). Returns false on failure.
+static inline bool copy_pool_init(struct copy_pool *pool, int threads, parallel_copy_fn_t copy)
+{
+    if (threads < 1 || threads > COPY_POOL_MAX_THREADS || !copy) {
+        return false;
+    }
+
+    pool->threads = threads;
+    pool->copy = copy;
+    pool->generation = 0;
+    pool->shutdown = false;
+    pool->active = 1;
+    pool->pending = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+
+    for (int i = 1; i < threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if (pthread_create(&pool->workers[i].thread, NULL, copy_pool_worker, &pool->workers[i]) != 0) {
+            pool->threads = i;
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline void copy_pool_destroy(struct copy_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 1; i < pool->threads; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+}
+
+// Copy `size` bytes using the pool. Returns once every stripe has landed.
+static inline void copy_pool_run(struct copy_pool *pool, void *dst, const void *src, size_t size)
+{
+    int active = pool->threads;
+    while (active > 1 && size / active < COPY_POOL_MIN_STRIPE) {
+        active--;
+    }
+
+    if (active == 1) {
+        pool->copy(dst, src, size);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->dst = (uint8_t *)dst;
+    pool->src = (const uint8_t *)src;
+    pool->size = size;
+    pool->active = active;
+    __atomic_store_n(&pool->pending, active - 1, __ATOMIC_RELAXED);
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    copy_pool_stripe(pool, 0);
+
+    // Acquire pairs with each worker's release decrement
+    while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) != 0) {
+        sched_yield();
+    }
+}
+
+#endif // PARALLEL_COPY_H
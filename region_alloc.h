@@ -0,0 +1,498 @@
+/*
+ * region_alloc.h - Variable-size message allocator over the shared data area
+ *
+ * Without an allocator every transfer writes `data_size` bytes at
+ * shm->buffer[0], so messages of mixed sizes go one at a time. This module
+ * carves the data area into size-class slabs for small messages and a
+ * page-granular arena for large ones, and hands out offsets from it:
+ *
+ *   buffer + 0                 ralloc_header (submit and free queues)
+ *   buffer + class_offset[c]   class_blocks[c] blocks of class_size[c] bytes
+ *   buffer + arena_offset      arena_size bytes, first-fit in RALLOC_PAGE units
+ *
+ * The host is the only allocator, so free lists and the arena's extent list
+ * are host-local and need no atomics. The host writes a message into a block
+ * and submits its descriptor (offset, size, sequence) on the submit queue;
+ * the guest reads the message in place and gives the block back by pushing
+ * the same descriptor on the free queue. The host drains the free queue
+ * whenever it needs space. Both queues are SPSC rings of fixed-size
+ * descriptors with free-running head/tail counters on their own cache lines.
+ *
+ * Descriptors on the free queue come from the guest, so the host never trusts
+ * them: it looks each offset up in its own table of outstanding blocks and
+ * releases the capacity and size it recorded at allocation time. Offsets that
+ * are out of range, misaligned for their class or not outstanding (double
+ * frees) are counted and dropped.
+ *
+ * A slab class with no free block falls through to the arena, so a burst of
+ * small messages degrades to arena allocations rather than stalling.
+ */
+
+#ifndef REGION_ALLOC_H
+#define REGION_ALLOC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RALLOC_MAGIC 0x52414C43    // "RALC"
+#define RALLOC_CACHE_LINE 64
+#define RALLOC_PAGE 4096           // Arena granule and slab alignment
+#define RALLOC_MAX_CLASSES 8
+#define RALLOC_QUEUE_SLOTS 1024    // Descriptors per queue (power of two)
+#define RALLOC_ARENA_CLASS 0xFFFFu // ralloc_desc.size_class for arena blocks
+#define RALLOC_NOT_LIVE 0xFFFFFFFFu // Outstanding-block table entry with no live block
+
+// Default slab classes and the share of the data area they get
+static const uint32_t ralloc_default_classes[] = { 256, 1024, 4096, 16384, 65536 };
+#define RALLOC_DEFAULT_CLASS_COUNT 5
+#define RALLOC_SLAB_SHARE 4        // Slabs get 1/RALLOC_SLAB_SHARE of the area, the arena the rest
+
+// Benchmark phases: arena only, then slabs in front of the arena
+#define RALLOC_PHASES 2
+
+// One message in flight (submit queue) or one block coming back (free queue)
+struct ralloc_desc {
+    uint64_t offset;               // Block, from the allocator header
+    uint32_t capacity;             // Bytes reserved for the block
+    uint32_t size;                 // Message bytes
+    uint32_t sequence;
+    uint16_t kind;                 // Producer-defined message type
+    uint16_t size_class;           // Slab class, or RALLOC_ARENA_CLASS
+};
+
+// Allocator control block, placed at the start of shared_data.buffer
+struct ralloc_header {
+    // Geometry - written once by the host in ralloc_init()
+    uint32_t magic;                // RALLOC_MAGIC once geometry is valid
+    uint32_t class_count;
+    uint64_t region_size;
+    uint64_t arena_offset;
+    uint64_t arena_size;
+    uint32_t class_size[RALLOC_MAX_CLASSES];
+    uint32_t class_blocks[RALLOC_MAX_CLASSES];
+    uint64_t class_offset[RALLOC_MAX_CLASSES];
+
+    // Submit queue - host produces, guest consumes
+    uint64_t submit_head __attribute__((aligned(RALLOC_CACHE_LINE)));
+    uint32_t closed;               // Set after the last submit
+    uint64_t submit_tail __attribute__((aligned(RALLOC_CACHE_LINE)));
+
+    // Free queue - guest produces, host consumes
+    uint64_t free_head __attribute__((aligned(RALLOC_CACHE_LINE)));
+    uint64_t free_tail __attribute__((aligned(RALLOC_CACHE_LINE)));
+
+    struct ralloc_desc submit[RALLOC_QUEUE_SLOTS] __attribute__((aligned(RALLOC_CACHE_LINE)));
+    struct ralloc_desc freed[RALLOC_QUEUE_SLOTS] __attribute__((aligned(RALLOC_CACHE_LINE)));
+};
+
+struct ralloc_extent {
+    uint64_t offset;
+    uint64_t size;
+};
+
+// Host view: header plus the host-local free lists (never placed in shared memory)
+struct ralloc {
+    volatile struct ralloc_header *hdr;
+    uint8_t *base;
+    uint32_t *free_blocks[RALLOC_MAX_CLASSES];  // Stack of free block indices per class
+    uint32_t free_count[RALLOC_MAX_CLASSES];
+    uint32_t *block_size[RALLOC_MAX_CLASSES];   // Message bytes per outstanding slab block
+    uint32_t *arena_live;          // Message bytes per arena page that starts an outstanding block
+    struct ralloc_extent *extents;  // Free arena extents, sorted by offset
+    uint32_t extent_count;
+    uint32_t extent_capacity;
+    uint64_t submit_index;         // Next submit slot
+    uint64_t submit_peer;          // Last observed submit_tail
+    uint64_t free_index;           // Next free-queue entry to reclaim
+
+    // Statistics
+    uint64_t in_use;               // Bytes reserved by live blocks
+    uint64_t requested;            // Bytes asked for by live blocks
+    uint64_t peak_in_use;
+    uint64_t slab_allocs;
+    uint64_t arena_allocs;
+    uint64_t failures;             // Allocations that found no space
+    uint64_t rejected;             // Free-queue descriptors that matched no outstanding block
+};
+
+// Guest view
+struct ralloc_reader {
+    volatile struct ralloc_header *hdr;
+    uint8_t *base;
+    uint64_t submit_index;         // Next descriptor to take
+    uint64_t submit_peer;          // Last observed submit_head
+    uint64_t free_index;           // Next free-queue slot
+    uint64_t free_peer;            // Last observed free_tail
+};
+
+static inline uint64_t ralloc_align_up(uint64_t value, uint64_t align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+
+static inline uint64_t ralloc_control_size(void)
+{
+    return ralloc_align_up(sizeof(struct ralloc_header), RALLOC_PAGE);
+}
+
+static inline void ralloc_destroy(struct ralloc *a)
+{
+    for (int c = 0; c < RALLOC_MAX_CLASSES; c++) {
+        free(a->free_blocks[c]);
+        free(a->block_size[c]);
+        a->free_blocks[c] = NULL;
+        a->block_size[c] = NULL;
+    }
+    free(a->arena_live);
+    free(a->extents);
+    a->arena_live = NULL;
+    a->extents = NULL;
+}
+
+// Host: format the allocator over [base, base + avail). `classes` lists the
+// slab block sizes (ascending, at most RALLOC_MAX_CLASSES); with class_count
+// 0 everything comes from the arena.
+static inline bool ralloc_init(struct ralloc *a, void *base, size_t avail, const uint32_t *classes,
+                               uint32_t class_count)
+{
+    uint64_t control = ralloc_control_size();
+    if (class_count > RALLOC_MAX_CLASSES || avail <= control + RALLOC_PAGE) {
+        return false;
+    }
+
+    memset(a, 0, sizeof(*a));
+    volatile struct ralloc_header *hdr = (volatile struct ralloc_header *)base;
+    hdr->magic = 0;
+    __sync_synchronize();
+    memset((void *)hdr, 0, sizeof(struct ralloc_header));
+    hdr->region_size = avail;
+    hdr->class_count = class_count;
+
+    uint64_t offset = control;
+    uint64_t share = class_count > 0 ? (avail - control) / RALLOC_SLAB_SHARE / class_count : 0;
+    for (uint32_t c = 0; c < class_count; c++) {
+        uint32_t blocks = (uint32_t)(share / classes[c]);
+        hdr->class_size[c] = classes[c];
+        hdr->class_blocks[c] = blocks;
+        hdr->class_offset[c] = offset;
+        offset = ralloc_align_up(offset + (uint64_t)blocks * classes[c], RALLOC_PAGE);
+
+        a->free_blocks[c] = malloc((blocks > 0 ? blocks : 1) * sizeof(uint32_t));
+        a->block_size[c] = malloc((blocks > 0 ? blocks : 1) * sizeof(uint32_t));
+        if (!a->free_blocks[c] || !a->block_size[c]) {
+            ralloc_destroy(a);
+            return false;
+        }
+        memset(a->block_size[c], 0xFF, (blocks > 0 ? blocks : 1) * sizeof(uint32_t));
+        // Lowest index on top so early allocations pack at the start of the slab
+        for (uint32_t b = 0; b < blocks; b++) {
+            a->free_blocks[c][b] = blocks - 1 - b;
+        }
+        a->free_count[c] = blocks;
+    }
+
+    if (offset + RALLOC_PAGE > avail) {
+        ralloc_destroy(a);
+        return false;
+    }
+    hdr->arena_offset = offset;
+    hdr->arena_size = (avail - offset) & ~(uint64_t)(RALLOC_PAGE - 1);
+
+    // Free extents never outnumber half the arena's pages (plus one)
+    a->extent_capacity = (uint32_t)(hdr->arena_size / RALLOC_PAGE / 2 + 2);
+    a->extents = malloc(a->extent_capacity * sizeof(struct ralloc_extent));
+    a->arena_live = malloc((hdr->arena_size / RALLOC_PAGE) * sizeof(uint32_t));
+    if (!a->extents || !a->arena_live) {
+        ralloc_destroy(a);
+        return false;
+    }
+    memset(a->arena_live, 0xFF, (hdr->arena_size / RALLOC_PAGE) * sizeof(uint32_t));
+    a->extents[0].offset = hdr->arena_offset;
+    a->extents[0].size = hdr->arena_size;
+    a->extent_count = 1;
+
+    // Publish geometry last so the guest never attaches to a half-built allocator
+    __atomic_store_n(&hdr->magic, RALLOC_MAGIC, __ATOMIC_RELEASE);
+
+    a->hdr = hdr;
+    a->base = (uint8_t *)base;
+    return true;
+}
+
+// Guest: attach to an allocator formatted by the host
+static inline bool ralloc_attach(struct ralloc_reader *r, void *base, size_t avail)
+{
+    volatile struct ralloc_header *hdr = (volatile struct ralloc_header *)base;
+
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != RALLOC_MAGIC) {
+        return false;
+    }
+    if (hdr->region_size > avail || hdr->class_count > RALLOC_MAX_CLASSES ||
+        hdr->arena_offset + hdr->arena_size > hdr->region_size) {
+        return false;
+    }
+
+    r->hdr = hdr;
+    r->base = (uint8_t *)base;
+    r->submit_index = __atomic_load_n(&hdr->submit_tail, __ATOMIC_ACQUIRE);
+    r->submit_peer = r->submit_index;
+    r->free_index = __atomic_load_n(&hdr->free_head, __ATOMIC_ACQUIRE);
+    r->free_peer = __atomic_load_n(&hdr->free_tail, __ATOMIC_ACQUIRE);
+    return true;
+}
+
+static inline uint8_t *ralloc_ptr(uint8_t *base, uint64_t offset)
+{
+    return base + offset;
+}
+
+// Host: give an arena extent back, coalescing with its neighbours
+static inline void ralloc_arena_free(struct ralloc *a, uint64_t offset, uint64_t size)
+{
+    uint32_t lo = 0, hi = a->extent_count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (a->extents[mid].offset < offset) lo = mid + 1;
+        else hi = mid;
+    }
+
+    bool merge_prev = lo > 0 && a->extents[lo - 1].offset + a->extents[lo - 1].size == offset;
+    bool merge_next = lo < a->extent_count && offset + size == a->extents[lo].offset;
+
+    if (merge_prev && merge_next) {
+        a->extents[lo - 1].size += size + a->extents[lo].size;
+        memmove(&a->extents[lo], &a->extents[lo + 1], (a->extent_count - lo - 1) * sizeof(struct ralloc_extent));
+        a->extent_count--;
+    } else if (merge_prev) {
+        a->extents[lo - 1].size += size;
+    } else if (merge_next) {
+        a->extents[lo].offset = offset;
+        a->extents[lo].size += size;
+    } else {
+        memmove(&a->extents[lo + 1], &a->extents[lo], (a->extent_count - lo) * sizeof(struct ralloc_extent));
+        a->extents[lo].offset = offset;
+        a->extents[lo].size = size;
+        a->extent_count++;
+    }
+}
+
+// Host: first-fit arena allocation. Returns false if no extent is large enough.
+static inline bool ralloc_arena_alloc(struct ralloc *a, uint64_t size, uint64_t *offset)
+{
+    for (uint32_t i = 0; i < a->extent_count; i++) {
+        if (a->extents[i].size >= size) {
+            *offset = a->extents[i].offset;
+            a->extents[i].offset += size;
+            a->extents[i].size -= size;
+            if (a->extents[i].size == 0) {
+                memmove(&a->extents[i], &a->extents[i + 1], (a->extent_count - i - 1) * sizeof(struct ralloc_extent));
+                a->extent_count--;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// Host: release a block the guest has finished with. Only the offset is taken
+// from the descriptor; capacity and size come from the host's own table. Returns
+// false (and releases nothing) if the offset isn't an outstanding block.
+static inline bool ralloc_release(struct ralloc *a, const struct ralloc_desc *d)
+{
+    uint64_t capacity;
+    uint32_t size;
+
+    if (d->size_class == RALLOC_ARENA_CLASS) {
+        if (d->offset < a->hdr->arena_offset || d->offset >= a->hdr->arena_offset + a->hdr->arena_size ||
+            (d->offset - a->hdr->arena_offset) % RALLOC_PAGE != 0) {
+            a->rejected++;
+            return false;
+        }
+        uint64_t page = (d->offset - a->hdr->arena_offset) / RALLOC_PAGE;
+        size = a->arena_live[page];
+        if (size == RALLOC_NOT_LIVE) {
+            a->rejected++;
+            return false;
+        }
+        a->arena_live[page] = RALLOC_NOT_LIVE;
+        capacity = ralloc_align_up(size > 0 ? size : 1, RALLOC_PAGE);
+        ralloc_arena_free(a, d->offset, capacity);
+    } else {
+        uint32_t c = d->size_class;
+        if (c >= a->hdr->class_count || d->offset < a->hdr->class_offset[c]) {
+            a->rejected++;
+            return false;
+        }
+        uint64_t rel = d->offset - a->hdr->class_offset[c];
+        capacity = a->hdr->class_size[c];
+        if (rel % capacity != 0 || rel / capacity >= a->hdr->class_blocks[c]) {
+            a->rejected++;
+            return false;
+        }
+        uint32_t block = (uint32_t)(rel / capacity);
+        size = a->block_size[c][block];
+        if (size == RALLOC_NOT_LIVE) {
+            a->rejected++;
+            return false;
+        }
+        a->block_size[c][block] = RALLOC_NOT_LIVE;
+        a->free_blocks[c][a->free_count[c]++] = block;
+    }
+    a->in_use -= capacity;
+    a->requested -= size;
+    return true;
+}
+
+// Host: take back every block on the free queue. Returns how many were
+// released; rejected descriptors are consumed but not released. `consumed`
+// (optional) receives every descriptor taken off the queue, rejected or not.
+static inline uint32_t ralloc_reclaim(struct ralloc *a, uint32_t *consumed)
+{
+    uint64_t head = __atomic_load_n(&a->hdr->free_head, __ATOMIC_ACQUIRE);
+    uint64_t start = a->free_index;
+    uint32_t released = 0;
+    while (a->free_index != head) {
+        struct ralloc_desc d = *(const struct ralloc_desc *)&a->hdr->freed[a->free_index & (RALLOC_QUEUE_SLOTS - 1)];
+        if (ralloc_release(a, &d)) {
+            released++;
+        }
+        a->free_index++;
+    }
+    // Publish even when everything was rejected, or the guest sees a full free queue forever
+    if (a->free_index != start) {
+        __atomic_store_n(&a->hdr->free_tail, a->free_index, __ATOMIC_RELEASE);
+    }
+    if (consumed) *consumed = (uint32_t)(a->free_index - start);
+    return released;
+}
+
+// Host: reserve a block for a `size`-byte message. Fills everything in `d`
+// except sequence and kind. Reclaims freed blocks before giving up.
+static inline bool ralloc_alloc(struct ralloc *a, uint32_t size, struct ralloc_desc *d)
+{
+    for (int attempt = 0; attempt < 2; attempt++) {
+        for (uint32_t c = 0; c < a->hdr->class_count; c++) {
+            if (size <= a->hdr->class_size[c]) {
+                if (a->free_count[c] > 0) {
+                    uint32_t block = a->free_blocks[c][--a->free_count[c]];
+                    d->offset = a->hdr->class_offset[c] + (uint64_t)block * a->hdr->class_size[c];
+                    d->capacity = a->hdr->class_size[c];
+                    d->size_class = (uint16_t)c;
+                    a->block_size[c][block] = size;
+                    a->slab_allocs++;
+                    goto allocated;
+                }
+                break;
+            }
+        }
+
+        uint64_t capacity = ralloc_align_up(size > 0 ? size : 1, RALLOC_PAGE);
+        if (ralloc_arena_alloc(a, capacity, &d->offset)) {
+            d->capacity = (uint32_t)capacity;
+            d->size_class = RALLOC_ARENA_CLASS;
+            a->arena_live[(d->offset - a->hdr->arena_offset) / RALLOC_PAGE] = size;
+            a->arena_allocs++;
+            goto allocated;
+        }
+        if (ralloc_reclaim(a, NULL) == 0) {
+            break;
+        }
+    }
+    a->failures++;
+    return false;
+
+allocated:
+    d->size = size;
+    a->in_use += d->capacity;
+    a->requested += size;
+    if (a->in_use > a->peak_in_use) a->peak_in_use = a->in_use;
+    return true;
+}
+
+// Host: hand a written block to the guest. Returns false if the submit queue is full.
+static inline bool ralloc_submit(struct ralloc *a, const struct ralloc_desc *d)
+{
+    if (a->submit_index - a->submit_peer >= RALLOC_QUEUE_SLOTS) {
+        a->submit_peer = __atomic_load_n(&a->hdr->submit_tail, __ATOMIC_ACQUIRE);
+        if (a->submit_index - a->submit_peer >= RALLOC_QUEUE_SLOTS) {
+            return false;
+        }
+    }
+    a->hdr->submit[a->submit_index & (RALLOC_QUEUE_SLOTS - 1)] = *d;
+    a->submit_index++;
+    __atomic_store_n(&a->hdr->submit_head, a->submit_index, __ATOMIC_RELEASE);
+    return true;
+}
+
+static inline void ralloc_close(struct ralloc *a)
+{
+    __atomic_store_n(&a->hdr->closed, 1, __ATOMIC_RELEASE);
+}
+
+static inline bool ralloc_closed(const struct ralloc_reader *r)
+{
+    return __atomic_load_n(&r->hdr->closed, __ATOMIC_ACQUIRE) != 0;
+}
+
+// Host: every submitted block has been freed and reclaimed
+static inline bool ralloc_idle(struct ralloc *a)
+{
+    ralloc_reclaim(a, NULL);
+    return a->in_use == 0;
+}
+
+// Host: largest free arena extent and total free arena bytes
+static inline uint64_t ralloc_arena_largest(const struct ralloc *a, uint64_t *free_bytes)
+{
+    uint64_t largest = 0, total = 0;
+    for (uint32_t i = 0; i < a->extent_count; i++) {
+        total += a->extents[i].size;
+        if (a->extents[i].size > largest) largest = a->extents[i].size;
+    }
+    if (free_bytes) *free_bytes = total;
+    return largest;
+}
+
+// Host: external fragmentation of the arena, 1 - largest free extent / free bytes
+static inline double ralloc_external_frag(const struct ralloc *a)
+{
+    uint64_t free_bytes;
+    uint64_t largest = ralloc_arena_largest(a, &free_bytes);
+    return free_bytes > 0 ? 1.0 - (double)largest / free_bytes : 0.0;
+}
+
+// Guest: next submitted block, or false if none
+static inline bool ralloc_receive(struct ralloc_reader *r, struct ralloc_desc *d)
+{
+    if (r->submit_index == r->submit_peer) {
+        r->submit_peer = __atomic_load_n(&r->hdr->submit_head, __ATOMIC_ACQUIRE);
+        if (r->submit_index == r->submit_peer) {
+            return false;
+        }
+    }
+    *d = *(const struct ralloc_desc *)&r->hdr->submit[r->submit_index & (RALLOC_QUEUE_SLOTS - 1)];
+    r->submit_index++;
+    __atomic_store_n(&r->hdr->submit_tail, r->submit_index, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Guest: give a block back. Returns false if the free queue is full (the host
+// has not reclaimed yet); retry after waiting.
+static inline bool ralloc_free(struct ralloc_reader *r, const struct ralloc_desc *d)
+{
+    if (r->free_index - r->free_peer >= RALLOC_QUEUE_SLOTS) {
+        r->free_peer = __atomic_load_n(&r->hdr->free_tail, __ATOMIC_ACQUIRE);
+        if (r->free_index - r->free_peer >= RALLOC_QUEUE_SLOTS) {
+            return false;
+        }
+    }
+    r->hdr->freed[r->free_index & (RALLOC_QUEUE_SLOTS - 1)] = *d;
+    r->free_index++;
+    __atomic_store_n(&r->hdr->free_head, r->free_index, __ATOMIC_RELEASE);
+    return true;
+}
+
+#endif // REGION_ALLOC_H
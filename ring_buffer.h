@@ -0,0 +1,330 @@
+/*
+ * ring_buffer.h - Lock-free single-producer/single-consumer slot ring
+ *
+ * The single-message protocol in common.h carries exactly one frame per
+ * state machine round trip, so throughput is capped by the round trip rather
+ * than by memory bandwidth. This ring carves the data area of the shared
+ * region into N fixed-size slots so the host can write frame N+1 while the
+ * guest is still reading frame N.
+ *
+ * Ownership follows the same rule as host_state/guest_state: the producer
+ * only writes `head` and the slots it owns, the consumer only writes `tail`.
+ * Both indices are free-running 64-bit counters, each in its own 128-byte
+ * line pair (the adjacent-line prefetcher moves lines in pairs, see the v2
+ * control block in common.h); slot = index % slot_count. The host is usually
+ * the producer, but the code is symmetric: the duplex test runs a second ring
+ * with the guest producing (ring_attach_producer) and the host consuming.
+ *
+ * Producers that can build a frame where it will be read use ring_reserve() /
+ * ring_commit() instead of ring_try_push(): reserve returns the next free
+ * slot's payload, the producer renders into it, and commit publishes it.
+ *
+ * Consumers that can work on a frame where it lies use ring_lease() /
+ * ring_release() instead of ring_try_pop(): a lease is a read-only pointer
+ * into the slot, and the slot stays out of the producer's reach until it is
+ * released. Leases are released in the order they were taken.
+ */
+
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#define RING_MAGIC 0x52494E47      // "RING"
+#define RING_CACHE_LINE 64
+#define RING_LINE_PAIR 128         // Adjacent-line prefetch unit, as SHM_LINE_PAIR in common.h
+#define RING_SLOT_ALIGN 4096       // Slot payloads are page aligned
+#define RING_DEFAULT_MAX_SLOTS 8
+
+// Per-slot descriptor (one cache line each) - written by producer before publish
+struct ring_slot_desc {
+    uint32_t sequence;             // Message sequence number
+    uint32_t data_size;            // Valid bytes in the slot payload
+    uint8_t  data_digest[32];      // Digest of the payload (algorithm in shared_data.digest_algo)
+    uint8_t  _pad[RING_CACHE_LINE - 40];
+} __attribute__((aligned(RING_CACHE_LINE)));
+
+// Ring control block, placed at the start of shared_data.buffer
+struct ring_header {
+    // Geometry - written once by the producer in ring_init()
+    uint32_t magic;                // RING_MAGIC once geometry is valid
+    uint32_t slot_count;           // Number of slots
+    uint32_t slot_size;            // Payload capacity per slot (bytes)
+    uint32_t data_offset;          // Offset of first payload from the ring header
+
+    // Producer index - host writes, guest reads
+    uint64_t head __attribute__((aligned(RING_LINE_PAIR)));
+
+    // Consumer index - guest writes, host reads
+    uint64_t tail __attribute__((aligned(RING_LINE_PAIR)));
+
+    struct ring_slot_desc slots[0] __attribute__((aligned(RING_LINE_PAIR)));
+};
+
+// Process-local view of a ring (never placed in shared memory)
+struct ring {
+    volatile struct ring_header *hdr;
+    uint8_t *data;                 // Base of the slot payload area
+    uint32_t slot_count;
+    uint32_t slot_size;
+    size_t   slot_stride;          // Distance between payloads (page aligned)
+    uint64_t local_index;          // Our own index (head for producer, tail for consumer)
+    uint64_t peer_index;           // Last observed peer index, refreshed only when needed
+    uint64_t dropped;              // Consumer: oversized slots discarded by ring_try_pop()
+    uint64_t lease_index;          // Consumer: next slot to lease; [local_index, lease_index) are leased
+};
+
+// A slot lent to the consumer in place (valid until ring_release)
+struct ring_lease {
+    const uint8_t *data;
+    uint32_t size;
+    uint32_t sequence;
+};
+
+static inline size_t ring_align_up(size_t value, size_t align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+
+// Bytes needed for a ring with the given geometry
+static inline size_t ring_required_size(uint32_t slot_count, uint32_t slot_size)
+{
+    size_t control = sizeof(struct ring_header) + slot_count * sizeof(struct ring_slot_desc);
+    return ring_align_up(control, RING_SLOT_ALIGN) +
+           (size_t)slot_count * ring_align_up(slot_size, RING_SLOT_ALIGN);
+}
+
+// Largest slot count that fits in `avail` bytes (0 if not even one slot fits)
+static inline uint32_t ring_max_slots(size_t avail, uint32_t slot_size)
+{
+    uint32_t count = 0;
+    while (ring_required_size(count + 1, slot_size) <= avail) {
+        count++;
+    }
+    return count;
+}
+
+static inline void ring_setup_view(struct ring *r, void *base)
+{
+    r->hdr = (volatile struct ring_header *)base;
+    r->slot_count = r->hdr->slot_count;
+    r->slot_size = r->hdr->slot_size;
+    r->slot_stride = ring_align_up(r->slot_size, RING_SLOT_ALIGN);
+    r->data = (uint8_t *)base + r->hdr->data_offset;
+}
+
+// Producer: format a ring in [base, base + avail). Returns false if it doesn't fit.
+static inline bool ring_init(struct ring *r, void *base, size_t avail, uint32_t slot_count, uint32_t slot_size)
+{
+    if (slot_count == 0 || slot_size == 0 || ring_required_size(slot_count, slot_size) > avail) {
+        return false;
+    }
+
+    volatile struct ring_header *hdr = (volatile struct ring_header *)base;
+    hdr->magic = 0;
+    __sync_synchronize();
+
+    memset((void *)hdr, 0, sizeof(struct ring_header) + slot_count * sizeof(struct ring_slot_desc));
+    hdr->slot_count = slot_count;
+    hdr->slot_size = slot_size;
+    hdr->data_offset = (uint32_t)ring_align_up(sizeof(struct ring_header) +
+                                               slot_count * sizeof(struct ring_slot_desc),
+                                               RING_SLOT_ALIGN);
+    hdr->head = 0;
+    hdr->tail = 0;
+
+    // Publish geometry last so a consumer never attaches to a half-built ring
+    __atomic_store_n(&hdr->magic, RING_MAGIC, __ATOMIC_RELEASE);
+
+    ring_setup_view(r, base);
+    r->local_index = 0;
+    r->peer_index = 0;
+    r->dropped = 0;
+    r->lease_index = 0;
+    return true;
+}
+
+// Consumer: attach to a ring formatted by the producer. Returns false if absent or invalid.
+static inline bool ring_attach(struct ring *r, void *base, size_t avail)
+{
+    volatile struct ring_header *hdr = (volatile struct ring_header *)base;
+
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != RING_MAGIC) {
+        return false;
+    }
+    if (hdr->slot_count == 0 || ring_required_size(hdr->slot_count, hdr->slot_size) > avail) {
+        return false;
+    }
+
+    ring_setup_view(r, base);
+    r->local_index = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+    r->peer_index = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+    r->dropped = 0;
+    r->lease_index = r->local_index;
+    return true;
+}
+
+// Producer that didn't format the ring: attach to one formatted by the other side
+static inline bool ring_attach_producer(struct ring *r, void *base, size_t avail)
+{
+    if (!ring_attach(r, base, avail)) {
+        return false;
+    }
+    r->local_index = __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+    r->peer_index = __atomic_load_n(&r->hdr->tail, __ATOMIC_ACQUIRE);
+    return true;
+}
+
+static inline uint8_t *ring_slot_data(const struct ring *r, uint64_t index)
+{
+    return r->data + (index % r->slot_count) * r->slot_stride;
+}
+
+static inline volatile struct ring_slot_desc *ring_slot_desc(const struct ring *r, uint64_t index)
+{
+    return &r->hdr->slots[index % r->slot_count];
+}
+
+// Producer: true if at least one slot is free. Only touches the consumer's
+// cache line when the cached view says the ring is full.
+static inline bool ring_has_space(struct ring *r)
+{
+    if (r->local_index - r->peer_index < r->slot_count) {
+        return true;
+    }
+    r->peer_index = __atomic_load_n(&r->hdr->tail, __ATOMIC_ACQUIRE);
+    return r->local_index - r->peer_index < r->slot_count;
+}
+
+// Consumer: true if at least one slot has been published
+static inline bool ring_has_data(struct ring *r)
+{
+    if (r->peer_index != r->local_index) {
+        return true;
+    }
+    r->peer_index = __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+    return r->peer_index != r->local_index;
+}
+
+// Producer view of published-but-unconsumed slots (refreshes the consumer index)
+static inline uint32_t ring_occupancy(struct ring *r)
+{
+    r->peer_index = __atomic_load_n(&r->hdr->tail, __ATOMIC_ACQUIRE);
+    return (uint32_t)(r->local_index - r->peer_index);
+}
+
+// Producer: payload of the next free slot (slot_size bytes) to write a
+// message into in place, or NULL if the ring is full. Nothing is visible to
+// the consumer until ring_commit(); reserving again returns the same slot.
+static inline uint8_t *ring_reserve(struct ring *r)
+{
+    if (!ring_has_space(r)) {
+        return NULL;
+    }
+    return ring_slot_data(r, r->local_index);
+}
+
+// Producer: publish the slot returned by ring_reserve() holding `size` bytes
+static inline void ring_commit(struct ring *r, uint32_t size, uint32_t sequence, const uint8_t *digest)
+{
+    uint64_t index = r->local_index;
+    volatile struct ring_slot_desc *desc = ring_slot_desc(r, index);
+
+    desc->sequence = sequence;
+    desc->data_size = size;
+    if (digest) {
+        memcpy((void *)desc->data_digest, digest, 32);
+    }
+
+    // Release: payload and descriptor are visible before the new head
+    r->local_index = index + 1;
+    __atomic_store_n(&r->hdr->head, r->local_index, __ATOMIC_RELEASE);
+}
+
+// Producer: copy a message into the next free slot and publish it.
+// Returns false if the ring is full or the message is larger than a slot.
+static inline bool ring_try_push(struct ring *r, const void *src, uint32_t size,
+                                 uint32_t sequence, const uint8_t *digest)
+{
+    uint8_t *slot;
+    if (size > r->slot_size || (slot = ring_reserve(r)) == NULL) {
+        return false;
+    }
+    memcpy(slot, src, size);
+    ring_commit(r, size, sequence, digest);
+    return true;
+}
+
+// Consumer: copy the oldest published message out and release its slot.
+// Returns false if the ring is empty. A descriptor claiming more than the slot
+// holds or than `capacity` is never copied: the slot is released, counted in
+// `dropped`, and false is returned, so a caller waiting on ring_has_data()
+// still makes progress.
+static inline bool ring_try_pop(struct ring *r, void *dst, uint32_t capacity,
+                                uint32_t *size, uint32_t *sequence, uint8_t *digest)
+{
+    if (!ring_has_data(r)) {
+        return false;
+    }
+
+    uint64_t index = r->local_index;
+    volatile struct ring_slot_desc *desc = ring_slot_desc(r, index);
+    uint32_t data_size = desc->data_size;
+
+    if (data_size > r->slot_size || data_size > capacity) {
+        r->dropped++;
+        r->local_index = index + 1;
+        __atomic_store_n(&r->hdr->tail, r->local_index, __ATOMIC_RELEASE);
+        return false;
+    }
+
+    memcpy(dst, ring_slot_data(r, index), data_size);
+    if (size) *size = data_size;
+    if (sequence) *sequence = desc->sequence;
+    if (digest) memcpy(digest, (const void *)desc->data_digest, 32);
+
+    // Release: our reads of the slot complete before the producer may reuse it
+    r->local_index = index + 1;
+    __atomic_store_n(&r->hdr->tail, r->local_index, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Consumer: lend the next published slot in place without copying it. The
+// slot is not returned to the producer until ring_release(); at most
+// slot_count leases can be outstanding. Don't mix with ring_try_pop() while
+// leases are held.
+static inline bool ring_lease(struct ring *r, struct ring_lease *lease)
+{
+    if (r->lease_index == r->peer_index) {
+        r->peer_index = __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+        if (r->lease_index == r->peer_index) {
+            return false;
+        }
+    }
+
+    uint64_t index = r->lease_index;
+    volatile struct ring_slot_desc *desc = ring_slot_desc(r, index);
+    uint32_t data_size = desc->data_size;
+
+    lease->data = ring_slot_data(r, index);
+    lease->size = data_size <= r->slot_size ? data_size : r->slot_size;
+    lease->sequence = desc->sequence;
+    r->lease_index = index + 1;
+    return true;
+}
+
+// Consumer: hand the oldest leased slot back to the producer
+static inline void ring_release(struct ring *r)
+{
+    if (r->local_index == r->lease_index) {
+        return;
+    }
+    // Release: our reads of the slot complete before the producer may reuse it
+    r->local_index++;
+    __atomic_store_n(&r->hdr->tail, r->local_index, __ATOMIC_RELEASE);
+}
+
+#endif // RING_BUFFER_H
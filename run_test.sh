@@ -14,6 +14,19 @@
 # Environment variables (inherited from setup.sh or set manually):
 #   HOST_CPU_CORES="0-1"   - Pin host processes to cores 0-1 (format: "0-3" or "0,2,4")
 #   VM_CPU_CORES="2-3"     - Information about VM pinning (for display only)
+#   WAIT_POLICY="spin"     - Polling strategy for both sides: spin, yield, backoff, usleep, doorbell, futex, pause,
+#                            umwait (default: backoff)
+#                            doorbell needs DOORBELL and an ivshmem-doorbell device bound to uio_pci_generic in the VM;
+#                            futex only works when both sides map /dev/shm (loopback), so this script rejects it;
+#                            umwait needs WAITPKG (Tremont, Sapphire Rapids and later), else it falls back to pause
+#   PAUSE_COUNT=64         - Pause hints per re-check for the pause/umwait policies (default: 32)
+#   DOORBELL="/tmp/ivshmem_socket" - ivshmem-server socket the host joins; the guest rings through UIO (default: unset)
+#   COPY_KERNEL="memcpy"   - Host frame write kernel: auto, memcpy, rep_movsb, sse2_nt, avx2_nt, avx512_nt (default: auto)
+#   VERIFY="xxh3"          - Frame digest: sha256, crc32c, xxh3, none (default: sha256)
+#   GUEST_PRODUCTION=1     - Guest receives with one fused copy+digest pass (default: phase breakdown)
+#   PAGES="hugetlb"        - Local buffer pages on both sides: 4k, thp, hugetlb (default: 4k)
+#   HUGEPAGES=1            - Shared region is on hugetlbfs (/dev/hugepages/ivshmem, see setup.sh)
+#   NUMA_NODE=0            - Bind the shared region and host writer to a NUMA node (default: unset)
 #
 # Example usage:
 #   HOST_CPU_CORES="0-1" VM_CPU_CORES="2-3" ./run_test.sh 1
@@ -70,6 +83,9 @@ fi
 # Configuration
 IVSHMEM_SIZE=64
 SHMEM_PATH="/dev/shm/ivshmem"
+if [[ "${HUGEPAGES:-0}" == "1" ]]; then
+  SHMEM_PATH="/dev/hugepages/ivshmem"
+fi
 SHMEM_FALLBACK="./ivshmem-shmem"
 SSH_KEY="temp_id_rsa"
 SSH_OPTS="-i $SSH_KEY -p 2222 -o StrictHostKeyChecking=no -o UserKnownHostsFile=/dev/null"
@@ -78,6 +94,26 @@ VM_USER="debian@localhost"
 
 # Parse test counts from command line arguments
 LAT_COUNT=${1:-1000}      # Default 1000 latency tests
+WAIT_POLICY=${WAIT_POLICY:-backoff}
+COPY_KERNEL=${COPY_KERNEL:-auto}
+VERIFY=${VERIFY:-sha256}
+PAGES=${PAGES:-4k}
+HOST_FLAGS="--pages $PAGES --shm $SHMEM_PATH"
+if [[ -n "${NUMA_NODE:-}" ]]; then
+  HOST_FLAGS="$HOST_FLAGS --numa-node $NUMA_NODE"
+fi
+GUEST_FLAGS="--pages $PAGES"
+if [[ -n "${PAUSE_COUNT:-}" ]]; then
+  HOST_FLAGS="$HOST_FLAGS --pause-count $PAUSE_COUNT"
+  GUEST_FLAGS="$GUEST_FLAGS --pause-count $PAUSE_COUNT"
+fi
+if [[ -n "${DOORBELL:-}" ]]; then
+  HOST_FLAGS="$HOST_FLAGS --doorbell $DOORBELL"
+  GUEST_FLAGS="$GUEST_FLAGS --doorbell uio"
+fi
+if [[ "${GUEST_PRODUCTION:-0}" == "1" ]]; then
+  GUEST_FLAGS="$GUEST_FLAGS --production"
+fi
 BAND_COUNT=${2:-10}       # Default 10 bandwidth tests
 
 # If only latency count provided and >0, skip bandwidth by default
@@ -95,6 +131,14 @@ if [[ $LAT_COUNT -eq 0 && $BAND_COUNT -eq 0 ]]; then
     error "At least one test type must be enabled (latency_count > 0 or bandwidth_count > 0)"
 fi
 
+if [[ "$WAIT_POLICY" == "futex" ]]; then
+    error "WAIT_POLICY=futex needs host and guest on the same /dev/shm region; the VM guest maps the PCI device"
+fi
+
+if [[ "$WAIT_POLICY" == "doorbell" && -z "${DOORBELL:-}" ]]; then
+    error "WAIT_POLICY=doorbell needs DOORBELL (the ivshmem-server socket)"
+fi
+
 # CPU Pinning Configuration (inherited from setup.sh or set manually)
 # These can be overridden by environment variables
 VM_CPU_CORES="${VM_CPU_CORES:-}"
@@ -221,7 +265,7 @@ else
         warning "Failed to compile memory_baseline.c on host, skipping baseline check"
     else
         # Copy to VM and compile there
-        if ! scp $SCP_OPTS memory_baseline.c $VM_USER:/tmp/ >/dev/null 2>&1; then
+        if ! scp $SCP_OPTS memory_baseline.c numa.h timing.h $VM_USER:/tmp/ >/dev/null 2>&1; then
             warning "Failed to copy memory_baseline.c to VM, skipping baseline check"
         elif ! ssh $SSH_OPTS $VM_USER 'cd /tmp && gcc -O2 -o memory_baseline memory_baseline.c' >/dev/null 2>&1; then
             warning "Failed to compile memory_baseline.c on VM, skipping baseline check"
@@ -263,7 +307,7 @@ else
             fi
             
             # Cleanup
-            ssh $SSH_OPTS $VM_USER 'rm -f /tmp/memory_baseline /tmp/memory_baseline.c' >/dev/null 2>&1 || true
+            ssh $SSH_OPTS $VM_USER 'rm -f /tmp/memory_baseline /tmp/memory_baseline.c /tmp/numa.h /tmp/timing.h' >/dev/null 2>&1 || true
         fi
     fi
     rm -f memory_baseline >/dev/null 2>&1 || true
@@ -338,7 +382,7 @@ if [ $LAT_COUNT -gt 0 ]; then
 
   # Start guest reader for latency test only
   echo "Starting guest reader for latency test (${LAT_COUNT} iterations)..."
-  ssh $SSH_OPTS $VM_USER "sudo /tmp/guest_reader -l $LAT_COUNT" > /tmp/guest_latency.log 2>&1 &
+  ssh $SSH_OPTS $VM_USER "sudo /tmp/guest_reader -l $LAT_COUNT -w $WAIT_POLICY $GUEST_FLAGS" > /tmp/guest_latency.log 2>&1 &
   LATENCY_GUEST_PID=$!
 
   # Wait for guest to initialize
@@ -349,7 +393,7 @@ if [ $LAT_COUNT -gt 0 ]; then
   fi
 
   # Run latency test on host (separate invocation)
-  if sudo $HOST_PINNING_CMD ./host_writer -l $LAT_COUNT; then
+  if sudo $HOST_PINNING_CMD ./host_writer -l $LAT_COUNT -w $WAIT_POLICY --copy-kernel $COPY_KERNEL --verify $VERIFY $HOST_FLAGS; then
       success "Latency test completed successfully"
   else
       warning "Latency test completed with issues"
@@ -377,7 +421,7 @@ if [ $BAND_COUNT -gt 0 ]; then
 
   # Start guest reader for bandwidth test only
   echo "Starting guest reader for bandwidth test (${BAND_COUNT} iterations)..."
-  ssh $SSH_OPTS $VM_USER "sudo /tmp/guest_reader -c $((BAND_COUNT * 3))" > /tmp/guest_bandwidth.log 2>&1 &
+  ssh $SSH_OPTS $VM_USER "sudo /tmp/guest_reader -c $((BAND_COUNT * 3)) -w $WAIT_POLICY $GUEST_FLAGS" > /tmp/guest_bandwidth.log 2>&1 &
   BANDWIDTH_GUEST_PID=$!
 
   # Wait for guest to initialize
@@ -388,7 +432,7 @@ if [ $BAND_COUNT -gt 0 ]; then
   fi
 
   # Run bandwidth test on host (separate invocation)
-  if echo "" | sudo $HOST_PINNING_CMD ./host_writer -b ${BAND_COUNT}; then
+  if echo "" | sudo $HOST_PINNING_CMD ./host_writer -b ${BAND_COUNT} -w $WAIT_POLICY --copy-kernel $COPY_KERNEL --verify $VERIFY $HOST_FLAGS; then
       success "Bandwidth test completed successfully"
   else
       warning "Bandwidth test completed with issues"
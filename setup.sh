@@ -18,6 +18,11 @@
 #   4-5 cores: VM=2-3, Host=0-1
 #   6-7 cores: VM=2-4, Host=0-1,5
 #   8+ cores:  VM=2-5, Host=0-1,6-7
+#
+# HUGE PAGES:
+#   HUGEPAGES=1            - Back the shared region with 2 MB pages: mounts hugetlbfs on
+#                            /dev/hugepages, reserves vm.nr_hugepages and creates
+#                            /dev/hugepages/ivshmem instead of /dev/shm/ivshmem
 
 # Variables
 IVSHMEM_SIZE=64
@@ -89,8 +94,25 @@ if [ "$OS" = "Darwin" ]; then
   CPU_FLAG="-cpu host"
   SHMEM_PATH=$SHMEM_FILE
 else
-  # Linux: use /dev/shm if available, otherwise local file
-  if [ -d /dev/shm ]; then
+  # Linux: use hugetlbfs when asked, else /dev/shm if available, otherwise local file
+  if [ "${HUGEPAGES:-0}" = "1" ]; then
+    HUGE_MOUNT=/dev/hugepages
+    # Region plus room for the host's local frame buffers (--pages hugetlb)
+    HUGE_NEEDED=$((IVSHMEM_SIZE / 2 + 32))
+    if ! grep -q " $HUGE_MOUNT hugetlbfs " /proc/mounts; then
+      sudo mkdir -p $HUGE_MOUNT
+      sudo mount -t hugetlbfs none $HUGE_MOUNT
+    fi
+    if [ "$(cat /proc/sys/vm/nr_hugepages)" -lt $HUGE_NEEDED ]; then
+      echo $HUGE_NEEDED | sudo tee /proc/sys/vm/nr_hugepages > /dev/null
+    fi
+    echo "Creating shared memory file: $HUGE_MOUNT/ivshmem (${IVSHMEM_SIZE}MB, 2 MB pages, $(cat /proc/sys/vm/nr_hugepages) reserved)"
+    # hugetlbfs files can't be written with dd; size them and let the first touch fault pages in
+    sudo rm -f $HUGE_MOUNT/ivshmem
+    sudo truncate -s ${IVSHMEM_SIZE}M $HUGE_MOUNT/ivshmem
+    sudo chmod 666 $HUGE_MOUNT/ivshmem
+    SHMEM_PATH=$HUGE_MOUNT/ivshmem
+  elif [ -d /dev/shm ]; then
     echo "Creating shared memory file: /dev/shm/ivshmem (${IVSHMEM_SIZE}MB)"
     dd if=/dev/zero of=/dev/shm/ivshmem bs=1M count=$IVSHMEM_SIZE
     SHMEM_PATH=/dev/shm/ivshmem
@@ -0,0 +1,215 @@
+/*
+ * timing.h - TSC timestamps calibrated against CLOCK_MONOTONIC
+ *
+ * clock_gettime(CLOCK_MONOTONIC) costs 20-40 ns through the vDSO. In a guest
+ * without a stable kvmclock it falls back to a syscall and costs far more. It
+ * also jitters by about as much, which is the same order as the small-message
+ * latencies being measured. When the CPU has an invariant TSC, get_time_ns()
+ * reads the TSC instead, fenced so it is ordered against the code it times.
+ * Every get_time_ns() stamp, start or end, uses the same read, so the overhead
+ * subtracted from an interval is that of the read actually taken at both ends:
+ *
+ *   timing_tsc_start() - lfence; rdtsc; lfence  (earlier code done, later code waits)
+ *
+ * timing_tsc_end() (rdtscp; lfence) only closes the calibration bracket in
+ * timing_anchor().
+ *
+ * timing_init() calibrates the TSC against CLOCK_MONOTONIC and anchors the
+ * two, so get_time_ns() starts out near the CLOCK_MONOTONIC epoch. The 20 ms
+ * calibration leaves it up to about a microsecond off, drifting by a fraction
+ * of a microsecond per second, and each process calibrates on its own. That is
+ * noise for an interval taken within one process, but not for a stamp another
+ * process subtracts from its own clock: those come from timing_shared_ns(),
+ * which is always CLOCK_MONOTONIC. timing_init() also measures the timer's own
+ * overhead, the smallest gap between two back-to-back reads, and
+ * timing_elapsed_ns() subtracts that from an interval.
+ *
+ * Without an invariant TSC, or when called before timing_init(),
+ * get_time_ns() is plain clock_gettime(CLOCK_MONOTONIC). The overhead and
+ * resolution are still measured. TIMING_TSC=0 in the environment forces the
+ * fallback.
+ */
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#define TIMING_CALIBRATE_NS 20000000ULL  // Calibration window (20 ms)
+#define TIMING_CALIBRATE_TRIES 5         // Anchor reads per end; the tightest bracket wins
+#define TIMING_OVERHEAD_PAIRS 10000      // Back-to-back reads for the overhead and resolution
+
+struct timing_calibration {
+    bool     tsc;                  // get_time_ns() reads the TSC
+    uint64_t tsc_hz;               // Calibrated TSC frequency (0 without a TSC)
+    uint64_t tsc_base;             // TSC at mono_base_ns
+    uint64_t mono_base_ns;
+    uint64_t ns_mult;              // ns = ticks * ns_mult >> 32
+    uint32_t overhead_ns;          // Smallest back-to-back get_time_ns() gap, subtracted by timing_elapsed_ns()
+    double   resolution_ns;        // Smallest step get_time_ns() can show
+    uint32_t clock_overhead_ns;    // Same measurement for clock_gettime(), for comparison
+};
+
+static struct timing_calibration timing;
+
+static inline uint64_t timing_mono_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#if defined(__x86_64__)
+static inline uint64_t timing_tsc_start(void)
+{
+    _mm_lfence();
+    uint64_t t = __rdtsc();
+    _mm_lfence();
+    return t;
+}
+
+static inline uint64_t timing_tsc_end(void)
+{
+    unsigned int aux;
+    uint64_t t = __rdtscp(&aux);
+    _mm_lfence();
+    return t;
+}
+
+// Invariant TSC (CPUID 0x80000007 EDX bit 8) ticks at a constant rate through
+// frequency and C-state changes, and is synchronised across cores; RDTSCP is
+// CPUID 0x80000001 EDX bit 27
+static inline bool timing_tsc_usable(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 27))) {
+        return false;
+    }
+    return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8));
+}
+#else
+static inline uint64_t timing_tsc_start(void) { return 0; }
+static inline uint64_t timing_tsc_end(void) { return 0; }
+static inline bool timing_tsc_usable(void) { return false; }
+#endif
+
+static inline uint64_t timing_tsc_to_ns(uint64_t tsc)
+{
+    int64_t ticks = (int64_t)(tsc - timing.tsc_base);
+    if (ticks >= 0) {
+        return timing.mono_base_ns + (uint64_t)(((unsigned __int128)ticks * timing.ns_mult) >> 32);
+    }
+    return timing.mono_base_ns - (uint64_t)(((unsigned __int128)(-ticks) * timing.ns_mult) >> 32);
+}
+
+static inline uint64_t get_time_ns(void)
+{
+    if (timing.tsc) {
+        return timing_tsc_to_ns(timing_tsc_start());
+    }
+    return timing_mono_ns();
+}
+
+// Timestamp read by the other process (publish stamps, clock sync probes).
+// CLOCK_MONOTONIC in every mode, so host and guest stamps share an epoch on a
+// loopback run, and clock_sync.h sees the same clock the stamps come from.
+static inline uint64_t timing_shared_ns(void)
+{
+    return timing_mono_ns();
+}
+
+// Interval between two get_time_ns() readings, less the timer's own overhead.
+// Both readings must come from the same process.
+static inline uint64_t timing_elapsed_ns(uint64_t start, uint64_t end)
+{
+    uint64_t elapsed = end - start;
+    return elapsed > timing.overhead_ns ? elapsed - timing.overhead_ns : 0;
+}
+
+// One (TSC, CLOCK_MONOTONIC) pair: the monotonic read bracketed by two TSC
+// reads, keeping the tightest of TIMING_CALIBRATE_TRIES
+static inline void timing_anchor(uint64_t *tsc, uint64_t *mono)
+{
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < TIMING_CALIBRATE_TRIES; i++) {
+        uint64_t t0 = timing_tsc_start();
+        uint64_t m = timing_mono_ns();
+        uint64_t t1 = timing_tsc_end();
+        if (t1 - t0 < best) {
+            best = t1 - t0;
+            *tsc = t0 + (t1 - t0) / 2;
+            *mono = m;
+        }
+    }
+}
+
+// Smallest gap and smallest non-zero step between back-to-back reads of `now`
+static inline void timing_measure(uint64_t (*now)(void), uint32_t *overhead_ns, uint64_t *step_ns)
+{
+    uint64_t min_gap = UINT64_MAX, min_step = UINT64_MAX;
+    for (int i = 0; i < TIMING_OVERHEAD_PAIRS; i++) {
+        uint64_t a = now();
+        uint64_t b = now();
+        uint64_t gap = b - a;
+        if (gap < min_gap) min_gap = gap;
+        if (gap > 0 && gap < min_step) min_step = gap;
+    }
+    *overhead_ns = (uint32_t)min_gap;
+    *step_ns = min_step == UINT64_MAX ? 0 : min_step;
+}
+
+// Calibrate once at startup, before any timestamps are taken. Returns true if the TSC is in use.
+static inline bool timing_init(void)
+{
+    memset(&timing, 0, sizeof(timing));
+    uint64_t step_ns;
+    timing_measure(timing_mono_ns, &timing.clock_overhead_ns, &step_ns);
+
+    const char *env = getenv("TIMING_TSC");
+    if (timing_tsc_usable() && !(env && strcmp(env, "0") == 0)) {
+        uint64_t tsc0, mono0, tsc1, mono1;
+        timing_anchor(&tsc0, &mono0);
+        struct timespec ts = { 0, (long)TIMING_CALIBRATE_NS };
+        nanosleep(&ts, NULL);
+        timing_anchor(&tsc1, &mono1);
+
+        if (tsc1 > tsc0 && mono1 > mono0) {
+            timing.tsc_hz = (uint64_t)((unsigned __int128)(tsc1 - tsc0) * 1000000000ULL / (mono1 - mono0));
+            timing.ns_mult = (uint64_t)(((unsigned __int128)(mono1 - mono0) << 32) / (tsc1 - tsc0));
+            timing.tsc_base = tsc1;
+            timing.mono_base_ns = mono1;
+            timing.tsc = timing.tsc_hz > 0;
+        }
+    }
+
+    if (timing.tsc) {
+        timing_measure(get_time_ns, &timing.overhead_ns, &step_ns);
+        timing.resolution_ns = 1e9 / (double)timing.tsc_hz;
+    } else {
+        timing.overhead_ns = timing.clock_overhead_ns;
+        timing.resolution_ns = (double)step_ns;
+    }
+    return timing.tsc;
+}
+
+static inline const char *timing_source(void)
+{
+    return timing.tsc ? "tsc" : "clock_gettime";
+}
+
+// TSC frequency in kHz for the results (0 = clock_gettime)
+static inline uint32_t timing_tsc_khz(void)
+{
+    return (uint32_t)(timing.tsc_hz / 1000);
+}
+
+#endif // TIMING_H
@@ -0,0 +1,307 @@
+/*
+ * wait_policy.h - Pluggable polling strategies for state and ring waits
+ *
+ * Every wait loop used to call usleep(10), which with the default 50 µs timer
+ * slack really sleeps 50-80 µs and hides the notification latency we are
+ * trying to measure. A wait policy trades CPU burn against wake-up latency:
+ *
+ *   spin    - pure busy-wait with the CPU's pause/yield hint (lowest latency)
+ *   yield   - spin for a while, then sched_yield() between polls
+ *   backoff - spin for a while, then nanosleep() with exponential backoff
+ *   usleep  - legacy fixed usleep(10) polling (for comparison with old runs)
+ *   doorbell - spin for a while, then block until the peer rings (doorbell.h);
+ *             state changes ring the peer, everything else is re-checked
+ *             every DOORBELL_RECHECK_MS
+ *   futex   - spin for a while, then FUTEX_WAIT on the peer's wake word; only
+ *             for host-local regions (/dev/shm), where both processes map the
+ *             same physical pages. State changes bump the word and FUTEX_WAKE
+ *             it, everything else is re-checked every WAIT_FUTEX_RECHECK_NS
+ *   pause   - pure busy-wait, `pause_count` pause hints between re-checks; a
+ *             larger count polls the line less often and leaves more issue
+ *             slots to the sibling hyperthread
+ *   umwait  - UMONITOR the cache line of the awaited word, then UMWAIT in the
+ *             C0.2 light sleep until it is written or WAIT_UMWAIT_TSC_TICKS
+ *             pass (the kernel also caps this, see umwait_control/max_time).
+ *             Needs WAITPKG (Tremont, Sapphire Rapids and later) and a
+ *             `monitor_word`; otherwise it falls back to pause. Waits on any
+ *             other word re-check on the timeout
+ *
+ * Usage:
+ *   struct wait_state ws;
+ *   wait_begin(&ws);
+ *   while (!condition) wait_step(&policy, &ws);
+ */
+
+#ifndef WAIT_POLICY_H
+#define WAIT_POLICY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <limits.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#include "doorbell.h"
+
+typedef enum {
+    WAIT_POLICY_USLEEP = 0,
+    WAIT_POLICY_SPIN = 1,
+    WAIT_POLICY_YIELD = 2,
+    WAIT_POLICY_BACKOFF = 3,
+    WAIT_POLICY_DOORBELL = 4,
+    WAIT_POLICY_FUTEX = 5,
+    WAIT_POLICY_PAUSE = 6,
+    WAIT_POLICY_UMWAIT = 7
+} wait_policy_kind_t;
+
+#define WAIT_DEFAULT_SPIN_LIMIT 2000    // pause iterations before yielding/sleeping
+#define WAIT_DEFAULT_SLEEP_MIN_NS 1000  // first backoff sleep (1 µs)
+#define WAIT_DEFAULT_SLEEP_MAX_NS 64000 // backoff ceiling (64 µs)
+#define WAIT_FUTEX_RECHECK_NS 1000000   // Longest a futex wait blocks before the caller re-checks
+#define WAIT_DEFAULT_PAUSE_COUNT 32     // pause hints per re-check for the pause policy
+#define WAIT_UMWAIT_TSC_TICKS 100000    // UMWAIT deadline, ~30-50 µs; the kernel's default cap is the same
+
+struct wait_policy {
+    wait_policy_kind_t kind;
+    uint32_t spin_limit;
+    uint32_t sleep_min_ns;
+    uint32_t sleep_max_ns;
+    struct doorbell *doorbell;     // Doorbell policy: what to block on (NULL = back off instead)
+    volatile uint32_t *futex_word; // Futex policy: the peer's wake word (NULL = back off instead)
+    uint32_t pause_count;          // Pause/umwait policies: pause hints per re-check
+    volatile uint32_t *monitor_word; // Umwait policy: word whose line is monitored (NULL = pause instead)
+};
+
+// Per-wait progress, reset with wait_begin() before each wait loop
+struct wait_state {
+    uint32_t spins;
+    uint32_t sleep_ns;
+    uint32_t futex_seq;            // Wake word value seen before the last condition check
+    bool     armed;                // Futex snapshot taken / monitor armed; the next step may block
+};
+
+static inline const char *wait_policy_name(wait_policy_kind_t kind)
+{
+    switch (kind) {
+        case WAIT_POLICY_USLEEP: return "usleep";
+        case WAIT_POLICY_SPIN: return "spin";
+        case WAIT_POLICY_YIELD: return "yield";
+        case WAIT_POLICY_BACKOFF: return "backoff";
+        case WAIT_POLICY_DOORBELL: return "doorbell";
+        case WAIT_POLICY_FUTEX: return "futex";
+        case WAIT_POLICY_PAUSE: return "pause";
+        case WAIT_POLICY_UMWAIT: return "umwait";
+        default: return "unknown";
+    }
+}
+
+static inline void wait_policy_defaults(struct wait_policy *policy, wait_policy_kind_t kind)
+{
+    policy->kind = kind;
+    policy->spin_limit = WAIT_DEFAULT_SPIN_LIMIT;
+    policy->sleep_min_ns = WAIT_DEFAULT_SLEEP_MIN_NS;
+    policy->sleep_max_ns = WAIT_DEFAULT_SLEEP_MAX_NS;
+    policy->doorbell = NULL;
+    policy->futex_word = NULL;
+    policy->pause_count = WAIT_DEFAULT_PAUSE_COUNT;
+    policy->monitor_word = NULL;
+}
+
+// Parse a policy name from the command line (keeps the tuning fields). Returns false if unknown.
+static inline bool wait_policy_parse(const char *name, struct wait_policy *policy)
+{
+    for (int kind = WAIT_POLICY_USLEEP; kind <= WAIT_POLICY_UMWAIT; kind++) {
+        if (strcasecmp(name, wait_policy_name((wait_policy_kind_t)kind)) == 0) {
+            policy->kind = (wait_policy_kind_t)kind;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Process-wide setup for a policy. Backoff sleeps are only useful if the
+// kernel doesn't round them up by the default 50 µs timer slack.
+static inline void wait_policy_apply(const struct wait_policy *policy)
+{
+    if (policy->kind == WAIT_POLICY_BACKOFF || policy->kind == WAIT_POLICY_DOORBELL || policy->kind == WAIT_POLICY_FUTEX) {
+        prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
+    }
+}
+
+// CPU hint for spin loops: lets the sibling hyperthread run and saves power
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    __sync_synchronize();
+#endif
+}
+
+// True if the CPU has UMONITOR/UMWAIT/TPAUSE (CPUID.7.0:ECX bit 5). Cached:
+// CPUID traps to the hypervisor in a guest and would dominate the wait step.
+static inline bool wait_umwait_supported(void)
+{
+#if defined(__x86_64__)
+    static int supported = -1;
+    if (supported < 0) {
+        unsigned int eax, ebx, ecx, edx;
+        supported = __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ecx & (1u << 5)) != 0;
+    }
+    return supported != 0;
+#else
+    return false;
+#endif
+}
+
+#if defined(__x86_64__)
+__attribute__((target("waitpkg")))
+static inline void wait_umonitor(volatile uint32_t *word)
+{
+    _umonitor((void *)word);
+}
+
+// Light sleep (C0.2) until the monitored line is written or the deadline passes
+__attribute__((target("waitpkg")))
+static inline void wait_umwait(void)
+{
+    _umwait(0, __rdtsc() + WAIT_UMWAIT_TSC_TICKS);
+}
+#endif
+
+static inline void cpu_relax_n(uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        cpu_relax();
+    }
+}
+
+// Shared (not FUTEX_PRIVATE) futex ops: the word lives in a MAP_SHARED region seen by two processes
+static inline void futex_wait(volatile uint32_t *word, uint32_t expected, uint64_t timeout_ns)
+{
+    struct timespec ts = { (time_t)(timeout_ns / 1000000000ULL), (long)(timeout_ns % 1000000000ULL) };
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, expected, &ts, NULL, 0);
+}
+
+static inline void futex_wake(volatile uint32_t *word)
+{
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// Publish-side half of the futex policy: call after the state the peer waits on is written
+static inline void wait_notify(volatile uint32_t *word)
+{
+    __atomic_fetch_add(word, 1, __ATOMIC_RELEASE);
+    futex_wake(word);
+}
+
+static inline void wait_begin(struct wait_state *ws)
+{
+    ws->spins = 0;
+    ws->sleep_ns = 0;
+    ws->futex_seq = 0;
+    ws->armed = false;
+}
+
+// One polling step; call between re-checks of the awaited condition
+static inline void wait_step(const struct wait_policy *policy, struct wait_state *ws)
+{
+    switch (policy->kind) {
+        case WAIT_POLICY_SPIN:
+            cpu_relax();
+            return;
+
+        case WAIT_POLICY_YIELD:
+            if (ws->spins < policy->spin_limit) {
+                ws->spins++;
+                cpu_relax();
+            } else {
+                sched_yield();
+            }
+            return;
+
+        case WAIT_POLICY_DOORBELL:
+            if (ws->spins < policy->spin_limit) {
+                ws->spins++;
+                cpu_relax();
+            } else if (policy->doorbell) {
+                doorbell_wait(policy->doorbell, DOORBELL_RECHECK_MS);
+            } else {
+                struct timespec ts = { 0, (long)policy->sleep_max_ns };
+                nanosleep(&ts, NULL);
+            }
+            return;
+
+        case WAIT_POLICY_FUTEX:
+            // Snapshot the wake word, let the caller re-check, then sleep only if the
+            // word hasn't moved since: a wake between the check and the wait isn't lost
+            if (ws->spins < policy->spin_limit) {
+                ws->spins++;
+                cpu_relax();
+            } else if (!policy->futex_word) {
+                struct timespec ts = { 0, (long)policy->sleep_max_ns };
+                nanosleep(&ts, NULL);
+            } else if (!ws->armed) {
+                ws->futex_seq = __atomic_load_n(policy->futex_word, __ATOMIC_ACQUIRE);
+                ws->armed = true;
+            } else {
+                futex_wait(policy->futex_word, ws->futex_seq, WAIT_FUTEX_RECHECK_NS);
+                ws->armed = false;
+            }
+            return;
+
+        case WAIT_POLICY_UMWAIT:
+#if defined(__x86_64__)
+            // Same two steps as futex: arm the monitor, let the caller re-check,
+            // then sleep; a write after the arm ends the UMWAIT at once
+            if (policy->monitor_word && wait_umwait_supported()) {
+                if (!ws->armed) {
+                    wait_umonitor(policy->monitor_word);
+                    ws->armed = true;
+                } else {
+                    wait_umwait();
+                    ws->armed = false;
+                }
+                return;
+            }
+#endif
+            cpu_relax_n(policy->pause_count);
+            return;
+
+        case WAIT_POLICY_PAUSE:
+            cpu_relax_n(policy->pause_count);
+            return;
+
+        case WAIT_POLICY_BACKOFF:
+            if (ws->spins < policy->spin_limit) {
+                ws->spins++;
+                cpu_relax();
+            } else {
+                ws->sleep_ns = ws->sleep_ns == 0 ? policy->sleep_min_ns : ws->sleep_ns * 2;
+                if (ws->sleep_ns > policy->sleep_max_ns) ws->sleep_ns = policy->sleep_max_ns;
+                struct timespec ts = { 0, (long)ws->sleep_ns };
+                nanosleep(&ts, NULL);
+            }
+            return;
+
+        case WAIT_POLICY_USLEEP:
+        default:
+            usleep(10); // 10 microsecond polling interval
+            return;
+    }
+}
+
+#endif // WAIT_POLICY_H